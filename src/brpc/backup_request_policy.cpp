@@ -0,0 +1,108 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>
+#include "butil/time.h"
+#include "brpc/backup_request_policy.h"
+
+
+namespace brpc {
+
+static const int64_t TOKEN_UNIT = 1000000;
+
+AdaptiveBackupRequestPolicyOptions::AdaptiveBackupRequestPolicyOptions()
+    : latency_percentile(0.95)
+    , min_backup_request_ms(1)
+    , max_backup_request_ms(-1)
+    , fallback_backup_request_ms(-1)
+    , min_samples(100)
+    , max_backup_ratio(0.05)
+    , max_backup_burst(10)
+    , update_interval_ms(100) {
+}
+
+AdaptiveBackupRequestPolicy::AdaptiveBackupRequestPolicy(
+    const AdaptiveBackupRequestPolicyOptions& options)
+    : _options(options)
+    , _backup_request_ms(options.fallback_backup_request_ms)
+    , _last_update_us(0)
+    , _budget(0) {
+}
+
+int32_t AdaptiveBackupRequestPolicy::CalculateBackupRequestMs() const {
+    if (_latency.count() < _options.min_samples) {
+        return _options.fallback_backup_request_ms;
+    }
+    const int64_t latency_us = _latency.latency_percentile(_options.latency_percentile);
+    if (latency_us <= 0) {
+        // No RPC in the window, keep the previous one.
+        return _backup_request_ms.load(butil::memory_order_relaxed);
+    }
+    int64_t ms = (latency_us + 999) / 1000;
+    if (_options.max_backup_request_ms >= 0 && ms > _options.max_backup_request_ms) {
+        ms = _options.max_backup_request_ms;
+    }
+    if (ms < _options.min_backup_request_ms) {
+        ms = _options.min_backup_request_ms;
+    }
+    return (int32_t)ms;
+}
+
+int32_t AdaptiveBackupRequestPolicy::GetBackupRequestMs(const Controller*) const {
+    // Called several times for each RPC, calculating the percentile is
+    // too expensive to be done every time.
+    const int64_t now_us = butil::cpuwide_time_us();
+    int64_t last_update_us = _last_update_us.load(butil::memory_order_relaxed);
+    if (now_us - last_update_us >= _options.update_interval_ms * 1000L &&
+        _last_update_us.compare_exchange_strong(
+            last_update_us, now_us, butil::memory_order_relaxed)) {
+        _backup_request_ms.store(CalculateBackupRequestMs(),
+                                 butil::memory_order_relaxed);
+    }
+    return _backup_request_ms.load(butil::memory_order_relaxed);
+}
+
+bool AdaptiveBackupRequestPolicy::DoBackup(const Controller*) const {
+    int64_t budget = _budget.load(butil::memory_order_relaxed);
+    do {
+        if (budget < TOKEN_UNIT) {
+            return false;
+        }
+    } while (!_budget.compare_exchange_weak(
+                 budget, budget - TOKEN_UNIT, butil::memory_order_relaxed));
+    return true;
+}
+
+void AdaptiveBackupRequestPolicy::OnRPCEnd(const Controller* controller) {
+    if (!controller->Failed()) {
+        _latency << controller->latency_us();
+    }
+    const int64_t max_budget = _options.max_backup_burst * TOKEN_UNIT;
+    const int64_t tokens = (int64_t)(_options.max_backup_ratio * TOKEN_UNIT);
+    int64_t budget = _budget.load(butil::memory_order_relaxed);
+    int64_t new_budget;
+    do {
+        new_budget = std::min(budget + tokens, max_budget);
+        if (new_budget == budget) {
+            return;
+        }
+    } while (!_budget.compare_exchange_weak(
+                 budget, new_budget, butil::memory_order_relaxed));
+}
+
+} // namespace brpc
@@ -19,6 +19,8 @@
 #ifndef BRPC_BACKUP_REQUEST_POLICY_H
 #define BRPC_BACKUP_REQUEST_POLICY_H
 
+#include "butil/atomicops.h"
+#include "bvar/latency_recorder.h"
 #include "brpc/controller.h"
 
 namespace brpc {
@@ -38,6 +40,79 @@ public:
     virtual void OnRPCEnd(const Controller* controller) = 0;
 };
 
+struct AdaptiveBackupRequestPolicyOptions {
+    AdaptiveBackupRequestPolicyOptions();
+
+    // Backup request is sent when the RPC does not finish within this
+    // percentile of latencies of recent successful RPCs.
+    // Default: 0.95
+    double latency_percentile;
+
+    // Range of the backup request time. Negative `max_backup_request_ms'
+    // means no upper bound.
+    // Default: 1, -1
+    int32_t min_backup_request_ms;
+    int32_t max_backup_request_ms;
+
+    // Backup request time before `min_samples' RPCs are recorded,
+    // negative means no backup request.
+    // Default: -1, 100
+    int32_t fallback_backup_request_ms;
+    int64_t min_samples;
+
+    // Backup requests are limited by a token bucket: each finished RPC adds
+    // `max_backup_ratio' tokens, at most `max_backup_burst' tokens are kept,
+    // and each backup request consumes one token.
+    // Default: 0.05, 10
+    double max_backup_ratio;
+    int max_backup_burst;
+
+    // The percentile is re-calculated at most once in this interval.
+    // Default: 100
+    int32_t update_interval_ms;
+};
+
+// A BackupRequestPolicy sending backup requests at the observed percentile
+// of latencies instead of a fixed backup_request_ms, with the extra load
+// limited by a budget. Whichever call responds first ends the RPC and the
+// other one is canceled as with backup_request_ms.
+// The policy keeps statistics of RPCs using it, use a separate instance for
+// each channel.
+//
+// Example:
+//   brpc::AdaptiveBackupRequestPolicy policy;
+//   brpc::ChannelOptions options;
+//   options.backup_request_policy = &policy;
+//   channel.Init("...", &options);
+class AdaptiveBackupRequestPolicy : public BackupRequestPolicy {
+public:
+    explicit AdaptiveBackupRequestPolicy(
+        const AdaptiveBackupRequestPolicyOptions& options =
+        AdaptiveBackupRequestPolicyOptions());
+
+    int32_t GetBackupRequestMs(const Controller* controller) const override;
+
+    // Consumes one token of the budget on success.
+    bool DoBackup(const Controller* controller) const override;
+
+    void OnRPCEnd(const Controller* controller) override;
+
+    // Latencies of successful RPCs, which can be exposed by users.
+    bvar::LatencyRecorder& latency_recorder() { return _latency; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(AdaptiveBackupRequestPolicy);
+
+    int32_t CalculateBackupRequestMs() const;
+
+    const AdaptiveBackupRequestPolicyOptions _options;
+    bvar::LatencyRecorder _latency;
+    mutable butil::atomic<int32_t> _backup_request_ms;
+    mutable butil::atomic<int64_t> _last_update_us;
+    // In 1/TOKEN_UNIT of tokens.
+    mutable butil::atomic<int64_t> _budget;
+};
+
 }
 
 #endif // BRPC_BACKUP_REQUEST_POLICY_H
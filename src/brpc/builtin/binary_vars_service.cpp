@@ -0,0 +1,437 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <errno.h>
+#include <stdlib.h>                         // strtoll, strtod
+#include <string.h>                         // memcpy
+#include <memory>
+#include <mutex>                            // std::unique_lock
+#include <sstream>
+#include <gflags/gflags.h>
+#include "butil/time.h"                     // gettimeofday_us
+#include "butil/synchronization/lock.h"
+#include "bvar/mvariable.h"
+#include "brpc/controller.h"                // Controller
+#include "brpc/closure_guard.h"             // ClosureGuard
+#include "brpc/progressive_attachment.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/builtin/binary_vars_service.h"
+
+namespace bvar {
+DECLARE_int32(bvar_max_dump_multi_dimension_metric_number);
+}
+
+namespace brpc {
+
+DEFINE_int32(binary_vars_max_sessions, 64,
+             "Max number of sessions of /binary_vars, scrapers beyond the "
+             "limit get full snapshots");
+DEFINE_int32(binary_vars_session_idle_s, 60,
+             "Sessions of /binary_vars not scraped for so many seconds are "
+             "dropped");
+BRPC_VALIDATE_GFLAG(binary_vars_max_sessions, NonNegativeInteger);
+BRPC_VALIDATE_GFLAG(binary_vars_session_idle_s, PositiveInteger);
+
+static const char BINARY_VARS_MAGIC[4] = { 'B', 'V', 'B', '1' };
+
+static void AppendVarint(std::string* out, uint64_t v) {
+    while (v >= 0x80) {
+        out->push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out->push_back((char)v);
+}
+
+static void AppendBytes(std::string* out, const butil::StringPiece& s) {
+    AppendVarint(out, s.size());
+    out->append(s.data(), s.size());
+}
+
+inline uint64_t ZigZagEncode(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+inline int64_t ZigZagDecode(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// Parse the description of a variable as an integer or a double.
+// Returns the type of record to carry the value.
+static int ParseValue(const butil::StringPiece& desc,
+                      int64_t* int_value, double* double_value) {
+    char buf[32];
+    if (desc.empty() || desc.size() >= sizeof(buf) ||
+        !(desc[0] == '-' || (desc[0] >= '0' && desc[0] <= '9'))) {
+        return BINARY_VARS_STRING;
+    }
+    memcpy(buf, desc.data(), desc.size());
+    buf[desc.size()] = '\0';
+    char* endptr = NULL;
+    errno = 0;
+    *int_value = strtoll(buf, &endptr, 10);
+    if (*endptr == '\0' && errno == 0) {
+        return BINARY_VARS_INT;
+    }
+    errno = 0;
+    *double_value = strtod(buf, &endptr);
+    if (*endptr == '\0' && errno == 0) {
+        return BINARY_VARS_DOUBLE;
+    }
+    return BINARY_VARS_STRING;
+}
+
+const size_t BinaryVarsEncoder::CHUNK_SIZE;
+
+BinaryVarsEncoder::BinaryVarsEncoder()
+    : _next_id(0)
+    , _seq(0)
+    , _out(NULL)
+    , _pa(NULL)
+    , _write_failed(false) {
+    CHECK_EQ(0, _vars.init(1024, 70));
+}
+
+void BinaryVarsEncoder::Begin(bool full, butil::IOBuf* out,
+                              ProgressiveAttachment* pa) {
+    if (full) {
+        _vars.clear();
+        _next_id = 0;
+    }
+    ++_seq;
+    _out = out;
+    _pa = pa;
+    _write_failed = false;
+    _chunk.clear();
+    _chunk.append(BINARY_VARS_MAGIC, sizeof(BINARY_VARS_MAGIC));
+    AppendVarint(&_chunk, full ? BINARY_VARS_FULL : 0);
+    AppendVarint(&_chunk, _seq);
+    AppendVarint(&_chunk, butil::gettimeofday_us());
+}
+
+bool BinaryVarsEncoder::dump(const std::string& name,
+                             const butil::StringPiece& description) {
+    int64_t int_value = 0;
+    double double_value = 0;
+    const int type = ParseValue(description, &int_value, &double_value);
+    VarState* state = _vars.seek(name);
+    if (state == NULL) {
+        state = &_vars[name];
+        state->id = _next_id++;
+        state->type = -1;
+        state->int_value = 0;
+        state->double_value = 0;
+        AppendVarint(&_chunk, BINARY_VARS_NAME);
+        AppendVarint(&_chunk, state->id);
+        AppendBytes(&_chunk, name);
+    }
+    state->seen_seq = _seq;
+    switch (type) {
+    case BINARY_VARS_INT:
+        if (state->type == type && state->int_value == int_value) {
+            return true;
+        }
+        AppendVarint(&_chunk, BINARY_VARS_INT);
+        AppendVarint(&_chunk, state->id);
+        AppendVarint(&_chunk, ZigZagEncode(int_value - state->int_value));
+        state->int_value = int_value;
+        break;
+    case BINARY_VARS_DOUBLE: {
+        if (state->type == type && state->double_value == double_value) {
+            return true;
+        }
+        AppendVarint(&_chunk, BINARY_VARS_DOUBLE);
+        AppendVarint(&_chunk, state->id);
+        uint64_t bits;
+        memcpy(&bits, &double_value, sizeof(bits));
+        for (int i = 0; i < 8; ++i) {
+            _chunk.push_back((char)(bits >> (i * 8)));
+        }
+        state->int_value = 0;
+        state->double_value = double_value;
+        break;
+    }
+    default:
+        if (state->type == type && state->string_value == description) {
+            return true;
+        }
+        AppendVarint(&_chunk, BINARY_VARS_STRING);
+        AppendVarint(&_chunk, state->id);
+        AppendBytes(&_chunk, description);
+        state->int_value = 0;
+        description.CopyToString(&state->string_value);
+        break;
+    }
+    state->type = type;
+    if (_chunk.size() >= CHUNK_SIZE) {
+        Flush();
+    }
+    return true;
+}
+
+void BinaryVarsEncoder::Flush() {
+    if (_chunk.empty()) {
+        return;
+    }
+    if (_pa != NULL) {
+        if (!_write_failed && _pa->Write(_chunk.data(), _chunk.size()) != 0) {
+            _write_failed = true;
+        }
+    } else {
+        _out->append(_chunk);
+    }
+    _chunk.clear();
+}
+
+int BinaryVarsEncoder::End() {
+    std::vector<std::string> gone;
+    for (VarMap::const_iterator it = _vars.begin(); it != _vars.end(); ++it) {
+        if (it->second.seen_seq != _seq) {
+            AppendVarint(&_chunk, BINARY_VARS_GONE);
+            AppendVarint(&_chunk, it->second.id);
+            gone.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < gone.size(); ++i) {
+        _vars.erase(gone[i]);
+    }
+    Flush();
+    _out = NULL;
+    _pa = NULL;
+    return _write_failed ? -1 : 0;
+}
+
+static bool ReadVarint(butil::IOBufBytesIterator& it, uint64_t* v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (!it) {
+            return false;
+        }
+        const uint8_t c = *it;
+        ++it;
+        *v |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ReadBytes(butil::IOBufBytesIterator& it, std::string* s) {
+    uint64_t len = 0;
+    if (!ReadVarint(it, &len) || len > it.bytes_left()) {
+        return false;
+    }
+    s->clear();
+    return it.copy_and_forward(s, len) == len;
+}
+
+int BinaryVarsDecoder::Decode(const butil::IOBuf& snapshot) {
+    butil::IOBufBytesIterator it(snapshot);
+    char magic[sizeof(BINARY_VARS_MAGIC)];
+    if (it.copy_and_forward(magic, sizeof(magic)) != sizeof(magic) ||
+        memcmp(magic, BINARY_VARS_MAGIC, sizeof(magic)) != 0) {
+        return -1;
+    }
+    uint64_t flags = 0;
+    uint64_t seq = 0;
+    uint64_t timestamp_us = 0;
+    if (!ReadVarint(it, &flags) || !ReadVarint(it, &seq) ||
+        !ReadVarint(it, &timestamp_us)) {
+        return -1;
+    }
+    if (flags & BINARY_VARS_FULL) {
+        _vars.clear();
+        _values.clear();
+    } else if (seq != _seq + 1) {
+        // Not the successor of the snapshot we have.
+        return -1;
+    }
+    std::string str;
+    while (it) {
+        uint64_t type = 0;
+        uint64_t id = 0;
+        if (!ReadVarint(it, &type) || !ReadVarint(it, &id)) {
+            return -1;
+        }
+        if (type == BINARY_VARS_NAME) {
+            if (id != _vars.size() || !ReadBytes(it, &str)) {
+                return -1;
+            }
+            VarState state;
+            state.name.swap(str);
+            state.int_value = 0;
+            _vars.push_back(state);
+            continue;
+        }
+        if (id >= _vars.size()) {
+            return -1;
+        }
+        VarState& state = _vars[id];
+        switch (type) {
+        case BINARY_VARS_INT: {
+            uint64_t delta = 0;
+            if (!ReadVarint(it, &delta)) {
+                return -1;
+            }
+            state.int_value += ZigZagDecode(delta);
+            _values[state.name] = std::to_string(state.int_value);
+            break;
+        }
+        case BINARY_VARS_DOUBLE: {
+            uint8_t bytes[8];
+            if (it.copy_and_forward(bytes, sizeof(bytes)) != sizeof(bytes)) {
+                return -1;
+            }
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; ++i) {
+                bits |= (uint64_t)bytes[i] << (i * 8);
+            }
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            std::ostringstream os;
+            os << value;
+            state.int_value = 0;
+            _values[state.name] = os.str();
+            break;
+        }
+        case BINARY_VARS_STRING:
+            if (!ReadBytes(it, &str)) {
+                return -1;
+            }
+            state.int_value = 0;
+            _values[state.name] = str;
+            break;
+        case BINARY_VARS_GONE:
+            state.int_value = 0;
+            _values.erase(state.name);
+            break;
+        default:
+            return -1;
+        }
+    }
+    _seq = seq;
+    return 0;
+}
+
+namespace {
+struct BinaryVarsSession {
+    butil::Mutex mutex;
+    BinaryVarsEncoder encoder;
+    int64_t last_access_us;
+};
+typedef std::map<std::string, std::shared_ptr<BinaryVarsSession> > SessionMap;
+
+butil::Mutex g_sessions_mutex;
+SessionMap* g_sessions = NULL;
+}  // namespace
+
+// Get the session named `id', creating it if it does not exist. Returns
+// NULL if there are too many sessions.
+static std::shared_ptr<BinaryVarsSession> GetSession(const std::string& id) {
+    const int64_t now_us = butil::gettimeofday_us();
+    BAIDU_SCOPED_LOCK(g_sessions_mutex);
+    if (g_sessions == NULL) {
+        g_sessions = new SessionMap;
+    }
+    SessionMap::iterator it = g_sessions->find(id);
+    if (it != g_sessions->end()) {
+        it->second->last_access_us = now_us;
+        return it->second;
+    }
+    const int64_t idle_us = FLAGS_binary_vars_session_idle_s * 1000000L;
+    for (it = g_sessions->begin(); it != g_sessions->end();) {
+        if (now_us - it->second->last_access_us > idle_us) {
+            g_sessions->erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    if (g_sessions->size() >= (size_t)FLAGS_binary_vars_max_sessions) {
+        return NULL;
+    }
+    std::shared_ptr<BinaryVarsSession> session =
+        std::make_shared<BinaryVarsSession>();
+    session->last_access_us = now_us;
+    (*g_sessions)[id] = session;
+    return session;
+}
+
+static int DumpBinaryVars(BinaryVarsEncoder* encoder, bool full,
+                          butil::IOBuf* out, ProgressiveAttachment* pa) {
+    encoder->Begin(full, out, pa);
+    if (bvar::Variable::dump_exposed(encoder, NULL) < 0) {
+        encoder->End();
+        return -1;
+    }
+    if (bvar::FLAGS_bvar_max_dump_multi_dimension_metric_number > 0) {
+        bvar::MVariableBase::dump_exposed(encoder, NULL);
+    }
+    return encoder->End();
+}
+
+void BinaryVarsService::default_method(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::BinaryVarsRequest*,
+    ::brpc::BinaryVarsResponse*,
+    ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller *cntl = static_cast<Controller*>(cntl_base);
+    cntl->http_response().set_content_type("application/octet-stream");
+
+    std::shared_ptr<BinaryVarsSession> session;
+    uint64_t last_seq = 0;
+    const std::string* id = cntl->http_request().uri().GetQuery("session");
+    if (id != NULL && !id->empty()) {
+        session = GetSession(*id);
+        const std::string* seq_str = cntl->http_request().uri().GetQuery("seq");
+        if (seq_str != NULL) {
+            last_seq = strtoull(seq_str->c_str(), NULL, 10);
+        }
+    }
+    BinaryVarsEncoder stateless_encoder;
+    BinaryVarsEncoder* encoder = &stateless_encoder;
+    std::unique_lock<butil::Mutex> session_lock;
+    if (session != NULL) {
+        session_lock = std::unique_lock<butil::Mutex>(session->mutex);
+        encoder = &session->encoder;
+    }
+    // A delta is only meaningful to the scraper holding the previous
+    // snapshot, otherwise (e.g. the last response was lost) start over.
+    const bool full = (encoder->seq() == 0 || encoder->seq() != last_seq);
+
+    butil::intrusive_ptr<ProgressiveAttachment> pa;
+    if (cntl->request_protocol() == PROTOCOL_HTTP) {
+        // Send chunks as soon as they're encoded rather than buffering the
+        // whole snapshot.
+        pa = cntl->CreateProgressiveAttachment();
+    }
+    if (pa == NULL) {
+        if (DumpBinaryVars(encoder, full, &cntl->response_attachment(),
+                           NULL) != 0) {
+            cntl->SetFailed("Fail to dump vars");
+        }
+        return;
+    }
+    // Send the header of the response before the body.
+    done_guard.reset(NULL);
+    // If some chunks are not written, the scraper does not get the snapshot
+    // and asks with the previous seq next time, which results in a full one.
+    DumpBinaryVars(encoder, full, NULL, pa.get());
+}
+
+} // namespace brpc
@@ -0,0 +1,151 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_BINARY_VARS_SERVICE_H
+#define BRPC_BINARY_VARS_SERVICE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "butil/iobuf.h"
+#include "butil/containers/flat_map.h"
+#include "bvar/variable.h"
+#include "brpc/builtin_service.pb.h"
+
+
+namespace brpc {
+
+class ProgressiveAttachment;
+
+// Compact exposition of bvar for monitoring agents scraping frequently.
+// Integers below are varints, signed ones are zigzag-encoded.
+//
+//   "BVB1" flags seq timestamp_us record*
+//
+// flags: BINARY_VARS_FULL if the snapshot does not depend on previous ones.
+// seq: sequence number of the snapshot in the session.
+// record:
+//   BINARY_VARS_NAME   id name_len name   Assign `id' to a name, sent once
+//                                         per session.
+//   BINARY_VARS_INT    id delta           Value minus the previous integral
+//                                         value of `id' (0 if none).
+//   BINARY_VARS_DOUBLE id 8-byte-little-endian-double
+//   BINARY_VARS_STRING id len bytes
+//   BINARY_VARS_GONE   id                 The variable is hidden.
+// Variables unchanged since the previous snapshot of the session are not
+// included.
+enum BinaryVarsRecord {
+    BINARY_VARS_NAME = 0,
+    BINARY_VARS_INT = 1,
+    BINARY_VARS_DOUBLE = 2,
+    BINARY_VARS_STRING = 3,
+    BINARY_VARS_GONE = 4,
+};
+static const uint32_t BINARY_VARS_FULL = 1;
+
+// Encode snapshots of one session. Not thread-safe.
+class BinaryVarsEncoder : public bvar::Dumper {
+public:
+    // Flushed chunks are at least so large except the last one.
+    static const size_t CHUNK_SIZE = 65536;
+
+    BinaryVarsEncoder();
+
+    // Start a snapshot which is appended to `out' or written to `pa'
+    // chunk by chunk if `pa' is not NULL. States of previous snapshots
+    // are dropped if `full' is true.
+    void Begin(bool full, butil::IOBuf* out, ProgressiveAttachment* pa);
+    // Finish the snapshot. Returns 0 on success, -1 if the chunks could
+    // not be written to the ProgressiveAttachment.
+    int End();
+
+    // Sequence number of last snapshot, 0 if none.
+    uint64_t seq() const { return _seq; }
+
+    bool dump(const std::string& name,
+              const butil::StringPiece& description) override;
+    bool dump_mvar(const std::string& name,
+                   const butil::StringPiece& description) override {
+        return dump(name, description);
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(BinaryVarsEncoder);
+
+    struct VarState {
+        uint32_t id;
+        int type;
+        int64_t int_value;
+        double double_value;
+        std::string string_value;
+        uint64_t seen_seq;
+    };
+    typedef butil::FlatMap<std::string, VarState> VarMap;
+
+    void Flush();
+
+    VarMap _vars;
+    uint32_t _next_id;
+    uint64_t _seq;
+    std::string _chunk;
+    butil::IOBuf* _out;
+    ProgressiveAttachment* _pa;
+    bool _write_failed;
+};
+
+// Rebuild values of variables from snapshots of one session, for monitoring
+// agents and tests.
+class BinaryVarsDecoder {
+public:
+    BinaryVarsDecoder() : _seq(0) {}
+
+    // Apply a snapshot. Returns 0 on success, -1 if the data is malformed.
+    int Decode(const butil::IOBuf& snapshot);
+
+    // Sequence number of last decoded snapshot.
+    uint64_t seq() const { return _seq; }
+
+    // Values of all visible variables, integers and doubles are printed
+    // in the same way as /vars.
+    const std::map<std::string, std::string>& values() const { return _values; }
+
+private:
+    struct VarState {
+        std::string name;
+        int64_t int_value;
+    };
+    std::vector<VarState> _vars;
+    std::map<std::string, std::string> _values;
+    uint64_t _seq;
+};
+
+// Serve the format above at /binary_vars. Pass ?session=<id>&seq=<seq>
+// to receive deltas against the snapshot `seq' of the session, a full
+// snapshot is returned if the session or the snapshot is unknown.
+class BinaryVarsService : public binary_vars {
+public:
+    void default_method(::google::protobuf::RpcController* cntl_base,
+                        const ::brpc::BinaryVarsRequest* request,
+                        ::brpc::BinaryVarsResponse* response,
+                        ::google::protobuf::Closure* done) override;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_BINARY_VARS_SERVICE_H
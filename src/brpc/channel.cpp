@@ -35,6 +35,8 @@
 #include "brpc/serialized_request.h"
 #include "brpc/serialized_response.h"
 #include "brpc/details/usercode_backup_pool.h"       // TooManyUserCode
+#include "brpc/details/method_status.h"              // MethodStatus
+#include "brpc/details/inherited_deadline.h"
 #include "brpc/rdma/rdma_helper.h"
 #include "brpc/policy/esp_authenticator.h"
 
@@ -56,6 +58,7 @@ ChannelOptions::ChannelOptions()
     , backup_request_ms(-1)
     , max_retry(3)
     , enable_circuit_breaker(false)
+    , circuit_breaker_per_method(false)
     , protocol(PROTOCOL_BAIDU_STD)
     , connection_type(CONNECTION_TYPE_UNKNOWN)
     , succeed_without_server(true)
@@ -254,6 +257,24 @@ int Channel::InitChannelOptions(const ChannelOptions* options) {
     if (!cg.empty() && (::isspace(cg.front()) || ::isspace(cg.back()))) {
         butil::TrimWhitespace(cg, butil::TRIM_ALL, &cg);
     }
+
+    _status.reset();
+    const AdaptiveMaxConcurrency& amc = _options.max_concurrency;
+    if (amc.type() != AdaptiveMaxConcurrency::UNLIMITED) {
+        const ConcurrencyLimiter* cl =
+            ConcurrencyLimiterExtension()->Find(amc.type().c_str());
+        if (cl == NULL) {
+            LOG(ERROR) << "Fail to find ConcurrencyLimiter by `" << amc.value() << "'";
+            return -1;
+        }
+        ConcurrencyLimiter* cl_copy = cl->New(amc);
+        if (cl_copy == NULL) {
+            LOG(ERROR) << "Fail to new ConcurrencyLimiter";
+            return -1;
+        }
+        _status = std::make_shared<MethodStatus>();
+        _status->SetConcurrencyLimiter(cl_copy);
+    }
     return 0;
 }
 
@@ -463,6 +484,9 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     cntl->_retry_policy = _options.retry_policy;
     if (_options.enable_circuit_breaker) {
         cntl->add_flag(Controller::FLAGS_ENABLED_CIRCUIT_BREAKER);
+        if (_options.circuit_breaker_per_method) {
+            cntl->add_flag(Controller::FLAGS_CIRCUIT_BREAKER_PER_METHOD);
+        }
     }
     const CallId correlation_id = cntl->call_id();
     const int rc = bthread_id_lock_and_reset_range(
@@ -513,6 +537,16 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     if (cntl->timeout_ms() == UNSET_MAGIC_NUM) {
         cntl->set_timeout_ms(_options.timeout_ms);
     }
+    // Don't last beyond the deadline of the RPC being served in this bthread.
+    const int64_t inherited_deadline_us = GetInheritedDeadline();
+    int64_t inherited_timeout_ms = -1;
+    if (inherited_deadline_us >= 0) {
+        inherited_timeout_ms = (inherited_deadline_us - start_send_real_us) / 1000;
+        if (inherited_timeout_ms > 0 &&
+            (cntl->timeout_ms() < 0 || inherited_timeout_ms < cntl->timeout_ms())) {
+            cntl->set_timeout_ms(inherited_timeout_ms);
+        }
+    }
     // Since connection is shared extensively amongst channels and RPC,
     // overriding connect_timeout_ms does not make sense, just use the
     // one in ChannelOptions
@@ -539,6 +573,24 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     // Share the lb with controller.
     cntl->_lb = _lb;
 
+    if (inherited_deadline_us >= 0 && inherited_timeout_ms <= 0) {
+        cntl->set_max_retry(0);
+        cntl->SetFailed(ERPCTIMEDOUT, "Deadline of the RPC being served has passed");
+        return cntl->HandleSendFailed();
+    }
+
+    if (_status) {
+        // Released in Controller::EndRPC even if the call is rejected.
+        cntl->_channel_status = _status;
+        if (!_status->OnRequested(NULL, cntl)) {
+            // Retrying rejected calls makes the overloading worse.
+            cntl->set_max_retry(0);
+            cntl->SetFailed(ELIMIT, "Reached channel's max_concurrency=%d",
+                            _status->MaxConcurrency());
+            return cntl->HandleSendFailed();
+        }
+    }
+
     // Ensure that serialize_request is done before pack_request in all
     // possible executions, including:
     //   HandleSendFailed => OnVersionedRPCReturned => IssueRPC(pack_request)
@@ -556,7 +608,7 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
         return cntl->HandleSendFailed();
     }
 
-    if (!cntl->_request_streams.empty()) {
+    if (!cntl->_request_streams.empty() || cntl->has_progressive_writer()) {
         // Currently we cannot handle retry and backup request correctly
         cntl->set_max_retry(0);
         cntl->set_backup_request_ms(-1);
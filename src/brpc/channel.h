@@ -23,6 +23,7 @@
 // on internal structures, use opaque pointers instead.
 
 #include <ostream>                          // std::ostream
+#include <memory>                           // std::shared_ptr
 #include "bthread/errno.h"                  // Redefine errno
 #include "butil/intrusive_ptr.hpp"          // butil::intrusive_ptr
 #include "butil/ptr_container.h"
@@ -37,6 +38,7 @@
 #include "brpc/backup_request_policy.h"
 #include "brpc/naming_service_filter.h"
 #include "brpc/health_check_option.h"
+#include "brpc/adaptive_max_concurrency.h"  // AdaptiveMaxConcurrency
 
 namespace brpc {
 
@@ -79,6 +81,15 @@ struct ChannelOptions {
     // Default: false
     bool enable_circuit_breaker;
 
+    // Effective only when enable_circuit_breaker is true. Keep a circuit
+    // breaker for each (server, method) instead of each server, so that
+    // errors of one method do not isolate the server from other methods.
+    // Calls are rejected with EHOSTDOWN (and retried on other servers if
+    // possible) while the breaker of the method is open, the server is never
+    // isolated in this mode.
+    // Default: false
+    bool circuit_breaker_per_method;
+
     // Serialization protocol, defined in src/brpc/options.proto
     // NOTE: You can assign name of the protocol to this field as well, for
     // Example: options.protocol = "baidu_std";
@@ -148,6 +159,13 @@ struct ChannelOptions {
     // Its priority is higher than FLAGS_health_check_path and FLAGS_health_check_timeout_ms.
     // When it is not set, FLAGS_health_check_path and FLAGS_health_check_timeout_ms will take effect.
     HealthCheckOption hc_option;
+
+    // Max number of outstanding calls of this channel, calls beyond the
+    // limit fail with ELIMIT immediately without being retried. Besides
+    // a number, it can be the name of a concurrency limiter, such as "auto",
+    // "gradient" or "vegas" which adjust the limit with latencies of calls.
+    // Default: "unlimited"
+    AdaptiveMaxConcurrency max_concurrency;
 private:
     // SSLOptions is large and not often used, allocate it on heap to
     // prevent ChannelOptions from being bloated in most cases.
@@ -166,6 +184,7 @@ private:
 class Channel : public ChannelBase {
 friend class Controller;
 friend class SelectiveChannel;
+friend class ChannelPrivateAccessor;
 public:
     Channel(ProfilerLinker = ProfilerLinker());
     virtual ~Channel();
@@ -253,6 +272,9 @@ protected:
     butil::intrusive_ptr<SharedLoadBalancer> _lb;
     ChannelOptions _options;
     int _preferred_index;
+    // Concurrency of calls, created when options.max_concurrency is set.
+    // Shared with controllers like `_lb'.
+    std::shared_ptr<MethodStatus> _status;
 };
 
 enum ChannelOwnership {
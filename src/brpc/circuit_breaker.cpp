@@ -22,6 +22,7 @@
 
 #include "brpc/errno.pb.h"
 #include "brpc/reloadable_flags.h"
+#include "butil/scoped_lock.h"
 #include "butil/time.h"
 
 namespace brpc {
@@ -52,6 +53,11 @@ DEFINE_int32(circuit_breaker_half_open_window_size, 0,
     "go to the closed state. Otherwise, it goes back to the open state. "
     "Values == 0 disables this feature");
 BRPC_VALIDATE_GFLAG(circuit_breaker_half_open_window_size, NonNegativeInteger);
+DEFINE_int32(circuit_breaker_half_open_probe_interval_ms, 100,
+    "When the circuit breaker is half-open, at most one request is allowed "
+    "to pass through in every interval of this many milliseconds. Values == 0 "
+    "let all requests pass through");
+BRPC_VALIDATE_GFLAG(circuit_breaker_half_open_probe_interval_ms, NonNegativeInteger);
 
 namespace {
 // EPSILON is used to generate the smoothing coefficient when calculating EMA.
@@ -170,6 +176,26 @@ bool CircuitBreaker::EmaErrorRecorder::UpdateErrorCost(int64_t error_cost,
     return true;
 }
 
+namespace {
+enum CircuitBreakerState {
+    CIRCUIT_BREAKER_CLOSED = 0,
+    CIRCUIT_BREAKER_BROKEN = 1,
+    CIRCUIT_BREAKER_HALF_OPEN = 2,
+};
+
+inline uint64_t MakeState(uint64_t generation, CircuitBreakerState state) {
+    return (generation << 2) | state;
+}
+
+inline uint64_t GenerationOf(uint64_t state) {
+    return state >> 2;
+}
+
+inline CircuitBreakerState StateOf(uint64_t state) {
+    return (CircuitBreakerState)(state & 3);
+}
+}  // namespace
+
 CircuitBreaker::CircuitBreaker()
     : _long_window(FLAGS_circuit_breaker_long_window_size,
                    FLAGS_circuit_breaker_long_window_error_percent)
@@ -178,12 +204,19 @@ CircuitBreaker::CircuitBreaker()
     , _last_reset_time_ms(0)
     , _isolation_duration_ms(FLAGS_circuit_breaker_min_isolation_duration_ms)
     , _isolated_times(0)
-    , _broken(false)
-    , _half_open(false)
-    , _half_open_success_count(0) {
+    , _state(MakeState(0, CIRCUIT_BREAKER_CLOSED))
+    , _half_open_success_count(0)
+    , _broken_time_ms(0)
+    , _next_probe_time_ms(0) {
 }
 
 bool CircuitBreaker::OnCallEnd(int error_code, int64_t latency) {
+    return OnCallEnd(error_code, latency,
+                     GenerationOf(_state.load(butil::memory_order_acquire)));
+}
+
+bool CircuitBreaker::OnCallEnd(int error_code, int64_t latency,
+                               uint64_t generation) {
     // If the server has reached its maximum concurrency, it will return
     // ELIMIT directly when a new request arrives. This usually means that
     // the entire downstream cluster is overloaded. If we isolate nodes at
@@ -194,19 +227,34 @@ bool CircuitBreaker::OnCallEnd(int error_code, int64_t latency) {
     if (error_code == ELIMIT) {
         return true;
     }
-    if (_broken.load(butil::memory_order_relaxed)) {
+    uint64_t state = _state.load(butil::memory_order_acquire);
+    if (GenerationOf(state) != generation) {
+        // Issued before the last transition, the result says nothing about
+        // the current state.
+        return StateOf(state) != CIRCUIT_BREAKER_BROKEN;
+    }
+    if (StateOf(state) == CIRCUIT_BREAKER_BROKEN) {
         return false;
     }
-    if (FLAGS_circuit_breaker_half_open_window_size > 0
-        && _half_open.load(butil::memory_order_relaxed)) {
-        if (error_code != 0) {
-            MarkAsBroken();
-            return false;
+    if (StateOf(state) == CIRCUIT_BREAKER_HALF_OPEN) {
+        // Reset() turns the breaker half-open only if the window is set,
+        // while AllowCall() always does and needs at least one successful
+        // probe.
+        BAIDU_SCOPED_LOCK(_state_mutex);
+        state = _state.load(butil::memory_order_relaxed);
+        if (GenerationOf(state) != generation) {
+            return StateOf(state) != CIRCUIT_BREAKER_BROKEN;
         }
-        if (_half_open_success_count.fetch_add(1, butil::memory_order_relaxed)
-                + 1 == FLAGS_circuit_breaker_half_open_window_size) {
-            _half_open.store(false, butil::memory_order_relaxed);
-            _half_open_success_count.store(0, butil::memory_order_relaxed);
+        if (StateOf(state) == CIRCUIT_BREAKER_HALF_OPEN) {
+            if (error_code != 0) {
+                MarkAsBrokenLocked();
+                return false;
+            }
+            if (++_half_open_success_count >=
+                std::max(FLAGS_circuit_breaker_half_open_window_size, 1)) {
+                _state.store(MakeState(generation, CIRCUIT_BREAKER_CLOSED),
+                             butil::memory_order_release);
+            }
         }
     }
 
@@ -214,26 +262,98 @@ bool CircuitBreaker::OnCallEnd(int error_code, int64_t latency) {
         _short_window.OnCallEnd(error_code, latency)) {
         return true;
     }
-    MarkAsBroken();
-    return false;
+    BAIDU_SCOPED_LOCK(_state_mutex);
+    state = _state.load(butil::memory_order_relaxed);
+    if (GenerationOf(state) == generation) {
+        MarkAsBrokenLocked();
+        return false;
+    }
+    return StateOf(state) != CIRCUIT_BREAKER_BROKEN;
+}
+
+bool CircuitBreaker::AllowCall(uint64_t* generation) {
+    uint64_t state = _state.load(butil::memory_order_acquire);
+    if (StateOf(state) == CIRCUIT_BREAKER_CLOSED) {
+        *generation = GenerationOf(state);
+        return true;
+    }
+    // Reject without locking in most cases.
+    const int64_t now_ms = butil::cpuwide_time_ms();
+    const int probe_interval_ms = FLAGS_circuit_breaker_half_open_probe_interval_ms;
+    if (StateOf(state) == CIRCUIT_BREAKER_BROKEN) {
+        if (now_ms - _broken_time_ms.load(butil::memory_order_relaxed) <
+            isolation_duration_ms()) {
+            return false;
+        }
+    } else if (probe_interval_ms > 0 &&
+               now_ms < _next_probe_time_ms.load(butil::memory_order_relaxed)) {
+        return false;
+    }
+
+    BAIDU_SCOPED_LOCK(_state_mutex);
+    state = _state.load(butil::memory_order_relaxed);
+    switch (StateOf(state)) {
+    case CIRCUIT_BREAKER_BROKEN:
+        if (now_ms - _broken_time_ms.load(butil::memory_order_relaxed) <
+            isolation_duration_ms()) {
+            return false;
+        }
+        // Isolated long enough, turn half-open and send the first probe.
+        _long_window.Reset();
+        _short_window.Reset();
+        _last_reset_time_ms = now_ms;
+        _half_open_success_count = 0;
+        _next_probe_time_ms.store(now_ms + probe_interval_ms,
+                                  butil::memory_order_relaxed);
+        state = MakeState(GenerationOf(state) + 1, CIRCUIT_BREAKER_HALF_OPEN);
+        _state.store(state, butil::memory_order_release);
+        break;
+    case CIRCUIT_BREAKER_HALF_OPEN:
+        if (probe_interval_ms > 0) {
+            if (now_ms < _next_probe_time_ms.load(butil::memory_order_relaxed)) {
+                return false;
+            }
+            _next_probe_time_ms.store(now_ms + probe_interval_ms,
+                                      butil::memory_order_relaxed);
+        }
+        break;
+    case CIRCUIT_BREAKER_CLOSED:
+        break;
+    }
+    *generation = GenerationOf(state);
+    return true;
 }
 
 void CircuitBreaker::Reset() {
+    BAIDU_SCOPED_LOCK(_state_mutex);
     _long_window.Reset();
     _short_window.Reset();
     _last_reset_time_ms = butil::cpuwide_time_ms();
-    _broken.store(false, butil::memory_order_release);
-    if (FLAGS_circuit_breaker_half_open_window_size > 0) {
-        _half_open.store(true, butil::memory_order_relaxed);
-        _half_open_success_count.store(0, butil::memory_order_relaxed);
-    }
+    _half_open_success_count = 0;
+    _next_probe_time_ms.store(0, butil::memory_order_relaxed);
+    const uint64_t generation =
+        GenerationOf(_state.load(butil::memory_order_relaxed)) + 1;
+    _state.store(MakeState(generation,
+                           FLAGS_circuit_breaker_half_open_window_size > 0 ?
+                           CIRCUIT_BREAKER_HALF_OPEN : CIRCUIT_BREAKER_CLOSED),
+                 butil::memory_order_release);
 }
 
 void CircuitBreaker::MarkAsBroken() {
-    if (!_broken.exchange(true, butil::memory_order_acquire)) {
-        _isolated_times.fetch_add(1, butil::memory_order_relaxed);
-        UpdateIsolationDuration();
+    BAIDU_SCOPED_LOCK(_state_mutex);
+    MarkAsBrokenLocked();
+}
+
+void CircuitBreaker::MarkAsBrokenLocked() {
+    const uint64_t state = _state.load(butil::memory_order_relaxed);
+    if (StateOf(state) == CIRCUIT_BREAKER_BROKEN) {
+        return;
     }
+    _isolated_times.fetch_add(1, butil::memory_order_relaxed);
+    UpdateIsolationDuration();
+    _broken_time_ms.store(butil::cpuwide_time_ms(), butil::memory_order_relaxed);
+    _state.store(MakeState(GenerationOf(state) + 1, CIRCUIT_BREAKER_BROKEN),
+                 butil::memory_order_release);
 }
 
 void CircuitBreaker::UpdateIsolationDuration() {
@@ -19,6 +19,7 @@
 #define BRPC_CIRCUIT_BREAKER_H
 
 #include "butil/atomicops.h"
+#include "butil/synchronization/lock.h"
 
 namespace brpc {
 
@@ -37,6 +38,24 @@ public:
     // will be called in the health check thread.
     bool OnCallEnd(int error_code, int64_t latency);
 
+    // Same as above, for a call allowed by AllowCall() which set
+    // `generation'. Results of calls issued before the CircuitBreaker was
+    // broken or turned half-open last time are ignored, so that late
+    // replies neither break a half-open CircuitBreaker nor close it.
+    bool OnCallEnd(int error_code, int64_t latency, uint64_t generation);
+
+    // Returns true if a call is allowed to be issued now. Only used by
+    // CircuitBreakers of methods, the server-wide one isolates the socket
+    // instead and is Reset() by health checking.
+    // A broken CircuitBreaker turns half-open after isolation_duration_ms().
+    // A half-open CircuitBreaker lets at most one call through in every
+    // -circuit_breaker_half_open_probe_interval_ms. It's closed after
+    // -circuit_breaker_half_open_window_size (at least 1) successful calls,
+    // and broken again on any failed call.
+    // `generation' is set if the call is allowed, which should be passed to
+    // OnCallEnd() when the call ends.
+    bool AllowCall(uint64_t* generation);
+
     // Reset CircuitBreaker and clear history data. will erase the historical
     // data and start sampling again. Before you call this method, you need to
     // ensure that no one else is accessing CircuitBreaker.
@@ -59,6 +78,8 @@ public:
     }
 
 private:
+    // Must be called with _state_mutex held.
+    void MarkAsBrokenLocked();
     void UpdateIsolationDuration();
 
     class EmaErrorRecorder {
@@ -86,9 +107,17 @@ private:
     int64_t _last_reset_time_ms;
     butil::atomic<int> _isolation_duration_ms;
     butil::atomic<int> _isolated_times;
-    butil::atomic<bool> _broken;
-    butil::atomic<bool> _half_open;
-    butil::atomic<int32_t> _half_open_success_count;
+    // Transitions of the state are serialized by _state_mutex, while the
+    // state is read without locking in the common cases.
+    butil::Mutex _state_mutex;
+    // The generation, which is increased whenever the CircuitBreaker is
+    // broken, turns half-open or is reset, in high bits and the state in
+    // the lowest 2 bits.
+    butil::atomic<uint64_t> _state;
+    int32_t _half_open_success_count;
+    // Time of being broken.
+    butil::atomic<int64_t> _broken_time_ms;
+    butil::atomic<int64_t> _next_probe_time_ms;
 };
 
 }  // namespace brpc
@@ -29,6 +29,7 @@
 #include "bthread/unstable.h"
 #include "bvar/bvar.h"
 #include "brpc/socket.h"
+#include "brpc/circuit_breaker.h"
 #include "brpc/socket_map.h"
 #include "brpc/channel.h"
 #include "brpc/load_balancer.h"
@@ -41,8 +42,10 @@
 #include "brpc/retry_policy.h"
 #include "brpc/stream_impl.h"
 #include "brpc/policy/streaming_rpc_protocol.h" // FIXME
+#include "brpc/policy/http2_rpc_protocol.h"     // H2ProgressiveAttachment
 #include "brpc/rpc_dump.h"
 #include "brpc/details/usercode_backup_pool.h"  // RunUserCode
+#include "brpc/details/method_status.h"
 #include "brpc/mongo_service_adaptor.h"
 
 // Force linking the .o in UT (which analysis deps by inclusions)
@@ -206,6 +209,7 @@ void Controller::ResetNonPods() {
     }
     delete _sender;
     _lb.reset(NULL);
+    _channel_status.reset();
     _current_call.Reset();
     ExcludedServers::Destroy(_accessed);
     _request_buf.clear();
@@ -266,6 +270,7 @@ void Controller::ResetPods() {
     _begin_time_us = 0;
     _end_time_us = 0;
     _tos = 0;
+    _request_priority = 0;
     _preferred_index = -1;
     _request_compress_type = COMPRESS_TYPE_NONE;
     _response_compress_type = COMPRESS_TYPE_NONE;
@@ -306,6 +311,8 @@ Controller::Call::Call(Controller::Call* rhs)
     , need_feedback(rhs->need_feedback)
     , enable_circuit_breaker(rhs->enable_circuit_breaker)
     , peer_id(rhs->peer_id)
+    , method_circuit_breaker(rhs->method_circuit_breaker)
+    , circuit_breaker_generation(rhs->circuit_breaker_generation)
     , begin_time_us(rhs->begin_time_us)
     , sending_sock(rhs->sending_sock.release())
     , stream_user_data(rhs->stream_user_data) {
@@ -314,6 +321,7 @@ Controller::Call::Call(Controller::Call* rhs)
     // will behave incorrectly.
     rhs->need_feedback = false;
     rhs->peer_id = INVALID_SOCKET_ID;
+    rhs->method_circuit_breaker = NULL;
     rhs->stream_user_data = NULL;
 }
 
@@ -326,11 +334,21 @@ void Controller::Call::Reset() {
     need_feedback = false;
     enable_circuit_breaker = false;
     peer_id = INVALID_SOCKET_ID;
+    method_circuit_breaker = NULL;
+    circuit_breaker_generation = 0;
     begin_time_us = 0;
     sending_sock.reset(NULL);
     stream_user_data = NULL;
 }
 
+int64_t Controller::remaining_deadline() const {
+    if (_deadline_us < 0) {
+        return -1;
+    }
+    const int64_t now_us = butil::gettimeofday_us();
+    return _deadline_us > now_us ? _deadline_us - now_us : 0;
+}
+
 void Controller::set_timeout_ms(int64_t timeout_ms) {
     if (timeout_ms <= 0x7fffffff) {
         _timeout_ms = timeout_ms;
@@ -789,7 +807,11 @@ void Controller::Call::OnComplete(
             sending_sock->AddRecentError();
         }
 
-        if (enable_circuit_breaker) {
+        if (method_circuit_breaker != NULL) {
+            method_circuit_breaker->OnCallEnd(error_code,
+                butil::gettimeofday_us() - begin_time_us,
+                circuit_breaker_generation);
+        } else if (enable_circuit_breaker) {
             sending_sock->FeedbackCircuitBreaker(error_code,
                 butil::gettimeofday_us() - begin_time_us);
         }
@@ -943,6 +965,10 @@ void Controller::EndRPC(const CompletionInfo& info) {
     }
     // RPC finished, now it's safe to release `LoadBalancerWithNaming'
     _lb.reset();
+    if (_channel_status) {
+        _channel_status->OnResponded(_error_code, butil::gettimeofday_us() - _begin_time_us);
+        _channel_status.reset();
+    }
     if (_span) {
         _span->set_ending_cid(info.id);
         _span->set_async(_done);
@@ -1078,6 +1104,7 @@ void Controller::IssueRPC(int64_t start_realtime_us) {
     // Pick a target server for sending RPC
     _current_call.need_feedback = false;
     _current_call.enable_circuit_breaker = has_enabled_circuit_breaker();
+    _current_call.method_circuit_breaker = NULL;
     SocketUniquePtr tmp_sock;
     if (SingleServer()) {
         // Don't use _current_call.peer_id which is set to -1 after construction
@@ -1112,6 +1139,23 @@ void Controller::IssueRPC(int64_t start_realtime_us) {
         // here.
         _remote_side = tmp_sock->remote_side();
     }
+    // The server-wide CircuitBreaker isolates the socket by failing it,
+    // only breakers of methods are asked before sending.
+    if (_current_call.enable_circuit_breaker && has_circuit_breaker_per_method() &&
+        _method != NULL && !is_health_check_call()) {
+        _current_call.method_circuit_breaker =
+            tmp_sock->GetOrNewMethodCircuitBreaker(_method);
+        if (_current_call.method_circuit_breaker != NULL &&
+            !_current_call.method_circuit_breaker->AllowCall(
+                &_current_call.circuit_breaker_generation)) {
+            // Don't feed back a call which is not sent.
+            _current_call.method_circuit_breaker = NULL;
+            tmp_sock.reset();
+            SetFailed(EHOSTDOWN, "Isolated %s by circuit breaker",
+                      endpoint2str(_remote_side).c_str());
+            return HandleSendFailed();
+        }
+    }
     if (_stream_creator) {
         _current_call.stream_user_data =
             _stream_creator->OnCreatingStream(&tmp_sock, this);
@@ -1347,6 +1391,7 @@ void Controller::SaveClientSettings(ClientSettings* s) const {
     s->backup_request_policy = _backup_request_policy;
     s->max_retry = _max_retry;
     s->tos = _tos;
+    s->request_priority = _request_priority;
     s->connection_type = _connection_type;
     s->request_compress_type = _request_compress_type;
     s->request_checksum_type = _request_checksum_type;
@@ -1361,6 +1406,7 @@ void Controller::ApplyClientSettings(const ClientSettings& s) {
     set_backup_request_policy(s.backup_request_policy);
     set_max_retry(s.max_retry);
     set_type_of_service(s.tos);
+    set_request_priority(s.request_priority);
     set_connection_type(s.connection_type);
     set_request_compress_type(s.request_compress_type);
     set_request_checksum_type(s.request_checksum_type);
@@ -1502,8 +1548,8 @@ Controller::CreateProgressiveAttachment(StopStyle stop_style) {
         LOG(ERROR) << "One controller can only have one ProgressiveAttachment";
         return NULL;
     }
-    if (_request_protocol != PROTOCOL_HTTP) {
-        LOG(ERROR) << "Only http supports ProgressiveAttachment now";
+    if (_request_protocol != PROTOCOL_HTTP && _request_protocol != PROTOCOL_H2) {
+        LOG(ERROR) << "Only http and h2 support ProgressiveAttachment now";
         return NULL;
     }
     if (_current_call.sending_sock == NULL) {
@@ -1516,8 +1562,24 @@ Controller::CreateProgressiveAttachment(StopStyle stop_style) {
     if (stop_style == FORCE_STOP) {
         httpsock->fail_me_at_server_stop();
     }
-    _wpa.reset(new ProgressiveAttachment(
-                   httpsock, http_request().before_http_1_1()));
+    if (_request_protocol == PROTOCOL_H2) {
+        _wpa.reset(new policy::H2ProgressiveAttachment(httpsock));
+    } else {
+        _wpa.reset(new ProgressiveAttachment(
+                       httpsock, http_request().before_http_1_1()));
+    }
+    return _wpa;
+}
+
+butil::intrusive_ptr<ProgressiveAttachment>
+Controller::CreateRequestProgressiveAttachment() {
+    if (has_progressive_writer()) {
+        LOG(ERROR) << "One controller can only have one ProgressiveAttachment";
+        return NULL;
+    }
+    // The socket is chosen in CallMethod().
+    SocketUniquePtr no_sock;
+    _wpa.reset(new policy::H2ProgressiveAttachment(no_sock));
     return _wpa;
 }
 
@@ -23,6 +23,7 @@
 // on internal structures, use opaque pointers instead.
 
 #include <functional>                          // std::function
+#include <memory>                              // std::shared_ptr
 #include <gflags/gflags.h>                     // Users often need gflags
 #include <string>
 #include "butil/intrusive_ptr.hpp"             // butil::intrusive_ptr
@@ -72,6 +73,8 @@ class StreamSettings;
 class MongoContext;
 class RetryPolicy;
 class BackupRequestPolicy;
+class MethodStatus;
+class CircuitBreaker;
 class InputMessageBase;
 class ThriftStub;
 namespace policy {
@@ -151,6 +154,7 @@ friend void policy::ProcessThriftRequest(InputMessageBase*);
     static const uint32_t FLAGS_PB_SINGLE_REPEATED_TO_ARRAY = (1 << 20);
     static const uint32_t FLAGS_MANAGE_HTTP_BODY_ON_ERROR = (1 << 21);
     static const uint32_t FLAGS_WRITE_TO_SOCKET_IN_BACKGROUND = (1 << 22);
+    static const uint32_t FLAGS_CIRCUIT_BREAKER_PER_METHOD = (1 << 23);
 
 public:
     struct Inheritable {
@@ -460,9 +464,19 @@ public:
     // If `stop_style' is FORCE_STOP, the underlying socket will be failed
     // immediately when the socket becomes idle or server is stopped.
     // Default value of `stop_style' is WAIT_FOR_STOP.
+    // At server-side of h2, data is sent in DATA frames of the stream and
+    // the stream(with trailers of gRPC) ends when the attachment is destroyed.
     butil::intrusive_ptr<ProgressiveAttachment>
     CreateProgressiveAttachment(StopStyle stop_style = WAIT_FOR_STOP);
 
+    // [Client-side of h2 only] Create a ProgressiveAttachment to write the
+    // request body progressively, namely messages of a client-streaming or
+    // bidirectional-streaming gRPC, before CallMethod(). The request passed
+    // to CallMethod() is not sent and the request stream ends when all
+    // references to the attachment are released. The RPC is never retried.
+    butil::intrusive_ptr<ProgressiveAttachment>
+    CreateRequestProgressiveAttachment();
+
     bool has_progressive_writer() const { return _wpa != NULL; }
 
     // Set compression method for response.
@@ -521,6 +535,16 @@ public:
     // Protocol of the request sent by client or received by server.
     ProtocolType request_protocol() const { return _request_protocol; }
 
+    // Priority of the request, higher values are more important.
+    // Client-side: sent to the server along with the request (baidu_std and
+    // http/h2 only).
+    // Server-side: priority set by the client. Requests waiting in the
+    // admission queue (ServerOptions.enable_admission_queue) are admitted
+    // in descending order of priority.
+    // Default: 0
+    void set_request_priority(int priority) { _request_priority = priority; }
+    int request_priority() const { return _request_priority; }
+
     // Resets the Controller to its initial state so that it may be reused in
     // a new call.  Must NOT be called while an RPC is in progress.
     void Reset() override {
@@ -614,8 +638,17 @@ public:
 
     // Get deadline of this RPC (since the Epoch in microseconds).
     // -1 means no deadline.
+    // Server-side: set when the client delivers its deadline or timeout
+    // (-baidu_std_protocol_deliver_deadline, -http_deliver_deadline,
+    // -baidu_std_protocol_deliver_timeout_ms or grpc-timeout). RPCs issued
+    // by Channel::CallMethod() in the bthread calling the service method are
+    // not allowed to last beyond this deadline.
     int64_t deadline_us() const { return _deadline_us; }
 
+    // Microseconds left before deadline_us(), 0 if the deadline has passed,
+    // -1 means no deadline.
+    int64_t remaining_deadline() const;
+
     using AfterRpcRespFnType = std::function<void(Controller* cntl,
                                                const google::protobuf::Message* req,
                                                const google::protobuf::Message* res)>;
@@ -710,6 +743,7 @@ private:
         BackupRequestPolicy* backup_request_policy;
         int max_retry;
         int32_t tos;
+        int request_priority;
         ConnectionType connection_type;         
         CompressType request_compress_type;
         ChecksumType request_checksum_type;
@@ -755,6 +789,11 @@ private:
         bool enable_circuit_breaker;    // The channel enabled circuit_breaker
         bool touched_by_stream_creator; 
         SocketId peer_id;               // main server id
+        // Breaker of the method on peer_id if the channel enabled
+        // circuit_breaker_per_method, NULL otherwise.
+        CircuitBreaker* method_circuit_breaker;
+        // Set by method_circuit_breaker->AllowCall().
+        uint64_t circuit_breaker_generation;
         int64_t begin_time_us;          // sent real time.
         // The actual `Socket' for sending RPC. It's socket id will be
         // exactly the same as `peer_id' if `_connection_type' is
@@ -795,6 +834,10 @@ private:
         return has_flag(FLAGS_ENABLED_CIRCUIT_BREAKER); 
     }
 
+    bool has_circuit_breaker_per_method() const {
+        return has_flag(FLAGS_CIRCUIT_BREAKER_PER_METHOD);
+    }
+
     std::string& protocol_param() { return _thrift_method_name; }
     const std::string& protocol_param() const { return _thrift_method_name; }
 
@@ -850,6 +893,7 @@ private:
     int64_t _begin_time_us;
     int64_t _end_time_us;
     short _tos;    // Type of service.
+    int _request_priority;
     // The index of parse function which `InputMessenger' will use
     int _preferred_index;
     CompressType _request_compress_type;
@@ -865,6 +909,8 @@ private:
     uint64_t _request_code;
     SocketId _single_server_id;
     butil::intrusive_ptr<SharedLoadBalancer> _lb;
+    // Concurrency of the channel, released when RPC ends.
+    std::shared_ptr<MethodStatus> _channel_status;
 
     // for passing parameters to created bthread, don't modify it otherwhere.
     CompletionInfo _tmp_completion_info;
@@ -0,0 +1,149 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <limits>
+#include <gflags/gflags.h>
+#include "butil/time.h"
+#include "brpc/controller.h"
+#include "brpc/details/admission_queue.h"
+
+namespace brpc {
+
+DEFINE_int32(admission_queue_target_ms, 5,
+             "Acceptable queueing delay of the admission queue. If the "
+             "minimum queueing delay during an interval exceeds this value, "
+             "requests wait at most this long");
+DEFINE_int32(admission_queue_interval_ms, 100,
+             "Interval of checking queueing delay of the admission queue, "
+             "which is also the max time that a request waits when the "
+             "queue is not standing");
+DEFINE_int32(admission_queue_max_size, 1000,
+             "Max number of requests waiting in the admission queue of a "
+             "method. When the queue is full, a new request replaces the "
+             "waiting request with lowest priority if it's more important");
+
+enum WaiterState {
+    WAITER_QUEUED = 0,
+    WAITER_NOTIFIED,
+    WAITER_EVICTED,
+};
+
+AdmissionQueue::Waiter::Waiter(const Controller* cntl)
+    : priority(cntl ? cntl->request_priority() : 0)
+    , deadline_us(cntl ? cntl->deadline_us() : -1)
+    , enqueue_us(butil::gettimeofday_us())
+    , seq(0)
+    , state(WAITER_QUEUED) {
+}
+
+AdmissionQueue::AdmissionQueue()
+    : _size(0)
+    , _next_seq(0)
+    , _interval_end_us(0)
+    , _min_delay_us(std::numeric_limits<int64_t>::max())
+    , _overloaded(false) {
+}
+
+AdmissionQueue::~AdmissionQueue() {
+    CHECK(_waiters.empty());
+}
+
+void AdmissionQueue::UpdateDelay(int64_t delay_us, int64_t now_us) {
+    if (delay_us < _min_delay_us) {
+        _min_delay_us = delay_us;
+    }
+    if (now_us >= _interval_end_us) {
+        _overloaded = _min_delay_us > FLAGS_admission_queue_target_ms * 1000L;
+        _min_delay_us = std::numeric_limits<int64_t>::max();
+        _interval_end_us = now_us + FLAGS_admission_queue_interval_ms * 1000L;
+    }
+}
+
+bool AdmissionQueue::Wait(Waiter* w, int64_t expected_latency_us) {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    int64_t now_us = butil::gettimeofday_us();
+    const int64_t max_delay_ms = _overloaded ?
+        FLAGS_admission_queue_target_ms : FLAGS_admission_queue_interval_ms;
+    int64_t abstime_us = w->enqueue_us + max_delay_ms * 1000L;
+    if (w->deadline_us >= 0) {
+        // Don't wait for a slot that can't be used in time.
+        abstime_us = std::min(abstime_us, w->deadline_us - expected_latency_us);
+    }
+    if (abstime_us <= now_us) {
+        UpdateDelay(now_us - w->enqueue_us, now_us);
+        return false;
+    }
+    if (w->seq == 0) {
+        w->seq = ++_next_seq;
+    }
+    if ((int)_waiters.size() >= FLAGS_admission_queue_max_size) {
+        if (_waiters.empty()) {
+            return false;
+        }
+        std::set<Waiter*, WaiterLess>::iterator last = --_waiters.end();
+        if (!WaiterLess()(w, *last)) {
+            return false;
+        }
+        Waiter* victim = *last;
+        _waiters.erase(last);
+        victim->state = WAITER_EVICTED;
+        victim->cond.notify_one();
+    }
+    w->state = WAITER_QUEUED;
+    _waiters.insert(w);
+    _size.store(_waiters.size(), butil::memory_order_relaxed);
+
+    const timespec abstime = butil::microseconds_to_timespec(abstime_us);
+    while (w->state == WAITER_QUEUED) {
+        if (w->cond.wait_until(mu, abstime) == ETIMEDOUT) {
+            break;
+        }
+    }
+    if (w->state == WAITER_EVICTED) {
+        return false;
+    }
+    now_us = butil::gettimeofday_us();
+    UpdateDelay(now_us - w->enqueue_us, now_us);
+    if (w->state == WAITER_QUEUED) {
+        _waiters.erase(w);
+        _size.store(_waiters.size(), butil::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool AdmissionQueue::Notify(int min_priority) {
+    if (size() == 0) {
+        return false;
+    }
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    if (_waiters.empty()) {
+        return false;
+    }
+    Waiter* w = *_waiters.begin();
+    if (w->priority < min_priority) {
+        return false;
+    }
+    _waiters.erase(_waiters.begin());
+    _size.store(_waiters.size(), butil::memory_order_relaxed);
+    w->state = WAITER_NOTIFIED;
+    w->cond.notify_one();
+    return true;
+}
+
+} // namespace brpc
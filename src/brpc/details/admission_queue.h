@@ -0,0 +1,111 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_ADMISSION_QUEUE_H
+#define BRPC_ADMISSION_QUEUE_H
+
+#include <limits>
+#include <set>
+#include "butil/macros.h"
+#include "butil/atomicops.h"
+#include "bthread/mutex.h"
+#include "bthread/condition_variable.h"
+
+
+namespace brpc {
+
+class Controller;
+
+// Queue of requests rejected by the ConcurrencyLimiter of a method. Instead
+// of being responded with ELIMIT directly, such requests wait here until the
+// method finishes another request, and are woken up in descending order of
+// Controller::request_priority(), FIFO within a same priority. The slot of
+// the finished request is handed over to the woken request directly, and
+// new requests don't bypass the queue unless they're more important than
+// all queued ones, so that queued requests are not starved by a stream of
+// newcomers.
+//
+// The time that a request may wait is bounded CoDel-style: if the minimum
+// queueing delay during the last interval(-admission_queue_interval_ms)
+// exceeds the target(-admission_queue_target_ms), the queue is considered
+// to be standing and requests wait at most `target', otherwise at most
+// `interval'. Requests which cannot finish before their deadlines given
+// the average latency of the method are dropped without waiting, so that
+// no work is done for responses that will be discarded by clients.
+class AdmissionQueue {
+public:
+    struct Waiter {
+        explicit Waiter(const Controller* cntl);
+
+        int priority;
+        // Deadline of the request (since the Epoch in microseconds), -1 means
+        // no deadline.
+        int64_t deadline_us;
+        int64_t enqueue_us;
+        uint64_t seq;
+        int state;
+        bthread::ConditionVariable cond;
+    };
+
+    AdmissionQueue();
+    ~AdmissionQueue();
+
+    // Wait until Notify() picks `w', or `w' is evicted or timed out.
+    // `expected_latency_us' is the estimated time to process the request.
+    // Returns true if `w' is admitted and owns the slot handed over by
+    // Notify(), false if the request should be rejected.
+    bool Wait(Waiter* w, int64_t expected_latency_us);
+
+    // Hand over a slot of the method to the waiter with highest priority
+    // if its priority is not less than `min_priority'.
+    // Returns true if a waiter was woken up, false otherwise in which case
+    // the caller still owns the slot.
+    bool Notify(int min_priority = std::numeric_limits<int>::min());
+
+    // Number of waiting requests.
+    int size() const { return _size.load(butil::memory_order_relaxed); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(AdmissionQueue);
+
+    struct WaiterLess {
+        bool operator()(const Waiter* a, const Waiter* b) const {
+            if (a->priority != b->priority) {
+                return a->priority > b->priority;
+            }
+            return a->seq < b->seq;
+        }
+    };
+
+    // Update CoDel states with the queueing delay of a leaving waiter.
+    // Must be called with _mutex held.
+    void UpdateDelay(int64_t delay_us, int64_t now_us);
+
+    bthread::Mutex _mutex;
+    std::set<Waiter*, WaiterLess> _waiters;
+    butil::atomic<int> _size;
+    uint64_t _next_seq;
+    int64_t _interval_end_us;
+    int64_t _min_delay_us;
+    bool _overloaded;
+};
+
+} // namespace brpc
+
+
+#endif // BRPC_ADMISSION_QUEUE_H
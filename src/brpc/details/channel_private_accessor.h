@@ -0,0 +1,73 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_CHANNEL_PRIVATE_ACCESSOR_H
+#define BRPC_CHANNEL_PRIVATE_ACCESSOR_H
+
+// This is an rpc-internal file.
+
+#include "butil/time.h"
+#include "brpc/channel.h"
+#include "brpc/load_balancer.h"
+#include "brpc/socket.h"
+
+
+namespace brpc {
+
+// A wrapper to access some private methods/fields of `Channel'
+// This is supposed to be used by rpc-internal code ONLY
+class ChannelPrivateAccessor {
+public:
+    explicit ChannelPrivateAccessor(const Channel* channel) {
+        CHECK(channel);
+        _channel = channel;
+    }
+
+    // Select the server that a call with `request_code' would be sent to
+    // by the load balancer of the channel, without sending anything.
+    // Returns 0 on success, error code otherwise.
+    int SelectServer(uint64_t request_code, SocketId* id) const {
+        if (_channel->SingleServer()) {
+            *id = _channel->_server_id;
+            return 0;
+        }
+        const int64_t begin_time_us = butil::gettimeofday_us();
+        const LoadBalancer::SelectIn sel_in =
+            { begin_time_us, false, true, request_code, NULL };
+        SocketUniquePtr ptr;
+        LoadBalancer::SelectOut sel_out(&ptr);
+        const int rc = _channel->_lb->SelectServer(sel_in, &sel_out);
+        if (rc != 0) {
+            return rc;
+        }
+        *id = ptr->id();
+        if (sel_out.need_feedback) {
+            // Nothing was sent, end the selection immediately.
+            const LoadBalancer::CallInfo info = { begin_time_us, *id, 0, NULL };
+            _channel->_lb->Feedback(info);
+        }
+        return 0;
+    }
+
+private:
+    const Channel* _channel;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_CHANNEL_PRIVATE_ACCESSOR_H
@@ -128,6 +128,9 @@ public:
     void set_readable_progressive_attachment(ReadableProgressiveAttachment* s)
     { _cntl->_rpa.reset(s); }
 
+    ProgressiveAttachment* progressive_writer() { return _cntl->_wpa.get(); }
+    void reset_progressive_writer() { _cntl->_wpa.reset(NULL); }
+
     void set_auth_flags(uint32_t auth_flags) {
         _cntl->_auth_flags = auth_flags;
     }
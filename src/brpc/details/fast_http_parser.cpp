@@ -0,0 +1,294 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+#include <string.h>
+#include <limits.h>                    // ULLONG_MAX
+#include "brpc/details/http_parser.h"  // F_*, BRPC_HTTP_MAX_HEADER_SIZE
+#include "brpc/details/fast_http_parser.h"
+
+namespace brpc {
+
+// Sets of characters as inclusive ranges, in the layout required by
+// _mm_cmpestri(_SIDD_CMP_RANGES): at most 8 pairs in 16 bytes.
+class CharRanges {
+public:
+    CharRanges(const char (&ranges)[16], int size)
+        : _size(size) {
+        memcpy(_ranges, ranges, sizeof(_ranges));
+        memset(_table, 0, sizeof(_table));
+        for (int i = 0; i + 1 < size; i += 2) {
+            for (int c = (unsigned char)ranges[i];
+                 c <= (unsigned char)ranges[i + 1]; ++c) {
+                _table[c] = true;
+            }
+        }
+    }
+
+    // Returns the first character in [p, end) falling into the ranges,
+    // or `end' if there's none.
+    const char* Find(const char* p, const char* end) const {
+#ifdef __SSE4_2__
+        const __m128i ranges = _mm_load_si128((const __m128i*)_ranges);
+        for (; end - p >= 16; p += 16) {
+            const __m128i b = _mm_loadu_si128((const __m128i*)p);
+            const int i = _mm_cmpestri(ranges, _size, b, 16,
+                                       _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                                       _SIDD_LEAST_SIGNIFICANT);
+            if (i != 16) {
+                return p + i;
+            }
+        }
+#endif
+        for (; p != end; ++p) {
+            if (_table[(unsigned char)*p]) {
+                return p;
+            }
+        }
+        return end;
+    }
+
+private:
+    BAIDU_CACHELINE_ALIGNMENT char _ranges[16];
+    int _size;
+    bool _table[256];
+};
+
+// Characters ending a url: spaces, controls and DEL. Urls with fragments
+// are left to http_parser.
+static const char URL_DELIMITERS[16] = {
+    '\x00', ' ', '#', '#', '\x7f', '\x7f'
+};
+// Characters ending a header name, namely non-tokens except that '|' and
+// '~' are in the last range to fit in 8 ranges.
+static const char NAME_DELIMITERS[16] = {
+    '\x00', ' ', '"', '"', '(', ')', ',', ',',
+    '/', '/', ':', '@', '[', ']', '{', '\xff'
+};
+// Characters ending a header value: controls except HT, and DEL.
+static const char VALUE_DELIMITERS[16] = {
+    '\x00', '\x08', '\x0a', '\x1f', '\x7f', '\x7f'
+};
+
+static const CharRanges s_url_delimiters(URL_DELIMITERS, 6);
+static const CharRanges s_name_delimiters(NAME_DELIMITERS, 16);
+static const CharRanges s_value_delimiters(VALUE_DELIMITERS, 6);
+
+static bool ParseMethod(const char* p, size_t len, HttpMethod* method) {
+    switch (len) {
+    case 3:
+        if (memcmp(p, "GET", 3) == 0) {
+            *method = HTTP_METHOD_GET;
+            return true;
+        }
+        if (memcmp(p, "PUT", 3) == 0) {
+            *method = HTTP_METHOD_PUT;
+            return true;
+        }
+        return false;
+    case 4:
+        if (memcmp(p, "POST", 4) == 0) {
+            *method = HTTP_METHOD_POST;
+            return true;
+        }
+        if (memcmp(p, "HEAD", 4) == 0) {
+            *method = HTTP_METHOD_HEAD;
+            return true;
+        }
+        return false;
+    case 5:
+        if (memcmp(p, "PATCH", 5) == 0) {
+            *method = HTTP_METHOD_PATCH;
+            return true;
+        }
+        return false;
+    case 6:
+        if (memcmp(p, "DELETE", 6) == 0) {
+            *method = HTTP_METHOD_DELETE;
+            return true;
+        }
+        return false;
+    case 7:
+        if (memcmp(p, "OPTIONS", 7) == 0) {
+            *method = HTTP_METHOD_OPTIONS;
+            return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+static bool EqualsIgnoreCase(const butil::StringPiece& s, const char* lower) {
+    const size_t len = strlen(lower);
+    if (s.size() != len) {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        if ((s[i] | 0x20) != lower[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Headers changing how http_parser parses the message. Returns false if
+// the header is not handled by the fast path.
+static bool OnSpecialHeader(const FastHttpHeaders::Field& f,
+                            FastHttpHeaders* out) {
+    const butil::StringPiece& name = f.name;
+    switch (name[0] | 0x20) {
+    case 'c':
+        if (EqualsIgnoreCase(name, "content-length")) {
+            // At most 18 digits to not overflow.
+            if ((out->flags & F_CONTENTLENGTH) || f.value.empty() ||
+                f.value.size() > 18) {
+                return false;
+            }
+            uint64_t n = 0;
+            for (size_t i = 0; i < f.value.size(); ++i) {
+                const char c = f.value[i];
+                if (c < '0' || c > '9') {
+                    return false;
+                }
+                n = n * 10 + (c - '0');
+            }
+            out->flags |= F_CONTENTLENGTH;
+            out->content_length = n;
+        } else if (EqualsIgnoreCase(name, "connection")) {
+            if (out->flags & (F_CONNECTION_KEEP_ALIVE | F_CONNECTION_CLOSE)) {
+                return false;
+            }
+            if (EqualsIgnoreCase(f.value, "keep-alive")) {
+                out->flags |= F_CONNECTION_KEEP_ALIVE;
+            } else if (EqualsIgnoreCase(f.value, "close")) {
+                out->flags |= F_CONNECTION_CLOSE;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    case 'p':
+        return !EqualsIgnoreCase(name, "proxy-connection");
+    case 't':
+        return !EqualsIgnoreCase(name, "transfer-encoding");
+    case 'u':
+        return !EqualsIgnoreCase(name, "upgrade");
+    default:
+        return true;
+    }
+}
+
+bool FastParseHttpHeaders(const char* data, size_t len, FastHttpHeaders* out) {
+    const char* p = data;
+    // Longer headers are rejected by http_parser.
+    const char* const end =
+        data + std::min(len, (size_t)BRPC_HTTP_MAX_HEADER_SIZE);
+    out->nfield = 0;
+    out->flags = 0;
+    out->content_length = ULLONG_MAX;
+
+    if (end - p >= 5 && memcmp(p, "HTTP/", 5) == 0) {
+        // HTTP/1.x SSS[ reason]\r\n
+        if (end - p < 14 || memcmp(p, "HTTP/1.", 7) != 0 ||
+            (p[7] != '0' && p[7] != '1') || p[8] != ' ' ||
+            p[9] < '1' || p[9] > '9' || p[10] < '0' || p[10] > '9' ||
+            p[11] < '0' || p[11] > '9') {
+            return false;
+        }
+        out->is_request = false;
+        out->method = HTTP_METHOD_DELETE;
+        out->http_minor = p[7] - '0';
+        out->status_code = (p[9] - '0') * 100 + (p[10] - '0') * 10 + (p[11] - '0');
+        p += 12;
+        if (*p == ' ') {
+            p = s_value_delimiters.Find(p + 1, end);
+        }
+    } else {
+        // METHOD /url HTTP/1.x\r\n
+        const char* sp = (const char*)memchr(p, ' ', std::min(end - p, (ptrdiff_t)8));
+        if (sp == NULL || !ParseMethod(p, sp - p, &out->method)) {
+            return false;
+        }
+        p = sp + 1;
+        if (p == end || *p != '/') {
+            return false;
+        }
+        const char* url_end = s_url_delimiters.Find(p, end);
+        if (url_end == end || *url_end != ' ') {
+            return false;
+        }
+        out->is_request = true;
+        out->status_code = 0;
+        out->url.set(p, url_end - p);
+        p = url_end + 1;
+        if (end - p < 8 || memcmp(p, "HTTP/1.", 7) != 0 ||
+            (p[7] != '0' && p[7] != '1')) {
+            return false;
+        }
+        out->http_minor = p[7] - '0';
+        p += 8;
+    }
+    if (end - p < 2 || p[0] != '\r' || p[1] != '\n') {
+        return false;
+    }
+    p += 2;
+
+    while (true) {
+        if (end - p < 2) {
+            return false;
+        }
+        if (*p == '\r') {
+            if (p[1] != '\n') {
+                return false;
+            }
+            out->size = p + 1 - data;
+            return true;
+        }
+        if (out->nfield == FastHttpHeaders::MAX_FIELDS) {
+            return false;
+        }
+        FastHttpHeaders::Field& f = out->fields[out->nfield];
+        // name:
+        const char* q = s_name_delimiters.Find(p, end);
+        while (q != end && (*q == '|' || *q == '~')) {
+            q = s_name_delimiters.Find(q + 1, end);
+        }
+        if (q == end || *q != ':' || q == p) {
+            return false;
+        }
+        f.name.set(p, q - p);
+        // Leading whitespaces of the value are skipped while trailing ones
+        // are kept, same as http_parser.
+        for (p = q + 1; p != end && (*p == ' ' || *p == '\t'); ++p) {}
+        q = s_value_delimiters.Find(p, end);
+        if (end - q < 3 || q[0] != '\r' || q[1] != '\n' ||
+            q[2] == ' ' || q[2] == '\t'/*obs-fold*/) {
+            return false;
+        }
+        f.value.set(p, q - p);
+        p = q + 2;
+        if (!OnSpecialHeader(f, out)) {
+            return false;
+        }
+        ++out->nfield;
+    }
+}
+
+} // namespace brpc
@@ -0,0 +1,65 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_FAST_HTTP_PARSER_H
+#define BRPC_FAST_HTTP_PARSER_H
+
+#include <stdint.h>
+#include "butil/strings/string_piece.h"
+#include "brpc/http_method.h"          // HttpMethod
+
+namespace brpc {
+
+// Start line and headers of a HTTP/1.x message, pointing into the parsed
+// data.
+struct FastHttpHeaders {
+    static const size_t MAX_FIELDS = 64;
+
+    struct Field {
+        butil::StringPiece name;
+        butil::StringPiece value;
+    };
+
+    bool is_request;
+    HttpMethod method;               // requests only
+    int status_code;                 // responses only
+    int http_minor;                  // http_major is always 1
+    butil::StringPiece url;          // requests only
+    Field fields[MAX_FIELDS];
+    size_t nfield;
+    // F_CONNECTION_KEEP_ALIVE, F_CONNECTION_CLOSE and F_CONTENTLENGTH of
+    // http_parser_flags.
+    unsigned int flags;
+    // ULLONG_MAX if Content-Length is absent.
+    uint64_t content_length;
+    // Length of the start line and headers, excluding the final LF.
+    size_t size;
+};
+
+// Parse the start line and headers at the beginning of `data', which
+// must contain all of them. Delimiters are searched 16 bytes at a time
+// with SSE4.2 when it's enabled.
+// This is a fast path of http_parser for common messages, false is
+// returned if the headers are incomplete or contain anything it does not
+// handle (absolute urls, rare methods, obs-fold, bare LF, Transfer-Encoding,
+// Upgrade, malformed data...), in which case http_parser should be used
+// to get the same result as if this function was not called.
+bool FastParseHttpHeaders(const char* data, size_t len, FastHttpHeaders* out);
+
+} // namespace brpc
+
+#endif // BRPC_FAST_HTTP_PARSER_H
@@ -46,13 +46,17 @@ struct IndexTableOptions {
 
 struct HeaderAndHashCode {
     size_t hash_code;
-    const HPacker::Header* header;
+    const std::string* name;
+    const std::string* value;
 };
 
 struct HeaderHasher {
+    size_t operator()(const std::string& name, const std::string& value) const {
+        return butil::CaseIgnoredHasher()(name)
+            * 101 + butil::DefaultHasher<std::string>()(value);
+    }
     size_t operator()(const HPacker::Header& h) const {
-        return butil::CaseIgnoredHasher()(h.name)
-            * 101 + butil::DefaultHasher<std::string>()(h.value);
+        return operator()(h.name, h.value);
     }
     size_t operator()(const HeaderAndHashCode& h) const {
         return h.hash_code;
@@ -65,7 +69,8 @@ struct HeaderEqualTo {
             && butil::DefaultEqualTo<std::string>()(h1.value, h2.value);
     }
     bool operator()(const HPacker::Header& h1, const HeaderAndHashCode& h2) const {
-        return operator()(h1, *h2.header);
+        return butil::CaseIgnoredEqual()(h1.name, *h2.name)
+            && butil::DefaultEqualTo<std::string>()(h1.value, *h2.value);
     }
 };
 
@@ -111,6 +116,7 @@ public:
     }
 
     bool empty() const { return _size == 0; }
+    size_t max_size() const { return _max_size; }
     int start_index() const { return _start_index; }
     int end_index() const { return start_index() + _header_queue.size(); }
 
@@ -317,6 +323,8 @@ public:
         node(cur).value = value;
     }
 
+    size_t node_count() const { return _node_memory.size(); }
+
     const HuffmanNode* node(NodeId id) const {
         if (id == 0u) {
             return NULL;
@@ -349,129 +357,148 @@ public:
     HuffmanEncoder(butil::IOBufAppender* out, const HuffmanCode* table)
         : _out(out)
         , _table(table)
-        , _partial_byte(0)
-        , _remain_bit(8)
+        , _bits(0)
+        , _nbits(0)
+        , _nbuf(0)
         , _out_bytes(0)
     {}
 
     void Encode(unsigned char byte) {
         const HuffmanCode code = _table[byte];
-        uint16_t bits_left = code.bit_len;
-        while (bits_left) {
-            const uint16_t adding_bits_len = std::min(_remain_bit, bits_left);
-            const uint8_t adding_bits = static_cast<uint8_t>(
-                    (code.code & ((1u << bits_left) - 1))   // clear leading bits
-                            >> (bits_left - adding_bits_len));  // align to LSB
-            _partial_byte |= adding_bits << (_remain_bit - adding_bits_len);
-            _remain_bit -= adding_bits_len;
-            bits_left -= adding_bits_len;
-            if (!_remain_bit) {
-                ++_out_bytes;
-                _out->push_back(_partial_byte);
-                _remain_bit = 8;
-                _partial_byte = 0;
-            }
+        // _nbits < 8 before shifting and codes are at most 30 bits, the
+        // bits not output yet always fit in _bits.
+        _bits = (_bits << code.bit_len) | code.code;
+        _nbits += code.bit_len;
+        while (_nbits >= 8) {
+            _nbits -= 8;
+            PutByte(static_cast<uint8_t>(_bits >> _nbits));
         }
     }
 
     void EndStream() {
-        if (_remain_bit == 8u) {
-            return;
+        if (_nbits) {
+            // Add padding `1's to lsb to make _out aligned
+            const uint32_t padding = 8 - _nbits;
+            PutByte(static_cast<uint8_t>(
+                        (_bits << padding) | ((1u << padding) - 1)));
+            _nbits = 0;
+        }
+        if (_nbuf) {
+            _out->append(_buf, _nbuf);
+            _nbuf = 0;
         }
-        DCHECK_LT(_remain_bit, 8u);
-        // Add padding `1's to lsb to make _out aligned
-        _partial_byte |= (1 << _remain_bit) - 1;
-        // TODO: push_back is probably costly since it acquires tls everytime it
-        // is invoked.
-        _out->push_back(_partial_byte);
-        _partial_byte = 0;
-        _remain_bit = 0;
         _out = NULL;
-        ++_out_bytes;
     }
 
     uint32_t out_bytes() const { return _out_bytes; }
 
 private:
+    void PutByte(uint8_t c) {
+        if (_nbuf == sizeof(_buf)) {
+            _out->append(_buf, _nbuf);
+            _nbuf = 0;
+        }
+        _buf[_nbuf++] = c;
+        ++_out_bytes;
+    }
+
     butil::IOBufAppender* _out;
     const HuffmanCode* _table;
-    uint8_t  _partial_byte;
-    uint16_t _remain_bit;
+    uint64_t _bits;
+    uint32_t _nbits;
+    uint32_t _nbuf;
     uint32_t _out_bytes;
+    char _buf[64];
 };
 
-class HuffmanDecoder {
-DISALLOW_COPY_AND_ASSIGN(HuffmanDecoder);
-public:
-    HuffmanDecoder(std::string* out, const HuffmanTree* tree)
-        // FIXME: resizing of out is costly
-        : _out(out)
-        , _tree(tree)
-        , _cur_node(tree->node(HuffmanTree::ROOT_NODE))
-        , _cur_depth(0)  // Depth of root node is 0
-        , _padding(true)
-    {}
-    int Decode(uint8_t byte) {
-        for (int i = 7; i >= 0; --i) {
-            if (byte & (1u << i)) {
-                _cur_node = _tree->node(_cur_node->right_child);
-                if (BAIDU_UNLIKELY(!_cur_node)) {
-                    LOG(ERROR) << "Decoder stream reaches NULL_NODE";
-                    return -1;
-                }
-                if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                    if (BAIDU_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                        LOG(ERROR) << "Decoder stream reaches EOS";
-                        return -1;
-                    }
-                    _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                    _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                    _cur_depth = 0;
-                    _padding = true;
-                    continue;
-                }
-                _padding &= 1;
-            } else {
-                _cur_node = _tree->node(_cur_node->left_child);
-                if (BAIDU_UNLIKELY(!_cur_node)) {
-                    LOG(ERROR) << "Decoder stream reaches NULL_NODE";
-                    return -1;
+// Huffman decoding consumes 4 bits at a time with a state machine, where the
+// states are internal nodes of the huffman tree. Since codes are at least 5
+// bits long, at most one symbol is decoded per step.
+enum HuffmanDecodeFlags {
+    HUFFMAN_DECODE_SYMBOL = 1,    // `symbol' is decoded in this step.
+    HUFFMAN_DECODE_ACCEPTED = 2,  // The string may end at `state', namely
+                                  // the bits since last symbol are a valid
+                                  // padding (a prefix of EOS, at most 7 bits).
+    HUFFMAN_DECODE_FAILED = 4,    // The bits are not a valid code or hit EOS.
+};
+
+struct HuffmanDecodeEntry {
+    uint16_t state;
+    uint8_t flags;
+    uint8_t symbol;
+};
+
+// 257 symbols (including EOS) => 256 internal nodes.
+static const size_t HUFFMAN_DECODE_STATES = 256;
+typedef HuffmanDecodeEntry HuffmanDecodeTable[HUFFMAN_DECODE_STATES][16];
+
+static void BuildHuffmanDecodeTable(const HuffmanTree& tree,
+                                    HuffmanDecodeTable* table) {
+    const size_t n = tree.node_count();
+    std::vector<int> state_of(n + 1, -1);
+    std::vector<HuffmanTree::NodeId> node_of;
+    std::vector<bool> accepted(n + 1, false);
+    // Traverse the tree to number internal nodes and find valid paddings.
+    struct Visit {
+        HuffmanTree::NodeId id;
+        int depth;
+        bool all_ones;
+    };
+    std::vector<Visit> stack;
+    Visit root = { HuffmanTree::ROOT_NODE, 0, true };
+    stack.push_back(root);
+    while (!stack.empty()) {
+        const Visit v = stack.back();
+        stack.pop_back();
+        const HuffmanNode* node = tree.node(v.id);
+        if (node->value != HuffmanTree::INVALID_VALUE) {
+            continue;
+        }
+        state_of[v.id] = node_of.size();
+        node_of.push_back(v.id);
+        accepted[v.id] = (v.all_ones && v.depth <= 7);
+        if (node->left_child != HuffmanTree::NULL_NODE) {
+            Visit left = { node->left_child, v.depth + 1, false };
+            stack.push_back(left);
+        }
+        if (node->right_child != HuffmanTree::NULL_NODE) {
+            Visit right = { node->right_child, v.depth + 1, v.all_ones };
+            stack.push_back(right);
+        }
+    }
+    CHECK_EQ(HUFFMAN_DECODE_STATES, node_of.size());
+    CHECK_EQ(0, state_of[HuffmanTree::ROOT_NODE]);
+    for (size_t state = 0; state < node_of.size(); ++state) {
+        for (int nibble = 0; nibble < 16; ++nibble) {
+            HuffmanDecodeEntry& e = (*table)[state][nibble];
+            e.state = 0;
+            e.flags = 0;
+            e.symbol = 0;
+            HuffmanTree::NodeId cur = node_of[state];
+            for (int i = 3; i >= 0; --i) {
+                const HuffmanNode* node = tree.node(cur);
+                cur = (nibble & (1 << i)) ? node->right_child : node->left_child;
+                const HuffmanNode* child = tree.node(cur);
+                if (child == NULL || child->value == HPACK_HUFFMAN_EOS) {
+                    e.flags = HUFFMAN_DECODE_FAILED;
+                    break;
                 }
-                if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                    if (BAIDU_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                        LOG(ERROR) << "Decoder stream reaches EOS";
-                        return -1;
-                    }
-                    _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                    _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                    _cur_depth = 0;
-                    _padding = true;
-                    continue;
+                if (child->value != HuffmanTree::INVALID_VALUE) {
+                    e.flags |= HUFFMAN_DECODE_SYMBOL;
+                    e.symbol = static_cast<uint8_t>(child->value);
+                    cur = HuffmanTree::ROOT_NODE;
                 }
-                _padding &= 0;
             }
-            ++_cur_depth;
-        }
-        return 0;
-    }
-    int EndStream() {
-        if (_cur_depth == 0) {
-            return 0;
-        }
-        if (_cur_depth <= 7 && _padding) {
-            return 0;
+            if (e.flags & HUFFMAN_DECODE_FAILED) {
+                continue;
+            }
+            e.state = state_of[cur];
+            if (accepted[cur]) {
+                e.flags |= HUFFMAN_DECODE_ACCEPTED;
+            }
         }
-        // Invalid stream, the padding is not corresponding to MSB of EOS
-        // https://tools.ietf.org/html/rfc7541#section-5.2
-        return -1;
     }
-private:
-    std::string* _out;
-    const HuffmanTree* _tree;
-    const HuffmanNode* _cur_node;
-    uint16_t _cur_depth;
-    bool _padding;
-};
+}
 
 // Primitive Type Representations
 
@@ -497,6 +524,7 @@ inline void EncodeInteger(butil::IOBufAppender* out, uint8_t msb,
 
 // Static variables
 static HuffmanTree* s_huffman_tree = NULL;
+static HuffmanDecodeTable* s_huffman_decode_table = NULL;
 static IndexTable* s_static_table = NULL;
 static pthread_once_t s_create_once = PTHREAD_ONCE_INIT;
 
@@ -505,6 +533,8 @@ static void CreateStaticTableOrDie() {
     for (size_t i = 0; i < ARRAY_SIZE(s_huffman_table); ++i) {
         s_huffman_tree->AddLeafNode(i, s_huffman_table[i]);
     }
+    s_huffman_decode_table = new HuffmanDecodeTable[1];
+    BuildHuffmanDecodeTable(*s_huffman_tree, s_huffman_decode_table);
     IndexTableOptions options;
     options.max_size = UINT_MAX;
     options.static_table = s_static_headers;
@@ -566,7 +596,23 @@ inline ssize_t DecodeInteger(butil::IOBufBytesIterator& iter,
 
 template <bool LOWERCASE> // use template to remove dead branches.
 inline void EncodeString(butil::IOBufAppender* out, const std::string& s,
-                         bool huffman_encoding) {
+                         bool huffman_encoding, bool huffman_if_shorter) {
+    uint32_t bit_len = 0;
+    if (huffman_encoding || huffman_if_shorter) {
+        // Calculate length of encoded string
+        if (LOWERCASE) {
+            for (size_t i = 0; i < s.size(); ++i) {
+                bit_len += s_huffman_table[(uint8_t)butil::ascii_tolower(s[i])].bit_len;
+            }
+        } else {
+            for (size_t i = 0; i < s.size(); ++i) {
+                bit_len += s_huffman_table[(uint8_t)s[i]].bit_len;
+            }
+        }
+        if (!huffman_encoding && (bit_len >> 3) + !!(bit_len & 7) < s.size()) {
+            huffman_encoding = true;
+        }
+    }
     if (!huffman_encoding) {
         EncodeInteger(out, 0x00, 7, s.size());
         if (LOWERCASE) {
@@ -578,17 +624,6 @@ inline void EncodeString(butil::IOBufAppender* out, const std::string& s,
         }
         return;
     }
-    // Calculate length of encoded string
-    uint32_t bit_len = 0;
-    if (LOWERCASE) {
-        for (size_t i = 0; i < s.size(); ++i) {
-            bit_len += s_huffman_table[(uint8_t)butil::ascii_tolower(s[i])].bit_len;
-        }
-    } else {
-        for (size_t i = 0; i < s.size(); ++i) {
-            bit_len += s_huffman_table[(uint8_t)s[i]].bit_len;
-        }
-    }
     EncodeInteger(out, 0x80, 7, (bit_len >> 3) + !!(bit_len & 7));
     HuffmanEncoder e(out, s_huffman_table);
     if (LOWERCASE) {
@@ -622,15 +657,38 @@ inline ssize_t DecodeString(butil::IOBufBytesIterator& iter, std::string* out) {
         iter.copy_and_forward(out, length);
         return in_bytes;
     }
-    HuffmanDecoder d(out, s_huffman_tree);
-    for (; iter != NULL && length; ++iter, --length) {
-        if (d.Decode(*iter) != 0) {
+    // Every symbol takes at least 5 bits.
+    out->resize(length * 8 / 5);
+    char* const p = &(*out)[0];
+    size_t n = 0;
+    const HuffmanDecodeTable& table = *s_huffman_decode_table;
+    uint16_t state = 0;
+    uint8_t flags = HUFFMAN_DECODE_ACCEPTED;
+    for (; length; ++iter, --length) {
+        const uint8_t c = *iter;
+        const HuffmanDecodeEntry& e1 = table[state][c >> 4];
+        if (BAIDU_UNLIKELY(e1.flags & HUFFMAN_DECODE_FAILED)) {
+            return -1;
+        }
+        if (e1.flags & HUFFMAN_DECODE_SYMBOL) {
+            p[n++] = e1.symbol;
+        }
+        const HuffmanDecodeEntry& e2 = table[e1.state][c & 0xF];
+        if (BAIDU_UNLIKELY(e2.flags & HUFFMAN_DECODE_FAILED)) {
             return -1;
         }
+        if (e2.flags & HUFFMAN_DECODE_SYMBOL) {
+            p[n++] = e2.symbol;
+        }
+        state = e2.state;
+        flags = e2.flags;
     }
-    if (d.EndStream() != 0) {
+    if (!(flags & HUFFMAN_DECODE_ACCEPTED)) {
+        // Invalid stream, the padding is not corresponding to MSB of EOS
+        // https://tools.ietf.org/html/rfc7541#section-5.2
         return -1;
     }
+    out->resize(n);
     return in_bytes;
 }
 
@@ -638,6 +696,7 @@ HPacker::HPacker()
     : _encode_table(NULL)
     , _decode_table(NULL) {
     CreateStaticTableOnceOrDie();
+    memset(_recent_headers, 0, sizeof(_recent_headers));
 }
 
 HPacker::~HPacker() {
@@ -675,9 +734,8 @@ int HPacker::Init(size_t max_table_size) {
     return 0;
 }
 
-inline int HPacker::FindHeaderFromIndexTable(const Header& h) const {
-    // saves a hash (which is a hotspot) for ones missing s_static_table
-    const HeaderAndHashCode hhc = { HeaderHasher()(h), &h };
+inline int HPacker::FindHeaderFromIndexTable(
+    const HeaderAndHashCode& hhc) const {
     int index = s_static_table->GetIndexOfHeader(hhc);
     if (index > 0) {
         return index;
@@ -695,24 +753,53 @@ inline int HPacker::FindNameFromIndexTable(const std::string& name) const {
 
 void HPacker::Encode(butil::IOBufAppender* out, const Header& header,
                      const HPackOptions& options) {
-    if (options.index_policy != HPACK_NEVER_INDEX_HEADER) {
-        const int index = FindHeaderFromIndexTable(header);
+    return Encode(out, header.name, header.value, options);
+}
+
+void HPacker::Encode(butil::IOBufAppender* out, const std::string& name,
+                     const std::string& value, const HPackOptions& options) {
+    HeaderIndexPolicy index_policy = options.index_policy;
+    size_t hash_code = 0;
+    if (index_policy != HPACK_NEVER_INDEX_HEADER) {
+        // saves a hash (which is a hotspot) for ones missing s_static_table
+        const HeaderAndHashCode hhc = { HeaderHasher()(name, value),
+                                        &name, &value };
+        const int index = FindHeaderFromIndexTable(hhc);
         if (index > 0) {
             // This header is already in the index table
             return EncodeInteger(out, 0x80, 7, index);
         }
+        hash_code = hhc.hash_code;
     } // The header can't be indexed or the header wasn't in the index table
     
-    const int name_index = FindNameFromIndexTable(header.name);
-    if (options.index_policy == HPACK_INDEX_HEADER) {
+    const int name_index = FindNameFromIndexTable(name);
+    if (index_policy == HPACK_INDEX_REPEATED_HEADER) {
+        // Index the header when it was the last one encoded in its slot, or
+        // when the name is not indexed so that following headers with the
+        // same name carry an index instead of the name. Never index a header
+        // taking more than half of the table.
+        // The hash of short strings is weak, mix it first.
+        const uint64_t h = hash_code * 0x9E3779B97F4A7C15ULL;
+        uint32_t& recent = _recent_headers[(h >> 56) % RECENT_HEADERS_SIZE];
+        const uint32_t fingerprint = (uint32_t)(h >> 24) | 1;
+        if ((recent == fingerprint || name_index == 0) &&
+            (name.size() + value.size() + 32) * 2 <= _encode_table->max_size()) {
+            index_policy = HPACK_INDEX_HEADER;
+        } else {
+            index_policy = HPACK_NOT_INDEX_HEADER;
+        }
+        recent = fingerprint;
+    }
+    if (index_policy == HPACK_INDEX_HEADER) {
         // TODO: Add Options that indexes name independently
-        _encode_table->AddHeader(header);
+        _encode_table->AddHeader(Header(name, value));
     }
-    switch (options.index_policy) {
+    switch (index_policy) {
     case HPACK_INDEX_HEADER:
         EncodeInteger(out, 0x40, 6, name_index);
         break;
     case HPACK_NOT_INDEX_HEADER:
+    case HPACK_INDEX_REPEATED_HEADER:
         EncodeInteger(out, 0x00, 4, name_index);
         break;
     case HPACK_NEVER_INDEX_HEADER:
@@ -720,9 +807,11 @@ void HPacker::Encode(butil::IOBufAppender* out, const Header& header,
         break;
     }
     if (name_index == 0) {
-        EncodeString<true>(out, header.name, options.encode_name);
+        EncodeString<true>(out, name, options.encode_name,
+                           options.huffman_if_shorter);
     }
-    EncodeString<false>(out, header.value, options.encode_value);
+    EncodeString<false>(out, value, options.encode_value,
+                        options.huffman_if_shorter);
 }
 
 inline const HPacker::Header* HPacker::HeaderAt(int index) const {
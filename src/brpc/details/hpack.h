@@ -42,6 +42,13 @@ enum HeaderIndexPolicy {
 
     // Append this header which will never replaced by a index
     HPACK_NEVER_INDEX_HEADER = 2,
+
+    // Like HPACK_INDEX_HEADER, except that the header is appended into the
+    // decoder dynamic table only when it was encoded recently or the name is
+    // not in the table yet, otherwise it is encoded as HPACK_NOT_INDEX_HEADER.
+    // Headers varying between requests (e.g. trace ids) don't evict the
+    // repeating ones from the table.
+    HPACK_INDEX_REPEATED_HEADER = 3,
 };
 
 // Options to encode a header
@@ -59,6 +66,12 @@ struct HPackOptions {
     // Default: false
     bool encode_value;
 
+    // If true, names and values not encoded with huffman encoding according
+    // to the options above are encoded with huffman encoding when the
+    // result is shorter.
+    // Default: false
+    bool huffman_if_shorter;
+
     // Construct default options
     HPackOptions();
 };
@@ -67,9 +80,11 @@ inline HPackOptions::HPackOptions()
     : index_policy(HPACK_INDEX_HEADER)
     , encode_name(false)
     , encode_value(false)
+    , huffman_if_shorter(false)
 {}
 
 class IndexTable;
+struct HeaderAndHashCode;
 
 // HPACK - Header compression algorithm for http2 (rfc7541)
 // http://httpwg.org/specs/rfc7541.html
@@ -107,6 +122,9 @@ public:
                 const HPackOptions& options);
     void Encode(butil::IOBufAppender* out, const Header& header)
     { return Encode(out, header, HPackOptions()); }
+    // Same as above, without copying name and value into a Header.
+    void Encode(butil::IOBufAppender* out, const std::string& name,
+                const std::string& value, const HPackOptions& options);
 
     // Try to decode at most one Header from source and erase corresponding
     // buffer.
@@ -124,7 +142,11 @@ public:
     
 private:
     DISALLOW_COPY_AND_ASSIGN(HPacker);
-    int FindHeaderFromIndexTable(const Header& h) const;
+    // Fingerprints of recently encoded headers, for
+    // HPACK_INDEX_REPEATED_HEADER.
+    static const size_t RECENT_HEADERS_SIZE = 256;
+
+    int FindHeaderFromIndexTable(const HeaderAndHashCode& h) const;
     int FindNameFromIndexTable(const std::string& name) const;
     const Header* HeaderAt(int index) const;
     ssize_t DecodeWithKnownPrefix(
@@ -132,6 +154,7 @@ private:
 
     IndexTable* _encode_table;
     IndexTable* _decode_table;
+    uint32_t _recent_headers[RECENT_HEADERS_SIZE];
 };
 
 // Lowercase the input string, a fast implementation.
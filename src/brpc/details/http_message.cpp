@@ -27,6 +27,7 @@
 #include "brpc/log.h"
 #include "brpc/reloadable_flags.h"
 #include "brpc/details/http_message.h"
+#include "brpc/details/fast_http_parser.h"
 
 namespace brpc {
 
@@ -38,6 +39,14 @@ DEFINE_bool(http_verbose, false,
             "[DEBUG] Print EVERY http request/response");
 DEFINE_int32(http_verbose_max_body_length, 512,
              "[DEBUG] Max body length printed when -http_verbose is on");
+DEFINE_bool(http_parser_fast_path, true,
+            "Parse start lines and headers of common http/1.x messages with "
+            "a vectorized parser rather than http_parser");
+BRPC_VALIDATE_GFLAG(http_parser_fast_path, PassValidate);
+DEFINE_int32(http_max_header_fields, 1000,
+             "Max number of header fields in a http message, messages with "
+             "more fields are rejected");
+BRPC_VALIDATE_GFLAG(http_max_header_fields, PositiveInteger);
 DECLARE_int64(socket_max_unwritten_bytes);
 
 // Implement callbacks for http parser
@@ -98,6 +107,11 @@ int HttpMessage::on_header_value(http_parser *parser,
             LOG(ERROR) << "Header name is empty";
             return -1;
         }
+        if (++http_message->_nheader_field > FLAGS_http_max_header_fields) {
+            LOG(ERROR) << "Too many header fields, max="
+                       << FLAGS_http_max_header_fields;
+            return -1;
+        }
         HttpHeader& header = http_message->header();
         if (header.CanFoldedInLine(http_message->_cur_header)) {
             http_message->_cur_value =
@@ -355,7 +369,7 @@ int HttpMessage::OnMessageComplete() {
         ProgressiveReader* r = _body_reader;
         _body_reader = NULL;
         mu.unlock();
-        r->OnEndOfMessage(butil::Status());
+        r->OnEndOfMessage(_end_of_message_status);
     }
     return 0;
 }
@@ -395,7 +409,7 @@ void HttpMessage::SetBodyReader(ProgressiveReader* r) {
                 return;
             } else {  // The body is complete and successfully consumed.
                 mu.unlock();
-                return r->OnEndOfMessage(butil::Status());
+                return r->OnEndOfMessage(_end_of_message_status);
             }
         } else if (_stage <= HTTP_ON_BODY && ++ntry >= MAX_TRY) {
             // Stop making _body empty after we've tried several times.
@@ -457,6 +471,44 @@ HttpMessage::~HttpMessage() {
     }
 }
 
+size_t HttpMessage::ParseHeadersFast(const char* data, size_t length) {
+    if (!FLAGS_http_parser_fast_path || FLAGS_http_verbose ||
+        _parsed_length != 0 || _stage != HTTP_ON_MESSAGE_BEGIN) {
+        return 0;
+    }
+    FastHttpHeaders h;
+    // Let http_parser reject messages with too many header fields.
+    if (!FastParseHttpHeaders(data, length, &h) ||
+        h.nfield > (size_t)FLAGS_http_max_header_fields ||
+        http_parser_resume_after_headers(&_parser) != 0) {
+        return 0;
+    }
+    _parser.type = h.is_request ? HTTP_REQUEST : HTTP_RESPONSE;
+    _parser.method = h.is_request ? h.method : 0;
+    _parser.status_code = h.status_code;
+    _parser.http_major = 1;
+    _parser.http_minor = h.http_minor;
+    _parser.flags = h.flags;
+    _parser.content_length = h.content_length;
+    // Same as callbacks of http_parser.
+    _url.assign(h.url.data(), h.url.size());
+    _stage = HTTP_ON_HEADER_VALUE;
+    _cur_value = NULL;
+    HttpHeader& header = this->header();
+    _nheader_field = h.nfield;
+    for (size_t i = 0; i < h.nfield; ++i) {
+        const FastHttpHeaders::Field& f = h.fields[i];
+        _cur_header.assign(f.name.data(), f.name.size());
+        std::string* value = header.CanFoldedInLine(_cur_header) ?
+            &header.GetOrAddHeader(_cur_header) : &header.AddHeader(_cur_header);
+        if (!value->empty()) {
+            value->append(header.HeaderValueDelimiter(_cur_header));
+        }
+        value->append(f.value.data(), f.value.size());
+    }
+    return h.size;
+}
+
 ssize_t HttpMessage::ParseFromArray(const char *data, const size_t length) {
     if (Completed()) {
         if (length == 0) {
@@ -466,8 +518,9 @@ ssize_t HttpMessage::ParseFromArray(const char *data, const size_t length) {
                    << ") to already-completed message";
         return -1;
     }
-    const size_t nprocessed =
-        http_parser_execute(&_parser, &g_parser_settings, data, length);
+    const size_t nfast = ParseHeadersFast(data, length);
+    const size_t nprocessed = nfast + http_parser_execute(
+        &_parser, &g_parser_settings, data + nfast, length - nfast);
     if (_parser.http_errno != 0) {
         // May try HTTP on other formats, failure is norm.
         RPC_VLOG << "Fail to parse http message, parser=" << _parser
@@ -500,8 +553,11 @@ ssize_t HttpMessage::ParseFromIOBuf(const butil::IOBuf &buf) {
             continue;
         }
         _current_block_base = blk.data();
-        size_t n = http_parser_execute(
-            &_parser, &g_parser_settings, blk.data(), blk.size());
+        // The final LF of headers is always left to http_parser.
+        const size_t nfast =
+            (nprocessed == 0 ? ParseHeadersFast(blk.data(), blk.size()) : 0);
+        size_t n = nfast + http_parser_execute(
+            &_parser, &g_parser_settings, blk.data() + nfast, blk.size() - nfast);
         nprocessed += n;
         _parsed_block_size += n;
         if (_parser.http_errno != 0) {
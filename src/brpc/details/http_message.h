@@ -25,6 +25,7 @@
 #include "butil/iobuf.h"               // butil::IOBuf
 #include "butil/scoped_lock.h"         // butil::unique_lock
 #include "butil/endpoint.h"
+#include "butil/status.h"              // butil::Status
 #include "brpc/details/http_parser.h"  // http_parser
 #include "brpc/http_header.h"          // HttpHeader
 #include "brpc/progressive_reader.h"   // ProgressiveReader
@@ -96,6 +97,12 @@ public:
     // Any error during the setting will destroy the reader.
     void SetBodyReader(ProgressiveReader* r);
 
+    // The status passed to ProgressiveReader::OnEndOfMessage() when the
+    // message completes, OK by default. Protocols carrying errors after
+    // the body(e.g. trailers of grpc) set it before completing the message.
+    void set_end_of_message_status(const butil::Status& st)
+    { _end_of_message_status = st; }
+
 protected:
     int OnBody(const char* data, size_t size);
     int OnMessageComplete();
@@ -104,6 +111,10 @@ protected:
 private:
     DISALLOW_COPY_AND_ASSIGN(HttpMessage);
     int UnlockAndFlushToBodyReader(std::unique_lock<butil::Mutex>& locked);
+    // Parse the start line and headers at the beginning of a message with
+    // FastParseHttpHeaders() and let _parser continue from the final LF.
+    // Returns bytes parsed, 0 if the fast path is not applicable.
+    size_t ParseHeadersFast(const char* data, size_t length);
 
     HttpParserStage _stage{HTTP_ON_MESSAGE_BEGIN};
     std::string _url;
@@ -115,6 +126,7 @@ private:
     // Read body progressively
     ProgressiveReader* _body_reader{NULL};
     butil::IOBuf _body;
+    butil::Status _end_of_message_status;
 
     // Store the IOBuf information in `ParseFromIOBuf'
     // for later zero-copy usage in `OnBody'.
@@ -126,6 +138,8 @@ private:
     struct http_parser _parser;
     std::string _cur_header;
     std::string *_cur_value{NULL};
+    // Number of parsed header fields.
+    int _nheader_field{0};
 
 protected:
     // Only valid when -http_verbose is on
@@ -2189,6 +2189,23 @@ http_parser_init (http_parser *parser, enum http_parser_type t)
   parser->http_errno = HPE_OK;
 }
 
+int
+http_parser_resume_after_headers(http_parser *parser)
+{
+  if (HTTP_PARSER_ERRNO(parser) != HPE_OK ||
+      (parser->state != s_start_req_or_res &&
+       parser->state != s_start_req &&
+       parser->state != s_start_res)) {
+    return -1;
+  }
+  parser->state = s_headers_almost_done;
+  parser->header_state = h_general;
+  parser->index = 0;
+  parser->nread = 0;
+  parser->uses_transfer_encoding = 0;
+  return 0;
+}
+
 const char *
 http_errno_name(enum http_errno err) {
   assert(err < (http_errno)(sizeof(http_strerror_tab)/sizeof(http_strerror_tab[0])));
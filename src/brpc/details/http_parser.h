@@ -300,6 +300,16 @@ size_t http_parser_execute(http_parser *parser,
                            size_t len);
 
 
+/* Continue a message whose start line and headers except the final LF
+ * were parsed by the caller (e.g. FastParseHttpHeaders()). `type', `method'
+ * or `status_code', `http_major', `http_minor', `flags' and `content_length'
+ * must be set as if they were parsed by http_parser_execute(). The next byte
+ * fed to http_parser_execute() must be the final LF, which triggers
+ * on_headers_complete and the parsing of the body.
+ * Returns 0 on success, -1 if `parser' is not at the start of a message. */
+int http_parser_resume_after_headers(http_parser *parser);
+
+
 /* If http_should_keep_alive() in the on_headers_complete or
  * on_message_complete callback returns 0, then this should be
  * the last message on the connection.
@@ -0,0 +1,59 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <pthread.h>
+#include "butil/logging.h"
+#include "bthread/bthread.h"
+#include "brpc/details/inherited_deadline.h"
+
+namespace brpc {
+
+static pthread_once_t s_deadline_key_once = PTHREAD_ONCE_INIT;
+static bthread_key_t s_deadline_key;
+
+static void CreateDeadlineKey() {
+    CHECK_EQ(0, bthread_key_create(&s_deadline_key, NULL));
+}
+
+// The deadline is stored as the value of the key directly, NULL means
+// no deadline.
+int64_t GetInheritedDeadline() {
+    pthread_once(&s_deadline_key_once, CreateDeadlineKey);
+    void* data = bthread_getspecific(s_deadline_key);
+    return data ? (int64_t)(intptr_t)data : -1;
+}
+
+InheritedDeadlineScope::InheritedDeadlineScope(int64_t deadline_us)
+    : _set(false)
+    , _saved_deadline_us(-1) {
+    if (deadline_us < 0) {
+        return;
+    }
+    _saved_deadline_us = GetInheritedDeadline();
+    _set = (bthread_setspecific(s_deadline_key,
+                                (void*)(intptr_t)deadline_us) == 0);
+}
+
+InheritedDeadlineScope::~InheritedDeadlineScope() {
+    if (_set) {
+        bthread_setspecific(s_deadline_key, _saved_deadline_us < 0 ? NULL :
+                            (void*)(intptr_t)_saved_deadline_us);
+    }
+}
+
+} // namespace brpc
@@ -0,0 +1,49 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_INHERITED_DEADLINE_H
+#define BRPC_INHERITED_DEADLINE_H
+
+#include <stdint.h>
+#include "butil/macros.h"
+
+
+namespace brpc {
+
+// Deadline (since the Epoch in microseconds) of the server-side RPC being
+// processed in current bthread, -1 if there's none. Channel::CallMethod()
+// truncates timeouts of RPCs to it.
+int64_t GetInheritedDeadline();
+
+// Set the inherited deadline of current bthread to `deadline_us' during the
+// lifetime of this object. No-op if `deadline_us' is negative.
+class InheritedDeadlineScope {
+public:
+    explicit InheritedDeadlineScope(int64_t deadline_us);
+    ~InheritedDeadlineScope();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(InheritedDeadlineScope);
+    bool _set;
+    int64_t _saved_deadline_us;
+};
+
+} // namespace brpc
+
+
+#endif // BRPC_INHERITED_DEADLINE_H
@@ -149,6 +149,31 @@ void MethodStatus::SetConcurrencyLimiter(ConcurrencyLimiter* cl) {
     _cl.reset(cl);
 }
 
+void MethodStatus::EnableAdmissionQueue(bool enabled) {
+    // Nothing is queued without a ConcurrencyLimiter.
+    _admission_queue.reset(enabled && _cl ? new AdmissionQueue : NULL);
+}
+
+bool MethodStatus::WaitForAdmission(Controller* cntl, bool has_slot) {
+    AdmissionQueue::Waiter w(cntl);
+    if (has_slot && !_admission_queue->Notify(w.priority)) {
+        // More important than all queued requests.
+        return true;
+    }
+    // Queued requests are not being processed, don't count them. If the
+    // slot was handed over, it's counted for the woken request instead.
+    if (!has_slot) {
+        _nconcurrency.fetch_sub(1, butil::memory_order_relaxed);
+    }
+    if (_admission_queue->Wait(&w, _latency_rec.latency())) {
+        // The slot handed over by Notify() has been counted.
+        return true;
+    }
+    // OnResponded() is still called for rejected requests.
+    _nconcurrency.fetch_add(1, butil::memory_order_relaxed);
+    return false;
+}
+
 int HandleResponseWritten(bthread_id_t id, void* data, int /*error_code*/) {
     auto args = static_cast<ResponseWriteInfo*>(data);
     args->sent_us = butil::cpuwide_time_us();
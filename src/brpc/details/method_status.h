@@ -23,6 +23,7 @@
 #include "bvar/bvar.h"                    // vars
 #include "brpc/describable.h"
 #include "brpc/concurrency_limiter.h"
+#include "brpc/details/admission_queue.h"
 
 
 namespace brpc {
@@ -38,6 +39,8 @@ public:
     // Call this function when the method is about to be called.
     // Returns false when the method is overloaded. If rejected_cc is not
     // NULL, it's set with the rejected concurrency.
+    // If the admission queue is enabled, an overloaded request may block
+    // in this function until it's admitted or dropped.
     bool OnRequested(int* rejected_cc = NULL, Controller* cntl = NULL);
 
     // Call this when the method just finished.
@@ -60,13 +63,24 @@ public:
 
 private:
 friend class Server;
+friend class Channel;
     DISALLOW_COPY_AND_ASSIGN(MethodStatus);
 
     // Note: SetConcurrencyLimiter() is not thread safe and can only be called 
     // before the server is started. 
     void SetConcurrencyLimiter(ConcurrencyLimiter* cl);
 
+    // Note: same as SetConcurrencyLimiter(), and must be called after it.
+    void EnableAdmissionQueue(bool enabled);
+
+    // Queue the request until it's admitted. `has_slot' is true when the
+    // request was accepted by _cl, in which case the slot is handed over to
+    // the first queued request unless this one is more important.
+    // Returns true on admitted.
+    bool WaitForAdmission(Controller* cntl, bool has_slot);
+
     std::unique_ptr<ConcurrencyLimiter> _cl;
+    std::unique_ptr<AdmissionQueue> _admission_queue;
     butil::atomic<int> _nconcurrency;
     bvar::Adder<int64_t>  _nerror_bvar;
     bvar::LatencyRecorder _latency_rec;
@@ -96,9 +110,14 @@ private:
 
 inline bool MethodStatus::OnRequested(int* rejected_cc, Controller* cntl) {
     const int cc = _nconcurrency.fetch_add(1, butil::memory_order_relaxed) + 1;
-    if (NULL == _cl || _cl->OnRequested(cc, cntl)) {
+    const bool has_slot = (NULL == _cl || _cl->OnRequested(cc, cntl));
+    if (has_slot && (NULL == _admission_queue || _admission_queue->size() == 0)) {
+        return true;
+    }
+    // Don't jump the queue.
+    if (NULL != _admission_queue && WaitForAdmission(cntl, has_slot)) {
         return true;
-    } 
+    }
     if (rejected_cc) {
         *rejected_cc = cc;
     }
@@ -106,7 +125,15 @@ inline bool MethodStatus::OnRequested(int* rejected_cc, Controller* cntl) {
 }
 
 inline void MethodStatus::OnResponded(int error_code, int64_t latency) {
-    _nconcurrency.fetch_sub(1, butil::memory_order_relaxed);
+    // Hand over the slot to a queued request directly so that it's not
+    // taken by new requests. Concurrency is unchanged after the handover,
+    // which must still be allowed by _cl (e.g. this request was rejected,
+    // or max_concurrency was lowered).
+    if (NULL == _admission_queue || _admission_queue->size() == 0 ||
+        !_cl->OnRequested(_nconcurrency.load(butil::memory_order_relaxed), NULL) ||
+        !_admission_queue->Notify()) {
+        _nconcurrency.fetch_sub(1, butil::memory_order_relaxed);
+    }
     if (0 == error_code) {
         _latency_rec << latency;
     } else {
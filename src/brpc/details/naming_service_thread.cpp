@@ -25,6 +25,7 @@
 #include "brpc/log.h"
 #include "brpc/socket_map.h"
 #include "brpc/details/naming_service_thread.h"
+#include "brpc/details/shared_naming_service.h"
 
 
 namespace brpc {
@@ -63,7 +64,8 @@ NamingServiceThread::Actions::Actions(NamingServiceThread* owner)
     : _owner(owner)
     , _wait_id(INVALID_BTHREAD_ID)
     , _has_wait_error(false)
-    , _wait_error(0) {
+    , _wait_error(0)
+    , _last_version(0) {
     CHECK_EQ(0, bthread_id_create(&_wait_id, NULL, NULL));
 }
 
@@ -78,15 +80,25 @@ NamingServiceThread::Actions::~Actions() {
 }
 
 void NamingServiceThread::Actions::AddServers(
-    const std::vector<ServerNode>&) {
-    // FIXME(gejun)
-    RELEASE_ASSERT_VERBOSE(false, "Not implemented");
+    const std::vector<ServerNode>& servers) {
+    UpdateServers(servers, std::vector<ServerNode>(), 0);
 }
 
 void NamingServiceThread::Actions::RemoveServers(
-    const std::vector<ServerNode>&) {
-    // FIXME(gejun)
-    RELEASE_ASSERT_VERBOSE(false, "Not implemented");
+    const std::vector<ServerNode>& servers) {
+    UpdateServers(std::vector<ServerNode>(), servers, 0);
+}
+
+void NamingServiceThread::Actions::SortAndUnique(
+    std::vector<ServerNode>* nodes) {
+    std::sort(nodes->begin(), nodes->end());
+    const size_t dedup_size = std::unique(nodes->begin(), nodes->end())
+        - nodes->begin();
+    if (dedup_size != nodes->size()) {
+        LOG(WARNING) << "Removed " << nodes->size() - dedup_size
+                     << " duplicated servers";
+        nodes->resize(dedup_size);
+    }
 }
 
 void NamingServiceThread::Actions::ResetServers(
@@ -95,14 +107,7 @@ void NamingServiceThread::Actions::ResetServers(
     
     // Diff servers with _last_servers by comparing sorted vectors.
     // Notice that _last_servers is always sorted.
-    std::sort(_servers.begin(), _servers.end());
-    const size_t dedup_size = std::unique(_servers.begin(), _servers.end())
-        - _servers.begin();
-    if (dedup_size != _servers.size()) {
-        LOG(WARNING) << "Removed " << _servers.size() - dedup_size
-                     << " duplicated servers";
-        _servers.resize(dedup_size);
-    }
+    SortAndUnique(&_servers);
     _added.resize(_servers.size());
     std::vector<ServerNode>::iterator _added_end = 
         std::set_difference(_servers.begin(), _servers.end(),
@@ -117,6 +122,69 @@ void NamingServiceThread::Actions::ResetServers(
                             _removed.begin());
     _removed.resize(_removed_end - _removed.begin());
 
+    if (!_added.empty() || !_removed.empty()) {
+        ApplyChanges();
+    }
+    EndWait(servers.empty() ? ENODATA : 0);
+}
+
+void NamingServiceThread::Actions::UpdateServers(
+        const std::vector<ServerNode>& added,
+        const std::vector<ServerNode>& removed,
+        uint64_t version) {
+    if (version != 0) {
+        if (version <= _last_version) {
+            RPC_VLOG << "Ignore changes of " << _owner->_service_name
+                     << " at version=" << version
+                     << ", last_version=" << _last_version;
+            return;
+        }
+        _last_version = version;
+    }
+    // Only the deltas are sorted, merging them into the sorted _last_servers
+    // is linear, which is much cheaper than sorting and diffing the full
+    // list as ResetServers() does.
+    _added.assign(added.begin(), added.end());
+    SortAndUnique(&_added);
+    _removed.clear();
+    for (size_t i = 0; i < removed.size(); ++i) {
+        // A server removed and added in the same batch is kept.
+        if (std::binary_search(_last_servers.begin(), _last_servers.end(),
+                               removed[i]) &&
+            !std::binary_search(_added.begin(), _added.end(), removed[i])) {
+            _removed.push_back(removed[i]);
+        }
+    }
+    SortAndUnique(&_removed);
+    size_t added_size = 0;
+    for (size_t i = 0; i < _added.size(); ++i) {
+        if (!std::binary_search(_last_servers.begin(), _last_servers.end(),
+                                _added[i])) {
+            // Don't self-assign, EndPoint resets itself before copying.
+            if (added_size != i) {
+                _added[added_size] = _added[i];
+            }
+            ++added_size;
+        }
+    }
+    _added.resize(added_size);
+    if (!_added.empty() || !_removed.empty()) {
+        _servers.resize(_last_servers.size());
+        std::vector<ServerNode>::iterator _servers_end =
+            std::set_difference(_last_servers.begin(), _last_servers.end(),
+                                _removed.begin(), _removed.end(),
+                                _servers.begin());
+        _servers.resize(_servers_end - _servers.begin());
+        const size_t before_added = _servers.size();
+        _servers.insert(_servers.end(), _added.begin(), _added.end());
+        std::inplace_merge(_servers.begin(), _servers.begin() + before_added,
+                           _servers.end());
+        ApplyChanges();
+    }
+    EndWait(_last_servers.empty() ? ENODATA : 0);
+}
+
+void NamingServiceThread::Actions::ApplyChanges() {
     _added_sockets.clear();
     for (size_t i = 0; i < _added.size(); ++i) {
         ServerNodeWithId tagged_id;
@@ -202,8 +270,6 @@ void NamingServiceThread::Actions::ResetServers(
         }
         LOG(INFO) << info.str();
     }
-
-    EndWait(servers.empty() ? ENODATA : 0);
 }
 
 void NamingServiceThread::Actions::EndWait(int error_code) {
@@ -471,7 +537,13 @@ int GetNamingServiceThread(
         }
     }
     if (new_thread) {
-        int rc = nsthread->Start(source_ns->New(), key.protocol, key.service_name, options);
+        NamingService* ns = source_ns->New();
+        if (IsNamingServiceSharingEnabled() &&
+            !ns->RunNamingServiceReturnsQuickly()) {
+            ns = new SharedNamingService(
+                ns, key.protocol + "://" + key.service_name);
+        }
+        int rc = nsthread->Start(ns, key.protocol, key.service_name, options);
         if (rc != 0) {
             LOG(ERROR) << "Fail to start NamingServiceThread";
             // Wake up those waiting for first batch of servers.
@@ -72,14 +72,24 @@ class NamingServiceThread : public SharedObject, public Describable {
         void AddServers(const std::vector<ServerNode>& servers) override;
         void RemoveServers(const std::vector<ServerNode>& servers) override;
         void ResetServers(const std::vector<ServerNode>& servers) override;
+        void UpdateServers(const std::vector<ServerNode>& added,
+                           const std::vector<ServerNode>& removed,
+                           uint64_t version) override;
         int WaitForFirstBatchOfServers();
         void EndWait(int error_code);
 
     private:
+        // Sort and de-duplicate `nodes' in-place.
+        static void SortAndUnique(std::vector<ServerNode>* nodes);
+        // Create/find sockets of _added/_removed, notify watchers and make
+        // _servers the new _last_servers.
+        void ApplyChanges();
+
         NamingServiceThread* _owner;
         bthread_id_t _wait_id;
         butil::atomic<bool> _has_wait_error;
         int _wait_error;
+        uint64_t _last_version;
         std::vector<ServerNode> _last_servers;
         std::vector<ServerNode> _servers;
         std::vector<ServerNode> _added;
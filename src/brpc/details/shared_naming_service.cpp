@@ -0,0 +1,359 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <fcntl.h>                                  // open
+#include <sys/file.h>                               // flock
+#include <sys/mman.h>                               // mmap
+#include <sys/stat.h>                               // fstat, mkdir
+#include <unistd.h>                                 // ftruncate
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "butil/endpoint.h"
+#include "butil/logging.h"
+#include "butil/string_printf.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h"
+#include "bthread/bthread.h"
+#include "brpc/log.h"
+#include "brpc/details/shared_naming_service.h"
+
+
+namespace brpc {
+
+namespace policy {
+// Defined in file_naming_service.cpp
+bool SplitIntoServerAndTag(const butil::StringPiece& line,
+                           butil::StringPiece* server_addr,
+                           butil::StringPiece* tag);
+} // namespace policy
+
+DEFINE_string(ns_shared_dir, "",
+              "If this flag is non-empty, processes on the host accessing "
+              "the same naming service share one resolution through "
+              "memory-mapped files under this directory, e.g. /dev/shm/brpc_ns");
+DEFINE_int32(ns_shared_max_size, 8 * 1024 * 1024,
+             "Max bytes of a server list shared between processes");
+
+static const uint32_t SHARED_NS_MAGIC = 0x4e534852;  // "NSHR"
+// Interval of checking the shared file by readers.
+static const int64_t SHARED_NS_CHECK_INTERVAL_US = 100000L;
+// Times of yielding to a publisher writing the list before giving up the
+// read, so that a reader can take over a publisher died in the middle of
+// writing.
+static const int SHARED_NS_MAX_WRITING_YIELDS = 16;
+
+// Layout of the shared file. The server list follows the header in the
+// same text format as FileNamingService.
+struct SharedNamingService::Header {
+    butil::atomic<uint32_t> magic;
+    uint32_t capacity;
+    // Odd when the publisher is writing the list.
+    butil::atomic<uint64_t> version;
+    butil::atomic<uint32_t> length;
+    butil::atomic<int64_t> publish_time_us;
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+};
+
+bool IsNamingServiceSharingEnabled() {
+    return !FLAGS_ns_shared_dir.empty();
+}
+
+class SharedNamingService::PublishingActions : public NamingServiceActions {
+public:
+    PublishingActions(SharedNamingService* owner,
+                      NamingServiceActions* actions)
+        : _owner(owner), _actions(actions) {}
+
+    void AddServers(const std::vector<ServerNode>& servers) override {
+        UpdateServers(servers, std::vector<ServerNode>(), 0);
+    }
+
+    void RemoveServers(const std::vector<ServerNode>& servers) override {
+        UpdateServers(std::vector<ServerNode>(), servers, 0);
+    }
+
+    void ResetServers(const std::vector<ServerNode>& servers) override {
+        _servers.clear();
+        _servers.insert(servers.begin(), servers.end());
+        _owner->Publish(_servers);
+        _actions->ResetServers(servers);
+    }
+
+    void UpdateServers(const std::vector<ServerNode>& added,
+                       const std::vector<ServerNode>& removed,
+                       uint64_t version) override {
+        for (size_t i = 0; i < removed.size(); ++i) {
+            _servers.erase(removed[i]);
+        }
+        _servers.insert(added.begin(), added.end());
+        _owner->Publish(_servers);
+        _actions->UpdateServers(added, removed, version);
+    }
+
+private:
+    SharedNamingService* _owner;
+    NamingServiceActions* _actions;
+    std::set<ServerNode> _servers;
+};
+
+SharedNamingService::SharedNamingService(NamingService* ns,
+                                         const std::string& url)
+    : _ns(ns)
+    , _url(url)
+    , _fd(-1)
+    , _header(NULL)
+    , _mapped_size(0)
+    , _last_read_version(0) {
+}
+
+SharedNamingService::~SharedNamingService() {
+    UnmapSharedFile();
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+    if (_ns) {
+        _ns->Destroy();
+        _ns = NULL;
+    }
+}
+
+int SharedNamingService::OpenSharedFile() {
+    if (mkdir(FLAGS_ns_shared_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        PLOG(ERROR) << "Fail to create " << FLAGS_ns_shared_dir;
+        return -1;
+    }
+    uint64_t hash[2];
+    butil::MurmurHash3_x64_128(_url.data(), _url.size(), 0, hash);
+    butil::string_printf(&_path, "%s/%016llx%016llx",
+                         FLAGS_ns_shared_dir.c_str(),
+                         (unsigned long long)hash[0],
+                         (unsigned long long)hash[1]);
+    _fd = open(_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        PLOG(ERROR) << "Fail to open " << _path;
+        return -1;
+    }
+    return 0;
+}
+
+bool SharedNamingService::MapSharedFile() {
+    if (_header != NULL) {
+        return true;
+    }
+    struct stat st;
+    if (fstat(_fd, &st) != 0) {
+        PLOG(ERROR) << "Fail to fstat " << _path;
+        return false;
+    }
+    const size_t size = st.st_size;
+    if (size < sizeof(Header)) {
+        // Not initialized by the publisher yet.
+        return false;
+    }
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (mem == MAP_FAILED) {
+        PLOG(ERROR) << "Fail to mmap " << _path;
+        return false;
+    }
+    Header* header = static_cast<Header*>(mem);
+    if (header->magic.load(butil::memory_order_acquire) != SHARED_NS_MAGIC ||
+        header->capacity + sizeof(Header) > size) {
+        munmap(mem, size);
+        return false;
+    }
+    _header = header;
+    _mapped_size = size;
+    return true;
+}
+
+void SharedNamingService::UnmapSharedFile() {
+    if (_header != NULL) {
+        munmap(_header, _mapped_size);
+        _header = NULL;
+        _mapped_size = 0;
+    }
+}
+
+bool SharedNamingService::TryLockSharedFile() {
+    if (flock(_fd, LOCK_EX | LOCK_NB) != 0) {
+        return false;
+    }
+    if (MapSharedFile()) {
+        // Keep publishing on the list left by the previous publisher. The
+        // version is odd if it died in the middle of writing, which is
+        // rounded up by the next Publish().
+        return true;
+    }
+    const size_t size = sizeof(Header) + std::max(FLAGS_ns_shared_max_size, 0);
+    if (ftruncate(_fd, size) != 0) {
+        PLOG(ERROR) << "Fail to truncate " << _path;
+        flock(_fd, LOCK_UN);
+        return false;
+    }
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (mem == MAP_FAILED) {
+        PLOG(ERROR) << "Fail to mmap " << _path;
+        flock(_fd, LOCK_UN);
+        return false;
+    }
+    _header = static_cast<Header*>(mem);
+    _mapped_size = size;
+    _header->capacity = size - sizeof(Header);
+    _header->version.store(0, butil::memory_order_relaxed);
+    _header->length.store(0, butil::memory_order_relaxed);
+    _header->publish_time_us.store(0, butil::memory_order_relaxed);
+    _header->magic.store(SHARED_NS_MAGIC, butil::memory_order_release);
+    return true;
+}
+
+void SharedNamingService::Publish(const std::set<ServerNode>& servers) {
+    _buf.clear();
+    for (std::set<ServerNode>::const_iterator it = servers.begin();
+         it != servers.end(); ++it) {
+        _buf.append(butil::endpoint2str(it->addr).c_str());
+        if (!it->tag.empty()) {
+            _buf.push_back(' ');
+            _buf.append(it->tag);
+        }
+        _buf.push_back('\n');
+    }
+    if (_buf.size() > _header->capacity) {
+        LOG(ERROR) << "Fail to share " << servers.size() << " servers of "
+                   << _url << ": " << _buf.size() << " bytes exceeds "
+                   << _header->capacity;
+        return;
+    }
+    // Round an odd version left by a died publisher up to even, otherwise
+    // the list would be published with odd versions and never be read.
+    // Readers keep their lists until then rather than reading the partially
+    // written one.
+    const uint64_t version =
+        (_header->version.load(butil::memory_order_relaxed) + 1) & ~1ULL;
+    _header->version.store(version + 1, butil::memory_order_relaxed);
+    butil::atomic_thread_fence(butil::memory_order_release);
+    memcpy(_header->data(), _buf.data(), _buf.size());
+    _header->length.store(_buf.size(), butil::memory_order_relaxed);
+    _header->publish_time_us.store(butil::gettimeofday_us(),
+                                   butil::memory_order_relaxed);
+    _header->version.store(version + 2, butil::memory_order_release);
+}
+
+bool SharedNamingService::ReadIfChanged(std::vector<ServerNode>* servers) {
+    if (!MapSharedFile()) {
+        return false;
+    }
+    int nyield = 0;
+    for (;;) {
+        const uint64_t v1 = _header->version.load(butil::memory_order_acquire);
+        if (v1 == _last_read_version) {
+            return false;
+        }
+        if (v1 & 1) {
+            // Being written. Return to the caller if the publisher does not
+            // finish soon, which may have died and should be taken over.
+            if (++nyield > SHARED_NS_MAX_WRITING_YIELDS) {
+                return false;
+            }
+            bthread_yield();
+            continue;
+        }
+        const uint32_t len = _header->length.load(butil::memory_order_relaxed);
+        if (len <= _header->capacity) {
+            _buf.assign(_header->data(), len);
+        }
+        butil::atomic_thread_fence(butil::memory_order_acquire);
+        const uint64_t v2 = _header->version.load(butil::memory_order_relaxed);
+        if (v1 == v2 && len <= _header->capacity) {
+            _last_read_version = v1;
+            break;
+        }
+    }
+    servers->clear();
+    butil::StringPiece content(_buf);
+    while (!content.empty()) {
+        size_t pos = content.find('\n');
+        if (pos == butil::StringPiece::npos) {
+            pos = content.size();
+        }
+        butil::StringPiece line = content.substr(0, pos);
+        content.remove_prefix(std::min(pos + 1, content.size()));
+        butil::StringPiece addr;
+        butil::StringPiece tag;
+        if (!policy::SplitIntoServerAndTag(line, &addr, &tag)) {
+            continue;
+        }
+        ServerNode node;
+        if (butil::str2endpoint(addr.as_string().c_str(), &node.addr) != 0) {
+            LOG(ERROR) << "Invalid address=`" << addr << "' in " << _path;
+            continue;
+        }
+        tag.CopyToString(&node.tag);
+        servers->push_back(node);
+    }
+    return true;
+}
+
+int SharedNamingService::RunNamingService(const char* service_name,
+                                          NamingServiceActions* actions) {
+    if (OpenSharedFile() != 0) {
+        LOG(WARNING) << "Fail to share naming service of " << _url
+                     << ", resolve it directly";
+        return _ns->RunNamingService(service_name, actions);
+    }
+    std::vector<ServerNode> servers;
+    for (;;) {
+        if (TryLockSharedFile()) {
+            // The publisher of the host, resolve with the real naming service
+            // until this thread is stopped. Other processes take over after
+            // the lock is released.
+            RPC_VLOG << "Publish servers of " << _url << " into " << _path;
+            PublishingActions publishing_actions(this, actions);
+            const int rc = _ns->RunNamingService(service_name,
+                                                 &publishing_actions);
+            flock(_fd, LOCK_UN);
+            return rc;
+        }
+        if (ReadIfChanged(&servers)) {
+            actions->ResetServers(servers);
+        }
+        if (bthread_usleep(SHARED_NS_CHECK_INTERVAL_US) < 0) {
+            if (errno == ESTOP) {
+                RPC_VLOG << "Quit NamingServiceThread=" << bthread_self();
+                return 0;
+            }
+            PLOG(ERROR) << "Fail to sleep";
+            return -1;
+        }
+    }
+}
+
+void SharedNamingService::Describe(std::ostream& os,
+                                   const DescribeOptions& options) const {
+    _ns->Describe(os, options);
+}
+
+NamingService* SharedNamingService::New() const {
+    return new SharedNamingService(_ns->New(), _url);
+}
+
+void SharedNamingService::Destroy() {
+    delete this;
+}
+
+} // namespace brpc
@@ -0,0 +1,87 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_SHARED_NAMING_SERVICE_H
+#define BRPC_SHARED_NAMING_SERVICE_H
+
+#include <set>
+#include <string>
+#include <vector>
+#include "brpc/naming_service.h"
+
+
+namespace brpc {
+
+// Whether naming services should be shared between processes on the host,
+// namely -ns_shared_dir is set.
+bool IsNamingServiceSharingEnabled();
+
+// Share the server list resolved by one naming service among all processes
+// on the host which access the same url.
+// The process holding the flock of a memory-mapped file in -ns_shared_dir
+// runs the wrapped naming service and publishes every change of the list
+// into the file. Other processes read the list lock-free (guarded by a
+// seqlock-like version) and take over the resolution once the publisher
+// quits or dies. As a result, the registry is accessed once per host rather
+// than once per process, and newly started processes get servers without
+// waiting for the registry.
+// NOTE: ServerNode::meta_map is not shared.
+class SharedNamingService : public NamingService {
+public:
+    // Takes ownership of `ns'.
+    SharedNamingService(NamingService* ns, const std::string& url);
+
+    int RunNamingService(const char* service_name,
+                         NamingServiceActions* actions) override;
+    void Describe(std::ostream& os, const DescribeOptions&) const override;
+    NamingService* New() const override;
+    void Destroy() override;
+
+private:
+    ~SharedNamingService() override;
+    DISALLOW_COPY_AND_ASSIGN(SharedNamingService);
+
+    class PublishingActions;
+    struct Header;
+
+    // Open(create if absent) the shared file, returns 0 on success.
+    int OpenSharedFile();
+    // Map the shared file if it's initialized by a publisher.
+    bool MapSharedFile();
+    // Try to be the publisher. Returns true on success.
+    bool TryLockSharedFile();
+    // Copy the list out of the shared file if it's changed since last read.
+    // Returns true if `servers' was filled.
+    bool ReadIfChanged(std::vector<ServerNode>* servers);
+    void Publish(const std::set<ServerNode>& servers);
+    void UnmapSharedFile();
+
+    NamingService* _ns;
+    std::string _url;
+    std::string _path;
+    int _fd;
+    Header* _header;
+    size_t _mapped_size;
+    uint64_t _last_read_version;
+    std::string _buf;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_SHARED_NAMING_SERVICE_H
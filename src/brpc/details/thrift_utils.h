@@ -0,0 +1,122 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_THRIFT_UTILS_H
+#define BRPC_DETAILS_THRIFT_UTILS_H
+
+#include <string>
+#include <thrift/Thrift.h>
+#include <thrift/transport/TVirtualTransport.h>
+
+// _THRIFT_STDCXX_H_ is defined by thrift/stdcxx.h which was added since thrift 0.11.0
+// but deprecated after thrift 0.13.0
+#include <thrift/TProcessor.h> // to include stdcxx.h if present
+#ifndef THRIFT_STDCXX
+ #if defined(_THRIFT_STDCXX_H_)
+ # define THRIFT_STDCXX apache::thrift::stdcxx
+ #elif defined(_THRIFT_VERSION_LOWER_THAN_0_11_0_)
+ # define THRIFT_STDCXX boost
+ # include <boost/make_shared.hpp>
+ #else
+ # define THRIFT_STDCXX std
+ #endif
+#endif
+
+#include "butil/iobuf.h"                        // butil::IOBuf
+#include "butil/status.h"
+#include "brpc/thrift_message.h"                // ThriftProtocolType
+
+namespace brpc {
+namespace policy {
+
+// A thrift transport reading from and writing into IOBuf, so that messages
+// are (de)serialized without being flattened into contiguous memory.
+class IOBufTransport
+    : public ::apache::thrift::transport::TVirtualTransport<IOBufTransport> {
+public:
+    // Read from `rbuf' which is consumed.
+    explicit IOBufTransport(butil::IOBuf* rbuf) : _rbuf(rbuf) {}
+    // Write only.
+    IOBufTransport() : _rbuf(NULL) {}
+
+    uint32_t read(uint8_t* buf, uint32_t len) {
+        return (_rbuf ? _rbuf->cutn(buf, len) : 0);
+    }
+
+    // Returns the first block if it has `*len' bytes at least, NULL otherwise
+    // in which case the protocol falls back to read().
+    const uint8_t* borrow(uint8_t* /*buf*/, uint32_t* len) {
+        if (_rbuf == NULL) {
+            return NULL;
+        }
+        const butil::StringPiece front = _rbuf->backing_block(0);
+        if (front.size() < *len || front.empty()) {
+            return NULL;
+        }
+        *len = front.size();
+        return (const uint8_t*)front.data();
+    }
+
+    void consume(uint32_t len) {
+        _rbuf->pop_front(len);
+    }
+
+    void write(const uint8_t* buf, uint32_t len) {
+        _wbuf.append(buf, len);
+    }
+
+    // Move written data into `out'.
+    void move_to(butil::IOBuf* out) {
+        _wbuf.move_to(*out);
+    }
+
+private:
+    butil::IOBuf* _rbuf;
+    butil::IOBufAppender _wbuf;
+};
+
+// Max size of the message header, namely 12 bytes plus the method name for
+// both protocols: binary has 4-byte version, length and seq_id, compact has
+// 2-byte protocol id and version, 5-byte varint length and seq_id at most.
+static const size_t THRIFT_MESSAGE_BEGIN_MAX_OVERHEAD = 12;
+
+inline size_t ThriftMessageBeginMaxSize(const std::string& method_name) {
+    return THRIFT_MESSAGE_BEGIN_MAX_OVERHEAD + method_name.size();
+}
+
+// A faster implementation of TProtocol::readMessageBegin without depending
+// on thrift stuff. The protocol is detected from the leading bytes and the
+// header is cut from `body'.
+butil::Status ReadThriftMessageBegin(butil::IOBuf* body,
+                                     std::string* method_name,
+                                     ::apache::thrift::protocol::TMessageType* mtype,
+                                     uint32_t* seq_id,
+                                     ThriftProtocolType* protocol_type);
+
+// Same as TProtocol::writeMessageBegin. Returns bytes written into `buf',
+// which has ThriftMessageBeginMaxSize() bytes at least.
+size_t WriteThriftMessageBegin(char* buf,
+                               ThriftProtocolType protocol_type,
+                               const std::string& method_name,
+                               ::apache::thrift::protocol::TMessageType mtype,
+                               uint32_t seq_id);
+
+} // namespace policy
+} // namespace brpc
+
+#endif // BRPC_DETAILS_THRIFT_UTILS_H
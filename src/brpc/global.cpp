@@ -59,6 +59,8 @@
 #include "brpc/compress.h"
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/policy/snappy_compress.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/policy/zstd_compress.h"
 
 // Checksum handlers
 #include "brpc/checksum.h"
@@ -91,6 +93,8 @@
 #include "brpc/policy/auto_concurrency_limiter.h"
 #include "brpc/policy/constant_concurrency_limiter.h"
 #include "brpc/policy/timeout_concurrency_limiter.h"
+#include "brpc/policy/gradient_concurrency_limiter.h"
+#include "brpc/policy/vegas_concurrency_limiter.h"
 
 #include "brpc/input_messenger.h"     // get_or_new_client_side_messenger
 #include "brpc/socket_map.h"          // SocketMapList
@@ -162,6 +166,8 @@ struct GlobalExtensions {
     AutoConcurrencyLimiter auto_cl;
     ConstantConcurrencyLimiter constant_cl;
     TimeoutConcurrencyLimiter timeout_cl;
+    GradientConcurrencyLimiter gradient_cl;
+    VegasConcurrencyLimiter vegas_cl;
 };
 
 static pthread_once_t register_extensions_once = PTHREAD_ONCE_INIT;
@@ -405,6 +411,21 @@ static void GlobalInitializeOrDieImpl() {
     if (RegisterCompressHandler(COMPRESS_TYPE_SNAPPY, snappy_compress) != 0) {
         exit(1);
     }
+#ifdef BRPC_WITH_LZ4
+    CompressHandler lz4_compress = { Lz4Compress, Lz4Decompress, "lz4" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_LZ4, lz4_compress) != 0) {
+        exit(1);
+    }
+#endif
+#ifdef BRPC_WITH_ZSTD
+    if (InitZstdDictionary() != 0) {
+        exit(1);
+    }
+    CompressHandler zstd_compress = { ZstdCompress, ZstdDecompress, "zstd" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_ZSTD, zstd_compress) != 0) {
+        exit(1);
+    }
+#endif
 
     // Checksum Handlers
     const ChecksumHandler crc32c_checksum = {Crc32cCompute, Crc32cVerify,
@@ -635,6 +656,8 @@ static void GlobalInitializeOrDieImpl() {
     ConcurrencyLimiterExtension()->RegisterOrDie("auto", &g_ext->auto_cl);
     ConcurrencyLimiterExtension()->RegisterOrDie("constant", &g_ext->constant_cl);
     ConcurrencyLimiterExtension()->RegisterOrDie("timeout", &g_ext->timeout_cl);
+    ConcurrencyLimiterExtension()->RegisterOrDie("gradient", &g_ext->gradient_cl);
+    ConcurrencyLimiterExtension()->RegisterOrDie("vegas", &g_ext->vegas_cl);
 
     if (FLAGS_usercode_in_pthread) {
         // Optional. If channel/server are initialized before main(), this
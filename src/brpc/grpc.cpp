@@ -20,13 +20,24 @@
 #include <cstdint>                  // int64_t
 #include <sstream>                  // std::stringstream
 #include <iomanip>                  // std::setw
+#include <string.h>                 // memcpy
+#include <gflags/gflags.h>
+#include <google/protobuf/message.h>
 #include "brpc/grpc.h"
 #include "brpc/errno.pb.h"
 #include "brpc/http_status_code.h"
+#include "brpc/progressive_attachment.h"
 #include "butil/logging.h"
+#include "butil/sys_byteorder.h"
+#include "brpc/reloadable_flags.h"
 
 namespace brpc {
 
+DEFINE_int32(grpc_max_message_size, 4 * 1024 * 1024,
+             "Max size of a message read by GrpcMessageReader, larger "
+             "messages stop the stream with GRPC_RESOURCEEXHAUSTED");
+BRPC_VALIDATE_GFLAG(grpc_max_message_size, PositiveInteger);
+
 const char* GrpcStatusToString(GrpcStatus s) {
     switch (s) {
         case GRPC_OK: return "GRPC_OK";
@@ -206,4 +217,63 @@ int64_t ConvertGrpcTimeoutToUS(const std::string* grpc_timeout) {
     CHECK(false) << "Impossible";
 }
 
+butil::Status GrpcMessageReader::OnReadOnePart(const void* data, size_t length) {
+    _buf.append(data, length);
+    while (_buf.size() >= 5) {
+        char header[5];
+        _buf.copy_to(header, sizeof(header));
+        if (header[0] != 0) {
+            return butil::Status(EREQUEST, "Compressed grpc message is not supported");
+        }
+        uint32_t message_length = 0;
+        memcpy(&message_length, header + 1, sizeof(message_length));
+        message_length = butil::NetToHost32(message_length);
+        if (message_length > (uint32_t)FLAGS_grpc_max_message_size) {
+            // ELIMIT is sent as GRPC_RESOURCEEXHAUSTED.
+            return butil::Status(ELIMIT, "grpc message of %u bytes exceeds "
+                                 "-grpc_max_message_size=%d", message_length,
+                                 FLAGS_grpc_max_message_size);
+        }
+        if (_buf.size() < sizeof(header) + message_length) {
+            break;
+        }
+        _buf.pop_front(sizeof(header));
+        butil::IOBuf message;
+        _buf.cutn(&message, message_length);
+        butil::Status st = OnGrpcMessage(&message);
+        if (!st.ok()) {
+            return st;
+        }
+    }
+    return butil::Status::OK();
+}
+
+void GrpcMessageReader::OnEndOfMessage(const butil::Status& status) {
+    if (status.ok() && !_buf.empty()) {
+        _buf.clear();
+        OnEndOfStream(butil::Status(ERESPONSE, "Truncated grpc message"));
+        return;
+    }
+    _buf.clear();
+    OnEndOfStream(status);
+}
+
+int WriteGrpcMessage(ProgressiveAttachment* pa,
+                     const google::protobuf::Message& message) {
+    butil::IOBuf body;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&body);
+    if (!message.SerializeToZeroCopyStream(&wrapper)) {
+        errno = EREQUEST;
+        return -1;
+    }
+    char header[5];
+    header[0] = 0;  // not compressed
+    const uint32_t message_length = butil::HostToNet32(body.size());
+    memcpy(header + 1, &message_length, sizeof(message_length));
+    butil::IOBuf buf;
+    buf.append(header, sizeof(header));
+    buf.append(butil::IOBuf::Movable(body));
+    return pa->Write(buf);
+}
+
 } // namespace brpc
@@ -21,9 +21,20 @@
 
 #include <map>
 #include <brpc/http2.h>
+#include "butil/iobuf.h"
+#include "butil/status.h"
+#include "brpc/progressive_reader.h"
+
+namespace google {
+namespace protobuf {
+class Message;
+}  // namespace protobuf
+}  // namespace google
 
 namespace brpc {
 
+class ProgressiveAttachment;
+
 enum GrpcStatus {
     // OK is returned on success.
     GRPC_OK = 0,
@@ -155,6 +166,37 @@ void PercentEncode(const std::string& str, std::string* str_out);
 
 void PercentDecode(const std::string& str, std::string* str_out);
 
+// Split the progressively-read body of a streaming gRPC into messages.
+// Compressed messages are not supported.
+// Usage:
+//   cntl.response_will_be_read_progressively();  // or request_will_be_...
+//   ...
+//   cntl.ReadProgressiveAttachmentBy(new MyGrpcMessageReader);
+class GrpcMessageReader : public ProgressiveReader {
+public:
+    // Called on each message without the length-prefix. Error returned
+    // stops the stream.
+    virtual butil::Status OnGrpcMessage(butil::IOBuf* message) = 0;
+
+    // Called once and only once when the stream ends. `status' is the
+    // status of the gRPC sent by the remote side if the stream is not
+    // broken. User can release the memory of this object inside.
+    virtual void OnEndOfStream(const butil::Status& status) = 0;
+
+    // @ProgressiveReader
+    butil::Status OnReadOnePart(const void* data, size_t length) override;
+    void OnEndOfMessage(const butil::Status& status) override;
+
+private:
+    butil::IOBuf _buf;
+};
+
+// Write `message' with the length-prefix into `pa' as one message of a
+// streaming gRPC.
+// Returns 0 on success, -1 otherwise and errno is set.
+int WriteGrpcMessage(ProgressiveAttachment* pa,
+                     const google::protobuf::Message& message);
+
 
 } // namespace brpc
 
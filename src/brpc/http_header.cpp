@@ -16,6 +16,8 @@
 // under the License.
 
 
+#include <string.h>                    // strcasecmp
+#include "butil/logging.h"
 #include "brpc/http_status_code.h"     // HTTP_STATUS_*
 #include "brpc/http_header.h"
 
@@ -26,16 +28,129 @@ const char* HttpHeader::SET_COOKIE = "set-cookie";
 const char* HttpHeader::COOKIE = "cookie";
 const char* HttpHeader::CONTENT_TYPE = "content-type";
 
+// Must be in the same order as HttpHeaderId.
+static const char* const s_header_names[] = {
+    ":authority",
+    ":method",
+    ":path",
+    ":scheme",
+    ":status",
+    "accept",
+    "accept-encoding",
+    "accept-language",
+    "authorization",
+    "cache-control",
+    "connection",
+    "content-encoding",
+    "content-length",
+    "content-type",
+    "cookie",
+    "date",
+    "expect",
+    "host",
+    "keep-alive",
+    "location",
+    "proxy-connection",
+    "server",
+    "set-cookie",
+    "te",
+    "transfer-encoding",
+    "upgrade",
+    "user-agent",
+    "x-forwarded-for",
+    "x-request-id",
+    "grpc-accept-encoding",
+    "grpc-encoding",
+    "grpc-message",
+    "grpc-status",
+    "grpc-timeout",
+    "log-id",
+    "x-bd-error-code",
+    "x-bd-parent-span-id",
+    "x-bd-span-id",
+    "x-bd-trace-id",
+};
+BAIDU_CASSERT(ARRAY_SIZE(s_header_names) == HTTP_HEADER_UNKNOWN,
+              s_header_names_must_match_HttpHeaderId);
+
+// Ids of well-known names grouped by length and the lowercased last
+// character, so that a name is compared with one or two candidates at most.
+class HttpHeaderIdTable {
+public:
+    static const size_t MAX_NAME_LENGTH = 23;
+    static const size_t MAX_CANDIDATES = 3;
+
+    HttpHeaderIdTable() {
+        memset(_slots, 0xFF, sizeof(_slots));
+        for (size_t i = 0; i < ARRAY_SIZE(s_header_names); ++i) {
+            const char* name = s_header_names[i];
+            const size_t len = strlen(name);
+            CHECK_LE(len, (size_t)MAX_NAME_LENGTH) << "name=" << name;
+            uint8_t* slot = _slots[len][Hash(name[len - 1])];
+            size_t j = 0;
+            while (j < MAX_CANDIDATES && slot[j] != 0xFF) {
+                ++j;
+            }
+            CHECK_LT(j, (size_t)MAX_CANDIDATES) << "Too many collisions of " << name;
+            slot[j] = i;
+        }
+    }
+
+    HttpHeaderId Find(const char* name, size_t length) const {
+        if (length == 0 || length > MAX_NAME_LENGTH) {
+            return HTTP_HEADER_UNKNOWN;
+        }
+        const uint8_t* slot = _slots[length][Hash(name[length - 1])];
+        for (size_t j = 0; j < MAX_CANDIDATES && slot[j] != 0xFF; ++j) {
+            const char* candidate = s_header_names[slot[j]];
+            size_t i = 0;
+            for (; i < length &&
+                     butil::ascii_tolower(name[i]) == candidate[i]; ++i) {}
+            if (i == length) {
+                return (HttpHeaderId)slot[j];
+            }
+        }
+        return HTTP_HEADER_UNKNOWN;
+    }
+
+private:
+    static size_t Hash(char last) {
+        return (uint8_t)butil::ascii_tolower(last) & 0xF;
+    }
+
+    uint8_t _slots[MAX_NAME_LENGTH + 1][16][MAX_CANDIDATES];
+};
+
+static const HttpHeaderIdTable& GetHttpHeaderIdTable() {
+    static const HttpHeaderIdTable table;
+    return table;
+}
+
+const char* HttpHeaderName(HttpHeaderId id) {
+    if ((unsigned)id >= (unsigned)HTTP_HEADER_UNKNOWN) {
+        return NULL;
+    }
+    return s_header_names[id];
+}
+
+HttpHeaderId FindHttpHeaderId(const char* name, size_t length) {
+    return GetHttpHeaderIdTable().Find(name, length);
+}
+
 HttpHeader::HttpHeader() 
     : _status_code(HTTP_STATUS_OK)
     , _method(HTTP_METHOD_GET)
-    , _version(1, 1)
-    , _first_set_cookie(NULL) {
+    , _version(1, 1) {
     // NOTE: don't forget to clear the field in Clear() as well.
+    memset(_first_of, 0, sizeof(_first_of));
 }
 
 void HttpHeader::Swap(HttpHeader &rhs) {
     _headers.swap(rhs._headers);
+    for (size_t i = 0; i < ARRAY_SIZE(_first_of); ++i) {
+        std::swap(_first_of[i], rhs._first_of[i]);
+    }
+    _unknown_first_of.swap(rhs._unknown_first_of);
     _uri.Swap(rhs._uri);
     std::swap(_status_code, rhs._status_code);
     std::swap(_method, rhs._method);
@@ -45,7 +160,10 @@ void HttpHeader::Swap(HttpHeader &rhs) {
 }
 
 void HttpHeader::Clear() {
+    // Keep the capacity for reusing.
     _headers.clear();
+    memset(_first_of, 0, sizeof(_first_of));
+    _unknown_first_of.clear();
     _uri.Clear();
     _status_code = HTTP_STATUS_OK;
     _method = HTTP_METHOD_GET;
@@ -54,16 +172,40 @@ void HttpHeader::Clear() {
     _version = std::make_pair(1, 1);
 }
 
+int HttpHeader::FindHeader(const char* key, size_t length,
+                           HttpHeaderId id) const {
+    if (id != HTTP_HEADER_UNKNOWN) {
+        return (int)_first_of[id] - 1;
+    }
+    if (_unknown_first_of.initialized()) {
+        const uint32_t* pos = _unknown_first_of.seek(key);
+        return pos != NULL ? (int)*pos - 1 : -1;
+    }
+    for (size_t i = 0; i < _headers.size(); ++i) {
+        const std::string& name = _headers[i].first;
+        if (name.size() == length && strcasecmp(name.c_str(), key) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 const std::string* HttpHeader::GetHeader(const char* key) const {
-    return GetHeader(std::string(key));
+    const size_t length = strlen(key);
+    const int index = FindHeader(key, length, FindHttpHeaderId(key, length));
+    return index >= 0 ? &_headers[index].second : NULL;
 }
 
 const std::string* HttpHeader::GetHeader(const std::string& key) const {
-    if (IsSetCookie(key)) {
-        return _first_set_cookie;
+    const int index = FindHeader(key.c_str(), key.size(), FindHttpHeaderId(key));
+    return index >= 0 ? &_headers[index].second : NULL;
+}
+
+const std::string* HttpHeader::GetHeader(HttpHeaderId id) const {
+    if ((unsigned)id >= (unsigned)HTTP_HEADER_UNKNOWN || _first_of[id] == 0) {
+        return NULL;
     }
-    std::string* val = _headers.seek(key);
-    return val;
+    return &_headers[_first_of[id] - 1].second;
 }
 
 std::vector<const std::string*> HttpHeader::GetAllSetCookieHeader() const {
@@ -89,12 +231,67 @@ void HttpHeader::SetHeader(const std::string& key,
 void HttpHeader::RemoveHeader(const char* key) {
     if (IsContentType(key)) {
         _content_type.clear();
-    } else {
-        _headers.erase(key);
-        if (IsSetCookie(key)) {
-            _first_set_cookie = NULL;
+        return;
+    }
+    const size_t old_size = _headers.size();
+    size_t n = 0;
+    for (size_t i = 0; i < old_size; ++i) {
+        if (!_header_key_equal(_headers[i].first, key)) {
+            if (n != i) {
+                _headers[n].swap(_headers[i]);
+            }
+            ++n;
+        }
+    }
+    if (n != old_size) {
+        _headers.resize(n);
+        ReindexHeaders();
+    }
+}
+
+void HttpHeader::IndexLastHeader(HttpHeaderId id) {
+    const uint32_t pos = _headers.size();
+    if (id != HTTP_HEADER_UNKNOWN) {
+        if (_first_of[id] == 0) {
+            _first_of[id] = pos;
+        }
+    } else if (_unknown_first_of.initialized()) {
+        const std::string& name = _headers.back().first;
+        if (_unknown_first_of.seek(name) == NULL) {
+            _unknown_first_of[name] = pos;
+        }
+    } else if (pos > MAX_SCANNED_HEADERS) {
+        IndexUnknownHeaders();
+    }
+}
+
+void HttpHeader::IndexUnknownHeaders() {
+    if (!_unknown_first_of.initialized() &&
+        _unknown_first_of.init(MAX_SCANNED_HEADERS * 4) != 0) {
+        // Find headers by scanning.
+        return;
+    }
+    _unknown_first_of.clear();
+    for (size_t i = 0; i < _headers.size(); ++i) {
+        const std::string& name = _headers[i].first;
+        if (FindHttpHeaderId(name) == HTTP_HEADER_UNKNOWN &&
+            _unknown_first_of.seek(name) == NULL) {
+            _unknown_first_of[name] = i + 1;
+        }
+    }
+}
+
+void HttpHeader::ReindexHeaders() {
+    memset(_first_of, 0, sizeof(_first_of));
+    for (size_t i = 0; i < _headers.size(); ++i) {
+        const HttpHeaderId id = FindHttpHeaderId(_headers[i].first);
+        if (id != HTTP_HEADER_UNKNOWN && _first_of[id] == 0) {
+            _first_of[id] = i + 1;
         }
     }
+    if (_unknown_first_of.initialized()) {
+        IndexUnknownHeaders();
+    }
 }
 
 void HttpHeader::AppendHeader(const std::string& key,
@@ -115,6 +312,22 @@ void HttpHeader::AppendHeader(const std::string& key,
     }
 }
 
+void HttpHeader::AppendParsedHeader(std::string* key, std::string* value) {
+    const HttpHeaderId id = FindHttpHeaderId(*key);
+    if (id == HTTP_HEADER_CONTENT_TYPE ||
+        (id != HTTP_HEADER_SET_COOKIE &&
+         FindHeader(key->c_str(), key->size(), id) >= 0)) {
+        return AppendHeader(*key, *value);
+    }
+    if (_headers.capacity() == 0) {
+        _headers.reserve(INITIAL_HEADER_CAPACITY);
+    }
+    _headers.push_back(HeaderField());
+    _headers.back().first.swap(*key);
+    _headers.back().second.swap(*value);
+    IndexLastHeader(id);
+}
+
 const char* HttpHeader::reason_phrase() const {
     return HttpReasonPhrase(_status_code);
 }
@@ -124,32 +337,29 @@ void HttpHeader::set_status_code(int status_code) {
 }
 
 std::string& HttpHeader::GetOrAddHeader(const std::string& key) {
-    if (IsContentType(key)) {
+    const HttpHeaderId id = FindHttpHeaderId(key);
+    if (id == HTTP_HEADER_CONTENT_TYPE) {
         return _content_type;
     }
-
-    bool is_set_cookie = IsSetCookie(key);
     // Only returns the first Set-Cookie header field for compatibility.
-    if (is_set_cookie && NULL != _first_set_cookie) {
-        return *_first_set_cookie;
+    const int index = FindHeader(key.c_str(), key.size(), id);
+    if (index >= 0) {
+        return _headers[index].second;
     }
-
-    std::string* val = _headers.seek(key);
-    if (NULL == val) {
-        val = _headers.insert({ key, "" });
-        if (is_set_cookie) {
-            _first_set_cookie = val;
-        }
-    }
-    return *val;
+    return PushHeader(key, id);
 }
 
 std::string& HttpHeader::AddHeader(const std::string& key) {
-    std::string* val = _headers.insert({ key, "" });
-    if (IsSetCookie(key) && NULL == _first_set_cookie) {
-        _first_set_cookie = val;
+    return PushHeader(key, FindHttpHeaderId(key));
+}
+
+std::string& HttpHeader::PushHeader(const std::string& key, HttpHeaderId id) {
+    if (_headers.capacity() == 0) {
+        _headers.reserve(INITIAL_HEADER_CAPACITY);
     }
-    return *val;
+    _headers.push_back(HeaderField(key, std::string()));
+    IndexLastHeader(id);
+    return _headers.back().second;
 }
 
 const HttpHeader& DefaultHttpHeader() {
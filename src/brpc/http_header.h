@@ -19,9 +19,10 @@
 #ifndef  BRPC_HTTP_HEADER_H
 #define  BRPC_HTTP_HEADER_H
 
+#include <string>
 #include <vector>
 #include "butil/strings/string_piece.h"  // StringPiece
-#include "butil/containers/case_ignored_flat_map.h"
+#include "butil/containers/case_ignored_flat_map.h"  // CaseIgnoredEqual
 #include "brpc/uri.h"              // URI
 #include "brpc/http_method.h"      // HttpMethod
 #include "brpc/http_status_code.h"
@@ -37,12 +38,77 @@ void ProcessHttpRequest(InputMessageBase *msg);
 class H2StreamContext;
 }
 
+// Well-known header names. They're interned: finding headers by the ids
+// (or by the names, which are mapped to ids first) does not hash or compare
+// strings.
+enum HttpHeaderId {
+    // Pseudo headers of http2, which are parsed into uri(), method() or
+    // status_code() rather than stored as headers.
+    HTTP_HEADER_H2_AUTHORITY = 0,
+    HTTP_HEADER_H2_METHOD,
+    HTTP_HEADER_H2_PATH,
+    HTTP_HEADER_H2_SCHEME,
+    HTTP_HEADER_H2_STATUS,
+
+    HTTP_HEADER_ACCEPT,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_ACCEPT_LANGUAGE,
+    HTTP_HEADER_AUTHORIZATION,
+    HTTP_HEADER_CACHE_CONTROL,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_CONTENT_ENCODING,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_CONTENT_TYPE,
+    HTTP_HEADER_COOKIE,
+    HTTP_HEADER_DATE,
+    HTTP_HEADER_EXPECT,
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_KEEP_ALIVE,
+    HTTP_HEADER_LOCATION,
+    HTTP_HEADER_PROXY_CONNECTION,
+    HTTP_HEADER_SERVER,
+    HTTP_HEADER_SET_COOKIE,
+    HTTP_HEADER_TE,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_UPGRADE,
+    HTTP_HEADER_USER_AGENT,
+    HTTP_HEADER_X_FORWARDED_FOR,
+    HTTP_HEADER_X_REQUEST_ID,
+
+    HTTP_HEADER_GRPC_ACCEPT_ENCODING,
+    HTTP_HEADER_GRPC_ENCODING,
+    HTTP_HEADER_GRPC_MESSAGE,
+    HTTP_HEADER_GRPC_STATUS,
+    HTTP_HEADER_GRPC_TIMEOUT,
+
+    // Headers of brpc.
+    HTTP_HEADER_LOG_ID,
+    HTTP_HEADER_X_BD_ERROR_CODE,
+    HTTP_HEADER_X_BD_PARENT_SPAN_ID,
+    HTTP_HEADER_X_BD_SPAN_ID,
+    HTTP_HEADER_X_BD_TRACE_ID,
+
+    HTTP_HEADER_UNKNOWN  // Not a well-known name, keep it last.
+};
+
+// Returns lowercased name of `id', NULL for HTTP_HEADER_UNKNOWN.
+const char* HttpHeaderName(HttpHeaderId id);
+
+// Returns id of the case-insensitive `name', HTTP_HEADER_UNKNOWN if the name
+// is not well-known.
+HttpHeaderId FindHttpHeaderId(const char* name, size_t length);
+inline HttpHeaderId FindHttpHeaderId(const std::string& name)
+{ return FindHttpHeaderId(name.data(), name.size()); }
+
 // Non-body part of a HTTP message.
 class HttpHeader {
 public:
-    typedef butil::CaseIgnoredMultiFlatMap<std::string> HeaderMap;
-    typedef HeaderMap::const_iterator HeaderIterator;
-    typedef HeaderMap::key_equal HeaderKeyEqual;
+    // Headers are stored in order of insertion in an array, which is
+    // allocated at most once for most messages.
+    typedef std::pair<std::string, std::string> HeaderField;
+    typedef std::vector<HeaderField> HeaderFields;
+    typedef HeaderFields::const_iterator HeaderIterator;
+    typedef butil::CaseIgnoredEqual HeaderKeyEqual;
 
     HttpHeader();
 
@@ -83,6 +149,8 @@ public:
     // (case-insensitive) is equal to `content_type()'.
     const std::string* GetHeader(const char* key) const;
     const std::string* GetHeader(const std::string& key) const;
+    // Same as above but faster, e.g. GetHeader(HTTP_HEADER_USER_AGENT).
+    const std::string* GetHeader(HttpHeaderId id) const;
 
     std::vector<const std::string*> GetAllSetCookieHeader() const;
 
@@ -117,6 +185,7 @@ public:
     void AppendHeader(const std::string& key, const butil::StringPiece& value);
     
     // Get header iterators which are invalidated after calling AppendHeader()
+    // Headers are iterated in the order that they're added.
     HeaderIterator HeaderBegin() const { return _headers.begin(); }
     HeaderIterator HeaderEnd() const { return _headers.end(); }
     // #headers
@@ -165,12 +234,37 @@ friend void policy::ProcessHttpRequest(InputMessageBase *msg);
     static const char* COOKIE;
     static const char* CONTENT_TYPE;
 
+    // Reserved #headers when the first header is added.
+    static const size_t INITIAL_HEADER_CAPACITY = 16;
+    // Names that are not well-known are found by scanning all headers until
+    // there're more headers than this, after which they're indexed.
+    static const size_t MAX_SCANNED_HEADERS = 16;
+
     std::vector<const std::string*> GetMultiLineHeaders(const std::string& key) const;
 
+    // Index of the first header of `key', -1 if absent.
+    int FindHeader(const char* key, size_t length, HttpHeaderId id) const;
+
     std::string& GetOrAddHeader(const std::string& key);
 
     std::string& AddHeader(const std::string& key);
 
+    // Add a header field with name of `key' after the others.
+    std::string& PushHeader(const std::string& key, HttpHeaderId id);
+
+    // Same as AppendHeader() but the name and value are swapped out when
+    // the header is absent, used by parsers to save copies.
+    void AppendParsedHeader(std::string* key, std::string* value);
+
+    // Index the last header in _headers.
+    void IndexLastHeader(HttpHeaderId id);
+
+    // Rebuild _unknown_first_of from all headers.
+    void IndexUnknownHeaders();
+
+    // Rebuild _first_of after headers are removed.
+    void ReindexHeaders();
+
     bool IsSetCookie(const std::string& key) const {
         return _header_key_equal(key, SET_COOKIE);
     }
@@ -195,14 +289,18 @@ friend void policy::ProcessHttpRequest(InputMessageBase *msg);
     }
 
     HeaderKeyEqual _header_key_equal;
-    HeaderMap _headers;
+    HeaderFields _headers;
+    // 1 + index of the first header of each well-known name, 0 if absent.
+    uint32_t _first_of[HTTP_HEADER_UNKNOWN];
+    // Same as _first_of but for names that are not well-known, initialized
+    // only when there're more than MAX_SCANNED_HEADERS headers.
+    butil::CaseIgnoredFlatMap<uint32_t> _unknown_first_of;
     URI _uri;
     int _status_code;
     HttpMethod _method;
     std::string _content_type;
     std::string _unresolved_path;
     std::pair<int, int> _version;
-    std::string* _first_set_cookie;
 };
 
 const HttpHeader& DefaultHttpHeader();
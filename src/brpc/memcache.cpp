@@ -16,7 +16,10 @@
 // under the License.
 
 #include "brpc/memcache.h"
+#include <map>
 
+#include "brpc/channel.h"
+#include "brpc/details/channel_private_accessor.h"
 #include "brpc/policy/memcache_binary_header.h"
 #include "brpc/proto_base.pb.h"
 #include "butil/logging.h"
@@ -86,6 +89,11 @@ bool MemcacheRequest::MergePartialFromCodedStream(
         if (tmp.size() < sizeof(*header) + total_body_length) {
             return false;
         }
+        if (header->command == (uint8_t)policy::MC_BINARY_GETQ ||
+            header->command == (uint8_t)policy::MC_BINARY_GETKQ) {
+            // Not replied on misses, see MultiGet().
+            --count;
+        }
         tmp.pop_front(sizeof(*header) + total_body_length);
     }
     _buf.append(saved);
@@ -418,6 +426,86 @@ bool MemcacheResponse::PopGet(
     return false;
 }
 
+bool MemcacheRequest::MultiGet(const std::vector<butil::StringPiece>& keys) {
+    const int saved_count = _pipelined_count;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (!GetOrDelete(policy::MC_BINARY_GETKQ, keys[i])) {
+            _pipelined_count = saved_count;
+            return false;
+        }
+    }
+    // Quiet GETs are replied only when the keys are found, only the NOOP
+    // which ends them is counted.
+    _pipelined_count = saved_count;
+    const policy::MemcacheRequestHeader header = {
+        policy::MC_MAGIC_REQUEST,
+        policy::MC_BINARY_NOOP,
+        0,
+        0,
+        policy::MC_BINARY_RAW_BYTES,
+        0,
+        0,
+        0,
+        0
+    };
+    if (_buf.append(&header, sizeof(header))) {
+        return false;
+    }
+    ++_pipelined_count;
+    return true;
+}
+
+// Replies of quiet GETs which are hits, ended by the reply of NOOP.
+// GETKQ replies MUST have flags as extras and MUST have key.
+bool MemcacheResponse::PopMultiGet(std::vector<Hit>* hits) {
+    while (true) {
+        const size_t n = _buf.size();
+        policy::MemcacheResponseHeader header;
+        if (n < sizeof(header)) {
+            butil::string_printf(&_err, "buffer is too small to contain a header");
+            return false;
+        }
+        _buf.copy_to(&header, sizeof(header));
+        if (n < sizeof(header) + header.total_body_length) {
+            butil::string_printf(&_err, "response=%u < header=%u + body=%u",
+                      (unsigned)n, (unsigned)sizeof(header), header.total_body_length);
+            return false;
+        }
+        if (header.command == (uint8_t)policy::MC_BINARY_NOOP) {
+            _buf.pop_front(sizeof(header) + header.total_body_length);
+            _err.clear();
+            return true;
+        }
+        if (header.command != (uint8_t)policy::MC_BINARY_GETKQ) {
+            butil::string_printf(&_err, "not a MultiGet response");
+            return false;
+        }
+        const int value_size = (int)header.total_body_length - (int)header.extras_length
+            - (int)header.key_length;
+        if (value_size < 0) {
+            butil::string_printf(&_err, "value_size=%d is negative", value_size);
+            return false;
+        }
+        if (header.status != (uint16_t)STATUS_SUCCESS || header.extras_length != 4u) {
+            _buf.pop_front(sizeof(header) + header.total_body_length);
+            continue;
+        }
+        _buf.pop_front(sizeof(header));
+        uint32_t raw_flags = 0;
+        _buf.cutn(&raw_flags, sizeof(raw_flags));
+        if (hits) {
+            hits->push_back(Hit());
+            Hit& hit = hits->back();
+            _buf.cutn(&hit.key, header.key_length);
+            _buf.cutn(&hit.value, value_size);
+            hit.flags = butil::NetToHost32(raw_flags);
+            hit.cas_value = header.cas_value;
+        } else {
+            _buf.pop_front(header.key_length + value_size);
+        }
+    }
+}
+
 // MUST NOT have extras
 // MUST NOT have key
 // MUST NOT have value
@@ -803,4 +891,79 @@ bool MemcacheResponse::PopVersion(std::string* version) {
     return true;
 }
  
+namespace {
+struct MultiGetCall {
+    MemcacheRequest request;
+    MemcacheResponse response;
+    Controller cntl;
+    std::vector<butil::StringPiece> keys;
+    uint64_t request_code;
+};
+}  // namespace
+
+int MemcacheMultiGet(Channel* channel, Controller* cntl,
+                     const std::vector<butil::StringPiece>& keys,
+                     std::vector<MemcacheResponse::Hit>* hits,
+                     policy::HashFunc key_hash) {
+    // Group keys by servers selected by the load balancer, the calls of a
+    // group carry request_code of its first key so that they are sent to
+    // the same server as long as the server is not changed meanwhile.
+    ChannelPrivateAccessor accessor(channel);
+    std::map<SocketId, MultiGetCall*> calls;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const uint64_t code = key_hash(keys[i].data(), keys[i].size());
+        SocketId id = INVALID_SOCKET_ID;
+        const int rc = accessor.SelectServer(code, &id);
+        if (rc != 0) {
+            for (auto it = calls.begin(); it != calls.end(); ++it) {
+                delete it->second;
+            }
+            cntl->SetFailed(rc, "Fail to select server for key=%.*s",
+                            (int)keys[i].size(), keys[i].data());
+            return -1;
+        }
+        MultiGetCall*& call = calls[id];
+        if (call == NULL) {
+            call = new MultiGetCall;
+            call->request_code = code;
+        }
+        call->keys.push_back(keys[i]);
+    }
+    for (auto it = calls.begin(); it != calls.end(); ++it) {
+        MultiGetCall* call = it->second;
+        call->request.MultiGet(call->keys);
+        call->cntl.set_request_code(call->request_code);
+        call->cntl.set_log_id(cntl->log_id());
+        if (cntl->timeout_ms() != UNSET_MAGIC_NUM) {
+            call->cntl.set_timeout_ms(cntl->timeout_ms());
+        }
+        if (cntl->max_retry() != UNSET_MAGIC_NUM) {
+            call->cntl.set_max_retry(cntl->max_retry());
+        }
+        channel->CallMethod(NULL, &call->cntl, &call->request, &call->response,
+                            calls.size() == 1 ? NULL : DoNothing());
+    }
+    int rc = 0;
+    for (auto it = calls.begin(); it != calls.end(); ++it) {
+        MultiGetCall* call = it->second;
+        if (calls.size() != 1) {
+            Join(call->cntl.call_id());
+        }
+        if (call->cntl.Failed()) {
+            if (rc == 0) {
+                cntl->SetFailed(call->cntl.ErrorCode(), "%s",
+                                call->cntl.ErrorText().c_str());
+            }
+            rc = -1;
+        } else if (!call->response.PopMultiGet(hits)) {
+            if (rc == 0) {
+                cntl->SetFailed(ERESPONSE, "%s", call->response.LastError().c_str());
+            }
+            rc = -1;
+        }
+        delete call;
+    }
+    return rc;
+}
+
 } // namespace brpc
@@ -20,14 +20,19 @@
 #define BRPC_MEMCACHE_H
 
 #include <string>
+#include <vector>
 
 #include "butil/iobuf.h"
 #include "butil/strings/string_piece.h"
 #include "brpc/nonreflectable_message.h"
 #include "brpc/pb_compat.h"
+#include "brpc/policy/hasher.h"
 
 namespace brpc {
 
+class Channel;
+class Controller;
+
 // Request to memcache.
 // Notice that you can pipeline multiple operations in one request and sent
 // them to memcached server together.
@@ -53,6 +58,11 @@ public:
 
     bool Get(const butil::StringPiece& key);
 
+    // Get values of `keys' with quiet GETs (GETKQ) followed by a NOOP. The
+    // server only replies hits, misses cost no bytes on the wire.
+    // Pop results with MemcacheResponse::PopMultiGet().
+    bool MultiGet(const std::vector<butil::StringPiece>& keys);
+
     // If the cas_value(Data Version Check) is non-zero, the requested operation
     // MUST only succeed if the item exists and has a cas_value identical to the
     // provided value.
@@ -175,6 +185,18 @@ public:
    
     bool PopGet(butil::IOBuf* value, uint32_t* flags, uint64_t* cas_value);
     bool PopGet(std::string* value, uint32_t* flags, uint64_t* cas_value);
+
+    // A hit of MultiGet().
+    struct Hit {
+        std::string key;
+        // References memory of the response, no copying.
+        butil::IOBuf value;
+        uint32_t flags;
+        uint64_t cas_value;
+    };
+    // Append hits of a MultiGet() to `hits' in the order of keys. Keys that
+    // the server failed to get are treated as misses.
+    bool PopMultiGet(std::vector<Hit>* hits);
     bool PopSet(uint64_t* cas_value);
     bool PopAdd(uint64_t* cas_value);
     bool PopReplace(uint64_t* cas_value);
@@ -218,6 +240,21 @@ private:
     mutable int _cached_size_;
 };
 
+// Get values of `keys' from a memcached cluster behind `channel', which
+// should be load-balanced by consistent hashing(c_murmurhash, c_md5 or
+// c_ketama). Keys are grouped by the servers that calls with
+// request_code=key_hash(key) are sent to, each group is sent to its server
+// as one MultiGet() and groups are sent in parallel. `cntl' is only used for
+// options(timeout_ms, max_retry, log_id) of the calls and for the error.
+// Hits are appended to `hits' group by group, misses are absent.
+// Returns 0 on success, -1 otherwise, in which case `cntl' is failed with
+// the error of a failed call while hits from other calls are still appended.
+// Synchronous only.
+int MemcacheMultiGet(Channel* channel, Controller* cntl,
+                     const std::vector<butil::StringPiece>& keys,
+                     std::vector<MemcacheResponse::Hit>* hits,
+                     policy::HashFunc key_hash = policy::MurmurHash32);
+
 } // namespace brpc
 
 #endif  // BRPC_MEMCACHE_H
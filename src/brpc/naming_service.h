@@ -39,6 +39,24 @@ public:
     virtual void AddServers(const std::vector<ServerNode>& servers) = 0;
     virtual void RemoveServers(const std::vector<ServerNode>& servers) = 0;
     virtual void ResetServers(const std::vector<ServerNode>& servers) = 0;
+
+    // Apply incremental changes to the server list. Naming services which
+    // know exactly what changed (by watching a file, a version/index from
+    // the registry etc) should prefer this method to ResetServers() which
+    // diffs the full list on every call.
+    // `version' should increase monotonically across calls, changes with a
+    // version not greater than the last applied one are ignored. Pass 0 to
+    // skip the check.
+    virtual void UpdateServers(const std::vector<ServerNode>& added,
+                               const std::vector<ServerNode>& removed,
+                               uint64_t version) {
+        if (!removed.empty()) {
+            RemoveServers(removed);
+        }
+        if (!added.empty()) {
+            AddServers(added);
+        }
+    }
 };
 
 // Mapping a name to ServerNodes.
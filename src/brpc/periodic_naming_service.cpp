@@ -33,22 +33,48 @@ int PeriodicNamingService::GetNamingServiceAccessIntervalMs() const {
     return std::max(FLAGS_ns_access_interval, 1) * 1000;
 }
 
+int PeriodicNamingService::GetServerChanges(const char*,
+                                            std::vector<ServerNode>*,
+                                            std::vector<ServerNode>*) {
+    return ENOTSUP;
+}
+
 int PeriodicNamingService::RunNamingService(
     const char* service_name, NamingServiceActions* actions) {
     std::vector<ServerNode> servers;
+    std::vector<ServerNode> added;
+    std::vector<ServerNode> removed;
     bool ever_reset = false;
+    bool ever_succeeded = false;
+    bool support_changes = true;
+    uint64_t version = 0;
     while (true) {
-        servers.clear();
-        const int rc = GetServers(service_name, &servers);
-        if (rc == 0) {
-            ever_reset = true;
-            actions->ResetServers(servers);
-        } else if (!ever_reset) {
-            // ResetServers must be called at first time even if GetServers
-            // failed, to wake up callers to `WaitForFirstBatchOfServers'
-            ever_reset = true;
+        int rc = ENOTSUP;
+        if (ever_succeeded && support_changes) {
+            added.clear();
+            removed.clear();
+            rc = GetServerChanges(service_name, &added, &removed);
+            if (rc == 0 && (!added.empty() || !removed.empty())) {
+                actions->UpdateServers(added, removed, ++version);
+            } else if (rc == ENOTSUP) {
+                support_changes = false;
+            }
+        }
+        if (rc == ENOTSUP) {
             servers.clear();
-            actions->ResetServers(servers);
+            rc = GetServers(service_name, &servers);
+            if (rc == 0) {
+                ever_reset = true;
+                ever_succeeded = true;
+                ++version;
+                actions->ResetServers(servers);
+            } else if (!ever_reset) {
+                // ResetServers must be called at first time even if GetServers
+                // failed, to wake up callers to `WaitForFirstBatchOfServers'
+                ever_reset = true;
+                servers.clear();
+                actions->ResetServers(servers);
+            }
         }
 
         // If `bthread_stop' is called to stop the ns bthread when `brpc::Join‘ is called
@@ -28,6 +28,17 @@ class PeriodicNamingService : public NamingService {
 protected:
     virtual int GetServers(const char *service_name,
                            std::vector<ServerNode>* servers) = 0;
+
+    // Optionally implement this method to fetch only the changes since the
+    // last successful GetServers()/GetServerChanges(), e.g. with a version
+    // or an ETag known by the remote side. It's called instead of
+    // GetServers() once the first batch of servers is fetched. Leave both
+    // `added' and `removed' empty if nothing changed.
+    // Returns 0 on success, ENOTSUP to fall back to GetServers() (default),
+    // other error code otherwise.
+    virtual int GetServerChanges(const char* service_name,
+                                 std::vector<ServerNode>* added,
+                                 std::vector<ServerNode>* removed);
     
     virtual int GetNamingServiceAccessIntervalMs() const;
 
@@ -0,0 +1,389 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <gflags/gflags.h>
+#include "butil/containers/doubly_buffered_data.h"
+#include "butil/containers/flat_map.h"
+#include "butil/string_splitter.h"
+#include "butil/synchronization/lock.h"
+#include "butil/time.h"
+#include "bvar/bvar.h"
+#include "brpc/compress.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/policy/adaptive_compression.h"
+
+namespace brpc {
+namespace policy {
+
+DEFINE_bool(enable_adaptive_compression, false, "Compress messages of "
+            "baidu_std whose compress_type is not set with the type chosen "
+            "by observed compression ratio and cost of each method");
+BRPC_VALIDATE_GFLAG(enable_adaptive_compression, PassValidate);
+DEFINE_string(adaptive_compression_types, "snappy,lz4,zstd",
+              "Comma-separated compression types that adaptive compression "
+              "chooses from besides none, types not registered are ignored. "
+              "Peers must be able to decompress all of them");
+DEFINE_int32(adaptive_compression_min_size, 512, "Messages smaller than "
+             "so many bytes are never compressed by adaptive compression");
+BRPC_VALIDATE_GFLAG(adaptive_compression_min_size, NonNegativeInteger);
+DEFINE_int32(adaptive_compression_sample_interval, 32, "One out of so many "
+             "compressions in each method and size band is measured");
+BRPC_VALIDATE_GFLAG(adaptive_compression_sample_interval, PositiveInteger);
+DEFINE_int32(adaptive_compression_network_ns_per_kb, 8000, "Estimated cost "
+             "of sending 1KB, in nanoseconds. The default value is for 1Gbps "
+             "networks, lower values make compression less attractive");
+BRPC_VALIDATE_GFLAG(adaptive_compression_network_ns_per_kb, NonNegativeInteger);
+
+// Candidate 0 is always COMPRESS_TYPE_NONE.
+static const int MAX_CANDIDATES = 8;
+// Candidates with fewer samples are tried first.
+static const int64_t MIN_SAMPLES = 3;
+// One out of so many sampled calls tries a candidate other than the chosen
+// one, in round-robin.
+static const uint64_t EXPLORE_INTERVAL = 4;
+// Weight of a new sample in the moving averages.
+static const double SAMPLE_WEIGHT = 0.2;
+
+// Upper bounds of sizes of the bands except the last one.
+static const size_t BAND_UPPER_BOUNDS[] = { 4096, 65536, 1048576 };
+static const int NUM_BANDS = ARRAY_SIZE(BAND_UPPER_BOUNDS) + 1;
+static const char* const BAND_NAMES[NUM_BANDS] = {
+    "<4K", "<64K", "<1M", ">=1M"
+};
+
+// Process-wide stats of a candidate type.
+struct CompressTypeStats {
+    CompressType type;
+    const char* name;
+    bvar::IntRecorder compress_ns_per_kb;
+    bvar::IntRecorder decompress_ns_per_kb;
+    bvar::IntRecorder ratio_permille;
+};
+
+static CompressTypeStats* g_candidates[MAX_CANDIDATES];
+static int g_ncandidates = 0;
+static pthread_once_t g_init_candidates_once = PTHREAD_ONCE_INIT;
+
+static void AddCandidate(CompressType type) {
+    CompressTypeStats* s = new CompressTypeStats;
+    s->type = type;
+    s->name = CompressTypeToCStr(type);
+    if (type != COMPRESS_TYPE_NONE) {
+        const std::string prefix =
+            std::string("rpc_adaptive_compression_") + s->name;
+        s->compress_ns_per_kb.expose_as(prefix, "compress_ns_per_kb");
+        s->decompress_ns_per_kb.expose_as(prefix, "decompress_ns_per_kb");
+        s->ratio_permille.expose_as(prefix, "ratio_permille");
+    }
+    g_candidates[g_ncandidates++] = s;
+}
+
+static void InitCandidates() {
+    AddCandidate(COMPRESS_TYPE_NONE);
+    for (butil::StringSplitter sp(FLAGS_adaptive_compression_types.c_str(), ',');
+         sp; ++sp) {
+        const std::string name(sp.field(), sp.length());
+        bool found = false;
+        for (int i = COMPRESS_TYPE_NONE + 1; CompressType_IsValid(i); ++i) {
+            const CompressType type = (CompressType)i;
+            if (FindCompressHandler(type) != NULL &&
+                name == CompressTypeToCStr(type)) {
+                found = true;
+                if (g_ncandidates < MAX_CANDIDATES) {
+                    AddCandidate(type);
+                }
+                break;
+            }
+        }
+        LOG_IF(WARNING, !found) << "Ignore unregistered compression `"
+                                << name << "' in -adaptive_compression_types";
+    }
+}
+
+static int FindCandidate(CompressType type) {
+    for (int i = 0; i < g_ncandidates; ++i) {
+        if (g_candidates[i]->type == type) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Decompression is measured on the receiving side, which is this process
+// only for messages sent by peers. 0 if never measured.
+static double DecompressNsPerByte(int candidate) {
+    if (candidate == 0) {
+        return 0;
+    }
+    return g_candidates[candidate]->decompress_ns_per_kb.average() / 1024.0;
+}
+
+struct CandidateStats {
+    int64_t nsample;
+    // Moving averages of compressed_size/raw_size and the time of
+    // serialization and compression per raw byte.
+    double ratio;
+    double cost_ns_per_byte;
+};
+
+struct BandStats {
+    BandStats() : choice(0), ncall(0), nsampled(0) {
+        memset(candidates, 0, sizeof(candidates));
+    }
+
+    butil::atomic<int> choice;
+    butil::atomic<uint64_t> ncall;
+    butil::Mutex mutex;
+    // Fields below are protected by `mutex'.
+    uint64_t nsampled;
+    CandidateStats candidates[MAX_CANDIDATES];
+};
+
+class MethodCompressionStats {
+public:
+    explicit MethodCompressionStats(const std::string& method_name)
+        : _status(method_name, "adaptive_compression", Print, this) {}
+
+    BandStats bands[NUM_BANDS];
+
+private:
+    static void Print(std::ostream& os, void* arg);
+
+    bvar::PassiveStatus<std::string> _status;
+};
+
+void MethodCompressionStats::Print(std::ostream& os, void* arg) {
+    MethodCompressionStats* stats = static_cast<MethodCompressionStats*>(arg);
+    bool first = true;
+    for (int i = 0; i < NUM_BANDS; ++i) {
+        BandStats& b = stats->bands[i];
+        BAIDU_SCOPED_LOCK(b.mutex);
+        if (b.nsampled == 0) {
+            continue;
+        }
+        if (!first) {
+            os << ' ';
+        }
+        first = false;
+        os << BAND_NAMES[i] << '='
+           << g_candidates[b.choice.load(butil::memory_order_relaxed)]->name
+           << '(';
+        for (int j = 0; j < g_ncandidates; ++j) {
+            const CandidateStats& c = b.candidates[j];
+            if (c.nsample == 0) {
+                continue;
+            }
+            os << (j ? " " : "") << g_candidates[j]->name
+               << ":ratio=" << c.ratio
+               << ",ns_per_kb=" << (int64_t)(c.cost_ns_per_byte * 1024);
+        }
+        os << ')';
+    }
+}
+
+typedef butil::FlatMap<const google::protobuf::MethodDescriptor*,
+                       MethodCompressionStats*> MethodStatsMap;
+static butil::DoublyBufferedData<MethodStatsMap>* g_method_stats = NULL;
+static butil::Mutex* g_method_stats_mutex = NULL;
+static pthread_once_t g_init_method_stats_once = PTHREAD_ONCE_INIT;
+
+static void InitMethodStats() {
+    g_method_stats = new butil::DoublyBufferedData<MethodStatsMap>;
+    g_method_stats_mutex = new butil::Mutex;
+}
+
+static size_t AddMethodStats(MethodStatsMap& m,
+                             const google::protobuf::MethodDescriptor* method,
+                             MethodCompressionStats* stats) {
+    if (!m.initialized() && m.init(64) != 0) {
+        return 0;
+    }
+    m[method] = stats;
+    return 1;
+}
+
+static MethodCompressionStats* FindMethodStats(
+    const google::protobuf::MethodDescriptor* method) {
+    butil::DoublyBufferedData<MethodStatsMap>::ScopedPtr ptr;
+    if (g_method_stats->Read(&ptr) != 0 || !ptr->initialized()) {
+        return NULL;
+    }
+    MethodCompressionStats** stats = ptr->seek(method);
+    return stats ? *stats : NULL;
+}
+
+// Stats of a method are created at its first call and never destroyed
+// since methods are not unregistered.
+static MethodCompressionStats* GetMethodStats(
+    const google::protobuf::MethodDescriptor* method) {
+    MethodCompressionStats* stats = FindMethodStats(method);
+    if (stats != NULL) {
+        return stats;
+    }
+    BAIDU_SCOPED_LOCK(*g_method_stats_mutex);
+    stats = FindMethodStats(method);
+    if (stats == NULL) {
+        stats = new MethodCompressionStats(method->full_name());
+        if (g_method_stats->Modify(AddMethodStats, method, stats) == 0) {
+            LOG(ERROR) << "Fail to add adaptive compression stats of "
+                       << method->full_name();
+            delete stats;
+            return NULL;
+        }
+    }
+    return stats;
+}
+
+static int BandOf(size_t size) {
+    for (size_t i = 0; i < ARRAY_SIZE(BAND_UPPER_BOUNDS); ++i) {
+        if (size < BAND_UPPER_BOUNDS[i]) {
+            return i;
+        }
+    }
+    return NUM_BANDS - 1;
+}
+
+// Candidate with the lowest estimated cost per byte. Called with b.mutex held.
+static int ChooseBest(const BandStats& b) {
+    const double net_ns_per_byte =
+        FLAGS_adaptive_compression_network_ns_per_kb / 1024.0;
+    int best = 0;
+    double best_cost = -1;
+    for (int i = 0; i < g_ncandidates; ++i) {
+        const CandidateStats& c = b.candidates[i];
+        if (c.nsample == 0) {
+            continue;
+        }
+        const double cost = c.cost_ns_per_byte +
+            c.ratio * (DecompressNsPerByte(i) + net_ns_per_byte);
+        if (best_cost < 0 || cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+// Candidate to be measured in the `k'-th sampled call. Called with b.mutex held.
+static int ChooseSampled(const BandStats& b, uint64_t k) {
+    int least_sampled = 0;
+    for (int i = 1; i < g_ncandidates; ++i) {
+        if (b.candidates[i].nsample < b.candidates[least_sampled].nsample) {
+            least_sampled = i;
+        }
+    }
+    if (b.candidates[least_sampled].nsample < MIN_SAMPLES) {
+        return least_sampled;
+    }
+    if (k % EXPLORE_INTERVAL == 0) {
+        return (k / EXPLORE_INTERVAL) % g_ncandidates;
+    }
+    return b.choice.load(butil::memory_order_relaxed);
+}
+
+bool IsAdaptiveCompressionEnabled() {
+    return FLAGS_enable_adaptive_compression;
+}
+
+CompressType ChooseCompressType(const google::protobuf::MethodDescriptor* method,
+                                size_t raw_size, CompressionSample* sample) {
+    if (method == NULL ||
+        raw_size < (size_t)FLAGS_adaptive_compression_min_size) {
+        return COMPRESS_TYPE_NONE;
+    }
+    pthread_once(&g_init_candidates_once, InitCandidates);
+    if (g_ncandidates <= 1) {
+        return COMPRESS_TYPE_NONE;
+    }
+    pthread_once(&g_init_method_stats_once, InitMethodStats);
+    MethodCompressionStats* stats = GetMethodStats(method);
+    if (stats == NULL) {
+        return COMPRESS_TYPE_NONE;
+    }
+    const int band = BandOf(raw_size);
+    BandStats& b = stats->bands[band];
+    const uint64_t n = b.ncall.fetch_add(1, butil::memory_order_relaxed);
+    if (n % FLAGS_adaptive_compression_sample_interval != 0) {
+        return g_candidates[b.choice.load(butil::memory_order_relaxed)]->type;
+    }
+    int candidate = 0;
+    {
+        BAIDU_SCOPED_LOCK(b.mutex);
+        candidate = ChooseSampled(b, b.nsampled++);
+    }
+    sample->stats = stats;
+    sample->band = band;
+    sample->candidate = candidate;
+    sample->raw_size = raw_size;
+    sample->start_ns = butil::cpuwide_time_ns();
+    return g_candidates[candidate]->type;
+}
+
+void OnCompressed(const CompressionSample& sample, size_t compressed_size) {
+    if (sample.stats == NULL) {
+        return;
+    }
+    const int64_t cost_ns = butil::cpuwide_time_ns() - sample.start_ns;
+    const double raw_size = std::max(sample.raw_size, (size_t)1);
+    const double ratio = compressed_size / raw_size;
+    const double cost_ns_per_byte = cost_ns / raw_size;
+    BandStats& b = sample.stats->bands[sample.band];
+    {
+        BAIDU_SCOPED_LOCK(b.mutex);
+        CandidateStats& c = b.candidates[sample.candidate];
+        if (c.nsample == 0) {
+            c.ratio = ratio;
+            c.cost_ns_per_byte = cost_ns_per_byte;
+        } else {
+            c.ratio += (ratio - c.ratio) * SAMPLE_WEIGHT;
+            c.cost_ns_per_byte +=
+                (cost_ns_per_byte - c.cost_ns_per_byte) * SAMPLE_WEIGHT;
+        }
+        ++c.nsample;
+        b.choice.store(ChooseBest(b), butil::memory_order_relaxed);
+    }
+    if (sample.candidate != 0) {
+        CompressTypeStats* s = g_candidates[sample.candidate];
+        s->compress_ns_per_kb << (int64_t)(cost_ns_per_byte * 1024);
+        s->ratio_permille << (int64_t)(ratio * 1000);
+    }
+}
+
+bool ShouldMeasureDecompression() {
+    if (!FLAGS_enable_adaptive_compression) {
+        return false;
+    }
+    static __thread uint64_t tls_ndecompressed = 0;
+    return tls_ndecompressed++ % FLAGS_adaptive_compression_sample_interval == 0;
+}
+
+void OnDecompressed(CompressType type, size_t compressed_size, int64_t cost_ns) {
+    if (type == COMPRESS_TYPE_NONE) {
+        return;
+    }
+    pthread_once(&g_init_candidates_once, InitCandidates);
+    const int candidate = FindCandidate(type);
+    if (candidate <= 0) {
+        return;
+    }
+    g_candidates[candidate]->decompress_ns_per_kb
+        << cost_ns * 1024 / (int64_t)std::max(compressed_size, (size_t)1);
+}
+
+} // namespace policy
+} // namespace brpc
@@ -0,0 +1,83 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_ADAPTIVE_COMPRESSION_H
+#define BRPC_POLICY_ADAPTIVE_COMPRESSION_H
+
+#include <google/protobuf/descriptor.h>
+#include "butil/macros.h"
+#include "brpc/options.pb.h"                     // CompressType
+
+namespace brpc {
+namespace policy {
+
+class MethodCompressionStats;
+
+// Sampled compression to be reported by OnCompressed().
+struct CompressionSample {
+    CompressionSample()
+        : stats(NULL), band(0), candidate(0), raw_size(0), start_ns(0) {}
+
+    MethodCompressionStats* stats;  // NULL if not sampled
+    int band;
+    int candidate;
+    size_t raw_size;
+    int64_t start_ns;
+};
+
+// Choose compression per method and size band by observed ratio and cost.
+//
+// Calls of one method are grouped into bands by size of the serialized
+// message. A small fraction of calls in each band (1 out of
+// -adaptive_compression_sample_interval) is timed and its compression ratio
+// recorded, some of them try other candidates (-adaptive_compression_types)
+// so that changes of the payload are noticed. The candidate minimizing
+//   serialize_and_compress_cost + decompress_cost
+//     + compressed_size * -adaptive_compression_network_ns_per_byte
+// is used by other calls of the band. Methods carrying incompressible data
+// (images, videos, compressed files...) end up with COMPRESS_TYPE_NONE.
+//
+// Enabled by -enable_adaptive_compression, messages of baidu_std are
+// compressed with the chosen type if the user does not set one. All
+// candidates must be supported by peers.
+
+// Returns true if -enable_adaptive_compression is on.
+bool IsAdaptiveCompressionEnabled();
+
+// Choose compression of a message of `method' whose serialized size is
+// `raw_size'. If the compression should be sampled, `sample' is filled and
+// OnCompressed() must be called after the compression.
+CompressType ChooseCompressType(const google::protobuf::MethodDescriptor* method,
+                                size_t raw_size, CompressionSample* sample);
+
+// Report the compression of `sample' which produced `compressed_size' bytes.
+// Does nothing if the compression was not sampled.
+void OnCompressed(const CompressionSample& sample, size_t compressed_size);
+
+// Returns true if the decompression of a received message should be
+// measured and reported by OnDecompressed().
+bool ShouldMeasureDecompression();
+
+// Report that `compressed_size' bytes compressed with `type' were
+// decompressed in `cost_ns', not including parsing which is paid by
+// uncompressed messages as well.
+void OnDecompressed(CompressType type, size_t compressed_size, int64_t cost_ns);
+
+} // namespace policy
+} // namespace brpc
+
+#endif // BRPC_POLICY_ADAPTIVE_COMPRESSION_H
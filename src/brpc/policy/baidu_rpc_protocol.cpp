@@ -36,6 +36,7 @@
 #include "brpc/stream_impl.h"
 #include "brpc/rpc_dump.h"                      // SampledRequest
 #include "brpc/rpc_pb_message_factory.h"
+#include "brpc/policy/adaptive_compression.h"
 #include "brpc/policy/baidu_rpc_meta.pb.h"      // RpcRequestMeta
 #include "brpc/policy/baidu_rpc_protocol.h"
 #include "brpc/policy/most_common_message.h"
@@ -43,6 +44,7 @@
 #include "brpc/details/usercode_backup_pool.h"
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/details/server_private_accessor.h"
+#include "brpc/details/inherited_deadline.h"
 
 extern "C" {
 void bthread_assign_data(void* data);
@@ -58,6 +60,9 @@ DEFINE_bool(baidu_protocol_use_fullname, true,
 
 DEFINE_bool(baidu_std_protocol_deliver_timeout_ms, false,
             "If this flag is true, baidu_std puts timeout_ms in requests.");
+DEFINE_bool(baidu_std_protocol_deliver_deadline, false,
+            "If this flag is true, baidu_std puts deadlines (since the Epoch) "
+            "in requests, clocks of clients and servers should be synced.");
 
 DECLARE_bool(pb_enum_as_number);
 
@@ -228,6 +233,12 @@ static bool SerializeResponse(const google::protobuf::Message& res,
     ContentType content_type = cntl.response_content_type();
     CompressType compress_type = cntl.response_compress_type();
     ChecksumType checksum_type = cntl.response_checksum_type();
+    CompressionSample sample;
+    if (COMPRESS_TYPE_NONE == compress_type && IsAdaptiveCompressionEnabled()) {
+        compress_type = ChooseCompressType(cntl.method(), res.ByteSizeLong(),
+                                           &sample);
+        cntl.set_response_compress_type(compress_type);
+    }
     if (!SerializeRpcMessage(res, cntl, content_type, compress_type,
                              checksum_type, &buf)) {
         cntl.SetFailed(ERESPONSE,
@@ -239,6 +250,7 @@ static bool SerializeResponse(const google::protobuf::Message& res,
                        ChecksumTypeToCStr(checksum_type));
         return false;
     }
+    OnCompressed(sample, buf.size());
     return true;
 }
 
@@ -469,6 +481,8 @@ struct CallMethodInBackupThreadArgs {
 
 static void CallMethodInBackupThread(void* void_args) {
     CallMethodInBackupThreadArgs* args = (CallMethodInBackupThreadArgs*)void_args;
+    InheritedDeadlineScope deadline_scope(
+        static_cast<Controller*>(args->controller)->deadline_us());
     args->service->CallMethod(args->method, args->controller, args->request,
                               args->response, args->done);
     delete args;
@@ -510,7 +524,30 @@ bool DeserializeRpcMessage(const butil::IOBuf& data, Controller& cntl,
             if (NULL == handler) {
                 return false;
             }
-            ok = handler->Decompress(data, &deserializer);
+            if (!ShouldMeasureDecompression()) {
+                ok = handler->Decompress(data, &deserializer);
+            } else {
+                // Time decompression only, parsing is paid by uncompressed
+                // messages as well and must not be charged to the codec.
+                butil::IOBuf decompressed;
+                Deserializer copier([&decompressed](
+                    google::protobuf::io::ZeroCopyInputStream* input) -> bool {
+                    const void* block = NULL;
+                    int size = 0;
+                    while (input->Next(&block, &size)) {
+                        decompressed.append(block, size);
+                    }
+                    return true;
+                });
+                const int64_t start_ns = butil::cpuwide_time_ns();
+                ok = handler->Decompress(data, &copier);
+                if (ok) {
+                    OnDecompressed(compress_type, data.size(),
+                                   butil::cpuwide_time_ns() - start_ns);
+                    butil::IOBufAsZeroCopyInputStream stream(decompressed);
+                    ok = deserializer.DeserializeFrom(&stream);
+                }
+            }
         }
         return ok;
     };
@@ -611,6 +648,19 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
     }
     if (request_meta.has_timeout_ms()) {
         cntl->set_timeout_ms(request_meta.timeout_ms());
+        if (request_meta.timeout_ms() > 0) {
+            accessor.set_deadline_us(msg->base_real_us() + msg->received_us() +
+                                     request_meta.timeout_ms() * 1000L);
+        }
+    }
+    if (request_meta.has_deadline_us()) {
+        if (cntl->deadline_us() < 0 ||
+            request_meta.deadline_us() < cntl->deadline_us()) {
+            accessor.set_deadline_us(request_meta.deadline_us());
+        }
+    }
+    if (request_meta.has_priority()) {
+        cntl->set_request_priority(request_meta.priority());
     }
     cntl->set_request_content_type(meta.content_type());
     cntl->set_request_compress_type((CompressType)meta.compress_type());
@@ -835,6 +885,7 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             span->set_start_callback_us(butil::cpuwide_time_us());
             span->AsParent();
         }
+        InheritedDeadlineScope deadline_scope(cntl->deadline_us());
         if (!FLAGS_usercode_in_pthread) {
             return svc->CallMethod(method, cntl.release(), 
                                    messages->Request(),
@@ -1027,6 +1078,12 @@ void SerializeRpcRequest(butil::IOBuf* request_buf, Controller* cntl,
     ContentType content_type = cntl->request_content_type();
     CompressType compress_type = cntl->request_compress_type();
     ChecksumType checksum_type = cntl->request_checksum_type();
+    CompressionSample sample;
+    if (COMPRESS_TYPE_NONE == compress_type && IsAdaptiveCompressionEnabled()) {
+        compress_type = ChooseCompressType(cntl->method(),
+                                           request->ByteSizeLong(), &sample);
+        cntl->set_request_compress_type(compress_type);
+    }
     if (!SerializeRpcMessage(*request, *cntl, content_type, compress_type,
                              checksum_type, request_buf)) {
         return cntl->SetFailed(
@@ -1037,6 +1094,7 @@ void SerializeRpcRequest(butil::IOBuf* request_buf, Controller* cntl,
             ContentTypeToCStr(content_type), CompressTypeToCStr(compress_type),
             ChecksumTypeToCStr(checksum_type));
     }
+    OnCompressed(sample, request_buf->size());
 }
 
 void PackRpcRequest(butil::IOBuf* req_buf,
@@ -1114,6 +1172,12 @@ void PackRpcRequest(butil::IOBuf* req_buf,
             request_meta->set_timeout_ms(accessor.real_timeout_ms());
         }
     }
+    if (cntl->request_priority() != 0) {
+        request_meta->set_priority(cntl->request_priority());
+    }
+    if (FLAGS_baidu_std_protocol_deliver_deadline && cntl->deadline_us() >= 0) {
+        request_meta->set_deadline_us(cntl->deadline_us());
+    }
     meta.set_content_type(cntl->request_content_type());
 
     Span* span = accessor.span();
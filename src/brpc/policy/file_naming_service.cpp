@@ -19,6 +19,8 @@
 #include <stdio.h>                                      // getline
 #include <string>                                       // std::string
 #include <set>                                          // std::set
+#include <algorithm>                                    // std::set_difference
+#include <iterator>                                     // std::back_inserter
 #include "butil/files/file_watcher.h"                    // FileWatcher
 #include "butil/files/scoped_file.h"                     // ScopedFILE
 #include "bthread/bthread.h"                            // bthread_usleep
@@ -66,6 +68,23 @@ bool SplitIntoServerAndTag(const butil::StringPiece& line,
     return true;
 }
 
+void DiffServerLists(std::vector<ServerNode>* last_servers,
+                     const std::vector<ServerNode>& servers,
+                     std::vector<ServerNode>* added,
+                     std::vector<ServerNode>* removed) {
+    std::vector<ServerNode> sorted(servers);
+    std::sort(sorted.begin(), sorted.end());
+    added->clear();
+    std::set_difference(sorted.begin(), sorted.end(),
+                        last_servers->begin(), last_servers->end(),
+                        std::back_inserter(*added));
+    removed->clear();
+    std::set_difference(last_servers->begin(), last_servers->end(),
+                        sorted.begin(), sorted.end(),
+                        std::back_inserter(*removed));
+    last_servers->swap(sorted);
+}
+
 int FileNamingService::GetServers(const char *service_name,
                                   std::vector<ServerNode>* servers) {
     servers->clear();
@@ -117,6 +136,10 @@ int FileNamingService::GetServers(const char *service_name,
 int FileNamingService::RunNamingService(const char* service_name,
                                         NamingServiceActions* actions) {
     std::vector<ServerNode> servers;
+    std::vector<ServerNode> last_servers;
+    std::vector<ServerNode> added;
+    std::vector<ServerNode> removed;
+    uint64_t version = 0;
     butil::FileWatcher fw;
     if (fw.init(service_name) < 0) {
         LOG(ERROR) << "Fail to init FileWatcher on `" << service_name << "'";
@@ -127,7 +150,18 @@ int FileNamingService::RunNamingService(const char* service_name,
         if (rc != 0) {
             return rc;
         }
-        actions->ResetServers(servers);
+        if (version == 0) {
+            actions->ResetServers(servers);
+            DiffServerLists(&last_servers, servers, &added, &removed);
+            ++version;
+        } else {
+            // Only push what changed in the file, an unmodified list costs
+            // nothing in the naming service thread and its watchers.
+            DiffServerLists(&last_servers, servers, &added, &removed);
+            if (!added.empty() || !removed.empty()) {
+                actions->UpdateServers(added, removed, ++version);
+            }
+        }
 
         for (;;) {
             butil::FileWatcher::Change change = fw.check_and_consume();
@@ -0,0 +1,194 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <algorithm>
+#include <gflags/gflags.h>
+#include "brpc/errno.pb.h"
+#include "brpc/policy/gradient_concurrency_limiter.h"
+
+namespace brpc {
+namespace policy {
+
+DEFINE_int32(gradient_cl_sample_window_size_ms, 1000,
+             "Duration of the sampling window.");
+DEFINE_int32(gradient_cl_min_sample_count, 20,
+             "During the duration of the sampling window, if the number of "
+             "requests collected is less than this value, the sampling window "
+             "will be discarded.");
+DEFINE_int32(gradient_cl_max_sample_count, 100,
+             "During the duration of the sampling window, once the number of "
+             "requests collected is greater than this value, even if the "
+             "duration of the window has not ended, the max_concurrency will "
+             "be updated and a new sampling window will be started.");
+DEFINE_double(gradient_cl_sampling_interval_ms, 0.1,
+              "Interval for sampling request in gradient concurrency limiter");
+DEFINE_int32(gradient_cl_initial_max_concurrency, 20,
+             "Initial max concurrency for gradient concurrency limiter");
+DEFINE_int32(gradient_cl_min_max_concurrency, 4,
+             "Lower bound of max concurrency of gradient concurrency limiter");
+DEFINE_int32(gradient_cl_max_max_concurrency, 1000,
+             "Upper bound of max concurrency of gradient concurrency limiter");
+DEFINE_double(gradient_cl_latency_tolerance, 1.5,
+              "Latency can grow to this times of the long-term latency before "
+              "max concurrency is reduced");
+DEFINE_int32(gradient_cl_queue_size, 4,
+             "Max concurrency grows by this value per sample window when the "
+             "latency is within the tolerance");
+DEFINE_double(gradient_cl_smoothing, 0.2,
+              "Weight of the new max concurrency in each sample window, "
+              "the value range is (0-1]");
+DEFINE_int32(gradient_cl_long_window_size, 60,
+             "Number of sample windows the long-term latency is averaged over");
+
+GradientConcurrencyLimiter::GradientConcurrencyLimiter()
+    : _max_concurrency(FLAGS_gradient_cl_initial_max_concurrency)
+    , _ema_max_concurrency(FLAGS_gradient_cl_initial_max_concurrency)
+    , _long_latency_us(-1)
+    , _last_sampling_time_us(0)
+    , _max_inflight(0) {
+}
+
+GradientConcurrencyLimiter* GradientConcurrencyLimiter::New(
+    const AdaptiveMaxConcurrency&) const {
+    return new (std::nothrow) GradientConcurrencyLimiter;
+}
+
+bool GradientConcurrencyLimiter::OnRequested(int current_concurrency, Controller*) {
+    int max_inflight = _max_inflight.load(butil::memory_order_relaxed);
+    while (current_concurrency > max_inflight &&
+           !_max_inflight.compare_exchange_weak(
+               max_inflight, current_concurrency, butil::memory_order_relaxed)) {}
+    return current_concurrency <= _max_concurrency;
+}
+
+void GradientConcurrencyLimiter::OnResponded(int error_code, int64_t latency_us) {
+    if (ELIMIT == error_code) {
+        return;
+    }
+
+    const int64_t now_time_us = butil::gettimeofday_us();
+    int64_t last_sampling_time_us =
+        _last_sampling_time_us.load(butil::memory_order_relaxed);
+
+    if (last_sampling_time_us == 0 ||
+        now_time_us - last_sampling_time_us >=
+            FLAGS_gradient_cl_sampling_interval_ms * 1000) {
+        bool sample_this_call = _last_sampling_time_us.compare_exchange_strong(
+            last_sampling_time_us, now_time_us, butil::memory_order_relaxed);
+        if (sample_this_call) {
+            bool sample_window_submitted = AddSample(error_code, latency_us,
+                                                     now_time_us);
+            if (sample_window_submitted) {
+                // The following log prints has data-race in extreme cases,
+                // unless you are in debug, you should not open it.
+                VLOG(1)
+                    << "Sample window submitted, current max_concurrency:"
+                    << _max_concurrency
+                    << ", long_latency_us:" << _long_latency_us;
+            }
+        }
+    }
+}
+
+int GradientConcurrencyLimiter::MaxConcurrency() {
+    return _max_concurrency;
+}
+
+int GradientConcurrencyLimiter::ResetMaxConcurrency(const AdaptiveMaxConcurrency&) {
+    return -1;
+}
+
+bool GradientConcurrencyLimiter::AddSample(int error_code,
+                                           int64_t latency_us,
+                                           int64_t sampling_time_us) {
+    std::unique_lock<butil::Mutex> lock_guard(_sw_mutex);
+    if (_sw.start_time_us == 0) {
+        _sw.start_time_us = sampling_time_us;
+    }
+
+    if (error_code != 0) {
+        ++_sw.failed_count;
+    } else {
+        ++_sw.succ_count;
+        _sw.total_succ_us += latency_us;
+    }
+
+    if (_sw.succ_count + _sw.failed_count < FLAGS_gradient_cl_min_sample_count) {
+        if (sampling_time_us - _sw.start_time_us >=
+            FLAGS_gradient_cl_sample_window_size_ms * 1000) {
+            // If the sample size is insufficient at the end of the sampling
+            // window, discard the entire sampling window
+            ResetSampleWindow(sampling_time_us);
+        }
+        return false;
+    }
+    if (sampling_time_us - _sw.start_time_us <
+        FLAGS_gradient_cl_sample_window_size_ms * 1000 &&
+        _sw.succ_count + _sw.failed_count < FLAGS_gradient_cl_max_sample_count) {
+        return false;
+    }
+
+    const int max_inflight = _max_inflight.exchange(0, butil::memory_order_relaxed);
+    if (_sw.succ_count > 0) {
+        UpdateMaxConcurrency(max_inflight);
+    }
+    // Failed requests don't tell anything about latency, windows with all
+    // requests failed are skipped.
+    ResetSampleWindow(sampling_time_us);
+    return true;
+}
+
+void GradientConcurrencyLimiter::ResetSampleWindow(int64_t sampling_time_us) {
+    _sw.start_time_us = sampling_time_us;
+    _sw.succ_count = 0;
+    _sw.failed_count = 0;
+    _sw.total_succ_us = 0;
+}
+
+void GradientConcurrencyLimiter::UpdateMaxConcurrency(int max_inflight) {
+    const double latency_us = (double)_sw.total_succ_us / _sw.succ_count;
+    if (_long_latency_us <= 0) {
+        _long_latency_us = latency_us;
+    } else {
+        const double ema_factor = 2.0 / (FLAGS_gradient_cl_long_window_size + 1);
+        _long_latency_us = latency_us * ema_factor + _long_latency_us * (1 - ema_factor);
+        if (_long_latency_us > latency_us * 2) {
+            // The long-term latency drifts slowly after a period of high
+            // latency, speed it up when the service has recovered.
+            _long_latency_us *= 0.95;
+        }
+    }
+
+    if (max_inflight * 2 < _max_concurrency) {
+        // Too few requests to tell whether the limit is proper, keep it
+        // unchanged rather than growing it without bound.
+        return;
+    }
+
+    const double gradient = std::max(0.5, std::min(1.0,
+        FLAGS_gradient_cl_latency_tolerance * _long_latency_us / latency_us));
+    const double smoothing = FLAGS_gradient_cl_smoothing;
+    const double next_max_concurrency =
+        _ema_max_concurrency * gradient + FLAGS_gradient_cl_queue_size;
+    _ema_max_concurrency = std::max<double>(FLAGS_gradient_cl_min_max_concurrency,
+        std::min<double>(FLAGS_gradient_cl_max_max_concurrency,
+            _ema_max_concurrency * (1 - smoothing) + next_max_concurrency * smoothing));
+    _max_concurrency = (int)_ema_max_concurrency;
+}
+
+}  // namespace policy
+}  // namespace brpc
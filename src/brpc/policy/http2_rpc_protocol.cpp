@@ -20,12 +20,14 @@
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/server.h"
 #include "butil/base64.h"
+#include "butil/time.h"
 #include "brpc/log.h"
 
 namespace brpc {
 
 DECLARE_bool(http_verbose);
 DECLARE_int32(http_verbose_max_body_length);
+DECLARE_int32(http_max_header_fields);
 DECLARE_int32(health_check_interval);
 DECLARE_bool(usercode_in_pthread);
 
@@ -46,6 +48,15 @@ DEFINE_bool(h2_hpack_encode_name, false,
             "Encode name in HTTP2 headers with huffman encoding");
 DEFINE_bool(h2_hpack_encode_value, false,
             "Encode value in HTTP2 headers with huffman encoding");
+DEFINE_bool(h2_hpack_huffman_if_shorter, true,
+            "Encode name and value in HTTP2 headers with huffman encoding "
+            "when the result is shorter");
+DEFINE_bool(h2_hpack_index_repeated_headers, true,
+            "Add headers of HTTP2 into the dynamic table of HPACK only when "
+            "they're sent again, so that headers varying between requests do "
+            "not evict the repeating ones");
+BRPC_VALIDATE_GFLAG(h2_hpack_huffman_if_shorter, PassValidate);
+BRPC_VALIDATE_GFLAG(h2_hpack_index_repeated_headers, PassValidate);
 
 static bool CheckStreamWindowSize(const char*, int32_t val) {
     return val >= 0;
@@ -57,6 +68,53 @@ static bool CheckConnWindowSize(const char*, int32_t val) {
 }
 BRPC_VALIDATE_GFLAG(h2_client_connection_window_size, CheckConnWindowSize);
 
+DEFINE_bool(h2_bdp_probe, true,
+            "Estimate bandwidth-delay product of HTTP2 connections with PINGs "
+            "and enlarge the local flow-control windows when the remote side "
+            "is limited by them");
+BRPC_VALIDATE_GFLAG(h2_bdp_probe, PassValidate);
+DEFINE_int32(h2_max_autotuned_window_size, 16 * 1024 * 1024,
+             "Flow-control windows enlarged by -h2_bdp_probe never exceed "
+             "this value");
+
+static bool CheckMaxAutotunedWindowSize(const char*, int32_t val) {
+    return val >= (int32_t)H2Settings::DEFAULT_INITIAL_WINDOW_SIZE;
+}
+BRPC_VALIDATE_GFLAG(h2_max_autotuned_window_size, CheckMaxAutotunedWindowSize);
+
+DEFINE_int64(h2_stream_max_pending_bytes, 8 * 1024 * 1024,
+             "Writing a ProgressiveAttachment of a http2 stream fails with "
+             "EOVERCROWDED when so many bytes are blocked by flow control");
+
+static bool CheckStreamMaxPendingBytes(const char*, int64_t val) {
+    return val > 0;
+}
+BRPC_VALIDATE_GFLAG(h2_stream_max_pending_bytes, CheckStreamMaxPendingBytes);
+
+struct H2WindowBvars {
+    // Sum of local windows of all HTTP2 connections.
+    bvar::Adder<int64_t> stream_window_size;
+    bvar::Adder<int64_t> connection_window_size;
+    bvar::Adder<int64_t> bdp_probe_count;
+    bvar::Adder<int64_t> window_grow_count;
+
+    H2WindowBvars()
+        : stream_window_size("h2_total_stream_window_size")
+        , connection_window_size("h2_total_connection_window_size")
+        , bdp_probe_count("h2_bdp_probe_count")
+        , window_grow_count("h2_window_grow_count") {
+    }
+};
+inline H2WindowBvars* get_h2_window_bvars() {
+    return butil::get_leaky_singleton<H2WindowBvars>();
+}
+
+const CommonStrings* get_common_strings();
+
+// Opaque data of PINGs for BDP probing, the lowest byte is a sequence.
+static const uint64_t BDP_PING_MAGIC = 0x6272706362647000ULL; // "brpcbdp"
+static const int64_t MAX_BDP_PROBE_INTERVAL_US = 1000000L;
+
 const char* H2StreamState2Str(H2StreamState s) {
     switch (s) {
     case H2_STREAM_IDLE: return "idle";
@@ -323,6 +381,7 @@ inline H2Context::FrameHandler FindFrameHandler(H2FrameType type) {
 
 H2Context::H2Context(Socket* socket, const Server* server)
     : _socket(socket)
+    , _server(server)
     // Maximize the window size to make sending big request possible before
     // receving the remote settings.
     , _remote_window_left(H2Settings::MAX_WINDOW_SIZE)
@@ -331,7 +390,16 @@ H2Context::H2Context(Socket* socket, const Server* server)
     , _last_sent_stream_id(1)
     , _goaway_stream_id(-1)
     , _remote_settings_received(false)
-    , _deferred_window_update(0) {
+    , _deferred_window_update(0)
+    , _local_conn_window_size(0)
+    , _bdp_ping_inflight(false)
+    , _bdp_ping_data(BDP_PING_MAGIC)
+    , _bdp_ping_start_us(0)
+    , _bdp_bytes(0)
+    , _bdp_next_probe_us(0)
+    , _bdp_probe_interval_us(0)
+    , _bdp(0)
+    , _bdp_rtt_us(0) {
     // Stop printing the field which is useless for remote settings.
     _remote_settings.connection_window_size = 0;
     // Maximize the window size to make sending big request possible before
@@ -345,6 +413,15 @@ H2Context::H2Context(Socket* socket, const Server* server)
         _unack_local_settings.max_frame_size = FLAGS_h2_client_max_frame_size;
         _unack_local_settings.connection_window_size = FLAGS_h2_client_connection_window_size;
     }
+    // The initial WINDOW_UPDATE is sent only for a larger window, see
+    // SerializeH2SettingsFrameAndWU.
+    _local_conn_window_size.store(
+        std::max<int64_t>(_unack_local_settings.connection_window_size,
+                          H2Settings::DEFAULT_INITIAL_WINDOW_SIZE),
+        butil::memory_order_relaxed);
+    H2WindowBvars* vars = get_h2_window_bvars();
+    vars->stream_window_size << _unack_local_settings.stream_window_size;
+    vars->connection_window_size << local_conn_window_size();
 #if defined(UNIT_TEST)
     // In ut, we hope _last_sent_stream_id run out quickly to test the correctness
     // of creating new h2 socket. This value is 10,000 less than 0x7FFFFFFF.
@@ -353,17 +430,33 @@ H2Context::H2Context(Socket* socket, const Server* server)
 }
 
 H2Context::~H2Context() {
+    H2WindowBvars* vars = get_h2_window_bvars();
+    vars->stream_window_size << -(int64_t)_unack_local_settings.stream_window_size;
+    vars->connection_window_size << -local_conn_window_size();
     for (StreamMap::iterator it = _pending_streams.begin();
          it != _pending_streams.end(); ++it) {
-        delete it->second;
+        H2StreamContext* sctx = it->second;
+        if (sctx->is_stage2()) {
+            sctx->AbortProgressiveRead(
+                butil::Status(ECONNRESET, "The connection was closed"));
+        } else {
+            delete sctx;
+        }
     }
     _pending_streams.clear();
+    for (WriterMap::iterator it = _writers.begin(); it != _writers.end(); ++it) {
+        it->second->Fail();
+    }
+    _writers.clear();
 }
 
 int H2Context::Init() {
     if (_pending_streams.init(64, 70) != 0) {
         LOG(WARNING) << "Fail to init _pending_streams";
     }
+    if (_writers.init(8, 70) != 0) {
+        LOG(WARNING) << "Fail to init _writers";
+    }
     if (_hpacker.Init(_unack_local_settings.header_table_size) != 0) {
         LOG(WARNING) << "Fail to init _hpacker";
     }
@@ -422,6 +515,56 @@ H2StreamContext* H2Context::FindStream(int stream_id) {
     return NULL;
 }
 
+bool H2Context::AddWriter(H2StreamWriter* w) {
+    std::unique_lock<butil::Mutex> mu(_stream_mutex);
+    butil::intrusive_ptr<H2StreamWriter>& pw = _writers[w->stream_id()];
+    if (pw != NULL) {
+        return false;
+    }
+    pw.reset(w);
+    return true;
+}
+
+void H2Context::RemoveWriter(int stream_id) {
+    // Release the writer outside the lock.
+    butil::intrusive_ptr<H2StreamWriter> w;
+    std::unique_lock<butil::Mutex> mu(_stream_mutex);
+    _writers.erase(stream_id, &w);
+}
+
+butil::intrusive_ptr<H2StreamWriter> H2Context::FindWriter(int stream_id) {
+    std::unique_lock<butil::Mutex> mu(_stream_mutex);
+    butil::intrusive_ptr<H2StreamWriter>* pw = _writers.seek(stream_id);
+    if (pw) {
+        return *pw;
+    }
+    return NULL;
+}
+
+bool H2Context::FailWriter(int stream_id) {
+    butil::intrusive_ptr<H2StreamWriter> w;
+    {
+        std::unique_lock<butil::Mutex> mu(_stream_mutex);
+        if (_writers.empty() || !_writers.erase(stream_id, &w)) {
+            return false;
+        }
+    }
+    w->Fail();
+    return true;
+}
+
+int64_t H2Context::TakeRemoteWindow(int64_t size) {
+    int64_t left = _remote_window_left.load(butil::memory_order_relaxed);
+    while (left > 0) {
+        const int64_t taken = std::min(left, size);
+        if (_remote_window_left.compare_exchange_weak(
+                left, left - taken, butil::memory_order_relaxed)) {
+            return taken;
+        }
+    }
+    return 0;
+}
+
 int H2Context::TryToInsertStream(int stream_id, H2StreamContext* ctx) {
     std::unique_lock<butil::Mutex> mu(_stream_mutex);
     if (_goaway_stream_id >= 0 && stream_id > _goaway_stream_id) {
@@ -514,8 +657,15 @@ ParseResult H2Context::Consume(
                 LOG(WARNING) << "Fail to send RST_STREAM to " << *_socket;
                 return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
             }
+            FailWriter(h2_res.stream_id());
             H2StreamContext* sctx = RemoveStreamAndDeferWU(h2_res.stream_id());
             if (sctx) {
+                if (sctx->is_stage2()) {
+                    sctx->AbortProgressiveRead(butil::Status(
+                            ECANCELED, "The stream was reset with h2_error=%d",
+                            (int)h2_res.error()));
+                    return MakeMessage(NULL);
+                }
                 if (is_server_side()) {
                     delete sctx;
                     return MakeMessage(NULL);
@@ -642,7 +792,7 @@ H2ParseResult H2StreamContext::OnHeaders(
         if (frame_head.flags & H2_FLAGS_END_STREAM) {
             return OnEndStream();
         }
-        return MakeH2Message(NULL);
+        return OnHeadersComplete();
     } else {
         if (frame_head.flags & H2_FLAGS_END_STREAM) {
             // Delay calling OnEndStream() in OnContinuation()
@@ -692,10 +842,32 @@ H2ParseResult H2StreamContext::OnContinuation(
         if (_stream_ended) {
             return OnEndStream();
         }
+        return OnHeadersComplete();
     }
     return MakeH2Message(NULL);
 }
 
+H2ParseResult H2StreamContext::OnHeadersComplete() {
+    if (_headers_ended) {
+        // Trailers without END_STREAM, nothing to do.
+        return MakeH2Message(NULL);
+    }
+    _headers_ended = true;
+    if (_conn_ctx->is_server_side()) {
+        if (!IsProgressiveReadRequest(_conn_ctx->_server)) {
+            return MakeH2Message(NULL);
+        }
+        set_read_body_progressively(true);
+    } else if (!read_body_progressively()) {
+        return MakeH2Message(NULL);
+    }
+    // Process the message before the body arrives, the body is fed to the
+    // reader set by users and the reference for stage2 is released when the
+    // stream ends.
+    AddOneRefForStage2();
+    return MakeH2Message(this);
+}
+
 H2ParseResult H2Context::OnData(
     butil::IOBufBytesIterator& it, const H2FrameHead& frame_head) {
     uint32_t frag_size = frame_head.payload_size;
@@ -709,6 +881,8 @@ H2ParseResult H2Context::OnData(
         return MakeH2Error(H2_FRAME_SIZE_ERROR);
     }
     frag_size -= pad_length;
+    // Padding is counted in flow control as well.
+    ProbeBdp(frame_head.payload_size);
     H2StreamContext* sctx = FindStream(frame_head.stream_id);
     if (sctx == NULL) {
         // If a DATA frame is received whose stream is not in "open" or "half-closed (local)" state,
@@ -735,11 +909,31 @@ H2ParseResult H2StreamContext::OnData(
     for (size_t i = 0; i < data.backing_block_num(); ++i) {
         const butil::StringPiece blk = data.backing_block(i);
         if (OnBody(blk.data(), blk.size()) != 0) {
+            if (is_stage2()) {
+                // The reader refused the body, just stop the stream.
+                return MakeH2Error(H2_CANCEL, frame_head.stream_id);
+            }
             LOG(ERROR) << "Fail to parse data";
             return MakeH2Error(H2_PROTOCOL_ERROR);
         }
     }
 
+    if (is_stage2() && !_has_body_reader.load()) {
+        // The body is buffered until users set the reader. Return the
+        // connection-level window to not block other streams and hold the
+        // stream-level one so that the buffered body is bounded.
+        _conn_ctx->DeferWindowUpdate(frag_size);
+        _held_window_update.fetch_add(frag_size);
+        if (_has_body_reader.load()) {
+            // Raced with ReadProgressiveAttachmentBy()
+            ReleaseHeldWindowUpdate();
+        }
+        if (frame_head.flags & H2_FLAGS_END_STREAM) {
+            return OnEndStream();
+        }
+        return MakeH2Message(NULL);
+    }
+
     int64_t acc = frag_size +
         _deferred_window_update.fetch_add(frag_size, butil::memory_order_relaxed);
     int64_t quota = static_cast<int64_t>(
@@ -785,9 +979,11 @@ H2ParseResult H2Context::OnResetStream(
         return MakeH2Error(H2_FRAME_SIZE_ERROR);
     }
     const H2Error h2_error = static_cast<H2Error>(LoadUint32(it));
+    // Streams of server may be written after the request ends.
+    const bool has_writer = FailWriter(frame_head.stream_id);
     H2StreamContext* sctx = FindStream(frame_head.stream_id);
     if (sctx == NULL) {
-        RPC_VLOG << "Fail to find stream_id=" << frame_head.stream_id;
+        RPC_VLOG_IF(!has_writer) << "Fail to find stream_id=" << frame_head.stream_id;
         return MakeH2Message(NULL);
     }
     return sctx->OnResetStream(h2_error, frame_head);
@@ -812,6 +1008,12 @@ H2ParseResult H2StreamContext::OnResetStream(
         LOG(ERROR) << "Fail to find stream_id=" << stream_id();
         return MakeH2Error(H2_PROTOCOL_ERROR);
     }
+    if (is_stage2()) {
+        AbortProgressiveRead(butil::Status(
+                ECONNRESET, "The stream was reset by remote with h2_error=%d",
+                (int)h2_error));
+        return MakeH2Message(NULL);
+    }
     if (_conn_ctx->is_client_side()) {
         sctx->header().set_status_code(H2ErrorToStatusCode(h2_error));
         return MakeH2Message(sctx);
@@ -841,6 +1043,32 @@ H2ParseResult H2StreamContext::OnEndStream() {
     }
     CHECK_EQ(sctx, this);
 
+    if (is_stage2()) {
+        // The message was processed already, end the body.
+        if (_trailers != NULL) {
+            const CommonStrings* common = get_common_strings();
+            const std::string* grpc_status = _trailers->GetHeader(common->GRPC_STATUS);
+            if (grpc_status) {
+                const GrpcStatus status =
+                    (GrpcStatus)strtol(grpc_status->c_str(), NULL, 10);
+                if (status != GRPC_OK) {
+                    std::string message;
+                    const std::string* grpc_message =
+                        _trailers->GetHeader(common->GRPC_MESSAGE);
+                    if (grpc_message) {
+                        PercentDecode(*grpc_message, &message);
+                    } else {
+                        message = GrpcStatusToString(status);
+                    }
+                    set_end_of_message_status(butil::Status(
+                            GrpcStatusToErrorCode(status), "%s", message.c_str()));
+                }
+            }
+        }
+        OnMessageComplete();
+        RemoveOneRefForStage2();
+        return MakeH2Message(NULL);
+    }
     OnMessageComplete();
     return MakeH2Message(sctx);
 }
@@ -897,12 +1125,25 @@ H2ParseResult H2Context::OnSettings(
         // be changed using WINDOW_UPDATE frames.
         // https://tools.ietf.org/html/rfc7540#section-6.9.2
         // TODO(gejun): Has race conditions with AppendAndDestroySelf
-        std::unique_lock<butil::Mutex> mu(_stream_mutex);
-        for (StreamMap::const_iterator it = _pending_streams.begin();
-             it != _pending_streams.end(); ++it) {
-            if (!AddWindowSize(&it->second->_remote_window_left, window_diff)) {
+        std::vector<butil::intrusive_ptr<H2StreamWriter> > writers;
+        {
+            std::unique_lock<butil::Mutex> mu(_stream_mutex);
+            for (StreamMap::const_iterator it = _pending_streams.begin();
+                 it != _pending_streams.end(); ++it) {
+                if (!AddWindowSize(&it->second->_remote_window_left, window_diff)) {
+                    return MakeH2Error(H2_FLOW_CONTROL_ERROR);
+                }
+            }
+            for (WriterMap::const_iterator it = _writers.begin();
+                 it != _writers.end(); ++it) {
+                writers.push_back(it->second);
+            }
+        }
+        for (size_t i = 0; i < writers.size(); ++i) {
+            if (!writers[i]->AddWindowSize(window_diff)) {
                 return MakeH2Error(H2_FLOW_CONTROL_ERROR);
             }
+            writers[i]->Flush();
         }
     }
     // Respond with ack
@@ -938,6 +1179,11 @@ H2ParseResult H2Context::OnPing(
         return MakeH2Error(H2_PROTOCOL_ERROR);
     }
     if (frame_head.flags & H2_FLAGS_ACK) {
+        uint64_t ping_data = 0;
+        for (int i = 0; i < 8; ++i) {
+            ping_data = ((ping_data << 8) | LoadUint8(it));
+        }
+        OnBdpPingAck(ping_data);
         return MakeH2Message(NULL);
     }
     
@@ -982,12 +1228,21 @@ H2ParseResult H2Context::OnGoAway(
 
         std::vector<H2StreamContext*> goaway_streams;
         RemoveGoAwayStreams(last_stream_id, &goaway_streams);
-        if (goaway_streams.empty()) {
-            return MakeH2Message(NULL);
-        }
+        size_t nresp = 0;
         for (size_t i = 0; i < goaway_streams.size(); ++i) {
             H2StreamContext* sctx = goaway_streams[i];
+            FailWriter(sctx->stream_id());
+            if (sctx->is_stage2()) {
+                sctx->AbortProgressiveRead(
+                    butil::Status(ELOGOFF, "The remote side sent GOAWAY"));
+                continue;
+            }
             sctx->header().set_status_code(HTTP_STATUS_SERVICE_UNAVAILABLE);
+            goaway_streams[nresp++] = sctx;
+        }
+        goaway_streams.resize(nresp);
+        if (goaway_streams.empty()) {
+            return MakeH2Message(NULL);
         }
         for (size_t i = 1; i < goaway_streams.size(); ++i) {
             bthread_t th;
@@ -1021,11 +1276,31 @@ H2ParseResult H2Context::OnWindowUpdate(
             LOG(ERROR) << "Invalid connection-level window_size_increment=" << inc;
             return MakeH2Error(H2_FLOW_CONTROL_ERROR);
         }
+        std::vector<butil::intrusive_ptr<H2StreamWriter> > writers;
+        {
+            std::unique_lock<butil::Mutex> mu(_stream_mutex);
+            for (WriterMap::const_iterator it = _writers.begin();
+                 it != _writers.end(); ++it) {
+                writers.push_back(it->second);
+            }
+        }
+        for (size_t i = 0; i < writers.size(); ++i) {
+            writers[i]->Flush();
+        }
         return MakeH2Message(NULL);
     } else {
+        butil::intrusive_ptr<H2StreamWriter> w = FindWriter(frame_head.stream_id);
+        if (w != NULL) {
+            if (!w->AddWindowSize(inc)) {
+                LOG(ERROR) << "Invalid stream-level window_size_increment=" << inc
+                           << " to stream_id=" << frame_head.stream_id;
+                return MakeH2Error(H2_FLOW_CONTROL_ERROR, frame_head.stream_id);
+            }
+            w->Flush();
+        }
         H2StreamContext* sctx = FindStream(frame_head.stream_id);
         if (sctx == NULL) {
-            RPC_VLOG << "Fail to find stream_id=" << frame_head.stream_id;
+            RPC_VLOG_IF(w == NULL) << "Fail to find stream_id=" << frame_head.stream_id;
             return MakeH2Message(NULL);
         }
         if (!AddWindowSize(&sctx->_remote_window_left, inc)) {
@@ -1052,6 +1327,9 @@ void H2Context::Describe(std::ostream& os, const DescribeOptions& opt) const {
        << sep << "remote_settings=" << _remote_settings
        << sep << "remote_settings_received=" << _remote_settings_received
        << sep << "local_settings=" << _local_settings
+       << sep << "local_conn_window=" << local_conn_window_size()
+       << sep << "bdp=" << _bdp
+       << sep << "bdp_rtt_us=" << _bdp_rtt_us
        << sep << "hpacker={";
     IndentingOStream os2(os, 2);
     _hpacker.Describe(os2, opt);
@@ -1080,7 +1358,11 @@ void H2Context::DeferWindowUpdate(int64_t size) {
         return;
     }
     const int64_t acc = _deferred_window_update.fetch_add(size, butil::memory_order_relaxed) + size;
-    if (acc >= local_settings().stream_window_size / 2) {
+    // The connection-level window may be smaller than the stream-level one
+    // after the latter being enlarged by ProbeBdp.
+    const int64_t window = std::min<int64_t>(local_settings().stream_window_size,
+                                             local_conn_window_size());
+    if (acc >= window / 2) {
         // Rarely happen for small messages.
         const int64_t conn_wu = _deferred_window_update.exchange(0, butil::memory_order_relaxed);
         if (conn_wu > 0) {
@@ -1094,6 +1376,91 @@ void H2Context::DeferWindowUpdate(int64_t size) {
     }
 }
 
+void H2Context::ProbeBdp(uint32_t size) {
+    if (!FLAGS_h2_bdp_probe) {
+        return;
+    }
+    if (_bdp_ping_inflight) {
+        _bdp_bytes += size;
+        return;
+    }
+    const int64_t max_window = FLAGS_h2_max_autotuned_window_size;
+    if (_unack_local_settings.stream_window_size >= max_window &&
+        local_conn_window_size() >= max_window) {
+        return;
+    }
+    const int64_t now_us = butil::cpuwide_time_us();
+    if (now_us < _bdp_next_probe_us) {
+        return;
+    }
+    // Bytes of this frame were sent before the PING, don't count them.
+    _bdp_ping_data = BDP_PING_MAGIC | ((_bdp_ping_data + 1) & 0xFF);
+    char pingbuf[FRAME_HEAD_SIZE + 8];
+    SerializeFrameHead(pingbuf, 8, H2_FRAME_PING, 0, 0);
+    for (int i = 0; i < 8; ++i) {
+        pingbuf[FRAME_HEAD_SIZE + i] = (_bdp_ping_data >> (56 - i * 8)) & 0xFF;
+    }
+    if (WriteAck(_socket, pingbuf, sizeof(pingbuf)) != 0) {
+        LOG(WARNING) << "Fail to send PING to " << *_socket;
+        return;
+    }
+    _bdp_ping_inflight = true;
+    _bdp_ping_start_us = now_us;
+    _bdp_bytes = 0;
+    get_h2_window_bvars()->bdp_probe_count << 1;
+}
+
+bool H2Context::OnBdpPingAck(uint64_t ping_data) {
+    if (!_bdp_ping_inflight || ping_data != _bdp_ping_data) {
+        return false;
+    }
+    _bdp_ping_inflight = false;
+    const int64_t now_us = butil::cpuwide_time_us();
+    _bdp = _bdp_bytes;
+    _bdp_rtt_us = now_us - _bdp_ping_start_us;
+
+    // The remote side is probably limited by a window if it sent more than
+    // 2/3 of the window in a round-trip, double the estimation to leave
+    // room for growing bandwidth. Windows are never shrinked.
+    const int64_t max_window = FLAGS_h2_max_autotuned_window_size;
+    const int64_t target = std::min(_bdp * 2, max_window);
+    char buf[FRAME_HEAD_SIZE + H2_SETTINGS_MAX_BYTE_SIZE + FRAME_HEAD_SIZE + 4];
+    char* p = buf;
+    const int64_t stream_window = _unack_local_settings.stream_window_size;
+    if (_bdp * 3 >= stream_window * 2 && target > stream_window) {
+        // Applied to the stream-level window of all streams, and becomes
+        // local_settings() when the remote side acknowledges it.
+        _unack_local_settings.stream_window_size = target;
+        const size_t nb = SerializeH2Settings(_unack_local_settings, p + FRAME_HEAD_SIZE);
+        SerializeFrameHead(p, nb, H2_FRAME_SETTINGS, 0, 0);
+        p += FRAME_HEAD_SIZE + nb;
+        get_h2_window_bvars()->stream_window_size << (target - stream_window);
+    }
+    const int64_t conn_window = local_conn_window_size();
+    if (_bdp * 3 >= conn_window * 2 && target > conn_window) {
+        _local_conn_window_size.store(target, butil::memory_order_relaxed);
+        SerializeFrameHead(p, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
+        SaveUint32(p + FRAME_HEAD_SIZE, target - conn_window);
+        p += FRAME_HEAD_SIZE + 4;
+        get_h2_window_bvars()->connection_window_size << (target - conn_window);
+    }
+    if (p == buf) {
+        // Probe less frequently when the windows are large enough.
+        _bdp_probe_interval_us = std::min(
+            std::max(_bdp_probe_interval_us * 2, _bdp_rtt_us),
+            MAX_BDP_PROBE_INTERVAL_US);
+        _bdp_next_probe_us = now_us + _bdp_probe_interval_us;
+        return true;
+    }
+    _bdp_probe_interval_us = 0;
+    _bdp_next_probe_us = now_us;
+    get_h2_window_bvars()->window_grow_count << 1;
+    if (WriteAck(_socket, buf, p - buf) != 0) {
+        LOG(WARNING) << "Fail to enlarge windows of " << *_socket;
+    }
+    return true;
+}
+
 #if defined(BRPC_PROFILE_H2)
 bvar::Adder<int64_t> g_parse_time;
 bvar::PerSecond<bvar::Adder<int64_t> > g_parse_time_per_second(
@@ -1148,9 +1515,23 @@ inline void H2Context::ClearAbandonedStreams() {
         const uint32_t stream_id = _abandoned_streams.back();
         _abandoned_streams.pop_back();
         mu.unlock();
+        if (FailWriter(stream_id)) {
+            // The remote side is still reading the stream.
+            char rstbuf[FRAME_HEAD_SIZE + 4];
+            SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, stream_id);
+            SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_CANCEL);
+            if (WriteAck(_socket, rstbuf, sizeof(rstbuf)) != 0) {
+                LOG(WARNING) << "Fail to send RST_STREAM to " << *_socket;
+            }
+        }
         H2StreamContext* sctx = RemoveStreamAndDeferWU(stream_id);
         if (sctx != NULL) {
-            delete sctx;
+            if (sctx->is_stage2()) {
+                sctx->AbortProgressiveRead(
+                    butil::Status(ECANCELED, "The RPC was abandoned"));
+            } else {
+                delete sctx;
+            }
         }
         mu.lock();
     }
@@ -1164,8 +1545,12 @@ H2StreamContext::H2StreamContext(bool read_body_progressively)
 #endif
     , _stream_id(0)
     , _stream_ended(false)
+    , _headers_ended(false)
     , _remote_window_left(0)
     , _deferred_window_update(0)
+    , _held_window_update(0)
+    , _has_body_reader(false)
+    , _socket_id(INVALID_SOCKET_ID)
     , _correlation_id(INVALID_BTHREAD_ID.value) {
     header().set_version(2, 0);
 #ifndef NDEBUG
@@ -1176,10 +1561,42 @@ H2StreamContext::H2StreamContext(bool read_body_progressively)
 void H2StreamContext::Init(H2Context* conn_ctx, int stream_id) {
     _conn_ctx = conn_ctx;
     _stream_id = stream_id;
+    _socket_id = conn_ctx->_socket->id();
     _remote_window_left.store(conn_ctx->remote_settings().stream_window_size,
                               butil::memory_order_relaxed);
 }
 
+void H2StreamContext::AbortProgressiveRead(const butil::Status& st) {
+    set_end_of_message_status(st);
+    OnMessageComplete();
+    RemoveOneRefForStage2();
+}
+
+void H2StreamContext::ReadProgressiveAttachmentBy(ProgressiveReader* r) {
+    SetBodyReader(r);
+    _has_body_reader.store(true);
+    ReleaseHeldWindowUpdate();
+}
+
+void H2StreamContext::ReleaseHeldWindowUpdate() {
+    const int64_t stream_wu = _held_window_update.exchange(0);
+    if (stream_wu <= 0) {
+        return;
+    }
+    // May be called outside the parsing thread where _conn_ctx is not
+    // guaranteed to be alive.
+    SocketUniquePtr sock;
+    if (Socket::Address(_socket_id, &sock) != 0) {
+        return;
+    }
+    char winbuf[FRAME_HEAD_SIZE + 4];
+    SerializeFrameHead(winbuf, 4, H2_FRAME_WINDOW_UPDATE, 0, stream_id());
+    SaveUint32(winbuf + FRAME_HEAD_SIZE, stream_wu);
+    if (WriteAck(sock.get(), winbuf, sizeof(winbuf)) != 0) {
+        LOG(WARNING) << "Fail to send WINDOW_UPDATE to " << *sock;
+    }
+}
+
 H2StreamContext::~H2StreamContext() {
 #ifndef NDEBUG
     get_h2_bvars()->h2_stream_context_count << -1;
@@ -1220,7 +1637,11 @@ bool H2StreamContext::ConsumeWindowSize(int64_t size) {
 
 int H2StreamContext::ConsumeHeaders(butil::IOBufBytesIterator& it) {
     HPacker& hpacker = _conn_ctx->hpacker();
-    HttpHeader& h = header();
+    if (is_stage2() && _trailers == NULL) {
+        // header() may be used by users now.
+        _trailers.reset(new HttpHeader);
+    }
+    HttpHeader& h = (is_stage2() ? *_trailers : header());
     while (it) {
         HPacker::Header pair;
         const int rc = hpacker.Decode(it, &pair);
@@ -1230,63 +1651,6 @@ int H2StreamContext::ConsumeHeaders(butil::IOBufBytesIterator& it) {
         if (rc == 0) {
             break;
         }
-        const char* const name = pair.name.c_str();
-        bool matched = false;
-        if (name[0] == ':') { // reserved names
-            switch (name[1]) {
-            case 'a':
-                if (strcmp(name + 2, /*a*/"uthority") == 0) {
-                    matched = true;
-                    h.uri().SetHostAndPort(pair.value);
-                }
-                break;
-            case 'm':
-                if (strcmp(name + 2, /*m*/"ethod") == 0) {
-                    matched = true;
-                    HttpMethod method;
-                    if (!Str2HttpMethod(pair.value.c_str(), &method)) {
-                        LOG(ERROR) << "Invalid method=" << pair.value;
-                        return -1;
-                    }
-                    h.set_method(method);
-                }
-                break;
-            case 'p':
-                if (strcmp(name + 2, /*p*/"ath") == 0) {
-                    matched = true;
-                    // Including path/query/fragment
-                    h.uri().SetH2Path(pair.value);
-                }
-                break;
-            case 's':
-                if (strcmp(name + 2, /*:s*/"cheme") == 0) {
-                    matched = true;
-                    h.uri().set_scheme(pair.value);
-                } else if (strcmp(name + 2, /*:s*/"tatus") == 0) {
-                    matched = true;
-                    char* endptr = NULL;
-                    const int sc = strtol(pair.value.c_str(), &endptr, 10);
-                    if (*endptr != '\0') {
-                        LOG(ERROR) << "Invalid status=" << pair.value;
-                        return -1;
-                    }
-                    h.set_status_code(sc);
-                }
-                break;
-            default:
-                break;
-            }
-            if (!matched) {
-                LOG(ERROR) << "Unknown name=`" << name << '\'';
-                return -1;
-            }
-        } else if (name[0] == 'c' &&
-                   strcmp(name + 1, /*c*/"ontent-type") == 0) {
-            h.set_content_type(pair.value);
-        } else {
-            h.AppendHeader(pair.name, pair.value);
-        }
-
         if (FLAGS_http_verbose) {
             butil::IOBufBuilder* vs = this->_vmsgbuilder.get();
             if (vs == NULL) {
@@ -1301,23 +1665,80 @@ int H2StreamContext::ConsumeHeaders(butil::IOBufBytesIterator& it) {
             // print \n first to be consistent with code in http_message.cpp
             *vs << "\n< " << pair.name << " = " << pair.value;
         }
+        switch (FindHttpHeaderId(pair.name)) {
+        case HTTP_HEADER_H2_AUTHORITY:
+            h.uri().SetHostAndPort(pair.value);
+            break;
+        case HTTP_HEADER_H2_METHOD: {
+            HttpMethod method;
+            if (!Str2HttpMethod(pair.value.c_str(), &method)) {
+                LOG(ERROR) << "Invalid method=" << pair.value;
+                return -1;
+            }
+            h.set_method(method);
+            break;
+        }
+        case HTTP_HEADER_H2_PATH:
+            // Including path/query/fragment
+            h.uri().SetH2Path(pair.value);
+            break;
+        case HTTP_HEADER_H2_SCHEME:
+            h.uri().set_scheme(pair.value);
+            break;
+        case HTTP_HEADER_H2_STATUS: {
+            char* endptr = NULL;
+            const int sc = strtol(pair.value.c_str(), &endptr, 10);
+            if (*endptr != '\0') {
+                LOG(ERROR) << "Invalid status=" << pair.value;
+                return -1;
+            }
+            h.set_status_code(sc);
+            break;
+        }
+        case HTTP_HEADER_CONTENT_TYPE:
+            h.mutable_content_type().swap(pair.value);
+            break;
+        default:
+            if (pair.name[0] == ':') { // reserved names
+                LOG(ERROR) << "Unknown name=`" << pair.name << '\'';
+                return -1;
+            }
+            h.AppendParsedHeader(&pair.name, &pair.value);
+            if (h.HeaderCount() > (size_t)FLAGS_http_max_header_fields) {
+                LOG(ERROR) << "Too many header fields, max="
+                           << FLAGS_http_max_header_fields;
+                return -1;
+            }
+            break;
+        }
     }
     return 0;
 }
 
-const CommonStrings* get_common_strings();
+static void GetHPackOptions(const H2Context* ctx, HPackOptions* options) {
+    options->encode_name = FLAGS_h2_hpack_encode_name;
+    options->encode_value = FLAGS_h2_hpack_encode_value;
+    options->huffman_if_shorter = FLAGS_h2_hpack_huffman_if_shorter;
+    if (ctx->remote_settings().header_table_size == 0) {
+        options->index_policy = HPACK_NEVER_INDEX_HEADER;
+    } else if (FLAGS_h2_hpack_index_repeated_headers) {
+        options->index_policy = HPACK_INDEX_REPEATED_HEADER;
+    }
+}
 
+// `end_stream' is false when the body is written by H2StreamWriter later.
 static void PackH2Message(butil::IOBuf* out,
                           butil::IOBuf& headers,
                           butil::IOBuf& trailer_headers,
                           const butil::IOBuf& data,
                           int stream_id,
-                          H2Context* conn_ctx) {
+                          H2Context* conn_ctx,
+                          bool end_stream) {
     const H2Settings& remote_settings = conn_ctx->remote_settings();
     char headbuf[FRAME_HEAD_SIZE];
     H2FrameHead headers_head = {
         (uint32_t)headers.size(), H2_FRAME_HEADERS, 0, stream_id};
-    if (data.empty() && trailer_headers.empty()) {
+    if (end_stream && data.empty() && trailer_headers.empty()) {
         headers_head.flags |= H2_FLAGS_END_STREAM;
     }
     if (headers_head.payload_size <= remote_settings.max_frame_size) {
@@ -1350,7 +1771,7 @@ static void PackH2Message(butil::IOBuf* out,
         while (it.bytes_left()) {
             if (it.bytes_left() <= remote_settings.max_frame_size) {
                 data_head.payload_size = it.bytes_left();
-                if (trailer_headers.empty()) {
+                if (end_stream && trailer_headers.empty()) {
                     data_head.flags |= H2_FLAGS_END_STREAM;
                 }
             } else {
@@ -1379,6 +1800,232 @@ static void PackH2Message(butil::IOBuf* out,
     }
 }
 
+// Pack trailers of a successful gRPC which ends the stream.
+static void PackGrpcOkTrailers(butil::IOBuf* out, H2Context* ctx, int stream_id) {
+    HPacker& hpacker = ctx->hpacker();
+    butil::IOBufAppender appender;
+    HPackOptions options;
+    GetHPackOptions(ctx, &options);
+    HPacker::Header status_header("grpc-status", "0");
+    hpacker.Encode(&appender, status_header, options);
+    butil::IOBuf trailer_frag;
+    appender.move_to(trailer_frag);
+    char headbuf[FRAME_HEAD_SIZE];
+    SerializeFrameHead(headbuf, trailer_frag.size(), H2_FRAME_HEADERS,
+                       H2_FLAGS_END_STREAM | H2_FLAGS_END_HEADERS, stream_id);
+    out->append(headbuf, sizeof(headbuf));
+    out->append(butil::IOBuf::Movable(trailer_frag));
+}
+
+// HPACK must be encoded in the order of writing, trailers sent outside
+// AppendAndDestroySelf() are wrapped in this message.
+class H2UnsentTrailers : public SocketMessage {
+public:
+    explicit H2UnsentTrailers(int stream_id) : _stream_id(stream_id) {}
+
+    // @SocketMessage
+    butil::Status AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) override {
+        std::unique_ptr<H2UnsentTrailers> destroy_self(this);
+        if (socket != NULL) {
+            H2Context* ctx = static_cast<H2Context*>(socket->parsing_context());
+            PackGrpcOkTrailers(out, ctx, _stream_id);
+        }
+        return butil::Status::OK();
+    }
+
+private:
+    int _stream_id;
+};
+
+H2StreamWriter::H2StreamWriter()
+    : _grpc_trailers(false)
+    , _flushing(false)
+    , _closed(false)
+    , _failed(false)
+    , _end_sent(false)
+    , _stream_id(0)
+    , _socket_id(INVALID_SOCKET_ID)
+    , _window(0) {
+}
+
+int H2StreamWriter::Write(butil::IOBuf* data) {
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_failed || _closed) {
+            errno = ECANCELED;
+            return -1;
+        }
+        if ((int64_t)_pending.size() >= FLAGS_h2_stream_max_pending_bytes) {
+            errno = EOVERCROWDED;
+            return -1;
+        }
+        _pending.append(butil::IOBuf::Movable(*data));
+    }
+    Flush();
+    return 0;
+}
+
+void H2StreamWriter::Close() {
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_closed) {
+            return;
+        }
+        _closed = true;
+    }
+    Flush();
+}
+
+void H2StreamWriter::Fail() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    _failed = true;
+    _pending.clear();
+}
+
+bool H2StreamWriter::AddWindowSize(int64_t diff) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (_window + diff > H2Settings::MAX_WINDOW_SIZE) {
+        return false;
+    }
+    _window += diff;
+    return true;
+}
+
+bool H2StreamWriter::PackLocked(H2Context* ctx, butil::IOBuf* out) {
+    const int64_t max_frame_size = ctx->remote_settings().max_frame_size;
+    char headbuf[FRAME_HEAD_SIZE];
+    while (!_pending.empty() && _window > 0) {
+        const int64_t size = std::min(std::min((int64_t)_pending.size(), _window),
+                                      max_frame_size);
+        const int64_t taken = ctx->TakeRemoteWindow(size);
+        if (taken <= 0) {
+            // Wait for connection-level WINDOW_UPDATE.
+            break;
+        }
+        SerializeFrameHead(headbuf, taken, H2_FRAME_DATA, 0, _stream_id);
+        out->append(headbuf, sizeof(headbuf));
+        _pending.cutn(out, taken);
+        _window -= taken;
+    }
+    if (_closed && _pending.empty() && !_end_sent) {
+        _end_sent = true;
+        return true;
+    }
+    return false;
+}
+
+bool H2StreamWriter::Start(Socket* socket, int stream_id, int64_t stream_window,
+                           bool grpc_trailers, butil::IOBuf* out) {
+    H2Context* ctx = static_cast<H2Context*>(socket->parsing_context());
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (_failed || _stream_id != 0) {
+        return false;
+    }
+    _stream_id = stream_id;
+    _socket_id = socket->id();
+    _window = stream_window;
+    _grpc_trailers = grpc_trailers;
+    if (!ctx->AddWriter(this)) {
+        _failed = true;
+        return false;
+    }
+    if (PackLocked(ctx, out)) {
+        if (_grpc_trailers) {
+            PackGrpcOkTrailers(out, ctx, _stream_id);
+        } else {
+            char headbuf[FRAME_HEAD_SIZE];
+            SerializeFrameHead(headbuf, 0, H2_FRAME_DATA,
+                               H2_FLAGS_END_STREAM, _stream_id);
+            out->append(headbuf, sizeof(headbuf));
+        }
+        ctx->RemoveWriter(_stream_id);
+    }
+    return true;
+}
+
+void H2StreamWriter::Flush() {
+    std::unique_lock<butil::Mutex> mu(_mutex);
+    if (_flushing || _stream_id == 0) {
+        // Another thread is flushing and will see the data, or the stream
+        // is not started yet.
+        return;
+    }
+    SocketUniquePtr sock;
+    if (Socket::Address(_socket_id, &sock) != 0) {
+        _failed = true;
+        _pending.clear();
+        return;
+    }
+    H2Context* ctx = static_cast<H2Context*>(sock->parsing_context());
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    // Only one thread writes the socket at any time to keep order of frames.
+    _flushing = true;
+    while (!_failed) {
+        butil::IOBuf frames;
+        const bool ended = PackLocked(ctx, &frames);
+        if (frames.empty() && !ended) {
+            break;
+        }
+        mu.unlock();
+        if (ended && !_grpc_trailers) {
+            char headbuf[FRAME_HEAD_SIZE];
+            SerializeFrameHead(headbuf, 0, H2_FRAME_DATA,
+                               H2_FLAGS_END_STREAM, _stream_id);
+            frames.append(headbuf, sizeof(headbuf));
+        }
+        int rc = 0;
+        if (!frames.empty()) {
+            rc = sock->Write(&frames, &wopt);
+        }
+        if (rc == 0 && ended && _grpc_trailers) {
+            SocketMessagePtr<H2UnsentTrailers> trailers(
+                new H2UnsentTrailers(_stream_id));
+            rc = sock->Write(trailers, &wopt);
+        }
+        if (ended) {
+            ctx->RemoveWriter(_stream_id);
+        }
+        mu.lock();
+        if (rc != 0) {
+            _failed = true;
+            _pending.clear();
+        }
+        if (ended) {
+            break;
+        }
+    }
+    _flushing = false;
+}
+
+H2ProgressiveAttachment::H2ProgressiveAttachment(SocketUniquePtr& movable_sock)
+    : ProgressiveAttachment(movable_sock, false)
+    , _writer(new H2StreamWriter) {
+}
+
+H2ProgressiveAttachment::~H2ProgressiveAttachment() {
+    _writer->Close();
+    // The stream is ended by the writer instead of a zero-sized chunk.
+    _httpsock.reset();
+}
+
+int H2ProgressiveAttachment::Write(const butil::IOBuf& data) {
+    butil::IOBuf copied(data);
+    return _writer->Write(&copied);
+}
+
+int H2ProgressiveAttachment::Write(const void* data, size_t n) {
+    butil::IOBuf copied;
+    copied.append(data, n);
+    return _writer->Write(&copied);
+}
+
+void H2ProgressiveAttachment::MarkRPCAsDone(bool rpc_failed) {
+    if (rpc_failed) {
+        _writer->Fail();
+    }
+}
+
 H2UnsentRequest* H2UnsentRequest::New(Controller* c) {
     const HttpHeader& h = c->http_request();
     const CommonStrings* const common = get_common_strings();
@@ -1452,6 +2099,17 @@ H2UnsentRequest* H2UnsentRequest::New(Controller* c) {
         val->append(encoded_user_info);
     }
     msg->_sctx.reset(new H2StreamContext(c->is_response_read_progressively()));
+    if (c->has_progressive_writer()) {
+        ControllerPrivateAccessor accessor(c);
+        H2ProgressiveAttachment* pa =
+            dynamic_cast<H2ProgressiveAttachment*>(accessor.progressive_writer());
+        if (pa) {
+            msg->_writer.reset(pa->writer());
+        }
+        // The request stream ends when users release the attachment, the
+        // controller should not hold it until the end of RPC.
+        accessor.reset_progressive_writer();
+    }
     return msg;
 }
 
@@ -1476,6 +2134,9 @@ void H2UnsentRequest::DestroyStreamUserData(SocketUniquePtr& sending_sock,
                                             int error_code,
                                             bool /*end_of_rpc*/) {
     RemoveRefOnQuit deref_self(this);
+    if (_writer != NULL && error_code != 0) {
+        _writer->Fail();
+    }
     if (sending_sock != NULL && error_code != 0) {
         CHECK_EQ(cntl, _cntl);
         std::unique_lock<butil::Mutex> mu(_mutex);
@@ -1569,11 +2230,7 @@ H2UnsentRequest::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
     HPacker& hpacker = ctx->hpacker();
     butil::IOBufAppender appender;
     HPackOptions options;
-    options.encode_name = FLAGS_h2_hpack_encode_name;
-    options.encode_value = FLAGS_h2_hpack_encode_value;
-    if (ctx->remote_settings().header_table_size == 0) {
-        options.index_policy = HPACK_NEVER_INDEX_HEADER;
-    }
+    GetHPackOptions(ctx, &options);
     
     for (size_t i = 0; i < _size; ++i) {
         hpacker.Encode(&appender, _list[i], options);
@@ -1582,14 +2239,24 @@ H2UnsentRequest::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
         const HttpHeader& h = _cntl->http_request();
         for (HttpHeader::HeaderIterator it = h.HeaderBegin();
              it != h.HeaderEnd(); ++it) {
-            HPacker::Header header(it->first, it->second);
-            hpacker.Encode(&appender, header, options);
+            hpacker.Encode(&appender, it->first, it->second, options);
         }
     }
     butil::IOBuf frag;
     appender.move_to(frag);
     butil::IOBuf dummy_buf;
-    PackH2Message(out, frag, dummy_buf, _cntl->request_attachment(), _stream_id, ctx);
+    PackH2Message(out, frag, dummy_buf, _cntl->request_attachment(),
+                  _stream_id, ctx, _writer == NULL);
+    if (_writer != NULL &&
+        !_writer->Start(socket, _stream_id,
+                        ctx->remote_settings().stream_window_size,
+                        false, out)) {
+        // The RPC is being failed.
+        char rstbuf[FRAME_HEAD_SIZE + 4];
+        SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, _stream_id);
+        SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_CANCEL);
+        out->append(rstbuf, sizeof(rstbuf));
+    }
     return butil::Status::OK();
 }
 
@@ -1647,6 +2314,13 @@ H2UnsentResponse::H2UnsentResponse(Controller* c, int stream_id, bool is_grpc)
         _grpc_status = ErrorCodeToGrpcStatus(c->ErrorCode());
         PercentEncode(c->ErrorText(), &_grpc_message);
     }
+    if (!c->Failed() && c->has_progressive_writer()) {
+        H2ProgressiveAttachment* pa = dynamic_cast<H2ProgressiveAttachment*>(
+            ControllerPrivateAccessor(c).progressive_writer());
+        if (pa) {
+            _writer.reset(pa->writer());
+        }
+    }
 }
 
 H2UnsentResponse* H2UnsentResponse::New(Controller* c, int stream_id, bool is_grpc) {
@@ -1692,6 +2366,9 @@ H2UnsentResponse::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
 #endif
     DestroyingPtr<H2UnsentResponse> destroy_self(this);
     if (socket == NULL) {
+        if (_writer != NULL) {
+            _writer->Fail();
+        }
         return butil::Status::OK();
     }
     H2Context* ctx = static_cast<H2Context*>(socket->parsing_context());
@@ -1714,11 +2391,7 @@ H2UnsentResponse::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
     HPacker& hpacker = ctx->hpacker();
     butil::IOBufAppender appender;
     HPackOptions options;
-    options.encode_name = FLAGS_h2_hpack_encode_name;
-    options.encode_value = FLAGS_h2_hpack_encode_value;
-    if (ctx->remote_settings().header_table_size == 0) {
-        options.index_policy = HPACK_NEVER_INDEX_HEADER;
-    }
+    GetHPackOptions(ctx, &options);
 
     for (size_t i = 0; i < _size; ++i) {
         hpacker.Encode(&appender, _list[i], options);
@@ -1726,13 +2399,27 @@ H2UnsentResponse::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
     if (_http_response) {
         for (HttpHeader::HeaderIterator it = _http_response->HeaderBegin();
              it != _http_response->HeaderEnd(); ++it) {
-            HPacker::Header header(it->first, it->second);
-            hpacker.Encode(&appender, header, options);
+            hpacker.Encode(&appender, it->first, it->second, options);
         }
     }
     butil::IOBuf frag;
     appender.move_to(frag);
 
+    if (_writer != NULL) {
+        // The body and trailers are sent by the writer.
+        butil::IOBuf dummy_buf;
+        PackH2Message(out, frag, dummy_buf, _data, _stream_id, ctx, false);
+        if (!_writer->Start(socket, _stream_id,
+                            ctx->remote_settings().stream_window_size,
+                            _is_grpc, out)) {
+            char rstbuf[FRAME_HEAD_SIZE + 4];
+            SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, _stream_id);
+            SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_INTERNAL_ERROR);
+            out->append(rstbuf, sizeof(rstbuf));
+        }
+        return butil::Status::OK();
+    }
+
     butil::IOBuf trailer_frag;
     if (_is_grpc) {
         HPacker::Header status_header("grpc-status",
@@ -1745,7 +2432,7 @@ H2UnsentResponse::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
         appender.move_to(trailer_frag);
     }
 
-    PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx);
+    PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx, true);
     return butil::Status::OK();
 }
 
@@ -25,6 +25,7 @@
 #include "brpc/details/hpack.h"
 #include "brpc/stream_creator.h"
 #include "brpc/controller.h"
+#include "brpc/progressive_attachment.h"
 
 #ifndef NDEBUG
 #include "bvar/bvar.h"
@@ -130,6 +131,86 @@ inline H2Bvars* get_h2_bvars() {
 }
 #endif
 
+// Sends the body of a http2 stream which is written progressively, namely
+// messages of a streaming gRPC. DATA frames are sent within flow-control
+// windows of the stream and the connection, data beyond the windows is
+// queued until WINDOW_UPDATE arrives.
+class H2StreamWriter : public SharedObject {
+public:
+    H2StreamWriter();
+
+    // Queue `data' and send as much as the windows allow.
+    // Returns 0 on success, -1 otherwise and errno is set to EOVERCROWDED
+    // when too much data is queued, or ECANCELED when the stream is broken.
+    int Write(butil::IOBuf* data);
+
+    // End the stream after all queued data is sent.
+    void Close();
+
+    // Stop sending, following Write() fails with ECANCELED.
+    void Fail();
+
+    // Called in AppendAndDestroySelf() of the message carrying HEADERS of
+    // the stream (without END_STREAM), after the HEADERS are packed in `out'.
+    // Queued data allowed by the windows is packed into `out' as well.
+    // The stream is ended with trailers of gRPC if `grpc_trailers' is true,
+    // otherwise with an empty DATA frame.
+    // Returns false if the writer was already started or failed.
+    bool Start(Socket* socket, int stream_id, int64_t stream_window,
+               bool grpc_trailers, butil::IOBuf* out);
+
+    // Change the stream-level remote window by `diff', call Flush() to
+    // send queued data.
+    // Returns false if the window overflows.
+    bool AddWindowSize(int64_t diff);
+
+    // Send queued data in the windows.
+    void Flush();
+
+    int stream_id() const { return _stream_id; }
+
+private:
+    // Cut data allowed by the windows into DATA frames. Returns true if the
+    // writer is closed and all data is packed, in which case the caller
+    // should end the stream. Must be called with _mutex held.
+    bool PackLocked(H2Context* ctx, butil::IOBuf* out);
+
+    butil::Mutex _mutex;
+    bool _grpc_trailers;
+    bool _flushing;
+    bool _closed;
+    bool _failed;
+    bool _end_sent;
+    int _stream_id;
+    SocketId _socket_id;
+    int64_t _window;
+    butil::IOBuf _pending;
+};
+
+// ProgressiveAttachment of a http2 stream. Unlike http/1.x, data is framed
+// and flow-controlled by H2StreamWriter and the stream is ended when this
+// object is destroyed.
+class H2ProgressiveAttachment : public ProgressiveAttachment {
+public:
+    // `movable_sock' is NULL at client-side where the socket is chosen
+    // after the attachment is created.
+    explicit H2ProgressiveAttachment(SocketUniquePtr& movable_sock);
+
+    // @ProgressiveAttachment
+    int Write(const butil::IOBuf& data) override;
+    int Write(const void* data, size_t n) override;
+
+    H2StreamWriter* writer() const { return _writer.get(); }
+
+protected:
+    ~H2ProgressiveAttachment() override;
+    // @ProgressiveAttachment
+    void MarkRPCAsDone(bool rpc_failed) override;
+
+private:
+    butil::intrusive_ptr<H2StreamWriter> _writer;
+};
+
 class H2UnsentRequest : public SocketMessage, public StreamUserData {
 friend void PackH2Request(butil::IOBuf*, SocketMessage**,
                           uint64_t, const google::protobuf::MethodDescriptor*,
@@ -190,6 +271,7 @@ private:
     mutable butil::Mutex _mutex;
     Controller* _cntl;
     std::unique_ptr<H2StreamContext> _sctx;
+    butil::intrusive_ptr<H2StreamWriter> _writer;
     HPacker::Header _list[0];
 };
 
@@ -222,6 +304,7 @@ private:
     bool _is_grpc;
     GrpcStatus _grpc_status;
     std::string _grpc_message;
+    butil::intrusive_ptr<H2StreamWriter> _writer;
     HPacker::Header _list[0];
 };
 
@@ -260,11 +343,30 @@ public:
 
     bool ConsumeWindowSize(int64_t size);
 
+    // Trailing headers received after the body was handed to users, NULL
+    // if there's none.
+    const HttpHeader* trailers() const { return _trailers.get(); }
+
+    // End the progressively-read body with `st' and release the reference
+    // held for stage2. Called when the stream is broken.
+    void AbortProgressiveRead(const butil::Status& st);
+
+    // @ReadableProgressiveAttachment
+    void ReadProgressiveAttachmentBy(ProgressiveReader* r) override;
+
 #if defined(BRPC_H2_STREAM_STATE)
     H2StreamState state() const { return _state; }
     void SetState(H2StreamState state);
 #endif
 
+private:
+    // Called when the first header block is complete and the stream is not
+    // ended yet. Hand the message to users before the body arrives if it
+    // should be read progressively.
+    H2ParseResult OnHeadersComplete();
+    // Send the stream-level WINDOW_UPDATE held before a body reader is set.
+    void ReleaseHeldWindowUpdate();
+
 friend class H2Context;
     H2Context* _conn_ctx;
 #if defined(BRPC_H2_STREAM_STATE)
@@ -272,10 +374,18 @@ friend class H2Context;
 #endif
     int _stream_id;
     bool _stream_ended;
+    bool _headers_ended;
     butil::atomic<int64_t> _remote_window_left;
     butil::atomic<int64_t> _deferred_window_update;
+    // Stream-level window consumed by the body which is buffered since no
+    // reader is set, sent back after ReadProgressiveAttachmentBy() so that
+    // the buffered body is bounded by the window.
+    butil::atomic<int64_t> _held_window_update;
+    butil::atomic<bool> _has_body_reader;
+    SocketId _socket_id;
     uint64_t _correlation_id;
     butil::IOBuf _remaining_header_fragment;
+    std::unique_ptr<HttpHeader> _trailers;
 };
 
 StreamCreator* get_h2_global_stream_creator();
@@ -351,8 +461,22 @@ public:
     void DeferWindowUpdate(int64_t);
     int64_t ReleaseDeferredWindowUpdate();
 
+    // Size of the connection-level window advertised to the remote side.
+    int64_t local_conn_window_size() const
+    { return _local_conn_window_size.load(butil::memory_order_relaxed); }
+
+    // Track `w' to deliver WINDOW_UPDATE, SETTINGS and RST_STREAM of its
+    // stream. Returns false if the stream is already tracked.
+    bool AddWriter(H2StreamWriter* w);
+    void RemoveWriter(int stream_id);
+
+    // Take at most `size' bytes from the connection-level remote window.
+    // Returns bytes taken.
+    int64_t TakeRemoteWindow(int64_t size);
+
 private:
 friend class H2StreamContext;
+friend class H2StreamWriter;
 friend class H2UnsentRequest;
 friend class H2UnsentResponse;
 friend void InitFrameHandlers();
@@ -374,10 +498,22 @@ friend void InitFrameHandlers();
     void RemoveGoAwayStreams(int goaway_stream_id, std::vector<H2StreamContext*>* out_streams);
 
     H2StreamContext* FindStream(int stream_id);
+    butil::intrusive_ptr<H2StreamWriter> FindWriter(int stream_id);
+    // Remove the writer of `stream_id' and stop it.
+    // Returns true if the writer exists.
+    bool FailWriter(int stream_id);
+
+    // Estimate the bandwidth-delay product(BDP) of the connection by bytes
+    // received between a PING and its ACK, and enlarge local windows when
+    // the remote side is limited by them. Called on every DATA frame.
+    void ProbeBdp(uint32_t size);
+    // Returns false if the PING-ACK does not belong to a BDP probe.
+    bool OnBdpPingAck(uint64_t ping_data);
 
     // True if the connection is established by client, otherwise it's
     // accepted by server.
     Socket* _socket;
+    const Server* _server;
     butil::atomic<int64_t> _remote_window_left;
     H2ConnectionState _conn_state;
     int _last_received_stream_id;
@@ -393,7 +529,20 @@ friend void InitFrameHandlers();
     typedef butil::FlatMap<int, H2StreamContext*> StreamMap;
     mutable butil::Mutex _stream_mutex;
     StreamMap _pending_streams;
+    typedef butil::FlatMap<int, butil::intrusive_ptr<H2StreamWriter> > WriterMap;
+    // Streams being written progressively, protected by _stream_mutex.
+    WriterMap _writers;
     butil::atomic<int64_t> _deferred_window_update;
+    butil::atomic<int64_t> _local_conn_window_size;
+    // Following fields are only accessed in the parsing thread.
+    bool _bdp_ping_inflight;
+    uint64_t _bdp_ping_data;
+    int64_t _bdp_ping_start_us;
+    int64_t _bdp_bytes;
+    int64_t _bdp_next_probe_us;
+    int64_t _bdp_probe_interval_us;
+    int64_t _bdp;
+    int64_t _bdp_rtt_us;
 };
 
 inline int H2Context::AllocateClientStreamId() {
@@ -20,6 +20,7 @@
 #include <google/protobuf/text_format.h>
 #include <gflags/gflags.h>
 #include <string>
+#include <limits.h>
 #include "brpc/policy/http_rpc_protocol.h"
 #include "butil/unique_ptr.h"                       // std::unique_ptr
 #include "butil/string_splitter.h"                  // StringMultiSplitter
@@ -40,8 +41,11 @@
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/builtin/index_service.h"             // IndexService
 #include "brpc/policy/gzip_compress.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/policy/zstd_compress.h"
 #include "brpc/policy/http2_rpc_protocol.h"
 #include "brpc/details/usercode_backup_pool.h"
+#include "brpc/details/inherited_deadline.h"
 #include "brpc/grpc.h"
 
 extern "C" {
@@ -76,6 +80,10 @@ DEFINE_bool(pb_enum_as_number, false,
             "server-side");
 
 DEFINE_string(request_id_header, "x-request-id", "The http header to mark a session");
+DEFINE_bool(http_deliver_deadline, false,
+            "If this flag is true, http/h2 puts deadlines (since the Epoch) in "
+            "the x-bd-deadline header of requests, clocks of clients and "
+            "servers should be synced.");
 
 DEFINE_bool(use_http_error_code, false, "Whether set the x-bd-error-code header "
                                         "of http response to brpc error code");
@@ -134,6 +142,8 @@ CommonStrings::CommonStrings()
     , KEEP_ALIVE("keep-alive")
     , CLOSE("close")
     , LOG_ID("log-id")
+    , PRIORITY("x-bd-priority")
+    , DEADLINE("x-bd-deadline")
     , DEFAULT_METHOD("default_method")
     , NO_METHOD("no_method")
     , H2_SCHEME(":scheme")
@@ -220,6 +230,74 @@ HttpContentType ParseContentType(butil::StringPiece ct, bool* is_grpc_ct) {
     return (ct.empty() || ct.front() == ';') ? type : HTTP_CONTENT_OTHERS;
 }
 
+// Content-coding (also used in grpc-encoding) of `type', NULL if http
+// bodies can't be compressed with `type'.
+static const char* HttpContentCodingOf(CompressType type) {
+    switch (type) {
+    case COMPRESS_TYPE_GZIP:
+        return "gzip";
+    case COMPRESS_TYPE_ZSTD:
+        return FindCompressHandler(type) ? "zstd" : NULL;
+    case COMPRESS_TYPE_LZ4:
+        return FindCompressHandler(type) ? "lz4" : NULL;
+    default:
+        return NULL;
+    }
+}
+
+static bool CompressHttpBody(CompressType type, const butil::IOBuf& in,
+                             butil::IOBuf* out) {
+    switch (type) {
+    case COMPRESS_TYPE_GZIP:
+        return GzipCompress(in, out, NULL);
+    case COMPRESS_TYPE_ZSTD:
+        return ZstdCompress(in, out);
+    case COMPRESS_TYPE_LZ4:
+        return Lz4Compress(in, out);
+    default:
+        return false;
+    }
+}
+
+// Decompress `body' in-place if it's encoded with `coding'. Bodies in
+// unknown codings are left as they are.
+// Returns false if the decompression failed.
+static bool DecompressHttpBody(const std::string* coding, butil::IOBuf* body) {
+    if (coding == NULL) {
+        return true;
+    }
+    butil::IOBuf uncompressed;
+    bool ok;
+    if (*coding == common->GZIP) {
+        ok = GzipDecompress(*body, &uncompressed);
+    } else if (*coding == "zstd" && FindCompressHandler(COMPRESS_TYPE_ZSTD)) {
+        ok = ZstdDecompress(*body, &uncompressed);
+    } else if (*coding == "lz4" && FindCompressHandler(COMPRESS_TYPE_LZ4)) {
+        ok = Lz4Decompress(*body, &uncompressed);
+    } else {
+        return true;
+    }
+    if (ok) {
+        body->swap(uncompressed);
+    }
+    return ok;
+}
+
+// Value of grpc-accept-encoding sent by clients.
+static const std::string& GrpcAcceptEncoding() {
+    static const std::string value = []() {
+        std::string v = "identity,gzip";
+        if (FindCompressHandler(COMPRESS_TYPE_ZSTD)) {
+            v.append(",zstd");
+        }
+        if (FindCompressHandler(COMPRESS_TYPE_LZ4)) {
+            v.append(",lz4");
+        }
+        return v;
+    }();
+    return value;
+}
+
 static void PrintMessage(const butil::IOBuf& inbuf,
                          bool request_or_response,
                          bool has_content) {
@@ -276,12 +354,11 @@ static bool RemoveGrpcPrefix(butil::IOBuf* body, bool* compressed) {
 static bool JsonToProtoMessage(const butil::IOBuf& body,
                                google::protobuf::Message* message,
                                Controller* cntl, int error_code) {
-    butil::IOBufAsZeroCopyInputStream wrapper(body);
     json2pb::Json2PbOptions options;
     options.base64_to_bytes = cntl->has_pb_bytes_to_base64();
     options.array_to_single_repeated = cntl->has_pb_single_repeated_to_array();
     std::string error;
-    bool ok = json2pb::JsonToProtoMessage(&wrapper, message, options, &error);
+    bool ok = json2pb::JsonToProtoMessage(body, message, options, &error);
     if (!ok) {
         cntl->SetFailed(error_code, "Fail to parse http json body as %s: %s",
                         message->GetDescriptor()->full_name().c_str(),
@@ -291,7 +368,7 @@ static bool JsonToProtoMessage(const butil::IOBuf& body,
 }
 
 static bool ProtoMessageToJson(const google::protobuf::Message& message,
-                               butil::IOBufAsZeroCopyOutputStream* wrapper,
+                               butil::IOBuf* body,
                                Controller* cntl, int error_code) {
     json2pb::Pb2JsonOptions options;
     options.bytes_to_base64 = cntl->has_pb_bytes_to_base64();
@@ -302,7 +379,7 @@ static bool ProtoMessageToJson(const google::protobuf::Message& message,
                           ? json2pb::OUTPUT_ENUM_BY_NUMBER
                           : json2pb::OUTPUT_ENUM_BY_NAME;
     std::string error;
-    bool ok = json2pb::ProtoMessageToJson(message, wrapper, options, &error);
+    bool ok = json2pb::ProtoMessageToJson(message, body, options, &error);
     if (!ok) {
         cntl->SetFailed(error_code, "Fail to convert %s to json: %s",
                         message.GetDescriptor()->full_name().c_str(),
@@ -404,7 +481,9 @@ void ProcessHttpResponse(InputMessageBase* msg) {
                 }
             }
         } else if (is_grpc) {
-            if (!RemoveGrpcPrefix(&res_body, &grpc_compressed)) {
+            // Messages read progressively are split by users.
+            if (!imsg_guard->read_body_progressively() &&
+                !RemoveGrpcPrefix(&res_body, &grpc_compressed)) {
                 cntl->SetFailed(ERESPONSE, "Invalid gRPC response");
                 break;
             }
@@ -448,7 +527,7 @@ void ProcessHttpResponse(InputMessageBase* msg) {
                                 static_cast<int>(res_header->status_code()),
                                 res_header->reason_phrase(),
                                 (int)body_str.size(), body_str.c_str());
-            } else if (cntl->response() != NULL &&
+            } else if (!is_grpc && cntl->response() != NULL &&
                        cntl->response()->GetDescriptor()->field_count() != 0) {
                 cntl->SetFailed(ERESPONSE, "A protobuf response can't be parsed"
                                 " from progressively-read HTTP body");
@@ -514,15 +593,14 @@ void ProcessHttpResponse(InputMessageBase* msg) {
         } else {
             encoding = res_header->GetHeader(common->CONTENT_ENCODING);
         }
-        if (encoding != NULL && *encoding == common->GZIP) {
+        if (encoding != NULL) {
             TRACEPRINTF("Decompressing response=%lu",
                         (unsigned long)res_body.size());
-            butil::IOBuf uncompressed;
-            if (!policy::GzipDecompress(res_body, &uncompressed)) {
-                cntl->SetFailed(ERESPONSE, "Fail to un-gzip response body");
+            if (!DecompressHttpBody(encoding, &res_body)) {
+                cntl->SetFailed(ERESPONSE, "Fail to decompress response body "
+                                "encoded with %s", encoding->c_str());
                 break;
             }
-            res_body.swap(uncompressed);
         }
         if (content_type == HTTP_CONTENT_PROTO) {
             if (!ParsePbFromIOBuf(cntl->response(), res_body)) {
@@ -578,7 +656,20 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
             hreq.set_content_type(param);
         }
     }
-    if (pbreq != NULL) {
+    if (cntl->has_progressive_writer()) {
+        if (!is_http2) {
+            return cntl->SetFailed(EREQUEST, "Only h2 supports writing the "
+                                   "request progressively");
+        }
+        if (!cntl->request_attachment().empty()) {
+            return cntl->SetFailed(EREQUEST, "request_attachment must be empty "
+                                   "when the request is written progressively");
+        }
+        // The body is written by users, `pbreq' is not serialized.
+        bool is_grpc_ct = false;
+        ParseContentType(hreq.content_type(), &is_grpc_ct);
+        is_grpc = is_grpc_ct;
+    } else if (pbreq != NULL) {
         // If request is not NULL, message body will be serialized proto/json,
         if (!pbreq->IsInitialized()) {
             return cntl->SetFailed(
@@ -626,7 +717,8 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
                 return;
             }
         } else if (content_type == HTTP_CONTENT_JSON) {
-            if (!ProtoMessageToJson(*pbreq, &wrapper, cntl, EREQUEST)) {
+            if (!ProtoMessageToJson(*pbreq, &cntl->request_attachment(),
+                                    cntl, EREQUEST)) {
                 cntl->request_attachment().clear();
                 return;
             }
@@ -646,7 +738,8 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
     }
     bool grpc_compressed = false;
     if (cntl->request_compress_type() != COMPRESS_TYPE_NONE) {
-        if (cntl->request_compress_type() != COMPRESS_TYPE_GZIP) {
+        const char* coding = HttpContentCodingOf(cntl->request_compress_type());
+        if (coding == NULL) {
             return cntl->SetFailed(EREQUEST, "http does not support %s",
                             CompressTypeToCStr(cntl->request_compress_type()));
         }
@@ -654,16 +747,18 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
         if (request_size >= (size_t)FLAGS_http_body_compress_threshold) {
             TRACEPRINTF("Compressing request=%lu", (unsigned long)request_size);
             butil::IOBuf compressed;
-            if (GzipCompress(cntl->request_attachment(), &compressed, NULL)) {
+            if (CompressHttpBody(cntl->request_compress_type(),
+                                 cntl->request_attachment(), &compressed)) {
                 cntl->request_attachment().swap(compressed);
                 if (is_grpc) {
                     grpc_compressed = true;
-                    hreq.SetHeader(common->GRPC_ENCODING, common->GZIP);
+                    hreq.SetHeader(common->GRPC_ENCODING, coding);
                 } else {
-                    hreq.SetHeader(common->CONTENT_ENCODING, common->GZIP);
+                    hreq.SetHeader(common->CONTENT_ENCODING, coding);
                 }
             } else {
-                cntl->SetFailed("Fail to gzip the request body, skip compressing");
+                cntl->SetFailed(butil::string_printf(
+                    "Fail to %s the request body, skip compressing", coding));
             }
         }
     }
@@ -676,6 +771,14 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
     if (!cntl->request_id().empty()) {
         hreq.SetHeader(FLAGS_request_id_header, cntl->request_id());
     }
+    if (cntl->request_priority() != 0) {
+        hreq.SetHeader(common->PRIORITY,
+                       butil::string_printf("%d", cntl->request_priority()));
+    }
+    if (FLAGS_http_deliver_deadline && cntl->deadline_us() >= 0) {
+        hreq.SetHeader(common->DEADLINE, butil::string_printf(
+                           "%" PRId64, cntl->deadline_us()));
+    }
 
     if (!is_http2) {
         // HTTP before 1.1 needs to set keep-alive explicitly.
@@ -687,18 +790,17 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
     } else {
         cntl->set_stream_creator(get_h2_global_stream_creator());
         if (is_grpc) {
-            /*
-            hreq.SetHeader(common->GRPC_ACCEPT_ENCODING,
-                              common->GRPC_ACCEPT_ENCODING_VALUE);
-            */
+            hreq.SetHeader(common->GRPC_ACCEPT_ENCODING, GrpcAcceptEncoding());
             // TODO: do we need this?
             hreq.SetHeader(common->TE, common->TRAILERS);
             if (cntl->timeout_ms() >= 0) {
                 hreq.SetHeader(common->GRPC_TIMEOUT,
                         butil::string_printf("%" PRId64 "m", cntl->timeout_ms()));
             }
-            // Append compressed and length before body
-            AddGrpcPrefix(&cntl->request_attachment(), grpc_compressed);
+            if (!cntl->has_progressive_writer()) {
+                // Append compressed and length before body
+                AddGrpcPrefix(&cntl->request_attachment(), grpc_compressed);
+            }
         }
     }
 
@@ -763,10 +865,12 @@ void PackHttpRequest(butil::IOBuf* buf,
     }
 }
 
-inline bool SupportGzip(Controller* cntl) {
-    const std::string* encodings =
-        cntl->http_request().GetHeader(common->ACCEPT_ENCODING);
-    return (encodings && encodings->find(common->GZIP) != std::string::npos);
+// True if the client accepts responses encoded with `coding'.
+inline bool SupportContentCoding(Controller* cntl, bool is_grpc,
+                                 const char* coding) {
+    const std::string* encodings = cntl->http_request().GetHeader(
+        is_grpc ? common->GRPC_ACCEPT_ENCODING : common->ACCEPT_ENCODING);
+    return (encodings && encodings->find(coding) != std::string::npos);
 }
 
 class HttpResponseSender {
@@ -874,6 +978,8 @@ HttpResponseSender::~HttpResponseSender() {
         // ^ user did not fill the body yet.
         res->GetDescriptor()->field_count() > 0 &&
         // ^ a pb service
+        !cntl->has_progressive_writer() &&
+        // ^ the body is written by users.
         !cntl->Failed()) {
         // ^ pb response in failed RPC is undefined, no need to convert.
         
@@ -889,7 +995,8 @@ HttpResponseSender::~HttpResponseSender() {
         } else if (content_type == HTTP_CONTENT_PROTO_JSON) {
             ProtoMessageToProtoJson(*res, &wrapper, cntl, ERESPONSE);
         } else {
-            ProtoMessageToJson(*res, &wrapper, cntl, ERESPONSE);
+            ProtoMessageToJson(*res, &cntl->response_attachment(),
+                               cntl, ERESPONSE);
         }
     }
 
@@ -964,22 +1071,28 @@ HttpResponseSender::~HttpResponseSender() {
                 " ignored when CreateProgressiveAttachment() was called";
         }
         // not set_content to enable chunked mode.
-    } else if (cntl->response_compress_type() == COMPRESS_TYPE_GZIP) {
+    } else if (HttpContentCodingOf(cntl->response_compress_type()) != NULL) {
+        const CompressType type = cntl->response_compress_type();
+        const char* coding = HttpContentCodingOf(type);
         const size_t response_size = cntl->response_attachment().size();
+        // gzip is always accepted by h2 clients, other codings must be
+        // listed in accept-encoding(grpc-accept-encoding).
         if (response_size >= (size_t)FLAGS_http_body_compress_threshold
-            && (is_http2 || SupportGzip(cntl))) {
+            && ((type == COMPRESS_TYPE_GZIP && is_http2) ||
+                SupportContentCoding(cntl, is_grpc, coding))) {
             TRACEPRINTF("Compressing response=%lu", (unsigned long)response_size);
             butil::IOBuf tmpbuf;
-            if (GzipCompress(cntl->response_attachment(), &tmpbuf, NULL)) {
+            if (CompressHttpBody(type, cntl->response_attachment(), &tmpbuf)) {
                 cntl->response_attachment().swap(tmpbuf);
                 if (is_grpc) {
                     grpc_compressed = true;
-                    res_header->SetHeader(common->GRPC_ENCODING, common->GZIP);
+                    res_header->SetHeader(common->GRPC_ENCODING, coding);
                 } else {
-                    res_header->SetHeader(common->CONTENT_ENCODING, common->GZIP);
+                    res_header->SetHeader(common->CONTENT_ENCODING, coding);
                 }
             } else {
-                LOG(ERROR) << "Fail to gzip the http response, skip compression.";
+                LOG(ERROR) << "Fail to " << coding
+                           << " the http response, skip compression.";
             }
         }
     } else {
@@ -1002,7 +1115,10 @@ HttpResponseSender::~HttpResponseSender() {
         wopt.notify_on_success = true;
     }
     if (is_http2) {
-        if (is_grpc) {
+        if (!cntl->Failed() && cntl->has_progressive_writer()) {
+            // Ignored as in http/1.x, messages are written by users.
+            cntl->response_attachment().clear();
+        } else if (is_grpc) {
             // Append compressed and length before body
             AddGrpcPrefix(&cntl->response_attachment(), grpc_compressed);
         }
@@ -1418,6 +1534,14 @@ void EndRunningCallMethodInPool(
     ::google::protobuf::Message* response,
     ::google::protobuf::Closure* done);
 
+// Deadlines may come from both x-bd-deadline and grpc-timeout, the earlier
+// one wins so that an inherited deadline is never loosened.
+static void SetEarlierDeadline(Controller* cntl, int64_t deadline_us) {
+    if (cntl->deadline_us() < 0 || deadline_us < cntl->deadline_us()) {
+        ControllerPrivateAccessor(cntl).set_deadline_us(deadline_us);
+    }
+}
+
 void ProcessHttpRequest(InputMessageBase *msg) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
     DestroyingPtr<HttpContext> imsg_guard(static_cast<HttpContext*>(msg));
@@ -1481,6 +1605,32 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         cntl->set_request_id(*request_id);
     }
 
+    const std::string* priority_str = req_header.GetHeader(common->PRIORITY);
+    if (priority_str) {
+        char* priority_end = NULL;
+        errno = 0;
+        const long priority = strtol(priority_str->c_str(), &priority_end, 10);
+        if (*priority_end || errno || priority < INT_MIN || priority > INT_MAX) {
+            LOG(ERROR) << "Invalid " << common->PRIORITY << '='
+                       << *priority_str << " in http request";
+        } else {
+            cntl->set_request_priority((int)priority);
+        }
+    }
+
+    const std::string* deadline_str = req_header.GetHeader(common->DEADLINE);
+    if (deadline_str) {
+        char* deadline_end = NULL;
+        errno = 0;
+        const int64_t deadline_us = strtoll(deadline_str->c_str(), &deadline_end, 10);
+        if (*deadline_end || errno || deadline_us < 0) {
+            LOG(ERROR) << "Invalid " << common->DEADLINE << '='
+                       << *deadline_str << " in http request";
+        } else {
+            SetEarlierDeadline(cntl, deadline_us);
+        }
+    }
+
     // Tag the bthread with this server's key for
     // thread_local_data().
     if (server->thread_local_options().thread_local_data_factory) {
@@ -1568,7 +1718,7 @@ void ProcessHttpRequest(InputMessageBase *msg) {
     resp_sender.set_method_status(method_status);
     if (method_status) {
         int rejected_cc = 0;
-        if (!method_status->OnRequested(&rejected_cc)) {
+        if (!method_status->OnRequested(&rejected_cc, cntl)) {
             cntl->SetFailed(ELIMIT, "Rejected by %s's ConcurrencyLimiter, concurrency=%d",
                             mp->method->full_name().c_str(), rejected_cc);
             return;
@@ -1621,7 +1771,19 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         cntl->SetFailed("Fail to new req or res");
         return;
     }
-    if (mp->params.allow_http_body_to_pb &&
+    if (is_http2 && imsg_guard->read_body_progressively()) {
+        // The body, namely messages of a streaming gRPC, is read by users.
+        accessor.set_readable_progressive_attachment(imsg_guard.get());
+        bool is_grpc_ct = false;
+        ParseContentType(req_header.content_type(), &is_grpc_ct);
+        if (is_grpc_ct) {
+            int64_t timeout_value_us =
+                ConvertGrpcTimeoutToUS(req_header.GetHeader(common->GRPC_TIMEOUT));
+            if (timeout_value_us >= 0) {
+                SetEarlierDeadline(cntl, butil::gettimeofday_us() + timeout_value_us);
+            }
+        }
+    } else if (mp->params.allow_http_body_to_pb &&
         method->input_type()->field_count() > 0) {
         // A protobuf service. No matter if Content-type is set to
         // applcation/json or body is empty, we have to treat body as a json
@@ -1658,21 +1820,19 @@ void ProcessHttpRequest(InputMessageBase *msg) {
                 int64_t timeout_value_us =
                     ConvertGrpcTimeoutToUS(req_header.GetHeader(common->GRPC_TIMEOUT));
                 if (timeout_value_us >= 0) {
-                    accessor.set_deadline_us(
-                            butil::gettimeofday_us() + timeout_value_us);
+                    SetEarlierDeadline(cntl, butil::gettimeofday_us() + timeout_value_us);
                 }
             } else { // http or h2 but not grpc
                 encoding = req_header.GetHeader(common->CONTENT_ENCODING);
             }
-            if (encoding != NULL && *encoding == common->GZIP) {
+            if (encoding != NULL) {
                 TRACEPRINTF("Decompressing request=%lu",
                             (unsigned long)req_body.size());
-                butil::IOBuf uncompressed;
-                if (!policy::GzipDecompress(req_body, &uncompressed)) {
-                    cntl->SetFailed(EREQUEST, "Fail to un-gzip request body");
+                if (!DecompressHttpBody(encoding, &req_body)) {
+                    cntl->SetFailed(EREQUEST, "Fail to decompress request body "
+                                    "encoded with %s", encoding->c_str());
                     return;
                 }
-                req_body.swap(uncompressed);
             }
             if (content_type == HTTP_CONTENT_PROTO) {
                 if (!ParsePbFromIOBuf(req, req_body)) {
@@ -1726,6 +1886,7 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         span->set_start_callback_us(butil::cpuwide_time_us());
         span->AsParent();
     }
+    InheritedDeadlineScope deadline_scope(cntl->deadline_us());
     if (!FLAGS_usercode_in_pthread) {
         return svc->CallMethod(method, cntl, req, res, done);
     }
@@ -1786,5 +1947,25 @@ void HttpContext::CheckProgressiveRead(const void* arg, Socket *socket) {
     }
 }
 
+bool HttpContext::IsProgressiveReadRequest(const Server* server) {
+    if (server == NULL) {
+        return false;
+    }
+    bool is_grpc_ct = false;
+    ParseContentType(header().content_type(), &is_grpc_ct);
+    const bool is_grpc = (is_grpc_ct && header().is_http2());
+    if (!is_grpc && !server->has_progressive_read_method()) {
+        return false;
+    }
+    const Server::MethodProperty *const sp = FindMethodPropertyByURI(
+        header().uri().path(), const_cast<Server*>(server),
+        const_cast<std::string *>(&header().unresolved_path()));
+    if (sp == NULL) {
+        return false;
+    }
+    return sp->params.enable_progressive_read ||
+        (is_grpc && sp->method != NULL && sp->method->client_streaming());
+}
+
 }  // namespace policy
 } // namespace brpc
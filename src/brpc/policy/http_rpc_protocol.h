@@ -24,6 +24,9 @@
 #include "brpc/protocol.h"
 
 namespace brpc {
+
+class Server;
+
 namespace policy {
 
 // Put commonly used std::strings (or other constants that need memory
@@ -53,6 +56,8 @@ struct CommonStrings {
     // rename this to `x-bd-log-id'.
     // NOTE: Keep in mind that this name also appears inside `http_message.cpp'
     std::string LOG_ID;
+    std::string PRIORITY;
+    std::string DEADLINE;
     std::string DEFAULT_METHOD;
     std::string NO_METHOD;
     std::string H2_SCHEME;
@@ -120,6 +125,11 @@ public:
 
     void CheckProgressiveRead(const void* arg, Socket *socket);
 
+    // True if the body of this request to `server' should be read
+    // progressively: the method enables progressive read or it's a
+    // client-streaming gRPC.
+    bool IsProgressiveReadRequest(const Server* server);
+
 private:
     bool _is_stage2;
 };
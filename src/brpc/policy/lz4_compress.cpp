@@ -0,0 +1,260 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifdef BRPC_WITH_LZ4
+#include <lz4frame.h>
+#endif
+#include <string.h>                         // memset
+#include <memory>
+#include "butil/logging.h"
+#include "butil/thread_local.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/protocol.h"
+#include "brpc/compress.h"
+
+namespace brpc {
+namespace policy {
+
+bool Lz4Compress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    bool ok;
+    if (msg.GetDescriptor() == Serializer::descriptor()) {
+        ok = ((const Serializer&)msg).SerializeTo(&wrapper);
+    } else {
+        ok = msg.SerializeToZeroCopyStream(&wrapper);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to serialize input pb="
+                     << msg.GetDescriptor()->full_name();
+        return false;
+    }
+    return Lz4Compress(serialized_pb, buf);
+}
+
+bool Lz4Decompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (!Lz4Decompress(data, &binary_pb)) {
+        return false;
+    }
+    bool ok;
+    butil::IOBufAsZeroCopyInputStream stream(binary_pb);
+    if (msg->GetDescriptor() == Deserializer::descriptor()) {
+        ok = ((Deserializer*)msg)->DeserializeFrom(&stream);
+    } else {
+        ok = msg->ParseFromZeroCopyStream(&stream);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to deserialize input message="
+                     << msg->GetDescriptor()->full_name();
+    }
+    return ok;
+}
+
+#ifdef BRPC_WITH_LZ4
+
+// Input is fed to LZ4F_compressUpdate in pieces not larger than this, so
+// that the output of each piece fits in a fixed buffer.
+static const size_t LZ4_INPUT_PIECE_SIZE = 8192;
+
+// Contexts are reused by threads since creating them is not cheap.
+// (De)compression never yields, so sharing them between bthreads on the
+// same pthread is safe.
+struct Lz4Contexts {
+    LZ4F_cctx* cctx;
+    LZ4F_dctx* dctx;
+    std::unique_ptr<char[]> out_buf;
+    size_t out_buf_size;
+};
+
+static void DeleteLz4Contexts(void* arg) {
+    Lz4Contexts* ctx = static_cast<Lz4Contexts*>(arg);
+    if (ctx->cctx) {
+        LZ4F_freeCompressionContext(ctx->cctx);
+    }
+    if (ctx->dctx) {
+        LZ4F_freeDecompressionContext(ctx->dctx);
+    }
+    delete ctx;
+}
+
+static BAIDU_THREAD_LOCAL Lz4Contexts* tls_lz4_contexts = NULL;
+
+static LZ4F_preferences_t MakeLz4Preferences() {
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+    prefs.frameInfo.blockMode = LZ4F_blockLinked;
+    // Emit a block for every piece so that the output of LZ4F_compressUpdate
+    // is bounded by the size of the piece.
+    prefs.autoFlush = 1;
+    return prefs;
+}
+
+static const LZ4F_preferences_t* GetLz4Preferences() {
+    static const LZ4F_preferences_t prefs = MakeLz4Preferences();
+    return &prefs;
+}
+
+static Lz4Contexts* GetLz4Contexts() {
+    Lz4Contexts* ctx = tls_lz4_contexts;
+    if (ctx != NULL) {
+        return ctx;
+    }
+    ctx = new (std::nothrow) Lz4Contexts;
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ctx->cctx = NULL;
+    ctx->dctx = NULL;
+    if (LZ4F_isError(LZ4F_createCompressionContext(&ctx->cctx, LZ4F_VERSION)) ||
+        LZ4F_isError(LZ4F_createDecompressionContext(&ctx->dctx, LZ4F_VERSION))) {
+        LOG(ERROR) << "Fail to create lz4 contexts";
+        DeleteLz4Contexts(ctx);
+        return NULL;
+    }
+    ctx->out_buf_size = std::max(
+        LZ4F_compressBound(LZ4_INPUT_PIECE_SIZE, GetLz4Preferences()),
+        (size_t)LZ4F_HEADER_SIZE_MAX);
+    ctx->out_buf.reset(new char[ctx->out_buf_size]);
+    tls_lz4_contexts = ctx;
+    butil::thread_atexit(DeleteLz4Contexts, ctx);
+    return ctx;
+}
+
+bool Lz4Compress(const butil::IOBuf& in, butil::IOBuf* out) {
+    Lz4Contexts* ctx = GetLz4Contexts();
+    if (ctx == NULL) {
+        return false;
+    }
+    const LZ4F_preferences_t* prefs = GetLz4Preferences();
+    char* const out_buf = ctx->out_buf.get();
+    size_t rc = LZ4F_compressBegin(ctx->cctx, out_buf, ctx->out_buf_size, prefs);
+    if (LZ4F_isError(rc)) {
+        LOG(WARNING) << "Fail to LZ4F_compressBegin: " << LZ4F_getErrorName(rc);
+        return false;
+    }
+    out->append(out_buf, rc);
+    // Compress blocks of `in' in place without flattening it.
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i < nblock; ++i) {
+        butil::StringPiece block = in.backing_block(i);
+        while (!block.empty()) {
+            const size_t n = std::min(block.size(), LZ4_INPUT_PIECE_SIZE);
+            rc = LZ4F_compressUpdate(ctx->cctx, out_buf, ctx->out_buf_size,
+                                     block.data(), n, NULL);
+            if (LZ4F_isError(rc)) {
+                LOG(WARNING) << "Fail to LZ4F_compressUpdate: "
+                             << LZ4F_getErrorName(rc);
+                return false;
+            }
+            out->append(out_buf, rc);
+            block.remove_prefix(n);
+        }
+    }
+    rc = LZ4F_compressEnd(ctx->cctx, out_buf, ctx->out_buf_size, NULL);
+    if (LZ4F_isError(rc)) {
+        LOG(WARNING) << "Fail to LZ4F_compressEnd: " << LZ4F_getErrorName(rc);
+        return false;
+    }
+    out->append(out_buf, rc);
+    return true;
+}
+
+bool Lz4Decompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    Lz4Contexts* ctx = GetLz4Contexts();
+    if (ctx == NULL) {
+        return false;
+    }
+    // Decompress into blocks of `out' directly.
+    butil::IOBufAsZeroCopyOutputStream stream(out);
+    void* dst = NULL;
+    int dst_size = 0;
+    int dst_used = 0;
+    size_t rc = 1;
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i < nblock && rc != 0; ++i) {
+        butil::StringPiece block = in.backing_block(i);
+        while (!block.empty()) {
+            if (dst_used == dst_size) {
+                if (!stream.Next(&dst, &dst_size)) {
+                    LZ4F_resetDecompressionContext(ctx->dctx);
+                    return false;
+                }
+                dst_used = 0;
+            }
+            size_t dst_n = dst_size - dst_used;
+            size_t src_n = block.size();
+            rc = LZ4F_decompress(ctx->dctx, (char*)dst + dst_used, &dst_n,
+                                 block.data(), &src_n, NULL);
+            if (LZ4F_isError(rc)) {
+                LOG(WARNING) << "Fail to LZ4F_decompress: "
+                             << LZ4F_getErrorName(rc);
+                LZ4F_resetDecompressionContext(ctx->dctx);
+                stream.BackUp(dst_size - dst_used);
+                return false;
+            }
+            dst_used += dst_n;
+            block.remove_prefix(src_n);
+            if (rc == 0) {
+                // End of the frame.
+                break;
+            }
+        }
+    }
+    // Flush data buffered in the context.
+    while (rc != 0) {
+        if (dst_used == dst_size) {
+            if (!stream.Next(&dst, &dst_size)) {
+                LZ4F_resetDecompressionContext(ctx->dctx);
+                return false;
+            }
+            dst_used = 0;
+        }
+        size_t dst_n = dst_size - dst_used;
+        size_t src_n = 0;
+        rc = LZ4F_decompress(ctx->dctx, (char*)dst + dst_used, &dst_n,
+                             NULL, &src_n, NULL);
+        if (LZ4F_isError(rc) || dst_n == 0) {
+            LOG(WARNING) << "Truncated lz4 frame, size=" << in.size();
+            LZ4F_resetDecompressionContext(ctx->dctx);
+            stream.BackUp(dst_size - dst_used);
+            return false;
+        }
+        dst_used += dst_n;
+    }
+    stream.BackUp(dst_size - dst_used);
+    return true;
+}
+
+#else  // BRPC_WITH_LZ4
+
+bool Lz4Compress(const butil::IOBuf&, butil::IOBuf*) {
+    LOG(ERROR) << "brpc is not built with lz4";
+    return false;
+}
+
+bool Lz4Decompress(const butil::IOBuf&, butil::IOBuf*) {
+    LOG(ERROR) << "brpc is not built with lz4";
+    return false;
+}
+
+#endif  // BRPC_WITH_LZ4
+
+}  // namespace policy
+} // namespace brpc
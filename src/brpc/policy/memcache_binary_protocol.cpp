@@ -52,6 +52,9 @@ static pthread_once_t supported_cmd_map_once = PTHREAD_ONCE_INIT;
 static void InitSupportedCommandMap() {
     butil::bit_array_clear(supported_cmd_map, 256);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_GET);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_GETQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_GETK);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_GETKQ);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_SET);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_ADD);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_REPLACE);
@@ -68,11 +71,17 @@ static void InitSupportedCommandMap() {
     butil::bit_array_set(supported_cmd_map, MC_BINARY_SASL_AUTH);
 }
 
-inline bool IsSupportedCommand(uint8_t command) {
+static inline bool IsSupportedCommand(uint8_t command) {
     pthread_once(&supported_cmd_map_once, InitSupportedCommandMap);
     return butil::bit_array_get(supported_cmd_map, command);
 }
 
+// Quiet commands are not replied on misses, thus not counted in
+// pipelined_count of the request.
+static inline bool IsQuietCommand(uint8_t command) {
+    return command == MC_BINARY_GETQ || command == MC_BINARY_GETKQ;
+}
+
 ParseResult ParseMemcacheMessage(butil::IOBuf* source,
                                  Socket* socket, bool /*read_eof*/, const void */*arg*/) {
     while (1) {
@@ -128,6 +137,10 @@ ParseResult ParseMemcacheMessage(butil::IOBuf* source,
         msg->meta.append(&local_header, sizeof(local_header));
         source->pop_front(sizeof(*header));
         source->cutn(&msg->meta, total_body_length);
+        if (IsQuietCommand(local_header.command)) {
+            socket->GivebackPipelinedInfo(pi);
+            continue;
+        }
         if (header->command == MC_BINARY_SASL_AUTH) {
             if (header->status != 0) {
                 LOG(ERROR) << "Failed to authenticate the couchbase bucket.";
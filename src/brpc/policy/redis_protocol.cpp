@@ -130,32 +130,47 @@ ParseResult ParseRedisMessage(butil::IOBuf* source, Socket* socket,
             ctx = new RedisConnContext(rs);
             socket->reset_parsing_context(ctx);
         }
-        std::vector<butil::StringPiece> current_args;
-        butil::IOBufAppender appender;
+        // Cut all commands first, so that they can be run together by the
+        // batch handler and the last one is known to flush batched commands.
+        std::vector<std::vector<butil::StringPiece> >& commands = ctx->commands;
+        int ncommand = 0;
         ParseError err = PARSE_OK;
-
-        err = ctx->parser.Consume(*source, &current_args, &ctx->arena);
-        if (err != PARSE_OK) {
-            return MakeParseError(err);
-        }
         while (true) {
-            std::vector<butil::StringPiece> next_args;
-            err = ctx->parser.Consume(*source, &next_args, &ctx->arena);
+            if (ncommand == (int)commands.size()) {
+                commands.emplace_back();
+            }
+            err = ctx->parser.Consume(*source, &commands[ncommand], &ctx->arena);
             if (err != PARSE_OK) {
                 break;
             }
-            if (ConsumeCommand(ctx, current_args, false, &appender) != 0) {
+            ++ncommand;
+        }
+        if (ncommand == 0) {
+            return MakeParseError(err);
+        }
+        butil::IOBufAppender appender;
+        int nhandled = 0;
+        RedisBatchCommandHandler* bh = rs->batch_command_handler();
+        if (bh != NULL && !ctx->transaction_handler && ctx->batched_size == 0) {
+            nhandled = bh->Run(ctx, commands.data(), ncommand, &appender);
+            if (nhandled < 0 || nhandled > ncommand) {
+                LOG_IF(ERROR, nhandled >= 0) << "Batch handler handled "
+                    << nhandled << " commands of " << ncommand;
                 return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
             }
-            current_args.swap(next_args);
         }
-        if (ConsumeCommand(ctx, current_args,
-                    true /*must be the last message*/, &appender) != 0) {
-            return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
+        for (int i = nhandled; i < ncommand; ++i) {
+            if (ConsumeCommand(ctx, commands[i],
+                        i + 1 == ncommand/*the last message*/, &appender) != 0) {
+                return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
+            }
         }
         butil::IOBuf sendbuf;
         appender.move_to(sendbuf);
-        CHECK(!sendbuf.empty());
+        if (sendbuf.empty()) {
+            LOG(ERROR) << "No reply to " << ncommand << " commands";
+            return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
+        }
         Socket::WriteOptions wopt;
         wopt.ignore_eovercrowded = true;
         LOG_IF(WARNING, socket->Write(&sendbuf, &wopt) != 0)
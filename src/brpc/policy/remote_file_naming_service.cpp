@@ -20,10 +20,12 @@
 #include <stdio.h>                                      // getline
 #include <string>                                       // std::string
 #include <set>                                          // std::set
+#include <algorithm>                                    // std::sort
 #include "bthread/bthread.h"                            // bthread_usleep
 #include "butil/iobuf.h"
 #include "brpc/log.h"
 #include "brpc/channel.h"
+#include "brpc/http_status_code.h"
 #include "brpc/policy/remote_file_naming_service.h"
 
 
@@ -40,6 +42,10 @@ DEFINE_int32(remote_file_timeout_ms, 1000,
 bool SplitIntoServerAndTag(const butil::StringPiece& line,
                            butil::StringPiece* server_addr,
                            butil::StringPiece* tag);
+void DiffServerLists(std::vector<ServerNode>* last_servers,
+                     const std::vector<ServerNode>& servers,
+                     std::vector<ServerNode>* added,
+                     std::vector<ServerNode>* removed);
 
 static bool CutLineFromIOBuf(butil::IOBuf* source, std::string* line_out) {
     if (source->empty()) {
@@ -57,67 +63,106 @@ static bool CutLineFromIOBuf(butil::IOBuf* source, std::string* line_out) {
     return true;
 }
 
-int RemoteFileNamingService::GetServers(const char *service_name_cstr,
-                                      std::vector<ServerNode>* servers) {
-    servers->clear();
-
-    if (_channel == NULL) {
-        butil::StringPiece tmpname(service_name_cstr);
-        size_t pos = tmpname.find("://");
-        butil::StringPiece proto;
-        if (pos != butil::StringPiece::npos) {
-            proto = tmpname.substr(0, pos);
-            for (pos += 3; tmpname[pos] == '/'; ++pos) {}
-            tmpname.remove_prefix(pos);
-        } else {
-            proto = "http";
-        }
-        if (proto != "bns" && proto != "http") {
-            LOG(ERROR) << "Invalid protocol=`" << proto
-                       << "\' in service_name=" << service_name_cstr;
-            return -1;
-        }
-        size_t slash_pos = tmpname.find('/');
-        butil::StringPiece server_addr_piece;
-        if (slash_pos == butil::StringPiece::npos) {
-            server_addr_piece = tmpname;
-            _path = "/";
-        } else {
-            server_addr_piece = tmpname.substr(0, slash_pos);
-            _path = tmpname.substr(slash_pos).as_string();
-        }
-        _server_addr.reserve(proto.size() + 3 + server_addr_piece.size());
-        _server_addr.append(proto.data(), proto.size());
-        _server_addr.append("://");
-        _server_addr.append(server_addr_piece.data(), server_addr_piece.size());
-        ChannelOptions opt;
-        opt.protocol = PROTOCOL_HTTP;
-        opt.connect_timeout_ms = FLAGS_remote_file_connect_timeout_ms > 0 ?
-            FLAGS_remote_file_connect_timeout_ms : FLAGS_remote_file_timeout_ms / 3;
-        opt.timeout_ms = FLAGS_remote_file_timeout_ms;
-        std::unique_ptr<Channel> chan(new Channel);
-        if (chan->Init(_server_addr.c_str(), "rr", &opt) != 0) {
-            LOG(ERROR) << "Fail to init channel to " << _server_addr;
-            return -1;
-        }
-        _channel.swap(chan);
+int RemoteFileNamingService::InitChannel(const char* service_name_cstr) {
+    if (_channel != NULL) {
+        return 0;
+    }
+    butil::StringPiece tmpname(service_name_cstr);
+    size_t pos = tmpname.find("://");
+    butil::StringPiece proto;
+    if (pos != butil::StringPiece::npos) {
+        proto = tmpname.substr(0, pos);
+        for (pos += 3; tmpname[pos] == '/'; ++pos) {}
+        tmpname.remove_prefix(pos);
+    } else {
+        proto = "http";
     }
+    if (proto != "bns" && proto != "http") {
+        LOG(ERROR) << "Invalid protocol=`" << proto
+                   << "\' in service_name=" << service_name_cstr;
+        return -1;
+    }
+    size_t slash_pos = tmpname.find('/');
+    butil::StringPiece server_addr_piece;
+    if (slash_pos == butil::StringPiece::npos) {
+        server_addr_piece = tmpname;
+        _path = "/";
+    } else {
+        server_addr_piece = tmpname.substr(0, slash_pos);
+        _path = tmpname.substr(slash_pos).as_string();
+    }
+    _server_addr.reserve(proto.size() + 3 + server_addr_piece.size());
+    _server_addr.append(proto.data(), proto.size());
+    _server_addr.append("://");
+    _server_addr.append(server_addr_piece.data(), server_addr_piece.size());
+    ChannelOptions opt;
+    opt.protocol = PROTOCOL_HTTP;
+    opt.connect_timeout_ms = FLAGS_remote_file_connect_timeout_ms > 0 ?
+        FLAGS_remote_file_connect_timeout_ms : FLAGS_remote_file_timeout_ms / 3;
+    opt.timeout_ms = FLAGS_remote_file_timeout_ms;
+    std::unique_ptr<Channel> chan(new Channel);
+    if (chan->Init(_server_addr.c_str(), "rr", &opt) != 0) {
+        LOG(ERROR) << "Fail to init channel to " << _server_addr;
+        return -1;
+    }
+    _channel.swap(chan);
+    return 0;
+}
 
+int RemoteFileNamingService::FetchServerList(bool conditional,
+                                             butil::IOBuf* body,
+                                             bool* not_modified) {
+    *not_modified = false;
     Controller cntl;
     cntl.http_request().uri() = _path;
+    if (conditional) {
+        // Let the remote side tell us that the list is unchanged, saving
+        // both the transfer and the parsing.
+        if (!_etag.empty()) {
+            cntl.http_request().SetHeader("If-None-Match", _etag);
+        }
+        if (!_last_modified.empty()) {
+            cntl.http_request().SetHeader("If-Modified-Since", _last_modified);
+        }
+    }
     _channel->CallMethod(NULL, &cntl, NULL, NULL, NULL);
     if (cntl.Failed()) {
+        if (conditional && cntl.http_response().status_code() ==
+            HTTP_STATUS_NOT_MODIFIED) {
+            *not_modified = true;
+            return 0;
+        }
         LOG(WARNING) << "Fail to access " << _server_addr << _path << ": "
                      << cntl.ErrorText();
         return -1;
     }
+    const std::string* etag = cntl.http_response().GetHeader("ETag");
+    if (etag) {
+        _etag = *etag;
+    } else {
+        _etag.clear();
+    }
+    const std::string* last_modified =
+        cntl.http_response().GetHeader("Last-Modified");
+    if (last_modified) {
+        _last_modified = *last_modified;
+    } else {
+        _last_modified.clear();
+    }
+    body->swap(cntl.response_attachment());
+    return 0;
+}
+
+void RemoteFileNamingService::ParseServerList(
+    const char* service_name_cstr, butil::IOBuf body,
+    std::vector<ServerNode>* servers) {
     std::string line;
     // Sort/unique the inserted vector is faster, but may have a different order
     // of addresses from the file. To make assertions in tests easier, we use
     // set to de-duplicate and keep the order.
     std::set<ServerNode> presence;
 
-    while (CutLineFromIOBuf(&cntl.response_attachment(), &line)) {
+    while (CutLineFromIOBuf(&body, &line)) {
         butil::StringPiece addr;
         butil::StringPiece tag;
         if (!SplitIntoServerAndTag(line, &addr, &tag)) {
@@ -142,6 +187,48 @@ int RemoteFileNamingService::GetServers(const char *service_name_cstr,
     RPC_VLOG << "Got " << servers->size()
              << (servers->size() > 1 ? " servers" : " server")
              << " from " << service_name_cstr;
+}
+
+int RemoteFileNamingService::GetServers(const char *service_name_cstr,
+                                      std::vector<ServerNode>* servers) {
+    servers->clear();
+    if (InitChannel(service_name_cstr) != 0) {
+        return -1;
+    }
+    butil::IOBuf body;
+    bool not_modified = false;
+    if (FetchServerList(false, &body, &not_modified) != 0) {
+        return -1;
+    }
+    _last_body = body;
+    ParseServerList(service_name_cstr, body, servers);
+    _last_servers.assign(servers->begin(), servers->end());
+    std::sort(_last_servers.begin(), _last_servers.end());
+    return 0;
+}
+
+int RemoteFileNamingService::GetServerChanges(const char* service_name_cstr,
+                                              std::vector<ServerNode>* added,
+                                              std::vector<ServerNode>* removed) {
+    added->clear();
+    removed->clear();
+    if (InitChannel(service_name_cstr) != 0) {
+        return -1;
+    }
+    butil::IOBuf body;
+    bool not_modified = false;
+    if (FetchServerList(true, &body, &not_modified) != 0) {
+        return -1;
+    }
+    // Servers not supporting conditional requests still send the same body
+    // for an unchanged list, which is skipped without being parsed.
+    if (not_modified || body.equals(_last_body)) {
+        return 0;
+    }
+    _last_body = body;
+    std::vector<ServerNode> servers;
+    ParseServerList(service_name_cstr, body, &servers);
+    DiffServerLists(&_last_servers, servers, added, removed);
     return 0;
 }
 
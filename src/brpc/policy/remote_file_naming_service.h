@@ -22,6 +22,7 @@
 #include "brpc/periodic_naming_service.h"
 #include "brpc/channel.h"
 #include "butil/unique_ptr.h"
+#include "butil/iobuf.h"
 
 
 namespace brpc {
@@ -33,6 +34,10 @@ private:
     int GetServers(const char* service_name,
                    std::vector<ServerNode>* servers) override;
 
+    int GetServerChanges(const char* service_name,
+                         std::vector<ServerNode>* added,
+                         std::vector<ServerNode>* removed) override;
+
     void Describe(std::ostream& os, const DescribeOptions&) const override;
 
     NamingService* New() const override;
@@ -40,9 +45,21 @@ private:
     void Destroy() override;
     
 private:
+    int InitChannel(const char* service_name);
+    int FetchServerList(bool conditional, butil::IOBuf* body,
+                        bool* not_modified);
+    static void ParseServerList(const char* service_name, butil::IOBuf body,
+                                std::vector<ServerNode>* servers);
+
     std::unique_ptr<Channel> _channel;
     std::string _server_addr;
     std::string _path;
+    // Validators of the last response for conditional requests.
+    std::string _etag;
+    std::string _last_modified;
+    butil::IOBuf _last_body;
+    // Sorted servers of the last response.
+    std::vector<ServerNode> _last_servers;
 };
 
 }  // namespace policy
@@ -33,26 +33,13 @@
 #include "brpc/policy/most_common_message.h"
 #include "brpc/policy/thrift_protocol.h"
 #include "brpc/details/usercode_backup_pool.h"
+#include "brpc/details/thrift_utils.h"
 
 #include <thrift/Thrift.h>
-#include <thrift/transport/TBufferTransports.h>
 #include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
 #include <thrift/TApplicationException.h>
 
-// _THRIFT_STDCXX_H_ is defined by thrift/stdcxx.h which was added since thrift 0.11.0
-// but deprecated after thrift 0.13.0
-#include <thrift/TProcessor.h> // to include stdcxx.h if present
-#ifndef THRIFT_STDCXX
- #if defined(_THRIFT_STDCXX_H_)
- # define THRIFT_STDCXX apache::thrift::stdcxx
- #elif defined(_THRIFT_VERSION_LOWER_THAN_0_11_0_)
- # define THRIFT_STDCXX boost
- # include <boost/make_shared.hpp>
- #else
- # define THRIFT_STDCXX std
- #endif
-#endif
-
 extern "C" {
 void bthread_assign_data(void* data);
 }
@@ -63,17 +50,97 @@ namespace policy {
 static const uint32_t MAX_THRIFT_METHOD_NAME_LENGTH = 256; // reasonably large
 static const uint32_t THRIFT_HEAD_VERSION_MASK = (uint32_t)0xffffff00;
 static const uint32_t THRIFT_HEAD_VERSION_1 = (uint32_t)0x80010000;
+// See TCompactProtocol.tcc
+static const uint8_t THRIFT_COMPACT_PROTOCOL_ID = 0x82;
+static const uint8_t THRIFT_COMPACT_VERSION_N = 1;
+static const uint8_t THRIFT_COMPACT_VERSION_MASK = 0x1f;
+static const uint8_t THRIFT_COMPACT_TYPE_SHIFT_AMOUNT = 5;
 struct thrift_head_t {
     uint32_t body_len;
 };
 
-// A faster implementation of TProtocol::readMessageBegin without depending
-// on thrift stuff.
-static butil::Status
-ReadThriftMessageBegin(butil::IOBuf* body,
-                       std::string* method_name,
-                       ::apache::thrift::protocol::TMessageType* mtype,
-                       uint32_t* seq_id) {
+typedef ::apache::thrift::protocol::TBinaryProtocolT<IOBufTransport> IOBufBinaryProtocol;
+typedef ::apache::thrift::protocol::TCompactProtocolT<IOBufTransport> IOBufCompactProtocol;
+
+// Call `fn' with a protocol of `type' over `trans'.
+template <typename Fn>
+static void WithThriftProtocol(ThriftProtocolType type,
+                               const THRIFT_STDCXX::shared_ptr<IOBufTransport>& trans,
+                               const Fn& fn) {
+    if (type == THRIFT_COMPACT_PROTOCOL) {
+        IOBufCompactProtocol prot(trans);
+        fn(&prot);
+    } else {
+        IOBufBinaryProtocol prot(trans);
+        fn(&prot);
+    }
+}
+
+static bool ReadVarint32(const char* buf, size_t n, size_t* pos, uint32_t* value) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35 && *pos < n; shift += 7) {
+        const uint8_t byte = buf[(*pos)++];
+        result |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t WriteVarint32(char* buf, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        buf[n++] = (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (char)value;
+    return n;
+}
+
+static bool IsThriftCompactMessage(const uint8_t* p) {
+    return p[0] == THRIFT_COMPACT_PROTOCOL_ID &&
+        (p[1] & THRIFT_COMPACT_VERSION_MASK) == THRIFT_COMPACT_VERSION_N;
+}
+
+butil::Status ReadThriftMessageBegin(butil::IOBuf* body,
+                                     std::string* method_name,
+                                     ::apache::thrift::protocol::TMessageType* mtype,
+                                     uint32_t* seq_id,
+                                     ThriftProtocolType* protocol_type) {
+    const uint8_t* first = (const uint8_t*)body->fetch1();
+    if (first != NULL && *first == THRIFT_COMPACT_PROTOCOL_ID) {
+        // Compact protocol format:
+        // Protocol id + Version and type + Sequence Id + Length + Method
+        //      |               |                |          |        |
+        //      1       +       1       +    varint  +  varint  +   >0
+        *protocol_type = THRIFT_COMPACT_PROTOCOL;
+        char buf[THRIFT_MESSAGE_BEGIN_MAX_OVERHEAD + MAX_THRIFT_METHOD_NAME_LENGTH];
+        const size_t n = body->copy_to(buf, sizeof(buf));
+        if (n < 2 || !IsThriftCompactMessage((const uint8_t*)buf)) {
+            return butil::Status(-1, "Invalid compact message header");
+        }
+        *mtype = (apache::thrift::protocol::TMessageType)
+            (((uint8_t)buf[1] >> THRIFT_COMPACT_TYPE_SHIFT_AMOUNT) & 0x07);
+        size_t pos = 2;
+        uint32_t method_name_length = 0;
+        if (!ReadVarint32(buf, n, &pos, seq_id) ||
+            !ReadVarint32(buf, n, &pos, &method_name_length)) {
+            return butil::Status(-1, "Fail to read varints of compact message header");
+        }
+        if (method_name_length > MAX_THRIFT_METHOD_NAME_LENGTH) {
+            return butil::Status(-1, "method_name_length=%u is too long",
+                                 method_name_length);
+        }
+        if (pos + method_name_length > n) {
+            return butil::Status(-1, "Fail to read method name");
+        }
+        method_name->assign(buf + pos, method_name_length);
+        body->pop_front(pos + method_name_length);
+        return butil::Status::OK();
+    }
+    *protocol_type = THRIFT_BINARY_PROTOCOL;
     // Thrift protocol format:
     // Version + Message type + Length + Method + Sequence Id
     //   |             |          |        |          |
@@ -104,16 +171,22 @@ ReadThriftMessageBegin(butil::IOBuf* body,
     return butil::Status::OK();
 }
 
-inline size_t ThriftMessageBeginSize(const std::string& method_name) {
-    return 12 + method_name.size();
-}
-
-static void
-WriteThriftMessageBegin(char* buf,
-                        const std::string& method_name,
-                        ::apache::thrift::protocol::TMessageType mtype,
-                        uint32_t seq_id) {
+size_t WriteThriftMessageBegin(char* buf,
+                               ThriftProtocolType protocol_type,
+                               const std::string& method_name,
+                               ::apache::thrift::protocol::TMessageType mtype,
+                               uint32_t seq_id) {
     char* p = buf;
+    if (protocol_type == THRIFT_COMPACT_PROTOCOL) {
+        *p++ = (char)THRIFT_COMPACT_PROTOCOL_ID;
+        *p++ = (char)((THRIFT_COMPACT_VERSION_N & THRIFT_COMPACT_VERSION_MASK) |
+                      (((uint32_t)mtype << THRIFT_COMPACT_TYPE_SHIFT_AMOUNT) & 0xE0));
+        p += WriteVarint32(p, seq_id);
+        p += WriteVarint32(p, method_name.size());
+        memcpy(p, method_name.data(), method_name.size());
+        p += method_name.size();
+        return p - buf;
+    }
     *(uint32_t*)p = htonl(THRIFT_HEAD_VERSION_1 | (((uint32_t)mtype) & 0x000000FF));
     p += 4;
     *(uint32_t*)p = htonl(method_name.size());
@@ -121,50 +194,92 @@ WriteThriftMessageBegin(char* buf,
     memcpy(p, method_name.data(), method_name.size());
     p += method_name.size();
     *(uint32_t*)p = htonl(seq_id);
+    p += 4;
+    return p - buf;
+}
+
+// Append a frame of message `method_name' whose fields are written by
+// `write_fields' into `out'.
+template <typename Fn>
+static void AppendThriftFrame(butil::IOBuf* out,
+                              ThriftProtocolType protocol_type,
+                              const std::string& method_name,
+                              ::apache::thrift::protocol::TMessageType mtype,
+                              uint32_t seq_id,
+                              const Fn& write_fields) {
+    auto trans = THRIFT_STDCXX::make_shared<IOBufTransport>();
+    WithThriftProtocol(protocol_type, trans,
+                       [&](::apache::thrift::protocol::TProtocol* oprot) {
+        oprot->writeMessageBegin(method_name, mtype, seq_id);
+        write_fields(oprot);
+        oprot->writeMessageEnd();
+        oprot->getTransport()->writeEnd();
+    });
+    butil::IOBuf body;
+    trans->move_to(&body);
+    const thrift_head_t head = { htonl(body.size()) };
+    out->append(&head, sizeof(head));
+    out->append(butil::IOBuf::Movable(body));
+}
+
+// Append a frame of message `method_name' whose fields are already
+// serialized in `body' into `out'.
+static void AppendThriftFrame(butil::IOBuf* out,
+                              ThriftProtocolType protocol_type,
+                              const std::string& method_name,
+                              ::apache::thrift::protocol::TMessageType mtype,
+                              uint32_t seq_id,
+                              const butil::IOBuf& body) {
+    char buf[sizeof(thrift_head_t) + ThriftMessageBeginMaxSize(method_name)];
+    const size_t mb_size = WriteThriftMessageBegin(
+        buf + sizeof(thrift_head_t), protocol_type, method_name, mtype, seq_id);
+    // suppress strict-aliasing warning
+    thrift_head_t* head = (thrift_head_t*)buf;
+    head->body_len = htonl(mb_size + body.size());
+    out->append(buf, sizeof(thrift_head_t) + mb_size);
+    out->append(body);
 }
 
 bool ReadThriftStruct(const butil::IOBuf& body,
                       ThriftMessageBase* raw_msg,
-                      int16_t expected_fid) {
-    const size_t body_len  = body.size();
-    uint8_t* thrift_buffer = (uint8_t*)malloc(body_len);
-    body.copy_to(thrift_buffer, body_len);
-    auto in_buffer =
-        THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>(
-            thrift_buffer, body_len,
-            ::apache::thrift::transport::TMemoryBuffer::TAKE_OWNERSHIP);
-    apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> iprot(in_buffer);
-
+                      int16_t expected_fid,
+                      ThriftProtocolType protocol_type) {
+    // Share blocks of `body' instead of copying.
+    butil::IOBuf rbuf(body);
+    auto trans = THRIFT_STDCXX::make_shared<IOBufTransport>(&rbuf);
     bool success = false;
     try {
-        // The following code was taken from thrift auto generate code
-        std::string fname;
-
-        uint32_t xfer = 0;
-        ::apache::thrift::protocol::TType ftype;
-        int16_t fid;
-        xfer += iprot.readStructBegin(fname);
-        while (true) {
-            xfer += iprot.readFieldBegin(fname, ftype, fid);
-            if (ftype == ::apache::thrift::protocol::T_STOP) {
-                break;
-            }
-            if (fid == expected_fid) {
-                if (ftype == ::apache::thrift::protocol::T_STRUCT) {
-                    xfer += raw_msg->Read(&iprot);
-                    success = true;
+        WithThriftProtocol(protocol_type, trans,
+                           [&](::apache::thrift::protocol::TProtocol* iprot) {
+            // The following code was taken from thrift auto generate code
+            std::string fname;
+
+            uint32_t xfer = 0;
+            ::apache::thrift::protocol::TType ftype = ::apache::thrift::protocol::T_STOP;
+            int16_t fid = 0;
+            xfer += iprot->readStructBegin(fname);
+            while (true) {
+                xfer += iprot->readFieldBegin(fname, ftype, fid);
+                if (ftype == ::apache::thrift::protocol::T_STOP) {
+                    break;
+                }
+                if (fid == expected_fid) {
+                    if (ftype == ::apache::thrift::protocol::T_STRUCT) {
+                        xfer += raw_msg->Read(iprot);
+                        success = true;
+                    } else {
+                        xfer += iprot->skip(ftype);
+                    }
                 } else {
-                    xfer += iprot.skip(ftype);
+                    xfer += iprot->skip(ftype);
                 }
-            } else {
-                xfer += iprot.skip(ftype);
+                xfer += iprot->readFieldEnd();
             }
-            xfer += iprot.readFieldEnd();
-        }
 
-        xfer += iprot.readStructEnd();
-        (void)xfer;
-        iprot.getTransport()->readEnd();
+            xfer += iprot->readStructEnd();
+            (void)xfer;
+            iprot->getTransport()->readEnd();
+        });
     } catch (std::exception& e) {
         LOG(WARNING) << "Catched thrift exception: " << e.what();
     } catch (...) {
@@ -174,19 +289,16 @@ bool ReadThriftStruct(const butil::IOBuf& body,
 }
 
 void ReadThriftException(const butil::IOBuf& body,
+                         ThriftProtocolType protocol_type,
                          ::apache::thrift::TApplicationException* x) {
-    size_t body_len  = body.size();
-    uint8_t* thrift_buffer = (uint8_t*)malloc(body_len);
-    body.copy_to(thrift_buffer, body_len);
-    auto in_buffer =
-        THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>(
-            thrift_buffer, body_len,
-            ::apache::thrift::transport::TMemoryBuffer::TAKE_OWNERSHIP);
-    apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> iprot(in_buffer);
-
-    x->read(&iprot);
-    iprot.readMessageEnd();
-    iprot.getTransport()->readEnd();
+    butil::IOBuf rbuf(body);
+    auto trans = THRIFT_STDCXX::make_shared<IOBufTransport>(&rbuf);
+    WithThriftProtocol(protocol_type, trans,
+                       [&](::apache::thrift::protocol::TProtocol* iprot) {
+        x->read(iprot);
+        iprot->readMessageEnd();
+        iprot->getTransport()->readEnd();
+    });
 }
 
 // The continuation of request processing. Namely send response back to client.
@@ -287,63 +399,35 @@ void ThriftClosure::DoRun() {
 
     butil::IOBuf write_buf;
 
+    const ThriftProtocolType protocol_type = _request.protocol_type;
     // The following code was taken and modified from thrift auto generated code
     if (_controller.Failed()) {
-        auto out_buffer =
-            THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>();
-        apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> oprot(out_buffer);
         ::apache::thrift::TApplicationException x(_controller.ErrorText());
-        oprot.writeMessageBegin(
-            method_name, ::apache::thrift::protocol::T_EXCEPTION, seq_id);
-        x.write(&oprot);
-        oprot.writeMessageEnd();
-        oprot.getTransport()->writeEnd();
-        oprot.getTransport()->flush();
-
-        uint8_t* buf;
-        uint32_t sz;
-        out_buffer->getBuffer(&buf, &sz);
-        const thrift_head_t head = { htonl(sz) };
-        write_buf.append(&head, sizeof(head));
-        write_buf.append(buf, sz);
+        AppendThriftFrame(&write_buf, protocol_type, method_name,
+                          ::apache::thrift::protocol::T_EXCEPTION, seq_id,
+                          [&](::apache::thrift::protocol::TProtocol* oprot) {
+            x.write(oprot);
+        });
     } else if (_response.raw_instance()) {
-        auto out_buffer =
-            THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>();
-        apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> oprot(out_buffer);
-        oprot.writeMessageBegin(
-            method_name, ::apache::thrift::protocol::T_REPLY, seq_id);
-
-        uint32_t xfer = 0;
-        xfer += oprot.writeStructBegin("rpc_result"); // can be any valid name
-        xfer += oprot.writeFieldBegin("success",
-                                      ::apache::thrift::protocol::T_STRUCT,
-                                      THRIFT_RESPONSE_FID);
-        xfer += _response.raw_instance()->Write(&oprot);
-        xfer += oprot.writeFieldEnd();
-        xfer += oprot.writeFieldStop();
-        xfer += oprot.writeStructEnd();
-        (void)xfer;
-
-        oprot.writeMessageEnd();
-        oprot.getTransport()->writeEnd();
-        oprot.getTransport()->flush();
-
-        uint8_t* buf;
-        uint32_t sz;
-        out_buffer->getBuffer(&buf, &sz);
-        const thrift_head_t head = { htonl(sz) };
-        write_buf.append(&head, sizeof(head));
-        write_buf.append(buf, sz);
+        AppendThriftFrame(&write_buf, protocol_type, method_name,
+                          ::apache::thrift::protocol::T_REPLY, seq_id,
+                          [&](::apache::thrift::protocol::TProtocol* oprot) {
+            uint32_t xfer = 0;
+            xfer += oprot->writeStructBegin("rpc_result"); // can be any valid name
+            xfer += oprot->writeFieldBegin("success",
+                                           ::apache::thrift::protocol::T_STRUCT,
+                                           THRIFT_RESPONSE_FID);
+            xfer += _response.raw_instance()->Write(oprot);
+            xfer += oprot->writeFieldEnd();
+            xfer += oprot->writeFieldStop();
+            xfer += oprot->writeStructEnd();
+            (void)xfer;
+        });
     } else {
-        const size_t mb_size = ThriftMessageBeginSize(method_name);
-        char buf[sizeof(thrift_head_t) + mb_size];
-        // suppress strict-aliasing warning
-        thrift_head_t* head = (thrift_head_t*)buf;
-        head->body_len = htonl(mb_size + _response.body.size());
-        WriteThriftMessageBegin(buf + sizeof(thrift_head_t), method_name,
-                                ::apache::thrift::protocol::T_REPLY, seq_id);
-        write_buf.append(buf, sizeof(buf));
-        write_buf.append(_response.body.movable());
+        AppendThriftFrame(&write_buf, protocol_type, method_name,
+                          ::apache::thrift::protocol::T_REPLY, seq_id,
+                          _response.body);
+        _response.body.clear();
     }
 
     if (span) {
@@ -377,7 +461,8 @@ ParseResult ParseThriftMessage(butil::IOBuf* source,
 
     const uint32_t sz = ntohl(*(uint32_t*)(header_buf + sizeof(thrift_head_t)));
     uint32_t version = sz & THRIFT_HEAD_VERSION_MASK;
-    if (version != THRIFT_HEAD_VERSION_1) {
+    if (version != THRIFT_HEAD_VERSION_1 &&
+        !IsThriftCompactMessage((const uint8_t*)header_buf + sizeof(thrift_head_t))) {
         RPC_VLOG << "version=" << version
                  << " doesn't match THRIFT_VERSION=" << THRIFT_HEAD_VERSION_1;
         return MakeParseError(PARSE_ERROR_TRY_OTHERS);
@@ -483,7 +568,10 @@ void ProcessThriftRequest(InputMessageBase* msg_base) {
     uint32_t seq_id;
     ::apache::thrift::protocol::TMessageType mtype;
     butil::Status st = ReadThriftMessageBegin(
-        &msg->payload, &cntl->_thrift_method_name, &mtype, &seq_id);
+        &msg->payload, &cntl->_thrift_method_name, &mtype, &seq_id,
+        &req->protocol_type);
+    // Reply with the protocol of the request.
+    res->protocol_type = req->protocol_type;
     if (!st.ok()) {
         return cntl->SetFailed(EREQUEST, "%s", st.error_cstr());
     }
@@ -598,15 +686,17 @@ void ProcessThriftResponse(InputMessageBase* msg_base) {
         std::string fname;
         ::apache::thrift::protocol::TMessageType mtype;
         uint32_t seq_id = 0; // unchecked
+        ThriftProtocolType protocol_type = THRIFT_BINARY_PROTOCOL;
         
-        butil::Status st = ReadThriftMessageBegin(&msg->payload, &fname, &mtype, &seq_id);
+        butil::Status st = ReadThriftMessageBegin(
+            &msg->payload, &fname, &mtype, &seq_id, &protocol_type);
         if (!st.ok()) {
             cntl->SetFailed(ERESPONSE, "%s", st.error_cstr());
             break;
         }
         if (mtype == ::apache::thrift::protocol::T_EXCEPTION) {
             ::apache::thrift::TApplicationException x;
-            ReadThriftException(msg->payload, &x);
+            ReadThriftException(msg->payload, protocol_type, &x);
             // TODO: Convert exception type to brpc errors.
             cntl->SetFailed(x.what());
             break;
@@ -627,9 +717,10 @@ void ProcessThriftResponse(InputMessageBase* msg_base) {
         // MUST be ThriftFramedMessage (checked in SerializeThriftRequest)
         ThriftFramedMessage* response = (ThriftFramedMessage*)cntl->response();
         if (response) {
+            response->protocol_type = protocol_type;
             if (response->raw_instance()) {
                 if (!ReadThriftStruct(msg->payload, response->raw_instance(),
-                                      THRIFT_RESPONSE_FID)) {
+                                      THRIFT_RESPONSE_FID, protocol_type)) {
                     cntl->SetFailed(ERESPONSE, "Fail to read presult");
                     break;
                 }
@@ -682,56 +773,35 @@ void SerializeThriftRequest(butil::IOBuf* request_buf, Controller* cntl,
 
     // xxx_pargs write
     if (req->raw_instance()) {
-        auto out_buffer =
-            THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>();
-        apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> oprot(out_buffer);
-
-        oprot.writeMessageBegin(
-            method_name, ::apache::thrift::protocol::T_CALL, 0/*seq_id*/);
-
-        uint32_t xfer = 0;
-        char struct_begin_str[32 + method_name.size()];
-        char* p = struct_begin_str;
-        memcpy(p, "ThriftService_", 14);
-        p += 14;
-        memcpy(p, method_name.data(), method_name.size());
-        p += method_name.size();
-        memcpy(p, "_pargs", 6);
-        p += 6;
-        *p = '\0';
-        xfer += oprot.writeStructBegin(struct_begin_str);
-        xfer += oprot.writeFieldBegin("request", ::apache::thrift::protocol::T_STRUCT,
-                                      THRIFT_REQUEST_FID);
-
-        // request's write
-        xfer += req->raw_instance()->Write(&oprot);
-
-        xfer += oprot.writeFieldEnd();
-        xfer += oprot.writeFieldStop();
-        xfer += oprot.writeStructEnd();
-        (void)xfer;
-
-        oprot.writeMessageEnd();
-        oprot.getTransport()->writeEnd();
-        oprot.getTransport()->flush();
-
-        uint8_t* buf;
-        uint32_t sz;
-        out_buffer->getBuffer(&buf, &sz);
-
-        const thrift_head_t head = { htonl(sz) };
-        request_buf->append(&head, sizeof(head));
-        request_buf->append(buf, sz);
+        AppendThriftFrame(request_buf, req->protocol_type, method_name,
+                          ::apache::thrift::protocol::T_CALL, 0/*seq_id*/,
+                          [&](::apache::thrift::protocol::TProtocol* oprot) {
+            uint32_t xfer = 0;
+            char struct_begin_str[32 + method_name.size()];
+            char* p = struct_begin_str;
+            memcpy(p, "ThriftService_", 14);
+            p += 14;
+            memcpy(p, method_name.data(), method_name.size());
+            p += method_name.size();
+            memcpy(p, "_pargs", 6);
+            p += 6;
+            *p = '\0';
+            xfer += oprot->writeStructBegin(struct_begin_str);
+            xfer += oprot->writeFieldBegin("request", ::apache::thrift::protocol::T_STRUCT,
+                                           THRIFT_REQUEST_FID);
+
+            // request's write
+            xfer += req->raw_instance()->Write(oprot);
+
+            xfer += oprot->writeFieldEnd();
+            xfer += oprot->writeFieldStop();
+            xfer += oprot->writeStructEnd();
+            (void)xfer;
+        });
     } else {
-        const size_t mb_size = ThriftMessageBeginSize(method_name);
-        char buf[sizeof(thrift_head_t) + mb_size];
-        // suppress strict-aliasing warning
-        thrift_head_t* head = (thrift_head_t*)buf;
-        head->body_len = htonl(mb_size + req->body.size());
-        WriteThriftMessageBegin(buf + sizeof(thrift_head_t), method_name,
-                                ::apache::thrift::protocol::T_CALL, 0/*seq_id*/);
-        request_buf->append(buf, sizeof(buf));
-        request_buf->append(req->body);
+        AppendThriftFrame(request_buf, req->protocol_type, method_name,
+                          ::apache::thrift::protocol::T_CALL, 0/*seq_id*/,
+                          req->body);
     }
 }
 
@@ -0,0 +1,218 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <cmath>
+#include <algorithm>
+#include <gflags/gflags.h>
+#include "brpc/errno.pb.h"
+#include "brpc/policy/vegas_concurrency_limiter.h"
+
+namespace brpc {
+namespace policy {
+
+DEFINE_int32(vegas_cl_sample_window_size_ms, 1000,
+             "Duration of the sampling window.");
+DEFINE_int32(vegas_cl_min_sample_count, 20,
+             "During the duration of the sampling window, if the number of "
+             "requests collected is less than this value, the sampling window "
+             "will be discarded.");
+DEFINE_int32(vegas_cl_max_sample_count, 100,
+             "During the duration of the sampling window, once the number of "
+             "requests collected is greater than this value, even if the "
+             "duration of the window has not ended, the max_concurrency will "
+             "be updated and a new sampling window will be started.");
+DEFINE_double(vegas_cl_sampling_interval_ms, 0.1,
+              "Interval for sampling request in vegas concurrency limiter");
+DEFINE_int32(vegas_cl_initial_max_concurrency, 20,
+             "Initial max concurrency for vegas concurrency limiter");
+DEFINE_int32(vegas_cl_min_max_concurrency, 4,
+             "Lower bound of max concurrency of vegas concurrency limiter");
+DEFINE_int32(vegas_cl_max_max_concurrency, 1000,
+             "Upper bound of max concurrency of vegas concurrency limiter");
+DEFINE_double(vegas_cl_smoothing, 1.0,
+              "Weight of the new max concurrency in each sample window, "
+              "the value range is (0-1]");
+DEFINE_int32(vegas_cl_probe_multiplier, 30,
+             "The min latency is measured again after about this times of "
+             "max concurrency requests are sampled");
+
+// log10 of the max concurrency, at least 1.
+static double LogMaxConcurrency(double max_concurrency) {
+    return std::max(1.0, std::log10(max_concurrency));
+}
+
+// Errors meaning that the request was not served in time.
+static bool IsDroppedError(int error_code) {
+    return error_code == ERPCTIMEDOUT ||
+        error_code == ETIMEDOUT ||
+        error_code == EOVERCROWDED;
+}
+
+VegasConcurrencyLimiter::VegasConcurrencyLimiter()
+    : _max_concurrency(FLAGS_vegas_cl_initial_max_concurrency)
+    , _ema_max_concurrency(FLAGS_vegas_cl_initial_max_concurrency)
+    , _min_latency_us(-1)
+    , _probe_count(0)
+    , _last_sampling_time_us(0)
+    , _max_inflight(0) {
+}
+
+VegasConcurrencyLimiter* VegasConcurrencyLimiter::New(
+    const AdaptiveMaxConcurrency&) const {
+    return new (std::nothrow) VegasConcurrencyLimiter;
+}
+
+bool VegasConcurrencyLimiter::OnRequested(int current_concurrency, Controller*) {
+    int max_inflight = _max_inflight.load(butil::memory_order_relaxed);
+    while (current_concurrency > max_inflight &&
+           !_max_inflight.compare_exchange_weak(
+               max_inflight, current_concurrency, butil::memory_order_relaxed)) {}
+    return current_concurrency <= _max_concurrency;
+}
+
+void VegasConcurrencyLimiter::OnResponded(int error_code, int64_t latency_us) {
+    if (ELIMIT == error_code) {
+        return;
+    }
+
+    const int64_t now_time_us = butil::gettimeofday_us();
+    int64_t last_sampling_time_us =
+        _last_sampling_time_us.load(butil::memory_order_relaxed);
+
+    if (last_sampling_time_us == 0 ||
+        now_time_us - last_sampling_time_us >=
+            FLAGS_vegas_cl_sampling_interval_ms * 1000) {
+        bool sample_this_call = _last_sampling_time_us.compare_exchange_strong(
+            last_sampling_time_us, now_time_us, butil::memory_order_relaxed);
+        if (sample_this_call) {
+            bool sample_window_submitted = AddSample(error_code, latency_us,
+                                                     now_time_us);
+            if (sample_window_submitted) {
+                // The following log prints has data-race in extreme cases,
+                // unless you are in debug, you should not open it.
+                VLOG(1)
+                    << "Sample window submitted, current max_concurrency:"
+                    << _max_concurrency
+                    << ", min_latency_us:" << _min_latency_us;
+            }
+        }
+    }
+}
+
+int VegasConcurrencyLimiter::MaxConcurrency() {
+    return _max_concurrency;
+}
+
+int VegasConcurrencyLimiter::ResetMaxConcurrency(const AdaptiveMaxConcurrency&) {
+    return -1;
+}
+
+bool VegasConcurrencyLimiter::AddSample(int error_code,
+                                        int64_t latency_us,
+                                        int64_t sampling_time_us) {
+    std::unique_lock<butil::Mutex> lock_guard(_sw_mutex);
+    if (_sw.start_time_us == 0) {
+        _sw.start_time_us = sampling_time_us;
+    }
+
+    if (error_code != 0) {
+        ++_sw.failed_count;
+        if (IsDroppedError(error_code)) {
+            ++_sw.dropped_count;
+        }
+    } else {
+        ++_sw.succ_count;
+        _sw.total_succ_us += latency_us;
+    }
+
+    if (_sw.succ_count + _sw.failed_count < FLAGS_vegas_cl_min_sample_count) {
+        if (sampling_time_us - _sw.start_time_us >=
+            FLAGS_vegas_cl_sample_window_size_ms * 1000) {
+            // If the sample size is insufficient at the end of the sampling
+            // window, discard the entire sampling window
+            ResetSampleWindow(sampling_time_us);
+        }
+        return false;
+    }
+    if (sampling_time_us - _sw.start_time_us <
+        FLAGS_vegas_cl_sample_window_size_ms * 1000 &&
+        _sw.succ_count + _sw.failed_count < FLAGS_vegas_cl_max_sample_count) {
+        return false;
+    }
+
+    UpdateMaxConcurrency(_max_inflight.exchange(0, butil::memory_order_relaxed));
+    ResetSampleWindow(sampling_time_us);
+    return true;
+}
+
+void VegasConcurrencyLimiter::ResetSampleWindow(int64_t sampling_time_us) {
+    _sw.start_time_us = sampling_time_us;
+    _sw.succ_count = 0;
+    _sw.failed_count = 0;
+    _sw.dropped_count = 0;
+    _sw.total_succ_us = 0;
+}
+
+void VegasConcurrencyLimiter::UpdateMaxConcurrency(int max_inflight) {
+    const double limit = _ema_max_concurrency;
+    const double log_limit = LogMaxConcurrency(limit);
+    double next_max_concurrency = limit;
+    if (_sw.dropped_count > 0) {
+        next_max_concurrency = limit - log_limit;
+    } else if (_sw.succ_count == 0) {
+        // Failed requests don't tell anything about latency.
+        return;
+    } else {
+        const int64_t latency_us = _sw.total_succ_us / _sw.succ_count;
+        _probe_count += _sw.succ_count;
+        if (_min_latency_us <= 0 ||
+            _probe_count > FLAGS_vegas_cl_probe_multiplier * limit) {
+            // Measure the min latency again, which is possibly changed
+            // since last measurement.
+            _min_latency_us = latency_us;
+            _probe_count = 0;
+            return;
+        }
+        _min_latency_us = std::min(_min_latency_us, latency_us);
+        if (max_inflight * 2 < limit) {
+            // Too few requests to tell whether the limit is proper, keep it
+            // unchanged rather than growing it without bound.
+            return;
+        }
+        const double queue_size =
+            std::ceil(limit * (1 - (double)_min_latency_us / latency_us));
+        const double alpha = 3 * log_limit;
+        const double beta = 6 * log_limit;
+        if (queue_size <= log_limit) {
+            next_max_concurrency = limit + beta;
+        } else if (queue_size < alpha) {
+            next_max_concurrency = limit + log_limit;
+        } else if (queue_size > beta) {
+            next_max_concurrency = limit - log_limit;
+        } else {
+            return;
+        }
+    }
+    const double smoothing = FLAGS_vegas_cl_smoothing;
+    _ema_max_concurrency = std::max<double>(FLAGS_vegas_cl_min_max_concurrency,
+        std::min<double>(FLAGS_vegas_cl_max_max_concurrency,
+            limit * (1 - smoothing) + next_max_concurrency * smoothing));
+    _max_concurrency = (int)_ema_max_concurrency;
+}
+
+}  // namespace policy
+}  // namespace brpc
@@ -0,0 +1,308 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifdef BRPC_WITH_ZSTD
+#include <zstd.h>
+#endif
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <gflags/gflags.h>
+#include "butil/file_util.h"                   // ReadFileToString
+#include "butil/logging.h"
+#include "butil/thread_local.h"
+#include "butil/scoped_lock.h"                  // BAIDU_SCOPED_LOCK
+#include "brpc/policy/zstd_compress.h"
+#include "brpc/protocol.h"
+#include "brpc/compress.h"
+
+namespace brpc {
+namespace policy {
+
+DEFINE_int32(zstd_compression_level, 3, "Compression level of zstd, "
+             "higher levels compress better but slower");
+DEFINE_string(zstd_dictionary, "", "Path to a dictionary trained by "
+              "`zstd --train', which is loaded at startup and used to "
+              "compress and decompress all zstd data. Peers must use the "
+              "same dictionary");
+
+bool ZstdCompress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    bool ok;
+    if (msg.GetDescriptor() == Serializer::descriptor()) {
+        ok = ((const Serializer&)msg).SerializeTo(&wrapper);
+    } else {
+        ok = msg.SerializeToZeroCopyStream(&wrapper);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to serialize input pb="
+                     << msg.GetDescriptor()->full_name();
+        return false;
+    }
+    return ZstdCompress(serialized_pb, buf);
+}
+
+bool ZstdDecompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (!ZstdDecompress(data, &binary_pb)) {
+        return false;
+    }
+    bool ok;
+    butil::IOBufAsZeroCopyInputStream stream(binary_pb);
+    if (msg->GetDescriptor() == Deserializer::descriptor()) {
+        ok = ((Deserializer*)msg)->DeserializeFrom(&stream);
+    } else {
+        ok = msg->ParseFromZeroCopyStream(&stream);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to deserialize input message="
+                     << msg->GetDescriptor()->full_name();
+    }
+    return ok;
+}
+
+#ifdef BRPC_WITH_ZSTD
+
+// Content of -zstd_dictionary, NULL if no dictionary is used.
+static std::string* g_zstd_dict = NULL;
+static ZSTD_DDict* g_zstd_ddict = NULL;
+// A CDict is bound to a compression level, so one is created for each level
+// in use. They're never freed.
+static pthread_mutex_t g_zstd_cdicts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<int, ZSTD_CDict*>* g_zstd_cdicts = NULL;
+
+static ZSTD_CDict* GetOrNewZstdCDict(int level) {
+    BAIDU_SCOPED_LOCK(g_zstd_cdicts_mutex);
+    if (g_zstd_cdicts == NULL) {
+        g_zstd_cdicts = new std::map<int, ZSTD_CDict*>;
+    }
+    ZSTD_CDict*& cdict = (*g_zstd_cdicts)[level];
+    if (cdict == NULL) {
+        cdict = ZSTD_createCDict(g_zstd_dict->data(), g_zstd_dict->size(),
+                                 level);
+    }
+    return cdict;
+}
+
+int InitZstdDictionary() {
+    if (FLAGS_zstd_dictionary.empty()) {
+        return 0;
+    }
+    std::string dict;
+    if (!butil::ReadFileToString(butil::FilePath(FLAGS_zstd_dictionary),
+                                 &dict)) {
+        LOG(ERROR) << "Fail to read zstd dictionary from "
+                   << FLAGS_zstd_dictionary;
+        return -1;
+    }
+    g_zstd_dict = new std::string(dict);
+    g_zstd_ddict = ZSTD_createDDict(dict.data(), dict.size());
+    if (g_zstd_ddict == NULL ||
+        GetOrNewZstdCDict(FLAGS_zstd_compression_level) == NULL) {
+        LOG(ERROR) << "Invalid zstd dictionary in " << FLAGS_zstd_dictionary;
+        return -1;
+    }
+    LOG(INFO) << "Loaded zstd dictionary(id="
+              << ZSTD_getDictID_fromDict(dict.data(), dict.size())
+              << ") from " << FLAGS_zstd_dictionary;
+    return 0;
+}
+
+// Contexts are reused by threads since creating them is not cheap.
+// (De)compression never yields, so sharing them between bthreads on the
+// same pthread is safe.
+struct ZstdContexts {
+    ZSTD_CCtx* cctx;
+    ZSTD_DCtx* dctx;
+    // CDict of `cdict_level', cached to skip the lock of g_zstd_cdicts.
+    ZSTD_CDict* cdict;
+    int cdict_level;
+};
+
+static void DeleteZstdContexts(void* arg) {
+    ZstdContexts* ctx = static_cast<ZstdContexts*>(arg);
+    ZSTD_freeCCtx(ctx->cctx);
+    ZSTD_freeDCtx(ctx->dctx);
+    delete ctx;
+}
+
+static BAIDU_THREAD_LOCAL ZstdContexts* tls_zstd_contexts = NULL;
+
+static ZstdContexts* GetZstdContexts() {
+    ZstdContexts* ctx = tls_zstd_contexts;
+    if (ctx != NULL) {
+        return ctx;
+    }
+    ctx = new (std::nothrow) ZstdContexts;
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ctx->cctx = ZSTD_createCCtx();
+    ctx->dctx = ZSTD_createDCtx();
+    ctx->cdict = NULL;
+    ctx->cdict_level = 0;
+    if (ctx->cctx == NULL || ctx->dctx == NULL) {
+        LOG(ERROR) << "Fail to create zstd contexts";
+        DeleteZstdContexts(ctx);
+        return NULL;
+    }
+    tls_zstd_contexts = ctx;
+    butil::thread_atexit(DeleteZstdContexts, ctx);
+    return ctx;
+}
+
+// Run `fn' on `input' until it's consumed (or the frame is complete when
+// `end' is true), writing into blocks of `stream' directly.
+template <typename Fn>
+static bool RunZstdStream(Fn fn, ZSTD_inBuffer* input, bool end,
+                          butil::IOBufAsZeroCopyOutputStream* stream,
+                          ZSTD_outBuffer* output, size_t* rc) {
+    while (true) {
+        if (output->pos == output->size) {
+            void* dst = NULL;
+            int size = 0;
+            if (!stream->Next(&dst, &size)) {
+                return false;
+            }
+            output->dst = dst;
+            output->size = size;
+            output->pos = 0;
+        }
+        const size_t last_pos = output->pos;
+        *rc = fn(output, input);
+        if (ZSTD_isError(*rc)) {
+            LOG(WARNING) << "Fail to run zstd: " << ZSTD_getErrorName(*rc);
+            return false;
+        }
+        if (end ? (*rc == 0) : (input->pos == input->size)) {
+            return true;
+        }
+        if (output->pos == last_pos && output->pos != output->size &&
+            input->pos == input->size) {
+            // No progress without more input.
+            return !end;
+        }
+    }
+}
+
+bool ZstdCompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    ZstdContexts* ctx = GetZstdContexts();
+    if (ctx == NULL) {
+        return false;
+    }
+    ZSTD_CCtx* cctx = ctx->cctx;
+    const int level = FLAGS_zstd_compression_level;
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+    if (g_zstd_dict != NULL) {
+        // Parameters of a referenced CDict supersede the ones of the
+        // context, use the CDict created with the current level.
+        if (ctx->cdict == NULL || ctx->cdict_level != level) {
+            ctx->cdict = GetOrNewZstdCDict(level);
+            ctx->cdict_level = level;
+            if (ctx->cdict == NULL) {
+                LOG(WARNING) << "Fail to create zstd CDict of level=" << level;
+                return false;
+            }
+        }
+        ZSTD_CCtx_refCDict(cctx, ctx->cdict);
+    } else {
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+    }
+    ZSTD_CCtx_setPledgedSrcSize(cctx, in.size());
+    auto compress_continue = [cctx](ZSTD_outBuffer* o, ZSTD_inBuffer* i) {
+        return ZSTD_compressStream2(cctx, o, i, ZSTD_e_continue);
+    };
+    auto compress_end = [cctx](ZSTD_outBuffer* o, ZSTD_inBuffer* i) {
+        return ZSTD_compressStream2(cctx, o, i, ZSTD_e_end);
+    };
+
+    butil::IOBufAsZeroCopyOutputStream stream(out);
+    ZSTD_outBuffer output = { NULL, 0, 0 };
+    size_t rc = 0;
+    bool ok = true;
+    // Compress blocks of `in' in place without flattening it.
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; ok && i < nblock; ++i) {
+        const butil::StringPiece block = in.backing_block(i);
+        ZSTD_inBuffer input = { block.data(), block.size(), 0 };
+        ok = RunZstdStream(compress_continue, &input, false,
+                           &stream, &output, &rc);
+    }
+    if (ok) {
+        ZSTD_inBuffer input = { NULL, 0, 0 };
+        ok = RunZstdStream(compress_end, &input, true, &stream, &output, &rc);
+    }
+    stream.BackUp(output.size - output.pos);
+    return ok;
+}
+
+bool ZstdDecompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    ZstdContexts* ctx = GetZstdContexts();
+    if (ctx == NULL) {
+        return false;
+    }
+    ZSTD_DCtx* dctx = ctx->dctx;
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    ZSTD_DCtx_refDDict(dctx, g_zstd_ddict);
+    auto decompress = [dctx](ZSTD_outBuffer* o, ZSTD_inBuffer* i) {
+        return ZSTD_decompressStream(dctx, o, i);
+    };
+
+    butil::IOBufAsZeroCopyOutputStream stream(out);
+    ZSTD_outBuffer output = { NULL, 0, 0 };
+    size_t rc = 1;
+    bool ok = true;
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; ok && i < nblock; ++i) {
+        const butil::StringPiece block = in.backing_block(i);
+        ZSTD_inBuffer input = { block.data(), block.size(), 0 };
+        ok = RunZstdStream(decompress, &input, false, &stream, &output, &rc);
+    }
+    if (ok && rc != 0) {
+        // Flush data buffered in the context, fail if the frame is truncated.
+        ZSTD_inBuffer input = { NULL, 0, 0 };
+        ok = RunZstdStream(decompress, &input, true, &stream, &output, &rc);
+        LOG_IF(WARNING, !ok) << "Truncated zstd frame, size=" << in.size();
+    }
+    stream.BackUp(output.size - output.pos);
+    return ok;
+}
+
+#else  // BRPC_WITH_ZSTD
+
+int InitZstdDictionary() {
+    LOG_IF(ERROR, !FLAGS_zstd_dictionary.empty())
+        << "brpc is not built with zstd, -zstd_dictionary is ignored";
+    return 0;
+}
+
+bool ZstdCompress(const butil::IOBuf&, butil::IOBuf*) {
+    LOG(ERROR) << "brpc is not built with zstd";
+    return false;
+}
+
+bool ZstdDecompress(const butil::IOBuf&, butil::IOBuf*) {
+    LOG(ERROR) << "brpc is not built with zstd";
+    return false;
+}
+
+#endif  // BRPC_WITH_ZSTD
+
+}  // namespace policy
+} // namespace brpc
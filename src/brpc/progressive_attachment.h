@@ -33,11 +33,12 @@ class ProgressiveAttachment : public SharedObject {
 friend class Controller;
 public:
     // [Thread-safe]
-    // Write `data' as one HTTP chunk to peer ASAP.
+    // Write `data' as one HTTP chunk(or DATA frames in http2) to peer ASAP.
     // Returns 0 on success, -1 otherwise and errno is set.
-    // Errnos are same as what Socket.Write may set.
-    int Write(const butil::IOBuf& data);
-    int Write(const void* data, size_t n);
+    // Errnos are same as what Socket.Write may set. EOVERCROWDED means that
+    // too much data is not sent yet, try again later.
+    virtual int Write(const butil::IOBuf& data);
+    virtual int Write(const void* data, size_t n);
 
     // Get ip/port of peer/self.
     butil::EndPoint remote_side() const;
@@ -58,10 +59,10 @@ protected:
     // will encode each piece of data in the format of chunked-encoding.
     ProgressiveAttachment(SocketUniquePtr& movable_httpsock,
                           bool before_http_1_1);
-    ~ProgressiveAttachment();
+    virtual ~ProgressiveAttachment();
 
     // Called by controller only.
-    void MarkRPCAsDone(bool rpc_failed);
+    virtual void MarkRPCAsDone(bool rpc_failed);
     
     bool _before_http_1_1;
     bool _pause_from_mark_rpc_as_done;
@@ -22,12 +22,18 @@
 
 #include "brpc/redis_command.h"
 #include "brpc/proto_base.pb.h"
+#include "brpc/reloadable_flags.h"
 #include "butil/status.h"
 #include "butil/strings/string_util.h" // StringToLowerASCII
 
 namespace brpc {
 
 DEFINE_bool(redis_verbose_crlf2space, false, "[DEBUG] Show \\r\\n as a space");
+DEFINE_bool(redis_reference_bulk_strings, false,
+            "Long bulk strings in replies reference the buffer read from "
+            "the connection instead of being copied, they're only accessible "
+            "by data() rather than c_str()");
+BRPC_VALIDATE_GFLAG(redis_reference_bulk_strings, PassValidate);
 
 RedisRequest::RedisRequest()
     : NonreflectableMessage<RedisRequest>() {
@@ -227,6 +233,7 @@ void RedisResponse::Clear() {
     _first_reply.Reset();
     _other_replies = NULL;
     _arena.clear();
+    _pinned.clear();
     _nreply = 0;
     _cached_size_ = 0;
 }
@@ -267,6 +274,22 @@ void RedisResponse::MergeFrom(const RedisResponse& from) {
     _nreply = new_nreply;
 }
 
+int RedisResponse::ResetReplies(int n) {
+    Clear();
+    if (n > 1) {
+        _other_replies = (RedisReply*)_arena.allocate(sizeof(RedisReply) * (n - 1));
+        if (_other_replies == NULL) {
+            LOG(ERROR) << "Fail to allocate RedisReply[" << n - 1 << "]";
+            return -1;
+        }
+        for (int i = 0; i < n - 1; ++i) {
+            new (&_other_replies[i]) RedisReply(&_arena);
+        }
+    }
+    _nreply = n;
+    return 0;
+}
+
 bool RedisResponse::IsInitialized() const {
     return reply_size() > 0;
 }
@@ -276,6 +299,7 @@ void RedisResponse::Swap(RedisResponse* other) {
         _first_reply.Swap(other->_first_reply);
         std::swap(_other_replies, other->_other_replies);
         _arena.swap(other->_arena);
+        _pinned.swap(other->_pinned);
         std::swap(_nreply, other->_nreply);
         std::swap(_cached_size_, other->_cached_size_);
     }
@@ -291,9 +315,10 @@ void RedisResponse::Swap(RedisResponse* other) {
 // ===================================================================
 
 ParseError RedisResponse::ConsumePartialIOBuf(butil::IOBuf& buf, int reply_count) {
+    butil::IOBuf* pinned = (FLAGS_redis_reference_bulk_strings ? &_pinned : NULL);
     size_t oldsize = buf.size();
     if (reply_size() == 0) {
-        ParseError err = _first_reply.ConsumePartialIOBuf(buf);
+        ParseError err = _first_reply.ConsumePartialIOBuf(buf, pinned);
         if (err != PARSE_OK) {
             return err;
         }
@@ -315,7 +340,7 @@ ParseError RedisResponse::ConsumePartialIOBuf(butil::IOBuf& buf, int reply_count
             }
         }
         for (int i = reply_size(); i < reply_count; ++i) {
-            ParseError err = _other_replies[i - 1].ConsumePartialIOBuf(buf);
+            ParseError err = _other_replies[i - 1].ConsumePartialIOBuf(buf, pinned);
             if (err != PARSE_OK) {
                 return err;
             }
@@ -160,6 +160,9 @@ public:
     // Returns PARSE_OK on success.
     // Returns PARSE_ERROR_NOT_ENOUGH_DATA if data in `buf' is not enough to parse.
     // Returns PARSE_ERROR_ABSOLUTELY_WRONG if the parsing failed.
+    // If -redis_reference_bulk_strings is on, long bulk strings are
+    // referenced rather than copied, the blocks holding them are kept by
+    // this response until Clear().
     ParseError ConsumePartialIOBuf(butil::IOBuf& buf, int reply_count);
     
     // implements Message ----------------------------------------------
@@ -173,13 +176,22 @@ public:
     ::google::protobuf::Metadata GetMetadata() const PB_527_OVERRIDE;
 
 private:
+friend class RedisClusterChannel;
     void SharedCtor();
     void SharedDtor();
     void SetCachedSize(int size) const PB_425_OVERRIDE;
 
+    // Make this response have `n' nil replies which are set by
+    // mutable_reply(). Returns 0 on success, -1 otherwise.
+    int ResetReplies(int n);
+    RedisReply& mutable_reply(int index) {
+        return (index == 0 ? _first_reply : _other_replies[index - 1]);
+    }
+
     RedisReply _first_reply;
     RedisReply* _other_replies;
     butil::Arena _arena;
+    butil::IOBuf _pinned;  // referenced by bulk strings in replies.
     int _nreply;
     mutable int _cached_size_;
 };
@@ -188,22 +200,34 @@ std::ostream& operator<<(std::ostream& os, const RedisRequest&);
 std::ostream& operator<<(std::ostream& os, const RedisResponse&);
 
 class RedisCommandHandler;
+class RedisBatchCommandHandler;
 
 // Container of CommandHandlers.
 // Assign an instance to ServerOption.redis_service to enable redis support. 
 class RedisService {
 public:
+    RedisService() : _batch_handler(NULL) {}
     virtual ~RedisService() {}
     
     // Call this function to register `handler` that can handle command `name`.
     bool AddCommandHandler(const std::string& name, RedisCommandHandler* handler);
 
-    // This function should not be touched by user and used by brpc deverloper only.
+    // Call this function to run all commands cut from one read of a connection
+    // by `handler' together, see RedisBatchCommandHandler below. Commands not
+    // handled by `handler' are still dispatched to the command handlers.
+    // `handler' is not owned by the service.
+    void SetBatchCommandHandler(RedisBatchCommandHandler* handler) {
+        _batch_handler = handler;
+    }
+
+    // These functions should not be touched by user and used by brpc deverloper only.
     RedisCommandHandler* FindCommandHandler(const butil::StringPiece& name) const;
+    RedisBatchCommandHandler* batch_command_handler() const { return _batch_handler; }
 
 private:
     typedef std::unordered_map<std::string, RedisCommandHandler*> CommandMap;
     CommandMap _command_map;
+    RedisBatchCommandHandler* _batch_handler;
 };
 
 enum RedisCommandHandlerResult {
@@ -238,6 +262,9 @@ public:
 
     RedisCommandParser parser;
     butil::Arena arena;
+    // Commands cut from the latest read, reused between reads to save
+    // allocations. Only the first few ones are valid.
+    std::vector<std::vector<butil::StringPiece> > commands;
 
 private:
     // If user is authenticated, session is set.
@@ -296,6 +323,31 @@ public:
     virtual RedisCommandHandler* NewTransactionHandler();
 };
 
+// The handler of all commands cut from one read of a connection, which makes
+// commands pipelined by clients executable together, e.g. running GETs of
+// different keys against an in-memory store with one lock, rather than one
+// lock per command.
+class RedisBatchCommandHandler {
+public:
+    virtual ~RedisBatchCommandHandler() {}
+
+    // `commands' is the array of `ncommand' commands in the order that they
+    // arrive, the format of each command is same with `args' of
+    // RedisCommandHandler::Run(). Serialize replies of the commands handled
+    // into `output' in order, e.g. by RedisReply::SerializeTo() with replies
+    // allocated on `ctx->arena', all replies are sent in one write.
+    // Returns the number of leading commands that are handled, the remaining
+    // ones are dispatched to the command handlers one by one as usual, e.g.
+    // return 0 when the first command is "multi". Returns -1 to close the
+    // connection.
+    // This method is not called when a transaction or a batched process of
+    // RedisCommandHandler is in progress.
+    virtual int Run(RedisConnContext* ctx,
+                    const std::vector<butil::StringPiece>* commands,
+                    int ncommand,
+                    butil::IOBufAppender* output) = 0;
+};
+
 } // namespace brpc
 
 #endif  // BRPC_REDIS_H
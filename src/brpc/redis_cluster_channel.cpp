@@ -0,0 +1,806 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <strings.h>
+#include <deque>
+#include <memory>
+#include "butil/fast_rand.h"
+#include "butil/string_splitter.h"
+#include "butil/strings/string_util.h"
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include "brpc/controller.h"
+#include "brpc/redis.h"
+#include "brpc/redis_command.h"
+#include "brpc/redis_cluster_channel.h"
+
+
+namespace brpc {
+
+// CRC16-CCITT(XMODEM) used by redis cluster.
+static const uint16_t s_crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
+};
+
+static uint16_t CRC16(const char* data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; ++i) {
+        crc = (crc << 8) ^ s_crc16_table[((crc >> 8) ^ (uint8_t)data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+int RedisClusterSlot(const butil::StringPiece& key) {
+    const size_t start = key.find('{');
+    if (start != butil::StringPiece::npos) {
+        const size_t end = key.find('}', start + 1);
+        if (end != butil::StringPiece::npos && end != start + 1) {
+            return CRC16(key.data() + start + 1, end - start - 1) & (REDIS_CLUSTER_SLOTS - 1);
+        }
+    }
+    return CRC16(key.data(), key.size()) & (REDIS_CLUSTER_SLOTS - 1);
+}
+
+RedisClusterChannelOptions::RedisClusterChannelOptions()
+    : max_redirects(5) {}
+
+namespace {
+
+// How replies of a command split by slots are merged.
+enum SplitType {
+    SPLIT_NONE = 0,
+    SPLIT_MGET,   // array of values in order of keys
+    SPLIT_MSET,   // OK
+    SPLIT_COUNT,  // sum of integers, e.g. DEL
+};
+
+// A command, or a part of a split command which is sent to one node.
+struct SubCommand {
+    int index;  // index of the command in the request
+    int slot;   // -1 if the command has no keys
+    std::vector<butil::StringPiece> args;
+    // Positions of keys in the split command.
+    std::vector<int> positions;
+    // Node in the last MOVED/ASK reply.
+    Channel* redirected;
+    // Send ASKING before the command.
+    bool asking;
+    int nredirect;
+    const RedisReply* reply;
+
+    SubCommand()
+        : index(0), slot(-1), redirected(NULL)
+        , asking(false), nredirect(0), reply(NULL) {}
+};
+
+// Commands sent to one node in one round.
+struct NodeCall {
+    Channel* node;
+    std::vector<SubCommand*> commands;
+    RedisRequest request;
+    RedisResponse response;
+    Controller cntl;
+};
+
+inline bool CommandIs(const butil::StringPiece& cmd, const char* name) {
+    const size_t len = strlen(name);
+    return cmd.size() == len && strncasecmp(cmd.data(), name, len) == 0;
+}
+
+SplitType GetSplitType(const butil::StringPiece& cmd) {
+    if (CommandIs(cmd, "mget")) {
+        return SPLIT_MGET;
+    } else if (CommandIs(cmd, "mset")) {
+        return SPLIT_MSET;
+    } else if (CommandIs(cmd, "del") || CommandIs(cmd, "unlink") ||
+               CommandIs(cmd, "exists") || CommandIs(cmd, "touch")) {
+        return SPLIT_COUNT;
+    }
+    return SPLIT_NONE;
+}
+
+// Commands which can be resent safely.
+bool IsReadOnly(const butil::StringPiece& cmd) {
+    static const char* const readonly_commands[] = {
+        "bitcount", "bitpos", "dbsize", "dump", "echo", "exists", "geodist",
+        "geohash", "geopos", "get", "getbit", "getrange", "hexists", "hget",
+        "hgetall", "hkeys", "hlen", "hmget", "hstrlen", "hvals", "lindex",
+        "llen", "lrange", "mget", "ping", "pttl", "scard", "sismember",
+        "smembers", "smismember", "strlen", "ttl", "type", "xlen", "xrange",
+        "xrevrange", "zcard", "zcount", "zlexcount", "zmscore", "zrange",
+        "zrangebylex", "zrangebyscore", "zrank", "zrevrange",
+        "zrevrangebylex", "zrevrangebyscore", "zrevrank", "zscore"
+    };
+    for (size_t i = 0; i < arraysize(readonly_commands); ++i) {
+        if (CommandIs(cmd, readonly_commands[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// True if the failed call did not write its request to the node, e.g. the
+// connection could not be established.
+bool IsNotSent(const Controller& cntl) {
+    switch (cntl.ErrorCode()) {
+    case EHOSTDOWN:
+    case ECONNREFUSED:
+    case ENETUNREACH:
+    case EHOSTUNREACH:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool IsKeyless(const butil::StringPiece& cmd) {
+    static const char* const keyless_commands[] = {
+        "auth", "client", "cluster", "command", "config", "dbsize", "echo",
+        "flushall", "flushdb", "function", "hello", "info", "lastsave",
+        "ping", "randomkey", "script", "select", "time", "wait"
+    };
+    for (size_t i = 0; i < arraysize(keyless_commands); ++i) {
+        if (CommandIs(cmd, keyless_commands[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Split `args' of the index-th command into `subs'.
+SplitType SplitCommand(int index, const std::vector<butil::StringPiece>& args,
+                       std::deque<SubCommand>* subs) {
+    const SplitType type = GetSplitType(args[0]);
+    const size_t step = (type == SPLIT_MSET ? 2 : 1);
+    if (type != SPLIT_NONE && args.size() > 1 + step) {
+        // Keys in a same slot are kept in one command.
+        std::map<int, SubCommand*> slot_to_sub;
+        for (size_t i = 1, pos = 0; i < args.size(); i += step, ++pos) {
+            const int slot = RedisClusterSlot(args[i]);
+            SubCommand*& sub = slot_to_sub[slot];
+            if (sub == NULL) {
+                subs->push_back(SubCommand());
+                sub = &subs->back();
+                sub->index = index;
+                sub->slot = slot;
+                sub->args.push_back(args[0]);
+            }
+            for (size_t j = i; j < i + step && j < args.size(); ++j) {
+                sub->args.push_back(args[j]);
+            }
+            sub->positions.push_back(pos);
+        }
+        return type;
+    }
+    subs->push_back(SubCommand());
+    SubCommand& sub = subs->back();
+    sub.index = index;
+    sub.args = args;
+    if (args.size() < 2 || IsKeyless(args[0])) {
+        sub.slot = -1;
+    } else if (CommandIs(args[0], "eval") || CommandIs(args[0], "evalsha") ||
+               CommandIs(args[0], "fcall") || CommandIs(args[0], "fcall_ro")) {
+        // EVAL script numkeys key [key ...] arg [arg ...]
+        const long numkeys = (args.size() > 3 ? strtol(args[2].as_string().c_str(), NULL, 10) : 0);
+        sub.slot = (numkeys > 0 ? RedisClusterSlot(args[3]) : -1);
+    } else {
+        sub.slot = RedisClusterSlot(args[1]);
+    }
+    return SPLIT_NONE;
+}
+
+// Parse "MOVED <slot> <host:port>" or "ASK <slot> <host:port>".
+bool ParseRedirection(const char* msg, bool* ask, int* slot, std::string* addr) {
+    if (strncmp(msg, "MOVED ", 6) == 0) {
+        *ask = false;
+        msg += 6;
+    } else if (strncmp(msg, "ASK ", 4) == 0) {
+        *ask = true;
+        msg += 4;
+    } else {
+        return false;
+    }
+    char* endptr = NULL;
+    const long value = strtol(msg, &endptr, 10);
+    if (endptr == msg || *endptr != ' ' || value < 0 || value >= REDIS_CLUSTER_SLOTS) {
+        return false;
+    }
+    *slot = value;
+    addr->assign(endptr + 1);
+    return !addr->empty();
+}
+
+} // namespace
+
+RedisClusterChannel::SlotTable::SlotTable()
+    : nodes(REDIS_CLUSTER_SLOTS, NULL) {}
+
+RedisClusterChannel::RedisClusterChannel()
+    : _refreshing(false)
+    , _last_refresh_us(0)
+    , _nrefreshed(0)
+    , _refresh_tid(INVALID_BTHREAD) {}
+
+RedisClusterChannel::~RedisClusterChannel() {
+    bthread_t tid;
+    {
+        BAIDU_SCOPED_LOCK(_refresh_mutex);
+        tid = _refresh_tid;
+    }
+    if (tid != INVALID_BTHREAD) {
+        bthread_join(tid, NULL);
+    }
+    for (std::map<std::string, Channel*>::iterator
+             it = _nodes.begin(); it != _nodes.end(); ++it) {
+        delete it->second;
+    }
+    _nodes.clear();
+}
+
+int RedisClusterChannel::Init(const char* seeds,
+                              const RedisClusterChannelOptions* options) {
+    if (seeds == NULL) {
+        LOG(ERROR) << "Param[seeds] is NULL";
+        return -1;
+    }
+    if (options) {
+        _options = *options;
+    }
+    _options.channel_options.protocol = PROTOCOL_REDIS;
+    for (butil::StringSplitter sp(seeds, ','); sp; ++sp) {
+        std::string seed;
+        butil::TrimWhitespaceASCII(std::string(sp.field(), sp.length()),
+                                   butil::TRIM_ALL, &seed);
+        if (!seed.empty()) {
+            _seeds.push_back(seed);
+        }
+    }
+    if (_seeds.empty()) {
+        LOG(ERROR) << "No seeds in `" << seeds << '\'';
+        return -1;
+    }
+    return RefreshSlots();
+}
+
+Channel* RedisClusterChannel::GetOrNewNode(const std::string& addr) {
+    BAIDU_SCOPED_LOCK(_node_mutex);
+    Channel*& node = _nodes[addr];
+    if (node == NULL) {
+        Channel* chan = new Channel;
+        if (chan->Init(addr.c_str(), &_options.channel_options) != 0) {
+            LOG(ERROR) << "Fail to init channel to redis node=" << addr;
+            delete chan;
+            _nodes.erase(addr);
+            return NULL;
+        }
+        node = chan;
+    }
+    return node;
+}
+
+Channel* RedisClusterChannel::GetNodeOfSlot(int slot) {
+    butil::DoublyBufferedData<SlotTable>::ScopedPtr s;
+    if (_slots.Read(&s) != 0) {
+        return NULL;
+    }
+    return s->nodes[slot];
+}
+
+Channel* RedisClusterChannel::GetAnyNode() {
+    {
+        butil::DoublyBufferedData<SlotTable>::ScopedPtr s;
+        if (_slots.Read(&s) == 0) {
+            const int start = butil::fast_rand_less_than(REDIS_CLUSTER_SLOTS);
+            for (int i = 0; i < REDIS_CLUSTER_SLOTS; ++i) {
+                Channel* node = s->nodes[(start + i) % REDIS_CLUSTER_SLOTS];
+                if (node != NULL) {
+                    return node;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < _seeds.size(); ++i) {
+        Channel* node = GetOrNewNode(_seeds[i]);
+        if (node != NULL) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+size_t RedisClusterChannel::SetSlots(SlotTable& table,
+                                     const std::vector<SlotRange>& ranges) {
+    std::fill(table.nodes.begin(), table.nodes.end(), (Channel*)NULL);
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        for (int slot = ranges[i].start; slot <= ranges[i].end; ++slot) {
+            table.nodes[slot] = ranges[i].node;
+        }
+    }
+    return 1;
+}
+
+size_t RedisClusterChannel::SetSlot(SlotTable& table, int slot, Channel* node) {
+    if (table.nodes[slot] == node) {
+        return 0;
+    }
+    table.nodes[slot] = node;
+    return 1;
+}
+
+int RedisClusterChannel::FetchSlots(const std::string& addr,
+                                    std::vector<SlotRange>* ranges) {
+    Channel* node = GetOrNewNode(addr);
+    if (node == NULL) {
+        return -1;
+    }
+    RedisRequest request;
+    request.AddCommand("CLUSTER SLOTS");
+    RedisResponse response;
+    Controller cntl;
+    node->CallMethod(NULL, &cntl, &request, &response, NULL);
+    if (cntl.Failed()) {
+        LOG(WARNING) << "Fail to fetch slots from " << addr << ": "
+                     << cntl.ErrorText();
+        return -1;
+    }
+    const RedisReply& reply = response.reply(0);
+    if (!reply.is_array()) {
+        LOG(WARNING) << "Invalid reply of CLUSTER SLOTS from " << addr
+                     << ": " << reply;
+        return -1;
+    }
+    // The host is empty when the node does not know its address.
+    const std::string default_host = addr.substr(0, addr.rfind(':'));
+    ranges->clear();
+    for (size_t i = 0; i < reply.size(); ++i) {
+        // [start, end, [host, port, id, ...], replicas...]
+        const RedisReply& r = reply[i];
+        if (r.size() < 3 || !r[0].is_integer() || !r[1].is_integer() ||
+            r[2].size() < 2 || !r[2][0].is_string() || !r[2][1].is_integer()) {
+            LOG(WARNING) << "Invalid slots from " << addr << ": " << r;
+            return -1;
+        }
+        SlotRange range;
+        range.start = r[0].integer();
+        range.end = r[1].integer();
+        if (range.start < 0 || range.end >= REDIS_CLUSTER_SLOTS ||
+            range.start > range.end) {
+            LOG(WARNING) << "Invalid slots from " << addr << ": " << r;
+            return -1;
+        }
+        std::string host = r[2][0].data().as_string();
+        if (host.empty() || host == "?") {
+            host = default_host;
+        }
+        range.node = GetOrNewNode(butil::string_printf(
+                "%s:%" PRId64, host.c_str(), r[2][1].integer()));
+        if (range.node == NULL) {
+            return -1;
+        }
+        ranges->push_back(range);
+    }
+    return 0;
+}
+
+int RedisClusterChannel::RefreshSlots() {
+    // Ask known nodes first since seeds may be removed from the cluster.
+    std::vector<std::string> addrs;
+    {
+        BAIDU_SCOPED_LOCK(_node_mutex);
+        for (std::map<std::string, Channel*>::const_iterator
+                 it = _nodes.begin(); it != _nodes.end(); ++it) {
+            addrs.push_back(it->first);
+        }
+    }
+    addrs.insert(addrs.end(), _seeds.begin(), _seeds.end());
+    std::vector<SlotRange> ranges;
+    for (size_t i = 0; i < addrs.size(); ++i) {
+        if (FetchSlots(addrs[i], &ranges) == 0) {
+            _slots.Modify(SetSlots, ranges);
+            return 0;
+        }
+    }
+    LOG(ERROR) << "Fail to fetch slots from any node of the redis cluster";
+    return -1;
+}
+
+void* RedisClusterChannel::RunRefreshSlots(void* arg) {
+    RedisClusterChannel* channel = static_cast<RedisClusterChannel*>(arg);
+    channel->RefreshSlots();
+    BAIDU_SCOPED_LOCK(channel->_refresh_mutex);
+    channel->_refreshing = false;
+    ++channel->_nrefreshed;
+    channel->_refresh_cond.notify_all();
+    return NULL;
+}
+
+void RedisClusterChannel::StartRefreshSlots(int64_t now_us) {
+    if (bthread_start_background(&_refresh_tid, NULL, RunRefreshSlots, this) != 0) {
+        LOG(ERROR) << "Fail to start bthread to refresh slots";
+        return;
+    }
+    _refreshing = true;
+    _last_refresh_us = now_us;
+}
+
+void RedisClusterChannel::TryRefreshSlots() {
+    // Slots changed by MOVED are updated in-place, refreshing all slots is
+    // not urgent and done in background at most once per interval.
+    const int64_t now_us = butil::gettimeofday_us();
+    BAIDU_SCOPED_LOCK(_refresh_mutex);
+    if (_refreshing || now_us < _last_refresh_us + MIN_REFRESH_INTERVAL_US) {
+        return;
+    }
+    StartRefreshSlots(now_us);
+}
+
+void RedisClusterChannel::WaitForRefreshedSlots(int64_t deadline_us) {
+    std::unique_lock<bthread::Mutex> lck(_refresh_mutex);
+    const int64_t expected = _nrefreshed + 1;
+    while (_nrefreshed < expected) {
+        const int64_t now_us = butil::gettimeofday_us();
+        if (deadline_us >= 0 && now_us >= deadline_us) {
+            return;
+        }
+        // Wake up at the deadline, or when the interval between refreshes
+        // passes if no refresh is running.
+        int64_t wakeup_us = deadline_us;
+        if (!_refreshing) {
+            const int64_t next_us = _last_refresh_us + MIN_REFRESH_INTERVAL_US;
+            if (now_us >= next_us) {
+                StartRefreshSlots(now_us);
+                if (!_refreshing) {
+                    return;
+                }
+            } else if (wakeup_us < 0 || next_us < wakeup_us) {
+                wakeup_us = next_us;
+            }
+        }
+        if (wakeup_us < 0) {
+            _refresh_cond.wait(lck);
+        } else {
+            _refresh_cond.wait_for(lck, wakeup_us - now_us);
+        }
+    }
+}
+
+struct RedisClusterChannel::Call {
+    RedisClusterChannel* channel;
+    Controller* cntl;
+    const google::protobuf::Message* request;
+    google::protobuf::Message* response;
+    google::protobuf::Closure* done;
+};
+
+void* RedisClusterChannel::RunCall(void* arg) {
+    std::unique_ptr<Call> call(static_cast<Call*>(arg));
+    call->channel->DoCallMethod(call->cntl, call->request, call->response);
+    call->done->Run();
+    return NULL;
+}
+
+void RedisClusterChannel::CallMethod(
+    const google::protobuf::MethodDescriptor* /*method*/,
+    google::protobuf::RpcController* controller,
+    const google::protobuf::Message* request,
+    google::protobuf::Message* response,
+    google::protobuf::Closure* done) {
+    Controller* cntl = static_cast<Controller*>(controller);
+    if (done == NULL) {
+        return DoCallMethod(cntl, request, response);
+    }
+    Call* call = new Call;
+    call->channel = this;
+    call->cntl = cntl;
+    call->request = request;
+    call->response = response;
+    call->done = done;
+    bthread_t th;
+    if (bthread_start_background(&th, NULL, RunCall, call) != 0) {
+        LOG(ERROR) << "Fail to start bthread";
+        RunCall(call);
+    }
+}
+
+void RedisClusterChannel::DoCallMethod(Controller* cntl,
+                                       const google::protobuf::Message* request_base,
+                                       google::protobuf::Message* response_base) {
+    const RedisRequest* request = dynamic_cast<const RedisRequest*>(request_base);
+    RedisResponse* response = dynamic_cast<RedisResponse*>(response_base);
+    if (request == NULL || response == NULL) {
+        cntl->SetFailed(EREQUEST, "request and response must be "
+                        "RedisRequest and RedisResponse");
+        return;
+    }
+    const int ncommand = request->command_size();
+    butil::IOBuf buf;
+    if (ncommand == 0 || !request->SerializeTo(&buf)) {
+        cntl->SetFailed(EREQUEST, "Invalid or empty RedisRequest");
+        return;
+    }
+    int64_t deadline_us = -1;
+    if (cntl->timeout_ms() != UNSET_MAGIC_NUM && cntl->timeout_ms() >= 0) {
+        deadline_us = butil::gettimeofday_us() + cntl->timeout_ms() * 1000L;
+    }
+
+    // Parse the commands back to find out their keys.
+    butil::Arena arena;
+    RedisCommandParser parser;
+    std::deque<SubCommand> subs;
+    std::vector<SplitType> split_types(ncommand, SPLIT_NONE);
+    for (int i = 0; i < ncommand; ++i) {
+        std::vector<butil::StringPiece> args;
+        if (parser.Consume(buf, &args, &arena) != PARSE_OK || args.empty()) {
+            cntl->SetFailed(EREQUEST, "Fail to parse command[%d]", i);
+            return;
+        }
+        split_types[i] = SplitCommand(i, args, &subs);
+    }
+
+    // Replies referenced by SubCommand.reply are owned by `calls'.
+    std::vector<std::unique_ptr<NodeCall> > calls;
+    std::vector<SubCommand*> pending;
+    for (size_t i = 0; i < subs.size(); ++i) {
+        pending.push_back(&subs[i]);
+    }
+    while (!pending.empty()) {
+        int64_t timeout_ms = UNSET_MAGIC_NUM;
+        if (deadline_us >= 0) {
+            timeout_ms = (deadline_us - butil::gettimeofday_us()) / 1000;
+            if (timeout_ms <= 0) {
+                cntl->SetFailed(ERPCTIMEDOUT, "Reached timeout=%" PRId64 "ms",
+                                cntl->timeout_ms());
+                return;
+            }
+        }
+        // Group commands by nodes.
+        std::map<Channel*, NodeCall*> node_calls;
+        for (size_t i = 0; i < pending.size(); ++i) {
+            SubCommand* sub = pending[i];
+            Channel* node = sub->redirected;
+            if (node == NULL) {
+                node = (sub->slot < 0 ? GetAnyNode() : GetNodeOfSlot(sub->slot));
+            }
+            if (node == NULL) {
+                cntl->SetFailed(EHOSTDOWN, "No redis node serves slot=%d", sub->slot);
+                return;
+            }
+            NodeCall*& nc = node_calls[node];
+            if (nc == NULL) {
+                calls.emplace_back(new NodeCall);
+                nc = calls.back().get();
+                nc->node = node;
+                nc->cntl.set_log_id(cntl->log_id());
+                if (timeout_ms != UNSET_MAGIC_NUM) {
+                    nc->cntl.set_timeout_ms(timeout_ms);
+                }
+            }
+            if (sub->asking) {
+                nc->request.AddCommand("ASKING");
+            }
+            nc->request.AddCommandByComponents(sub->args.data(), sub->args.size());
+            nc->commands.push_back(sub);
+        }
+        for (std::map<Channel*, NodeCall*>::iterator
+                 it = node_calls.begin(); it != node_calls.end(); ++it) {
+            NodeCall* nc = it->second;
+            nc->node->CallMethod(NULL, &nc->cntl, &nc->request, &nc->response,
+                                 DoNothing());
+        }
+        for (std::map<Channel*, NodeCall*>::iterator
+                 it = node_calls.begin(); it != node_calls.end(); ++it) {
+            Join(it->second->cntl.call_id());
+        }
+
+        std::vector<SubCommand*> next_pending;
+        bool need_refresh = false;
+        bool wait_refresh = false;
+        for (std::map<Channel*, NodeCall*>::iterator
+                 it = node_calls.begin(); it != node_calls.end(); ++it) {
+            NodeCall* nc = it->second;
+            if (nc->cntl.Failed() ||
+                nc->response.reply_size() != nc->request.command_size()) {
+                // The node may be down, retry after refreshing slots. Commands
+                // which may have been run by the node are not resent unless
+                // they're read-only, their replies are errors.
+                const bool maybe_run = !(nc->cntl.Failed() && IsNotSent(nc->cntl));
+                RedisReply* error = NULL;
+                for (size_t i = 0; i < nc->commands.size(); ++i) {
+                    SubCommand* sub = nc->commands[i];
+                    if (maybe_run && !IsReadOnly(sub->args[0])) {
+                        if (error == NULL) {
+                            error = new (arena.allocate(sizeof(RedisReply))) RedisReply(&arena);
+                            error->FormatError("ERR fail to access redis node: %s",
+                                               nc->cntl.Failed() ? nc->cntl.ErrorText().c_str()
+                                               : "unmatched number of replies");
+                        }
+                        sub->reply = error;
+                        continue;
+                    }
+                    if (++sub->nredirect > _options.max_redirects) {
+                        cntl->SetFailed(nc->cntl.Failed() ? nc->cntl.ErrorCode() : ERESPONSE,
+                                        "Fail to access redis node: %s",
+                                        nc->cntl.Failed() ? nc->cntl.ErrorText().c_str()
+                                        : "unmatched number of replies");
+                        return;
+                    }
+                    sub->redirected = NULL;
+                    sub->asking = false;
+                    next_pending.push_back(sub);
+                    // Slots still point to the node until refreshed.
+                    wait_refresh = true;
+                }
+                need_refresh = true;
+                continue;
+            }
+            int reply_index = 0;
+            for (size_t i = 0; i < nc->commands.size(); ++i) {
+                SubCommand* sub = nc->commands[i];
+                if (sub->asking) {
+                    ++reply_index;  // skip reply of ASKING
+                }
+                const RedisReply& reply = nc->response.reply(reply_index++);
+                sub->reply = &reply;
+                bool ask = false;
+                int slot = 0;
+                std::string addr;
+                if (!reply.is_error() ||
+                    !ParseRedirection(reply.error_message(), &ask, &slot, &addr) ||
+                    sub->nredirect >= _options.max_redirects) {
+                    continue;
+                }
+                Channel* node = GetOrNewNode(addr);
+                if (node == NULL) {
+                    continue;
+                }
+                ++sub->nredirect;
+                sub->redirected = node;
+                sub->asking = ask;
+                if (!ask) {
+                    _slots.Modify(SetSlot, slot, node);
+                    need_refresh = true;
+                }
+                next_pending.push_back(sub);
+            }
+        }
+        if (wait_refresh) {
+            // Resend commands to the failed node after slots are refreshed,
+            // which may be moved to other nodes by failover.
+            WaitForRefreshedSlots(deadline_us);
+        } else if (need_refresh) {
+            TryRefreshSlots();
+        }
+        pending.swap(next_pending);
+    }
+
+    // Put replies into the response in order of commands.
+    std::vector<std::vector<const SubCommand*> > parts(ncommand);
+    for (size_t i = 0; i < subs.size(); ++i) {
+        parts[subs[i].index].push_back(&subs[i]);
+    }
+    if (response->ResetReplies(ncommand) != 0) {
+        cntl->SetFailed(ENOMEM, "Fail to allocate replies");
+        return;
+    }
+    for (int i = 0; i < ncommand; ++i) {
+        RedisReply& out = response->mutable_reply(i);
+        const std::vector<const SubCommand*>& cmd_parts = parts[i];
+        if (cmd_parts.size() == 1) {
+            out.CopyFromDifferentArena(*cmd_parts[0]->reply);
+            continue;
+        }
+        // Merge replies of the split command. Any error fails the command.
+        const RedisReply* error = NULL;
+        for (size_t j = 0; j < cmd_parts.size(); ++j) {
+            const RedisReply& r = *cmd_parts[j]->reply;
+            if (r.is_error()) {
+                error = &r;
+                break;
+            }
+            if ((split_types[i] == SPLIT_MGET &&
+                 (!r.is_array() || r.size() != cmd_parts[j]->positions.size())) ||
+                (split_types[i] == SPLIT_COUNT && !r.is_integer())) {
+                error = &r;
+                break;
+            }
+        }
+        if (error != NULL) {
+            if (error->is_error()) {
+                out.CopyFromDifferentArena(*error);
+            } else {
+                out.FormatError("ERR unexpected reply of split command: %s",
+                                RedisReplyTypeToString(error->type()));
+            }
+            continue;
+        }
+        if (split_types[i] == SPLIT_MGET) {
+            size_t nkey = 0;
+            for (size_t j = 0; j < cmd_parts.size(); ++j) {
+                nkey += cmd_parts[j]->positions.size();
+            }
+            out.SetArray(nkey);
+            for (size_t j = 0; j < cmd_parts.size(); ++j) {
+                const SubCommand* part = cmd_parts[j];
+                for (size_t k = 0; k < part->positions.size(); ++k) {
+                    out[part->positions[k]].CopyFromDifferentArena((*part->reply)[k]);
+                }
+            }
+        } else if (split_types[i] == SPLIT_COUNT) {
+            int64_t count = 0;
+            for (size_t j = 0; j < cmd_parts.size(); ++j) {
+                count += cmd_parts[j]->reply->integer();
+            }
+            out.SetInteger(count);
+        } else {
+            out.SetStatus("OK");
+        }
+    }
+}
+
+void RedisClusterChannel::Describe(std::ostream& os,
+                                   const DescribeOptions& options) const {
+    os << "RedisClusterChannel[";
+    {
+        BAIDU_SCOPED_LOCK(_node_mutex);
+        for (std::map<std::string, Channel*>::const_iterator
+                 it = _nodes.begin(); it != _nodes.end(); ++it) {
+            if (it != _nodes.begin()) {
+                os << ' ';
+            }
+            os << it->first;
+        }
+    }
+    os << ']';
+}
+
+int RedisClusterChannel::CheckHealth() {
+    return GetAnyNode() != NULL ? 0 : -1;
+}
+
+} // namespace brpc
@@ -0,0 +1,176 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_REDIS_CLUSTER_CHANNEL_H
+#define BRPC_REDIS_CLUSTER_CHANNEL_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "butil/containers/doubly_buffered_data.h"
+#include "butil/strings/string_piece.h"
+#include "butil/synchronization/lock.h"
+#include "bthread/condition_variable.h"
+#include "bthread/mutex.h"
+#include "bthread/types.h"
+#include "brpc/channel.h"
+
+
+namespace brpc {
+
+// Number of hash slots in redis cluster.
+const int REDIS_CLUSTER_SLOTS = 16384;
+
+// Slot of `key' in redis cluster, namely CRC16(key) mod 16384. If the key
+// contains a non-empty "{...}", only the part inside the first one is
+// hashed (hash tags).
+int RedisClusterSlot(const butil::StringPiece& key);
+
+struct RedisClusterChannelOptions {
+    RedisClusterChannelOptions();
+
+    // Options of channels to nodes of the cluster. `protocol' is always
+    // overwritten with "redis".
+    ChannelOptions channel_options;
+
+    // Max times of following MOVED/ASK redirections for a command, or of
+    // resending commands to a node which fails to respond. Only read-only
+    // commands or commands which were not sent are resent.
+    // Default: 5
+    int max_redirects;
+};
+
+// A channel to redis cluster without proxies. Slots of the cluster are
+// fetched by `CLUSTER SLOTS' from seed nodes. Commands in a RedisRequest
+// are sent to nodes owning slots of their keys, commands to a same node are
+// pipelined and nodes are accessed in parallel, replies are put into the
+// RedisResponse in the same order of commands. MGET, MSET, DEL, UNLINK,
+// EXISTS and TOUCH with keys in different slots are split by slots and
+// replies are merged as if the command was run by one server.
+// MOVED and ASK replies are followed, a MOVED reply also triggers a refresh
+// of the slots in background. If a node fails to respond, commands to it
+// are resent after the slots are refreshed, only if they're read-only or
+// were not sent, otherwise their replies are errors since they may have
+// been run.
+//
+// Keys of a command are assumed to be the 2nd component, except for the
+// commands mentioned above and EVAL/EVALSHA/FCALL. Commands without keys
+// (e.g. PING) are sent to any node. Transactions (MULTI/EXEC) are not
+// supported.
+//
+// Example:
+//   brpc::RedisClusterChannel channel;
+//   if (channel.Init("10.0.0.1:6379,10.0.0.2:6379", NULL) != 0) {
+//       LOG(ERROR) << "Fail to init channel";
+//   }
+//   brpc::RedisRequest request;
+//   request.AddCommand("GET k1");
+//   request.AddCommand("GET k2");
+//   brpc::RedisResponse response;
+//   brpc::Controller cntl;
+//   channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+class RedisClusterChannel : public ChannelBase/*non-copyable*/ {
+public:
+    RedisClusterChannel();
+    ~RedisClusterChannel();
+
+    // `seeds' is a comma-separated list of "host:port" of nodes in the
+    // cluster, slots are fetched from the first one available.
+    // Returns 0 on success, -1 otherwise.
+    int Init(const char* seeds, const RedisClusterChannelOptions* options);
+
+    // Fetch slots of the cluster again. Called automatically on MOVED.
+    // Returns 0 on success, -1 otherwise.
+    int RefreshSlots();
+
+    // `request' must be RedisRequest and `response' must be RedisResponse.
+    // Asynchronous calls run in a separate bthread, `request' must be valid
+    // until `done' is run and the call can't be waited by Join(call_id).
+    void CallMethod(const google::protobuf::MethodDescriptor* method,
+                    google::protobuf::RpcController* controller,
+                    const google::protobuf::Message* request,
+                    google::protobuf::Message* response,
+                    google::protobuf::Closure* done) override;
+
+    void Describe(std::ostream& os, const DescribeOptions& options) const override;
+
+    int CheckHealth() override;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(RedisClusterChannel);
+
+    struct SlotTable {
+        SlotTable();
+        // Channels of nodes owning the slots, NULL for unassigned slots.
+        std::vector<Channel*> nodes;
+    };
+    struct SlotRange {
+        int start;
+        int end;  // inclusive
+        Channel* node;
+    };
+    struct Call;
+
+    // Min interval between two refreshes triggered by MOVED or failures.
+    static const int64_t MIN_REFRESH_INTERVAL_US = 100000;
+
+    static size_t SetSlots(SlotTable& table, const std::vector<SlotRange>& ranges);
+    static size_t SetSlot(SlotTable& table, int slot, Channel* node);
+
+    // Get the channel to `addr', create one if it does not exist.
+    Channel* GetOrNewNode(const std::string& addr);
+    // Get a node owning any slot, or any seed if no slots are known.
+    Channel* GetAnyNode();
+    Channel* GetNodeOfSlot(int slot);
+    // Refresh slots in background if no other refresh is running and the
+    // last one is not too recent.
+    void TryRefreshSlots();
+    // Wait until a refresh running or started after this call finishes, or
+    // `deadline_us' (-1 means no deadline) is reached.
+    void WaitForRefreshedSlots(int64_t deadline_us);
+    // Start a refresh in background. Called with _refresh_mutex held.
+    void StartRefreshSlots(int64_t now_us);
+    static void* RunRefreshSlots(void* arg);
+    int FetchSlots(const std::string& addr, std::vector<SlotRange>* ranges);
+
+    static void* RunCall(void* arg);
+    void DoCallMethod(Controller* cntl, const google::protobuf::Message* request,
+                      google::protobuf::Message* response);
+
+    RedisClusterChannelOptions _options;
+    std::vector<std::string> _seeds;
+    butil::DoublyBufferedData<SlotTable> _slots;
+    // Channels are never removed before destruction of this channel, since
+    // they may be used by ongoing calls.
+    mutable butil::Mutex _node_mutex;
+    std::map<std::string, Channel*> _nodes;
+    // Protecting fields of the background refresh below.
+    bthread::Mutex _refresh_mutex;
+    // Signaled when a refresh finishes.
+    bthread::ConditionVariable _refresh_cond;
+    bool _refreshing;
+    int64_t _last_refresh_us;
+    // Number of finished refreshes.
+    int64_t _nrefreshed;
+    bthread_t _refresh_tid;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_REDIS_CLUSTER_CHANNEL_H
@@ -46,11 +46,7 @@ inline size_t AppendDecimal(char* outbuf, unsigned long d) {
     return sizeof(buf) - n;
 }
 
-// This function is the hotspot of RedisCommandFormatV() when format is
-// short or does not have many %. In a 100K-time call to formating of
-// "GET key1", the time spent on RedisRequest.AddCommand() are ~700ns
-// vs. ~400ns while using snprintf() vs. AppendDecimal() respectively.
-inline void AppendHeader(std::string& buf, char fc, unsigned long value) {
+inline void AppendHeader(butil::IOBuf& buf, char fc, unsigned long value) {
     char header[32];
     header[0] = fc;
     size_t len = AppendDecimal(header + 1, value);
@@ -58,19 +54,57 @@ inline void AppendHeader(std::string& buf, char fc, unsigned long value) {
     header[len + 2] = '\n';
     buf.append(header, len + 3);
 }
-inline void AppendHeader(butil::IOBuf& buf, char fc, unsigned long value) {
+
+// Headers("$<length>\r\n") of bulk strings shorter than this are
+// precomputed, which covers most keys and values in practice.
+static const size_t MAX_PRECOMPUTED_BULK_LENGTH = 1024;
+
+struct BulkHeader {
+    char data[7];  // longest one is "$1023\r\n"
+    uint8_t size;
+};
+
+static const BulkHeader* CreateBulkHeaders() {
+    BulkHeader* headers = new BulkHeader[MAX_PRECOMPUTED_BULK_LENGTH];
+    for (size_t i = 0; i < MAX_PRECOMPUTED_BULK_LENGTH; ++i) {
+        char* p = headers[i].data;
+        p[0] = '$';
+        const size_t len = AppendDecimal(p + 1, i);
+        p[len + 1] = '\r';
+        p[len + 2] = '\n';
+        headers[i].size = len + 3;
+    }
+    return headers;
+}
+
+// This function is the hotspot of RedisCommandFormatV() when format is
+// short or does not have many %. In a 100K-time call to formating of
+// "GET key1", the time spent on RedisRequest.AddCommand() are ~700ns
+// vs. ~400ns while using snprintf() vs. AppendDecimal() respectively.
+inline void AppendBulkHeader(butil::IOBufAppender* appender, size_t length) {
+    // Never deleted, shared by all threads.
+    static const BulkHeader* const s_headers = CreateBulkHeaders();
+    if (length < MAX_PRECOMPUTED_BULK_LENGTH) {
+        appender->append(s_headers[length].data, s_headers[length].size);
+        return;
+    }
     char header[32];
-    header[0] = fc;
-    size_t len = AppendDecimal(header + 1, value);
+    header[0] = '$';
+    size_t len = AppendDecimal(header + 1, length);
     header[len + 1] = '\r';
     header[len + 2] = '\n';
-    buf.append(header, len + 3);
+    appender->append(header, len + 3);
+}
+
+inline void AppendBulkString(butil::IOBufAppender* appender,
+                             const butil::StringPiece& str) {
+    AppendBulkHeader(appender, str.size());
+    appender->append(str.data(), str.size());
+    appender->append("\r\n", 2);
 }
 
-static void FlushComponent(std::string* out, std::string* compbuf, int* ncomp) {
-    AppendHeader(*out, '$', compbuf->size());
-    out->append(*compbuf);
-    out->append("\r\n", 2);
+static void FlushComponent(butil::IOBufAppender* out, std::string* compbuf, int* ncomp) {
+    AppendBulkString(out, *compbuf);
     compbuf->clear();
     ++*ncomp;
 }
@@ -87,8 +121,8 @@ RedisCommandFormatV(butil::IOBuf* outbuf, const char* fmt, va_list ap) {
         return butil::Status(EINVAL, "Param[outbuf] or [fmt] is NULL");
     }
     const size_t fmt_len = strlen(fmt);
-    std::string nocount_buf;
-    nocount_buf.reserve(fmt_len * 3 / 2 + 16);
+    // Components are encoded before knowing the count, which is the header.
+    butil::IOBufAppender nocount_buf;
     std::string compbuf;  // A component
     compbuf.reserve(fmt_len + 16);
     const char* c = fmt;
@@ -274,7 +308,7 @@ RedisCommandFormatV(butil::IOBuf* outbuf, const char* fmt, va_list ap) {
         "formatting of conversion specifiers)";
     
     AppendHeader(*outbuf, '*', ncomponent);
-    outbuf->append(nocount_buf);
+    outbuf->append(butil::IOBuf::Movable(nocount_buf.buf()));
     return butil::Status::OK();
 }
 
@@ -292,8 +326,7 @@ RedisCommandNoFormat(butil::IOBuf* outbuf, const butil::StringPiece& cmd) {
         return butil::Status(EINVAL, "Param[outbuf] or [cmd] is NULL");
     }
     const size_t cmd_len = cmd.size();
-    std::string nocount_buf;
-    nocount_buf.reserve(cmd_len * 3 / 2 + 16);
+    butil::IOBufAppender nocount_buf;
     std::string compbuf;  // A component
     compbuf.reserve(cmd_len + 16);
     int ncomponent = 0;
@@ -346,7 +379,7 @@ RedisCommandNoFormat(butil::IOBuf* outbuf, const butil::StringPiece& cmd) {
     }
 
     AppendHeader(*outbuf, '*', ncomponent);
-    outbuf->append(nocount_buf);
+    outbuf->append(butil::IOBuf::Movable(nocount_buf.buf()));
     return butil::Status::OK();
 }
 
@@ -356,12 +389,14 @@ butil::Status RedisCommandByComponents(butil::IOBuf* output,
     if (output == NULL) {
         return butil::Status(EINVAL, "Param[output] is NULL");
     }
-    AppendHeader(*output, '*', ncomponents);
+    butil::IOBufAppender appender;
+    appender.push_back('*');
+    appender.append_decimal(ncomponents);
+    appender.append("\r\n", 2);
     for (size_t i = 0; i < ncomponents; ++i) {
-        AppendHeader(*output, '$', components[i].size());
-        output->append(components[i].data(), components[i].size());
-        output->append("\r\n", 2);
+        AppendBulkString(&appender, components[i]);
     }
+    output->append(butil::IOBuf::Movable(appender.buf()));
     return butil::Status::OK();
 }
 
@@ -16,9 +16,11 @@
 // under the License.
 
 
+#include <cmath>
 #include <limits>
 #include "butil/logging.h"
 #include "butil/string_printf.h"
+#include "butil/third_party/dmg_fp/dmg_fp.h"
 #include "brpc/redis_reply.h"
 #include "gflags/gflags.h"
 
@@ -38,6 +40,12 @@ const char* RedisReplyTypeToString(RedisReplyType type) {
     case REDIS_REPLY_NIL: return "nil";
     case REDIS_REPLY_STATUS: return "status";
     case REDIS_REPLY_ERROR: return "error";
+    case REDIS_REPLY_DOUBLE: return "double";
+    case REDIS_REPLY_BOOLEAN: return "boolean";
+    case REDIS_REPLY_MAP: return "map";
+    case REDIS_REPLY_SET: return "set";
+    case REDIS_REPLY_PUSH: return "push";
+    case REDIS_REPLY_BIGNUM: return "bignum";
     default: return "unknown redis type";
     }
 }
@@ -47,11 +55,14 @@ bool RedisReply::SerializeTo(butil::IOBufAppender* appender) {
         case REDIS_REPLY_ERROR:
             // fall through
         case REDIS_REPLY_STATUS:
-            appender->push_back((_type == REDIS_REPLY_ERROR)? '-' : '+');
+            // fall through
+        case REDIS_REPLY_BIGNUM:
+            appender->push_back((_type == REDIS_REPLY_ERROR) ? '-' :
+                                (_type == REDIS_REPLY_STATUS ? '+' : '('));
             if (_length < (int)sizeof(_data.short_str)) {
                 appender->append(_data.short_str, _length);
             } else {
-                appender->append(_data.long_str, _length);
+                appender->append(_data.long_str.data, _length);
             }
             appender->append("\r\n", 2);
             return true;
@@ -60,6 +71,31 @@ bool RedisReply::SerializeTo(butil::IOBufAppender* appender) {
             appender->append_decimal(_data.integer);
             appender->append("\r\n", 2);
             return true;
+        case REDIS_REPLY_DOUBLE: {
+            // Not printf() which depends on LC_NUMERIC.
+            appender->push_back(',');
+            if (std::isnan(_data.real)) {
+                appender->append("nan", 3);
+            } else if (std::isinf(_data.real)) {
+                appender->append(_data.real < 0 ? "-inf" : "inf");
+            } else {
+                char buf[32];
+                const char* str = dmg_fp::g_fmt(buf, _data.real);
+                // g_fmt() omits the 0 before the decimal point.
+                if (*str == '-') {
+                    appender->push_back(*str++);
+                }
+                if (*str == '.') {
+                    appender->push_back('0');
+                }
+                appender->append(str);
+            }
+            appender->append("\r\n", 2);
+            return true;
+        }
+        case REDIS_REPLY_BOOLEAN:
+            appender->append(_data.integer ? "#t\r\n" : "#f\r\n", 4);
+            return true;
         case REDIS_REPLY_STRING:
             appender->push_back('$');
             appender->append_decimal(_length);
@@ -68,14 +104,27 @@ bool RedisReply::SerializeTo(butil::IOBufAppender* appender) {
                 if (_length < (int)sizeof(_data.short_str)) {
                     appender->append(_data.short_str, _length);
                 } else {
-                    appender->append(_data.long_str, _length);
+                    appender->append(_data.long_str.data, _length);
                 }
                 appender->append("\r\n", 2);
             }
             return true;
         case REDIS_REPLY_ARRAY:
-            appender->push_back('*');
-            appender->append_decimal(_length);
+            // fall through
+        case REDIS_REPLY_MAP:
+            // fall through
+        case REDIS_REPLY_SET:
+            // fall through
+        case REDIS_REPLY_PUSH:
+            switch (_type) {
+            case REDIS_REPLY_MAP: appender->push_back('%'); break;
+            case REDIS_REPLY_SET: appender->push_back('~'); break;
+            case REDIS_REPLY_PUSH: appender->push_back('>'); break;
+            default: appender->push_back('*'); break;
+            }
+            // Count of pairs for maps.
+            appender->append_decimal(
+                (_type == REDIS_REPLY_MAP && _length != npos) ? _length / 2 : _length);
             appender->append("\r\n", 2);
             if (_length != npos) {
                 for (int i = 0; i < _length; ++i) {
@@ -93,13 +142,14 @@ bool RedisReply::SerializeTo(butil::IOBufAppender* appender) {
     return false;
 }
 
-ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
-    if (_type == REDIS_REPLY_ARRAY && _data.array.last_index >= 0) {
+ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf,
+                                           butil::IOBuf* pinned) {
+    if (is_aggregate(_type) && _data.array.last_index >= 0) {
         // The parsing was suspended while parsing sub replies,
         // continue the parsing.
         RedisReply* subs = (RedisReply*)_data.array.replies;
         for (int i = _data.array.last_index; i < _length; ++i) {
-            ParseError err = subs[i].ConsumePartialIOBuf(buf);
+            ParseError err = subs[i].ConsumePartialIOBuf(buf, pinned);
             if (err != PARSE_OK) {
                 return err;
             }
@@ -118,7 +168,8 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
     const char fc = *pfc;  // first character
     switch (fc) {
     case '-':   // Error          "-<message>\r\n"
-    case '+': { // Simple String  "+<string>\r\n"
+    case '+':   // Simple String  "+<string>\r\n"
+    case '(': { // Big Number     "(<big number>\r\n" (RESP3)
         butil::IOBuf str;
         if (buf.cut_until(&str, "\r\n") != 0) {
             const size_t len = buf.size();
@@ -129,10 +180,12 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
             }
             return PARSE_ERROR_NOT_ENOUGH_DATA;
         }
+        const RedisReplyType type = (fc == '-' ? REDIS_REPLY_ERROR :
+                                     (fc == '+' ? REDIS_REPLY_STATUS : REDIS_REPLY_BIGNUM));
         const size_t len = str.size() - 1;
         if (len < sizeof(_data.short_str)) {
             // SSO short strings, including empty string.
-            _type = (fc == '-' ? REDIS_REPLY_ERROR : REDIS_REPLY_STATUS);
+            _type = type;
             _length = len;
             str.copy_to_cstr(_data.short_str, (size_t)-1L, 1/*skip fc*/);
             return PARSE_OK;
@@ -143,14 +196,23 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
             return PARSE_ERROR_ABSOLUTELY_WRONG;
         }
         CHECK_EQ(len, str.copy_to_cstr(d, (size_t)-1L, 1/*skip fc*/));
-        _type = (fc == '-' ? REDIS_REPLY_ERROR : REDIS_REPLY_STATUS);
+        _type = type;
         _length = len;
-        _data.long_str = d;
+        _data.long_str.data = d;
+        _data.long_str.referenced = false;
         return PARSE_OK;
     }
-    case '$':   // Bulk String   "$<length>\r\n<string>\r\n"
-    case '*':   // Array         "*<size>\r\n<sub-reply1><sub-reply2>..."
-    case ':': { // Integer       ":<integer>\r\n"
+    case '$':   // Bulk String     "$<length>\r\n<string>\r\n"
+    case '!':   // Bulk Error      "!<length>\r\n<error>\r\n" (RESP3)
+    case '=':   // Verbatim String "=<length>\r\n<fmt>:<string>\r\n" (RESP3)
+    case '*':   // Array           "*<size>\r\n<sub-reply1><sub-reply2>..."
+    case '%':   // Map             "%<npairs>\r\n<key1><value1>..." (RESP3)
+    case '~':   // Set             "~<size>\r\n<sub-reply1><sub-reply2>..." (RESP3)
+    case '>':   // Push            "><size>\r\n<sub-reply1><sub-reply2>..." (RESP3)
+    case ':':   // Integer         ":<integer>\r\n"
+    case ',':   // Double          ",<double>\r\n" (RESP3)
+    case '#':   // Boolean         "#t\r\n" or "#f\r\n" (RESP3)
+    case '_': { // Null            "_\r\n" (RESP3)
         char intbuf[32];  // enough for fc + 64-bit decimal + \r\n
         const size_t ncopied = buf.copy_to(intbuf, sizeof(intbuf) - 1);
         intbuf[ncopied] = '\0';
@@ -158,6 +220,38 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
         if (crlf_pos == butil::StringPiece::npos) {  // not enough data
             return PARSE_ERROR_NOT_ENOUGH_DATA;
         }
+        intbuf[crlf_pos] = '\0';
+        if (fc == '_' || fc == '#' || fc == ',') {
+            if (fc == '_') {
+                if (crlf_pos != 1) {
+                    LOG(ERROR) << "Invalid null `" << intbuf << '\'';
+                    return PARSE_ERROR_ABSOLUTELY_WRONG;
+                }
+                _type = REDIS_REPLY_NIL;
+                _data.integer = 0;
+            } else if (fc == '#') {
+                if (crlf_pos != 2 || (intbuf[1] != 't' && intbuf[1] != 'f')) {
+                    LOG(ERROR) << "Invalid boolean `" << intbuf << '\'';
+                    return PARSE_ERROR_ABSOLUTELY_WRONG;
+                }
+                _type = REDIS_REPLY_BOOLEAN;
+                _data.integer = (intbuf[1] == 't');
+            } else {
+                // Not strtod() which depends on LC_NUMERIC and rejects '.'
+                // as the decimal point in some locales.
+                char* endptr = NULL;
+                const double value = dmg_fp::strtod(intbuf + 1/*skip fc*/, &endptr);
+                if (crlf_pos == 1 || endptr != intbuf + crlf_pos) {
+                    LOG(ERROR) << '`' << intbuf + 1 << "' is not a valid double";
+                    return PARSE_ERROR_ABSOLUTELY_WRONG;
+                }
+                _type = REDIS_REPLY_DOUBLE;
+                _data.real = value;
+            }
+            buf.pop_front(crlf_pos + 2/*CRLF*/);
+            _length = 0;
+            return PARSE_OK;
+        }
         char* endptr = NULL;
         int64_t value = strtoll(intbuf + 1/*skip fc*/, &endptr, 10);
         if (endptr != intbuf + crlf_pos) {
@@ -170,7 +264,7 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
             _length = 0;
             _data.integer = value;
             return PARSE_OK;
-        } else if (fc == '$') {
+        } else if (fc == '$' || fc == '!' || fc == '=') {
             const int64_t len = value;  // `value' is length of the string
             if (len < 0) {  // redis nil
                 buf.pop_front(crlf_pos + 2/*CRLF*/);
@@ -184,30 +278,47 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
                            << FLAGS_redis_max_allocation_size << ", actually=" << len;
                 return PARSE_ERROR_ABSOLUTELY_WRONG;
             }
-            // We provide c_str(), thus even if bulk string is started with
-            // length, we have to end it with \0.
             if (buf.size() < crlf_pos + 2 + (size_t)len + 2/*CRLF*/) {
                 return PARSE_ERROR_NOT_ENOUGH_DATA;
             }
-            if ((size_t)len < sizeof(_data.short_str)) {
+            buf.pop_front(crlf_pos + 2/*CRLF*/);
+            // Format of verbatim strings is dropped.
+            size_t n = len;
+            if (fc == '=' && n >= 4) {
+                buf.pop_front(4/*fmt:*/);
+                n -= 4;
+            }
+            const RedisReplyType type =
+                (fc == '!' ? REDIS_REPLY_ERROR : REDIS_REPLY_STRING);
+            if (n < sizeof(_data.short_str)) {
                 // SSO short strings, including empty string.
-                _type = REDIS_REPLY_STRING;
-                _length = len;
-                buf.pop_front(crlf_pos + 2);
-                buf.cutn(_data.short_str, len);
-                _data.short_str[len] = '\0';
+                _type = type;
+                _length = n;
+                buf.cutn(_data.short_str, n);
+                _data.short_str[n] = '\0';
+            } else if (pinned != NULL && type == REDIS_REPLY_STRING &&
+                       buf.backing_block(0).size() >= n) {
+                // Reference the string instead of copying it since it's in
+                // one block. Errors are always copied for error_message().
+                _type = type;
+                _length = n;
+                _data.long_str.data = buf.backing_block(0).data();
+                _data.long_str.referenced = true;
+                buf.cutn(pinned, n);
             } else {
-                char* d = (char*)_arena->allocate((len/8 + 1)*8);
+                // We provide c_str(), thus even if bulk string is started
+                // with length, we have to end it with \0.
+                char* d = (char*)_arena->allocate((n/8 + 1)*8);
                 if (d == NULL) {
-                    LOG(FATAL) << "Fail to allocate string[" << len << "]";
+                    LOG(FATAL) << "Fail to allocate string[" << n << "]";
                     return PARSE_ERROR_ABSOLUTELY_WRONG;
                 }
-                buf.pop_front(crlf_pos + 2/*CRLF*/);
-                buf.cutn(d, len);
-                d[len] = '\0';
-                _type = REDIS_REPLY_STRING;
-                _length = len;
-                _data.long_str = d;
+                buf.cutn(d, n);
+                d[n] = '\0';
+                _type = type;
+                _length = n;
+                _data.long_str.data = d;
+                _data.long_str.referenced = false;
             }
             char crlf[2];
             buf.cutn(crlf, sizeof(crlf));
@@ -217,28 +328,44 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
             }
             return PARSE_OK;
         } else {
-            const int64_t count = value;  // `value' is count of sub replies
-            if (count < 0) { // redis nil
+            int64_t count = value;  // `value' is count of sub replies
+            if (count < 0) {
+                if (fc != '*') {
+                    LOG(ERROR) << "Invalid size=" << count << " of aggregate type";
+                    return PARSE_ERROR_ABSOLUTELY_WRONG;
+                }
+                // redis nil
                 buf.pop_front(crlf_pos + 2/*CRLF*/);
                 _type = REDIS_REPLY_NIL;
                 _length = 0;
                 _data.integer = 0;
                 return PARSE_OK;
             }
+            const RedisReplyType type =
+                (fc == '*' ? REDIS_REPLY_ARRAY :
+                 (fc == '%' ? REDIS_REPLY_MAP :
+                  (fc == '~' ? REDIS_REPLY_SET : REDIS_REPLY_PUSH)));
             if (count == 0) { // empty array
                 buf.pop_front(crlf_pos + 2/*CRLF*/);
-                _type = REDIS_REPLY_ARRAY;
+                _type = type;
                 _length = 0;
                 _data.array.last_index = -1;
                 _data.array.replies = NULL;
                 return PARSE_OK;
             }
             int64_t max_count = FLAGS_redis_max_allocation_size / sizeof(RedisReply);
+            if (fc == '%') {
+                // Keys and values.
+                max_count /= 2;
+            }
             if (count > max_count) {
                 LOG(ERROR) << "array allocation exceeds max allocation size! max=" 
                            << max_count << ", actually=" << count;
                 return PARSE_ERROR_ABSOLUTELY_WRONG;
             }
+            if (fc == '%') {
+                count *= 2;
+            }
             // FIXME(gejun): Call allocate_aligned instead.
             RedisReply* subs = (RedisReply*)_arena->allocate(sizeof(RedisReply) * count);
             if (subs == NULL) {
@@ -249,7 +376,7 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
                 new (&subs[i]) RedisReply(_arena);
             }
             buf.pop_front(crlf_pos + 2/*CRLF*/);
-            _type = REDIS_REPLY_ARRAY;
+            _type = type;
             _length = count;
             _data.array.replies = subs;
 
@@ -257,7 +384,7 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
             // be continued in next calls by tracking _data.array.last_index.
             _data.array.last_index = 0;
             for (int64_t i = 0; i < count; ++i) {
-                ParseError err = subs[i].ConsumePartialIOBuf(buf);
+                ParseError err = subs[i].ConsumePartialIOBuf(buf, pinned);
                 if (err != PARSE_OK) {
                     return err;
                 }
@@ -267,6 +394,9 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
             return PARSE_OK;
         }
     }
+    case '|':
+        LOG(ERROR) << "Attributes of RESP3 are not supported";
+        return PARSE_ERROR_ABSOLUTELY_WRONG;
     default:
         LOG(ERROR) << "Invalid first character=" << (int)fc;
         return PARSE_ERROR_ABSOLUTELY_WRONG;
@@ -325,11 +455,13 @@ void RedisReply::Print(std::ostream& os) const {
         if (_length < (int)sizeof(_data.short_str)) {
             os << RedisStringPrinter(_data.short_str, _length);
         } else {
-            os << RedisStringPrinter(_data.long_str, _length);
+            os << RedisStringPrinter(_data.long_str.data, _length);
         }
         os << '"';
         break;
     case REDIS_REPLY_ARRAY:
+    case REDIS_REPLY_SET:
+    case REDIS_REPLY_PUSH:
         os << '[';
         for (int i = 0; i < _length; ++i) {
             if (i != 0) {
@@ -339,9 +471,27 @@ void RedisReply::Print(std::ostream& os) const {
         }
         os << ']';
         break;
+    case REDIS_REPLY_MAP:
+        os << '{';
+        for (int i = 0; i + 1 < _length; i += 2) {
+            if (i != 0) {
+                os << ", ";
+            }
+            _data.array.replies[i].Print(os);
+            os << ": ";
+            _data.array.replies[i + 1].Print(os);
+        }
+        os << '}';
+        break;
     case REDIS_REPLY_INTEGER:
         os << "(integer) " << _data.integer;
         break;
+    case REDIS_REPLY_DOUBLE:
+        os << "(double) " << _data.real;
+        break;
+    case REDIS_REPLY_BOOLEAN:
+        os << (_data.integer ? "(true)" : "(false)");
+        break;
     case REDIS_REPLY_NIL:
         os << "(nil)";
         break;
@@ -349,10 +499,11 @@ void RedisReply::Print(std::ostream& os) const {
         os << "(error) ";
         // fall through
     case REDIS_REPLY_STATUS:
+    case REDIS_REPLY_BIGNUM:
         if (_length < (int)sizeof(_data.short_str)) {
             os << RedisStringPrinter(_data.short_str, _length);
         } else {
-            os << RedisStringPrinter(_data.long_str, _length);
+            os << RedisStringPrinter(_data.long_str.data, _length);
         }
         break;
     default:
@@ -365,7 +516,15 @@ void RedisReply::CopyFromDifferentArena(const RedisReply& other) {
     _type = other._type;
     _length = other._length;
     switch (_type) {
-    case REDIS_REPLY_ARRAY: {
+    case REDIS_REPLY_ARRAY:
+    case REDIS_REPLY_MAP:
+    case REDIS_REPLY_SET:
+    case REDIS_REPLY_PUSH: {
+        if (_length == npos) {  // null array
+            _data.array.last_index = -1;
+            _data.array.replies = NULL;
+            break;
+        }
         RedisReply* subs = (RedisReply*)_arena->allocate(sizeof(RedisReply) * _length);
         if (subs == NULL) {
             LOG(FATAL) << "Fail to allocate RedisReply[" << _length << "]";
@@ -389,8 +548,12 @@ void RedisReply::CopyFromDifferentArena(const RedisReply& other) {
     }
         break;
     case REDIS_REPLY_INTEGER:
+    case REDIS_REPLY_BOOLEAN:
         _data.integer = other._data.integer;
         break;
+    case REDIS_REPLY_DOUBLE:
+        _data.real = other._data.real;
+        break;
     case REDIS_REPLY_NIL:
         break;
     case REDIS_REPLY_STRING:
@@ -398,6 +561,8 @@ void RedisReply::CopyFromDifferentArena(const RedisReply& other) {
     case REDIS_REPLY_ERROR:
         // fall through
     case REDIS_REPLY_STATUS:
+        // fall through
+    case REDIS_REPLY_BIGNUM:
         if (_length < (int)sizeof(_data.short_str)) {
             memcpy(_data.short_str, other._data.short_str, _length + 1);
         } else {
@@ -406,20 +571,26 @@ void RedisReply::CopyFromDifferentArena(const RedisReply& other) {
                 LOG(FATAL) << "Fail to allocate string[" << _length << "]";
                 return;
             }
-            memcpy(d, other._data.long_str, _length + 1);
-            _data.long_str = d;
+            // Referenced strings are not ended with \0, which are copied
+            // as well and no longer rely on the buffer of `other'.
+            memcpy(d, other._data.long_str.data, _length);
+            d[_length] = '\0';
+            _data.long_str.data = d;
+            _data.long_str.referenced = false;
         }
         break;
     }
 }
 
-void RedisReply::SetArray(int size) {
+void RedisReply::SetAggregateImpl(int size, RedisReplyType type) {
     if (_type != REDIS_REPLY_NIL) {
         Reset();
     }
-    _type = REDIS_REPLY_ARRAY;
+    _type = type;
     if (size < 0) {
-        LOG(ERROR) << "negative size=" << size << " when calling SetArray";
+        LOG(ERROR) << "negative size=" << size << " when calling Set"
+                   << (type == REDIS_REPLY_ARRAY ? "Array" :
+                       (type == REDIS_REPLY_MAP ? "Map" : "Set"));
         return;
     } else if (size == 0) {
         _length = 0;
@@ -453,7 +624,8 @@ void RedisReply::SetStringImpl(const butil::StringPiece& str, RedisReplyType typ
         }
         memcpy(d, str.data(), size);
         d[size] = '\0';
-        _data.long_str = d;
+        _data.long_str.data = d;
+        _data.long_str.referenced = false;
     }
     _type = type;
     _length = size;
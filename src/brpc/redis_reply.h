@@ -35,7 +35,14 @@ enum RedisReplyType {
     REDIS_REPLY_INTEGER = 3,
     REDIS_REPLY_NIL = 4,
     REDIS_REPLY_STATUS = 5,  // Simple String
-    REDIS_REPLY_ERROR = 6
+    REDIS_REPLY_ERROR = 6,
+    // Types below are only replied in RESP3, namely after `HELLO 3'.
+    REDIS_REPLY_DOUBLE = 7,
+    REDIS_REPLY_BOOLEAN = 8,
+    REDIS_REPLY_MAP = 9,     // Keys and values are sub replies alternately
+    REDIS_REPLY_SET = 10,
+    REDIS_REPLY_PUSH = 11,   // Out-of-band data, e.g. messages of pubsub
+    REDIS_REPLY_BIGNUM = 12  // Big number in decimal
 };
 
 const char* RedisReplyTypeToString(RedisReplyType);
@@ -55,6 +62,12 @@ public:
     bool is_error() const;   // True if the reply is an error.
     bool is_string() const;  // True if the reply is a string.
     bool is_array() const;   // True if the reply is an array.
+    bool is_double() const;  // True if the reply is a double.
+    bool is_boolean() const; // True if the reply is a boolean.
+    bool is_map() const;     // True if the reply is a map.
+    bool is_set() const;     // True if the reply is a set.
+    bool is_push() const;    // True if the reply is a push.
+    bool is_bignum() const;  // True if the reply is a big number.
 
     // Set the reply to the null string.
     void SetNullString();
@@ -67,6 +80,13 @@ public:
     // value.
     void SetArray(int size);
 
+    // Set the reply to the map with `npairs' pairs of keys and values
+    // (RESP3), which are 2*npairs sub replies in order of k1,v1,k2,v2...
+    void SetMap(int npairs);
+
+    // Set the reply to the set with `size' elements (RESP3).
+    void SetSet(int size);
+
     // Set the reply to a status.
     void SetStatus(const butil::StringPiece& str);
     void FormatStatus(const char* fmt, ...);
@@ -78,6 +98,12 @@ public:
     // Set this reply to integer `value'.
     void SetInteger(int64_t value);
 
+    // Set this reply to double `value' (RESP3).
+    void SetDouble(double value);
+
+    // Set this reply to boolean `value' (RESP3).
+    void SetBoolean(bool value);
+
     // Set this reply to a (bulk) string.
     void SetString(const butil::StringPiece& str);
     void FormatString(const char* fmt, ...);
@@ -87,6 +113,14 @@ public:
     // call stacks are logged and 0 is returned.
     int64_t integer() const;
 
+    // Convert the reply into a double. If the reply is not a double, call
+    // stacks are logged and 0 is returned.
+    double double_value() const;
+
+    // Convert the reply into a boolean. If the reply is not a boolean, call
+    // stacks are logged and false is returned.
+    bool boolean() const;
+
     // Convert the reply to an error message. If the reply is not an error
     // message, call stacks are logged and "" is returned.
     const char* error_message() const;
@@ -94,18 +128,22 @@ public:
     // Convert the reply to a (c-style) string. If the reply is not a string,
     // call stacks are logged and "" is returned. Notice that a
     // string containing \0 is not printed fully, use data() instead.
+    // A long string referencing the buffer it was parsed from (see
+    // ConsumePartialIOBuf) is not ended with \0, call stacks are logged
+    // and "" is returned as well, use data() instead.
     const char* c_str() const;
     // Convert the reply to a StringPiece. If the reply is not a string,
     // call stacks are logged and "" is returned. 
     // If you need a std::string, call .data().as_string() (which allocates mem)
     butil::StringPiece data() const;
 
-    // Return number of sub replies in the array if this reply is an array, or
-    // return the length of string if this reply is a string, otherwise 0 is
-    // returned (call stacks are not logged).
+    // Return number of sub replies in the array(or map, set, push) if this
+    // reply is an array, or return the length of string if this reply is a
+    // string, otherwise 0 is returned (call stacks are not logged).
     size_t size() const;
-    // Get the index-th sub reply. If this reply is not an array or index is out of
-    // range, a nil reply is returned (call stacks are not logged)
+    // Get the index-th sub reply. If this reply is not an array(or map, set,
+    // push) or index is out of range, a nil reply is returned (call stacks are
+    // not logged)
     const RedisReply& operator[](size_t index) const;
     RedisReply& operator[](size_t index);
 
@@ -119,8 +157,15 @@ public:
     // reply. As a contrast, if the parsing needs `buf' to be intact,
     // the complexity in worst case may be O(N^2).
     // Returns PARSE_ERROR_ABSOLUTELY_WRONG if the parsing failed.
+    // Both RESP2 and RESP3 are understood except attributes of RESP3.
     ParseError ConsumePartialIOBuf(butil::IOBuf& buf);
 
+    // Same as above, except that long bulk strings lying in one block of
+    // `buf' are not copied into the arena but cut into `pinned' and
+    // referenced, which are only accessible by data(). `pinned' must
+    // outlive this reply.
+    ParseError ConsumePartialIOBuf(butil::IOBuf& buf, butil::IOBuf* pinned);
+
     // Serialize to iobuf appender using redis protocol
     bool SerializeTo(butil::IOBufAppender* appender);
 
@@ -146,15 +191,25 @@ private:
     // by calling CopyFrom[Different|Same]Arena.
     DISALLOW_COPY_AND_ASSIGN(RedisReply);
 
+    static bool is_aggregate(RedisReplyType type);
+
     void FormatStringImpl(const char* fmt, va_list args, RedisReplyType type);
     void SetStringImpl(const butil::StringPiece& str, RedisReplyType type);
+    void SetAggregateImpl(int size, RedisReplyType type);
+    const char* text() const;
     
     RedisReplyType _type;
     int _length;  // length of short_str/long_str, count of replies
     union {
         int64_t integer;
+        double real;
         char short_str[16];
-        const char* long_str;
+        struct {
+            const char* data;
+            // True if `data' references the parsed buffer and is not
+            // ended with \0.
+            bool referenced;
+        } long_str;
         struct {
             int32_t last_index;  // >= 0 if previous parsing suspends on replies.
             RedisReply* replies;
@@ -179,6 +234,10 @@ inline void RedisReply::Reset() {
     // _arena should not be reset because further memory allocation needs it.
 }
 
+inline ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
+    return ConsumePartialIOBuf(buf, NULL);
+}
+
 inline RedisReply::RedisReply(butil::Arena* arena)
     : _arena(arena) {
     Reset();
@@ -192,6 +251,17 @@ inline bool RedisReply::is_integer() const { return _type == REDIS_REPLY_INTEGER
 inline bool RedisReply::is_string() const
 { return _type == REDIS_REPLY_STRING || _type == REDIS_REPLY_STATUS; }
 inline bool RedisReply::is_array() const { return _type == REDIS_REPLY_ARRAY; }
+inline bool RedisReply::is_double() const { return _type == REDIS_REPLY_DOUBLE; }
+inline bool RedisReply::is_boolean() const { return _type == REDIS_REPLY_BOOLEAN; }
+inline bool RedisReply::is_map() const { return _type == REDIS_REPLY_MAP; }
+inline bool RedisReply::is_set() const { return _type == REDIS_REPLY_SET; }
+inline bool RedisReply::is_push() const { return _type == REDIS_REPLY_PUSH; }
+inline bool RedisReply::is_bignum() const { return _type == REDIS_REPLY_BIGNUM; }
+
+inline bool RedisReply::is_aggregate(RedisReplyType type) {
+    return type == REDIS_REPLY_ARRAY || type == REDIS_REPLY_MAP ||
+        type == REDIS_REPLY_SET || type == REDIS_REPLY_PUSH;
+}
 
 inline int64_t RedisReply::integer() const {
     if (is_integer()) {
@@ -202,6 +272,24 @@ inline int64_t RedisReply::integer() const {
     return 0;
 }
 
+inline double RedisReply::double_value() const {
+    if (is_double()) {
+        return _data.real;
+    }
+    CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
+                 << ", not a double";
+    return 0;
+}
+
+inline bool RedisReply::boolean() const {
+    if (is_boolean()) {
+        return _data.integer != 0;
+    }
+    CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
+                 << ", not a boolean";
+    return false;
+}
+
 inline void RedisReply::SetNullArray() {
     if (_type != REDIS_REPLY_NIL) {
         Reset();
@@ -247,6 +335,36 @@ inline void RedisReply::SetInteger(int64_t value) {
     _data.integer = value;
 }
 
+inline void RedisReply::SetDouble(double value) {
+    if (_type != REDIS_REPLY_NIL) {
+        Reset();
+    }
+    _type = REDIS_REPLY_DOUBLE;
+    _length = 0;
+    _data.real = value;
+}
+
+inline void RedisReply::SetBoolean(bool value) {
+    if (_type != REDIS_REPLY_NIL) {
+        Reset();
+    }
+    _type = REDIS_REPLY_BOOLEAN;
+    _length = 0;
+    _data.integer = value;
+}
+
+inline void RedisReply::SetArray(int size) {
+    return SetAggregateImpl(size, REDIS_REPLY_ARRAY);
+}
+
+inline void RedisReply::SetMap(int npairs) {
+    return SetAggregateImpl(npairs * 2, REDIS_REPLY_MAP);
+}
+
+inline void RedisReply::SetSet(int size) {
+    return SetAggregateImpl(size, REDIS_REPLY_SET);
+}
+
 inline void RedisReply::SetString(const butil::StringPiece& str) {
     return SetStringImpl(str, REDIS_REPLY_STRING);
 }
@@ -257,13 +375,21 @@ inline void RedisReply::FormatString(const char* fmt, ...) {
     va_end(ap);
 }
 
+inline const char* RedisReply::text() const {
+    if (_length < (int)sizeof(_data.short_str)) { // SSO
+        return _data.short_str;
+    } else if (_data.long_str.referenced) {
+        CHECK(false) << "The string is referenced and not ended with \\0"
+            ", use data() instead";
+        return "";
+    } else {
+        return _data.long_str.data;
+    }
+}
+
 inline const char* RedisReply::c_str() const {
-    if (is_string()) {
-        if (_length < (int)sizeof(_data.short_str)) { // SSO
-            return _data.short_str;
-        } else {
-            return _data.long_str;
-        }
+    if (is_string() || is_bignum()) {
+        return text();
     }
     CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
                  << ", not a string";
@@ -271,11 +397,11 @@ inline const char* RedisReply::c_str() const {
 }
 
 inline butil::StringPiece RedisReply::data() const {
-    if (is_string()) {
+    if (is_string() || is_bignum()) {
         if (_length < (int)sizeof(_data.short_str)) { // SSO
             return butil::StringPiece(_data.short_str, _length);
         } else {
-            return butil::StringPiece(_data.long_str, _length);
+            return butil::StringPiece(_data.long_str.data, _length);
         }
     }
     CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
@@ -285,11 +411,7 @@ inline butil::StringPiece RedisReply::data() const {
 
 inline const char* RedisReply::error_message() const {
     if (is_error()) {
-        if (_length < (int)sizeof(_data.short_str)) { // SSO
-            return _data.short_str;
-        } else {
-            return _data.long_str;
-        }
+        return text();
     }
     CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
                  << ", not an error";
@@ -306,7 +428,7 @@ inline RedisReply& RedisReply::operator[](size_t index) {
 }
 
 inline const RedisReply& RedisReply::operator[](size_t index) const {
-    if (is_array() && index < (size_t)_length) {
+    if (is_aggregate(_type) && index < (size_t)_length) {
         return _data.array.replies[index];
     }
     static RedisReply redis_nil(NULL);
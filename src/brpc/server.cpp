@@ -67,6 +67,7 @@
 #include "brpc/builtin/sockets_service.h"      // SocketsService
 #include "brpc/builtin/hotspots_service.h"     // HotspotsService
 #include "brpc/builtin/prometheus_metrics_service.h"
+#include "brpc/builtin/binary_vars_service.h"
 #include "brpc/builtin/memory_service.h"
 #include "brpc/details/method_status.h"
 #include "brpc/load_balancer.h"
@@ -135,6 +136,7 @@ ServerOptions::ServerOptions()
     , server_owns_interceptor(false)
     , num_threads(8)
     , max_concurrency(0)
+    , enable_admission_queue(false)
     , session_local_data_factory(NULL)
     , reserved_session_local_data(0)
     , thread_local_data_factory(NULL)
@@ -552,6 +554,10 @@ int Server::AddBuiltinServices() {
         LOG(ERROR) << "Fail to add MetricsService";
         return -1;
     }
+    if (AddBuiltinService(new (std::nothrow) BinaryVarsService)) {
+        LOG(ERROR) << "Fail to add BinaryVarsService";
+        return -1;
+    }
     if (FLAGS_enable_threads_service &&
         AddBuiltinService(new (std::nothrow) ThreadsService)) {
         LOG(ERROR) << "Fail to add ThreadsService";
@@ -1102,6 +1108,7 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
         it != _method_map.end(); ++it) {
         if (it->second.is_builtin_service) {
             it->second.status->SetConcurrencyLimiter(NULL);
+            it->second.status->EnableAdmissionQueue(false);
         } else {
             const AdaptiveMaxConcurrency* amc = &it->second.max_concurrency;
             if (amc->type() == AdaptiveMaxConcurrency::UNLIMITED) {
@@ -1114,6 +1121,8 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
             }
             it->second.status->SetConcurrencyLimiter(cl);
             it->second.max_concurrency.SetConcurrencyLimiter(cl);
+            it->second.status->EnableAdmissionQueue(
+                _options.enable_admission_queue);
         }
     }
     if (0 != SetServiceMaxConcurrency(_options.nshead_service)) {
@@ -135,6 +135,19 @@ struct ServerOptions {
     // Overridable by Server.MaxConcurrencyOf().
     AdaptiveMaxConcurrency method_max_concurrency;
 
+    // If this option is true, requests rejected by method-level max
+    // concurrencies are queued instead of being responded with ELIMIT
+    // directly. Queued requests are admitted in descending order of
+    // Controller::request_priority() when the method finishes other
+    // requests. A request is dropped with ELIMIT when it has waited longer
+    // than the CoDel-style bound(-admission_queue_target_ms and
+    // -admission_queue_interval_ms), or it can't finish before its
+    // deadline according to the average latency of the method.
+    // NOTE: requests wait in the bthreads processing them, a long-waiting
+    // request may delay other requests on the same connection.
+    // Default: false
+    bool enable_admission_queue;
+
     // -------------------------------------------------------
     // Differences between session-local and thread-local data
     // -------------------------------------------------------
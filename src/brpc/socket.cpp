@@ -26,6 +26,7 @@
 #include <mesalink/openssl/x509.h>
 #endif
 #include <netinet/tcp.h>                         // getsockopt
+#include <map>
 #include <gflags/gflags.h>
 #include "bthread/unstable.h"                    // bthread_timer_del
 #include "butil/fd_utility.h"                     // make_non_blocking
@@ -36,6 +37,7 @@
 #include "butil/macros.h"
 #include "butil/class_name.h"                     // butil::class_name
 #include "butil/memory/scope_guard.h"
+#include "butil/containers/doubly_buffered_data.h"
 #include "brpc/log.h"
 #include "brpc/reloadable_flags.h"          // BRPC_VALIDATE_GFLAG
 #include "brpc/errno.pb.h"
@@ -162,6 +164,9 @@ struct ExtendedSocketStat : public SocketStat {
     }
 };
 
+typedef std::map<const google::protobuf::MethodDescriptor*, CircuitBreaker*>
+    MethodCircuitBreakerMap;
+
 // Shared by main socket and derivative sockets.
 class Socket::SharedPart : public SharedObject {
 public:
@@ -192,6 +197,15 @@ public:
 
     CircuitBreaker circuit_breaker;
 
+    // CircuitBreakers of methods called through this socket, created on
+    // demand when ChannelOptions.circuit_breaker_per_method is on. They're
+    // looked up without locking for every call, and never removed before
+    // destruction of the SharedPart.
+    butil::atomic<butil::DoublyBufferedData<MethodCircuitBreakerMap>*>
+        method_circuit_breakers;
+    // Serialize creations of method_circuit_breakers and its elements.
+    butil::Mutex method_circuit_breakers_mutex;
+
     butil::atomic<uint64_t> recent_error_count;
 
     explicit SharedPart(SocketId creator_socket_id);
@@ -210,6 +224,7 @@ Socket::SharedPart::SharedPart(SocketId creator_socket_id2)
     , out_size(0)
     , out_num_messages(0)
     , extended_stat(NULL)
+    , method_circuit_breakers(NULL)
     , recent_error_count(0) {
 }
 
@@ -217,6 +232,21 @@ Socket::SharedPart::~SharedPart() {
     delete extended_stat;
     extended_stat = NULL;
     delete socket_pool.exchange(NULL, butil::memory_order_relaxed);
+    butil::DoublyBufferedData<MethodCircuitBreakerMap>* cbs =
+        method_circuit_breakers.exchange(NULL, butil::memory_order_relaxed);
+    if (cbs != NULL) {
+        {
+            // Both buffers hold the same CircuitBreakers.
+            butil::DoublyBufferedData<MethodCircuitBreakerMap>::ScopedPtr ptr;
+            if (cbs->Read(&ptr) == 0) {
+                for (MethodCircuitBreakerMap::const_iterator it = ptr->begin();
+                     it != ptr->end(); ++it) {
+                    delete it->second;
+                }
+            }
+        }
+        delete cbs;
+    }
 }
 
 void Socket::SharedPart::UpdateStatsEverySecond(int64_t now_ms) {
@@ -1092,6 +1122,55 @@ int Socket::isolated_times() const {
     return 0;
 }
 
+static CircuitBreaker* FindMethodCircuitBreaker(
+    butil::DoublyBufferedData<MethodCircuitBreakerMap>* cbs,
+    const google::protobuf::MethodDescriptor* method) {
+    butil::DoublyBufferedData<MethodCircuitBreakerMap>::ScopedPtr ptr;
+    if (cbs->Read(&ptr) != 0) {
+        return NULL;
+    }
+    MethodCircuitBreakerMap::const_iterator it =
+        ptr->find(method);
+    return (it != ptr->end() ? it->second : NULL);
+}
+
+static bool AddMethodCircuitBreaker(
+    MethodCircuitBreakerMap& bg,
+    const google::protobuf::MethodDescriptor* method, CircuitBreaker* cb) {
+    return bg.insert(std::make_pair(method, cb)).second;
+}
+
+CircuitBreaker* Socket::GetOrNewMethodCircuitBreaker(
+    const google::protobuf::MethodDescriptor* method) {
+    SharedPart* sp = GetOrNewSharedPart();
+    butil::DoublyBufferedData<MethodCircuitBreakerMap>* cbs =
+        sp->method_circuit_breakers.load(butil::memory_order_consume);
+    if (cbs != NULL) {
+        CircuitBreaker* cb = FindMethodCircuitBreaker(cbs, method);
+        if (cb != NULL) {
+            return cb;
+        }
+    }
+    BAIDU_SCOPED_LOCK(sp->method_circuit_breakers_mutex);
+    cbs = sp->method_circuit_breakers.load(butil::memory_order_consume);
+    if (cbs == NULL) {
+        cbs = new (std::nothrow)
+            butil::DoublyBufferedData<MethodCircuitBreakerMap>;
+        if (cbs == NULL) {
+            return NULL;
+        }
+        sp->method_circuit_breakers.store(cbs, butil::memory_order_release);
+    }
+    CircuitBreaker* cb = FindMethodCircuitBreaker(cbs, method);
+    if (cb == NULL) {
+        cb = new (std::nothrow) CircuitBreaker;
+        if (cb != NULL) {
+            cbs->Modify(AddMethodCircuitBreaker, method, cb);
+        }
+    }
+    return cb;
+}
+
 void Socket::FeedbackCircuitBreaker(int error_code, int64_t latency_us) {
     if (!GetOrNewSharedPart()->circuit_breaker.OnCallEnd(error_code, latency_us)) {
         if (SetFailed(main_socket_id()) == 0) {
@@ -43,6 +43,12 @@
 #include "brpc/versioned_ref_with_id.h"
 #include "brpc/health_check_option.h"
 
+namespace google {
+namespace protobuf {
+class MethodDescriptor;
+}  // namespace protobuf
+}  // namespace google
+
 namespace brpc {
 namespace policy {
 class ConsistentHashingLoadBalancer;
@@ -59,6 +65,7 @@ class RdmaConnect;
 
 class Socket;
 class AuthContext;
+class CircuitBreaker;
 class EventDispatcher;
 class Stream;
 
@@ -479,6 +486,13 @@ public:
 
     void FeedbackCircuitBreaker(int error_code, int64_t latency_us);
 
+    // Get the CircuitBreaker of calls to `method' through this socket (and
+    // sockets sharing the same main socket), create one if it does not
+    // exist. Breaking such a CircuitBreaker does not fail the socket.
+    // Returns NULL on out of memory.
+    CircuitBreaker* GetOrNewMethodCircuitBreaker(
+        const google::protobuf::MethodDescriptor* method);
+
     // Notify `id' object (by calling bthread_id_error) when this Socket
     // has been `SetFailed'. If it already has, notify `id' immediately
     void NotifyOnFailed(bthread_id_t id);
@@ -30,6 +30,7 @@ ThriftFramedMessage::ThriftFramedMessage()
 
 void ThriftFramedMessage::SharedCtor() {
     field_id = THRIFT_INVALID_FID;
+    protocol_type = THRIFT_BINARY_PROTOCOL;
     _own_raw_instance = false;
     _raw_instance = nullptr;
 }
@@ -70,6 +71,7 @@ void ThriftFramedMessage::Swap(ThriftFramedMessage* other) {
     if (other != this) {
         body.swap(other->body);
         std::swap(field_id, other->field_id);
+        std::swap(protocol_type, other->protocol_type);
         std::swap(_own_raw_instance, other->_own_raw_instance);
         std::swap(_raw_instance, other->_raw_instance);
     }
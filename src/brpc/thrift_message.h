@@ -44,6 +44,14 @@ static const int16_t THRIFT_INVALID_FID = -1;
 static const int16_t THRIFT_REQUEST_FID = 1;
 static const int16_t THRIFT_RESPONSE_FID = 0;
 
+// Encoding of thrift messages inside frames.
+enum ThriftProtocolType {
+    THRIFT_BINARY_PROTOCOL = 0,
+    // TCompactProtocol: varints and packed field headers, usually much
+    // smaller than the binary protocol for integer and list-heavy structs.
+    THRIFT_COMPACT_PROTOCOL = 1,
+};
+
 // Problem: TBase is absent in thrift 0.9.3
 // Solution: Wrap native messages with templates into instances inheriting
 //   from ThriftMessageBase which can be stored and handled uniformly.
@@ -60,6 +68,10 @@ friend class ThriftStub;
 public:
     butil::IOBuf body; // ~= "{ raw_instance }"
     int16_t field_id;  // must be set when body is set.
+    // Protocol of `body' and of the message sent. Set by brpc for received
+    // messages, a server always replies with the protocol of the request.
+    // Default: THRIFT_BINARY_PROTOCOL
+    ThriftProtocolType protocol_type;
 
 private:
     bool _own_raw_instance;
@@ -96,7 +108,9 @@ private:
 
 class ThriftStub {
 public:
-    explicit ThriftStub(ChannelBase* channel) : _channel(channel) {}
+    explicit ThriftStub(ChannelBase* channel,
+                        ThriftProtocolType protocol_type = THRIFT_BINARY_PROTOCOL)
+        : _channel(channel), _protocol_type(protocol_type) {}
 
     template <typename REQUEST, typename RESPONSE>
     void CallMethod(const char* method_name,
@@ -113,13 +127,15 @@ public:
 
 private:
     ChannelBase* _channel;
+    ThriftProtocolType _protocol_type;
 };
 
 namespace policy {
 // Implemented in policy/thrift_protocol.cpp
 bool ReadThriftStruct(const butil::IOBuf& body,
                       ThriftMessageBase* raw_msg,
-                      int16_t expected_fid);
+                      int16_t expected_fid,
+                      ThriftProtocolType protocol_type);
 }
 
 namespace details {
@@ -184,7 +200,7 @@ T* ThriftFramedMessage::Cast() {
     _own_raw_instance = true;
 
     if (!body.empty()) {
-        if (!policy::ReadThriftStruct(body, _raw_instance, field_id)) {
+        if (!policy::ReadThriftStruct(body, _raw_instance, field_id, protocol_type)) {
             LOG(ERROR) << "Fail to parse " << butil::class_name<T>();
         }
     }
@@ -203,6 +219,7 @@ void ThriftStub::CallMethod(const char* method_name,
         raw_request_wrapper(const_cast<REQUEST*>(raw_request));
     ThriftFramedMessage request;
     request._raw_instance = &raw_request_wrapper;
+    request.protocol_type = _protocol_type;
 
     if (done == NULL) {
         // response is guaranteed to be unused after a synchronous RPC, no
@@ -0,0 +1,79 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <limits>                       // std::numeric_limits
+#include "butil/logging.h"
+#include "bvar/detail/hdr_histogram.h"
+
+namespace bvar {
+namespace detail {
+
+class AddToHdrHistogram {
+public:
+    void operator()(ThreadLocalHdrHistogram& local_value,
+                    uint32_t latency) const {
+        local_value.add(latency);
+    }
+};
+
+HdrPercentile::HdrPercentile()
+    : _combiner(std::make_shared<combiner_type>()), _sampler(NULL) {}
+
+HdrPercentile::~HdrPercentile() {
+    // Have to destroy sampler first to avoid the race between destruction and
+    // sampler
+    if (_sampler != NULL) {
+        _sampler->destroy();
+        _sampler = NULL;
+    }
+}
+
+HdrPercentile::value_type HdrPercentile::reset() {
+    return _combiner->reset_all_agents();
+}
+
+HdrPercentile::value_type HdrPercentile::get_value() const {
+    return _combiner->combine_agents();
+}
+
+HdrPercentile& HdrPercentile::operator<<(int64_t latency) {
+    agent_type* agent = _combiner->get_or_create_tls_agent();
+    if (BAIDU_UNLIKELY(!agent)) {
+        LOG(FATAL) << "Fail to create agent";
+        return *this;
+    }
+    if (latency < 0) {
+        if (!_debug_name.empty()) {
+            LOG_EVERY_SECOND(WARNING) << "Input=" << latency << " to `"
+                                      << _debug_name << "' is negative, drop";
+        } else {
+            LOG_EVERY_SECOND(WARNING) << "Input=" << latency
+                                      << " to HdrPercentile(" << (void*)this
+                                      << ") is negative, drop";
+        }
+        return *this;
+    }
+    // Same as Percentile, overflowed values are counted in the last bucket.
+    if (latency > std::numeric_limits<uint32_t>::max()) {
+        latency = std::numeric_limits<uint32_t>::max();
+    }
+    agent->element.modify(AddToHdrHistogram(), (uint32_t)latency);
+    return *this;
+}
+
+}  // namespace detail
+}  // namespace bvar
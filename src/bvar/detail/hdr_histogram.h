@@ -0,0 +1,199 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_DETAIL_HDR_HISTOGRAM_H
+#define  BVAR_DETAIL_HDR_HISTOGRAM_H
+
+#include <string.h>                     // memset
+#include <stdint.h>                     // uint32_t
+#include <math.h>                       // ceil
+#include <ostream>                      // std::ostream
+#include "butil/macros.h"               // BAIDU_CASSERT
+#include "bvar/reducer.h"               // VoidOp
+#include "bvar/detail/combiner.h"       // AgentCombiner
+#include "bvar/detail/sampler.h"        // ReducerSampler
+
+namespace bvar {
+namespace detail {
+
+// Values less than 2^(HDR_SUB_BUCKET_BITS+1) are counted exactly, larger
+// values fall into 2^HDR_SUB_BUCKET_BITS linear buckets per power of 2, so
+// the relative error of a reported value is at most 1/2^(HDR_SUB_BUCKET_BITS+1)
+// (~1.6%), no matter how many values are recorded.
+static const size_t HDR_SUB_BUCKET_BITS = 5;
+static const size_t HDR_SUB_BUCKET_COUNT = (1UL << HDR_SUB_BUCKET_BITS);
+// Values are uint32_t as in Percentile: 2 groups of exact buckets for values
+// less than 2^(HDR_SUB_BUCKET_BITS+1) and one group for each larger power of 2.
+static const size_t NUM_HDR_BUCKETS =
+    (32 - HDR_SUB_BUCKET_BITS + 1) * HDR_SUB_BUCKET_COUNT;
+
+// Index of the bucket that `value' falls into.
+inline size_t hdr_bucket_index(uint32_t value) {
+    if (value < 2 * HDR_SUB_BUCKET_COUNT) {
+        return value;
+    }
+    const size_t shift = (31 - __builtin_clz(value)) - HDR_SUB_BUCKET_BITS;
+    return (shift + 1) * HDR_SUB_BUCKET_COUNT +
+        ((value >> shift) - HDR_SUB_BUCKET_COUNT);
+}
+
+// The value representing the bucket at `index', which is the middle of
+// the values falling into the bucket.
+inline uint32_t hdr_bucket_value(size_t index) {
+    if (index < 2 * HDR_SUB_BUCKET_COUNT) {
+        return index;
+    }
+    const size_t shift = index / HDR_SUB_BUCKET_COUNT - 1;
+    const uint64_t lower = (uint64_t)(index % HDR_SUB_BUCKET_COUNT +
+                                      HDR_SUB_BUCKET_COUNT) << shift;
+    return lower + ((1UL << shift) - 1) / 2;
+}
+
+// Counts of values in log-linear buckets. Unlike PercentileSamples, no
+// value is dropped, thus histograms of different threads and seconds are
+// merged exactly.
+template <typename Count>
+class HdrHistogram {
+public:
+    HdrHistogram() { memset(this, 0, sizeof(*this)); }
+
+    void add(uint32_t value) {
+        ++_counts[hdr_bucket_index(value)];
+        ++_num_added;
+    }
+
+    template <typename Count2>
+    void merge(const HdrHistogram<Count2>& rhs) {
+        if (rhs._num_added == 0) {
+            return;
+        }
+        for (size_t i = 0; i < NUM_HDR_BUCKETS; ++i) {
+            _counts[i] += rhs._counts[i];
+        }
+        _num_added += rhs._num_added;
+    }
+
+    // Get the `ratio'-ile value. E.g. 0.99 means 99%-ile value.
+    uint32_t get_number(double ratio) const {
+        uint64_t n = (uint64_t)ceil(ratio * _num_added);
+        if (n > _num_added) {
+            n = _num_added;
+        } else if (n == 0) {
+            return 0;
+        }
+        for (size_t i = 0; i < NUM_HDR_BUCKETS; ++i) {
+            if (n <= _counts[i]) {
+                return hdr_bucket_value(i);
+            }
+            n -= _counts[i];
+        }
+        return hdr_bucket_value(NUM_HDR_BUCKETS - 1);
+    }
+
+    // #values ever added.
+    uint64_t added_count() const { return _num_added; }
+
+    // For debuggin.
+    void describe(std::ostream& os) const {
+        os << "{num_added=" << _num_added;
+        for (size_t i = 0; i < NUM_HDR_BUCKETS; ++i) {
+            if (_counts[i]) {
+                os << ' ' << hdr_bucket_value(i) << ':' << _counts[i];
+            }
+        }
+        os << '}';
+    }
+
+private:
+template <typename Count2> friend class HdrHistogram;
+
+    uint64_t _num_added;
+    Count _counts[NUM_HDR_BUCKETS];
+};
+
+template <typename Count>
+std::ostream& operator<<(std::ostream& os, const HdrHistogram<Count>& h) {
+    h.describe(os);
+    return os;
+}
+
+// Counts of a thread never reach 2^32 within one sampling interval (a
+// second), use 32-bit counters to halve the memory.
+typedef HdrHistogram<uint64_t> GlobalHdrHistogram;
+typedef HdrHistogram<uint32_t> ThreadLocalHdrHistogram;
+
+struct AddHdrHistogram {
+    template <typename C1, typename C2>
+    void operator()(HdrHistogram<C1>& h1, const HdrHistogram<C2>& h2) const {
+        h1.merge(h2);
+    }
+};
+
+// A specialized reducer for finding the percentile of latencies with
+// bounded relative error, an alternative of Percentile.
+// NOTE: DON'T use it directly, use LatencyRecorder with -bvar_latency_use_hdr
+class HdrPercentile {
+public:
+    typedef GlobalHdrHistogram value_type;
+    typedef ReducerSampler<HdrPercentile, GlobalHdrHistogram,
+                           AddHdrHistogram, VoidOp> sampler_type;
+    typedef AgentCombiner<GlobalHdrHistogram,
+                          ThreadLocalHdrHistogram,
+                          AddHdrHistogram> combiner_type;
+    typedef combiner_type::self_shared_type shared_combiner_type;
+    typedef combiner_type::Agent agent_type;
+
+    HdrPercentile();
+    ~HdrPercentile();
+
+    AddHdrHistogram op() const { return AddHdrHistogram(); }
+    VoidOp inv_op() const { return VoidOp(); }
+
+    // The sampler for windows over percentile.
+    sampler_type* get_sampler() {
+        if (NULL == _sampler) {
+            _sampler = new sampler_type(this);
+            _sampler->schedule();
+        }
+        return _sampler;
+    }
+
+    value_type reset();
+
+    value_type get_value() const;
+
+    HdrPercentile& operator<<(int64_t latency);
+
+    bool valid() const { return _combiner != NULL && _combiner->valid(); }
+
+    // This name is useful for warning negative latencies in operator<<
+    void set_debug_name(const butil::StringPiece& name) {
+        _debug_name.assign(name.data(), name.size());
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(HdrPercentile);
+
+    shared_combiner_type _combiner;
+    sampler_type* _sampler;
+    std::string _debug_name;
+};
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  //BVAR_DETAIL_HDR_HISTOGRAM_H
@@ -39,11 +39,22 @@ BUTIL_VALIDATE_GFLAG(bvar_latency_p2, valid_percentile);
 DEFINE_int32(bvar_latency_p3, 99, "Third latency percentile");
 BUTIL_VALIDATE_GFLAG(bvar_latency_p3, valid_percentile);
 
+// Only affects LatencyRecorders created after the change.
+DEFINE_bool(bvar_latency_use_hdr, false,
+            "Compute latency percentiles with log-linear histograms which "
+            "count every latency with bounded relative error, rather than "
+            "with random samples");
+BUTIL_VALIDATE_GFLAG(bvar_latency_use_hdr, butil::PassValidate);
+
 namespace detail {
 
 typedef PercentileSamples<1022> CombinedPercentileSamples;
 
-CDF::CDF(PercentileWindow* w) : _w(w) {}
+static void get_percentiles(PercentileWindow* w, HdrPercentileWindow* hdr_w,
+                            const double* ratios, size_t n, int64_t* numbers);
+
+CDF::CDF(PercentileWindow* w, HdrPercentileWindow* hdr_w)
+    : _w(w), _hdr_w(hdr_w) {}
 
 CDF::~CDF() {
     hide();
@@ -55,29 +66,34 @@ void CDF::describe(std::ostream& os, bool) const {
 
 int CDF::describe_series(
     std::ostream& os, const SeriesOptions& options) const {
-    if (_w == NULL) {
+    if (_w == NULL && _hdr_w == NULL) {
         return 1;
     }
     if (options.test_only) {
         return 0;
     }
-    std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
-    std::vector<GlobalPercentileSamples> buckets;
-    _w->get_samples(&buckets);
-    for (size_t i = 0; i < buckets.size(); ++i) {
-        cb->combine_of(buckets.begin(), buckets.end());
-    }
-    std::pair<int, int> values[20];
+    int labels[20];
+    double ratios[arraysize(labels)];
     size_t n = 0;
-    for (int i = 1; i < 10; ++i) {
-        values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
+    for (int i = 1; i < 10; ++i, ++n) {
+        labels[n] = i * 10;
+        ratios[n] = i * 0.1;
     }
-    for (int i = 91; i < 100; ++i) {
-        values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+    for (int i = 91; i < 100; ++i, ++n) {
+        labels[n] = i;
+        ratios[n] = i * 0.01;
+    }
+    labels[n] = 100;
+    ratios[n++] = 0.999;
+    labels[n] = 101;
+    ratios[n++] = 0.9999;
+    CHECK_EQ(n, arraysize(labels));
+    int64_t numbers[arraysize(labels)];
+    get_percentiles(_w, _hdr_w, ratios, n, numbers);
+    std::pair<int, int> values[arraysize(labels)];
+    for (size_t i = 0; i < n; ++i) {
+        values[i] = std::make_pair(labels[i], (int)numbers[i]);
     }
-    values[n++] = std::make_pair(100, cb->get_number(0.999));
-    values[n++] = std::make_pair(101, cb->get_number(0.9999));
-    CHECK_EQ(n, arraysize(values));
     os << "{\"label\":\"cdf\",\"data\":[";
     for (size_t i = 0; i < n; ++i) {
         if (i) {
@@ -121,6 +137,23 @@ static CombinedPercentileSamples* combine(PercentileWindow* w) {
     return cb;
 }
 
+// Put `ratios[i]'-ile values into `numbers[i]' for i in [0, n).
+static void get_percentiles(PercentileWindow* w, HdrPercentileWindow* hdr_w,
+                            const double* ratios, size_t n, int64_t* numbers) {
+    if (hdr_w != NULL) {
+        // Histograms of all seconds inside the window are merged exactly.
+        const GlobalHdrHistogram h = hdr_w->get_value();
+        for (size_t i = 0; i < n; ++i) {
+            numbers[i] = h.get_number(ratios[i]);
+        }
+        return;
+    }
+    std::unique_ptr<CombinedPercentileSamples> cb(combine(w));
+    for (size_t i = 0; i < n; ++i) {
+        numbers[i] = cb->get_number(ratios[i]);
+    }
+}
+
 template <int64_t numerator, int64_t denominator>
 static int64_t get_percetile(void* arg) {
     return ((LatencyRecorder*)arg)->latency_percentile(
@@ -141,17 +174,11 @@ static int64_t get_p3(void* arg) {
 }
 
 static Vector<int64_t, 4> get_latencies(void *arg) {
-    std::unique_ptr<CombinedPercentileSamples> cb(
-        combine((PercentileWindow*)arg));
-    // NOTE: We don't show 99.99% since it's often significantly larger than
-    // other values and make other curves on the plotted graph small and
-    // hard to read.
-    Vector<int64_t, 4> result;
-    result[0] = cb->get_number(FLAGS_bvar_latency_p1 / 100.0);
-    result[1] = cb->get_number(FLAGS_bvar_latency_p2 / 100.0);
-    result[2] = cb->get_number(FLAGS_bvar_latency_p3 / 100.0);
-    result[3] = cb->get_number(0.999);
-    return result;
+    return static_cast<LatencyRecorder*>(arg)->latency_percentiles();
+}
+
+static HdrPercentile* new_hdr_percentile_if_enabled() {
+    return FLAGS_bvar_latency_use_hdr ? new HdrPercentile : NULL;
 }
 
 LatencyRecorderBase::LatencyRecorderBase(time_t window_size)
@@ -166,16 +193,29 @@ LatencyRecorderBase::LatencyRecorderBase(time_t window_size)
     , _latency_p3(get_p3, this)
     , _latency_999(get_percetile<999, 1000>, this)
     , _latency_9999(get_percetile<9999, 10000>, this)
-    , _latency_cdf(&_latency_percentile_window)
-    , _latency_percentiles(get_latencies, &_latency_percentile_window)
+    , _latency_hdr(new_hdr_percentile_if_enabled())
+    , _latency_hdr_window(_latency_hdr ? new HdrPercentileWindow(
+                              _latency_hdr.get(), window_size) : NULL)
+    , _latency_cdf(&_latency_percentile_window, _latency_hdr_window.get())
+    , _latency_percentiles(get_latencies, this)
 {}
 
 }  // namespace detail
 
 Vector<int64_t, 4> LatencyRecorder::latency_percentiles() const {
+    // NOTE: We don't show 99.99% since it's often significantly larger than
+    // other values and make other curves on the plotted graph small and
+    // hard to read.
+    const double ratios[4] = { FLAGS_bvar_latency_p1 / 100.0,
+                               FLAGS_bvar_latency_p2 / 100.0,
+                               FLAGS_bvar_latency_p3 / 100.0,
+                               0.999 };
+    Vector<int64_t, 4> result;
     // const_cast here is just to adapt parameter type and safe.
-    return detail::get_latencies(
-        const_cast<detail::PercentileWindow*>(&_latency_percentile_window));
+    detail::get_percentiles(
+        const_cast<detail::PercentileWindow*>(&_latency_percentile_window),
+        _latency_hdr_window.get(), ratios, 4, &result[0]);
+    return result;
 }
 
 int64_t LatencyRecorder::qps(time_t window_size) const {
@@ -215,6 +255,9 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
     // set debug names for printing helpful error log.
     _latency.set_debug_name(prefix);
     _latency_percentile.set_debug_name(prefix);
+    if (_latency_hdr) {
+        _latency_hdr->set_debug_name(prefix);
+    }
 
     if (_latency_window.expose_as(prefix, "latency") != 0) {
         return -1;
@@ -263,9 +306,11 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
 }
 
 int64_t LatencyRecorder::latency_percentile(double ratio) const {
-    std::unique_ptr<detail::CombinedPercentileSamples> cb(
-        combine((detail::PercentileWindow*)&_latency_percentile_window));
-    return cb->get_number(ratio);
+    int64_t number = 0;
+    detail::get_percentiles(
+        (detail::PercentileWindow*)&_latency_percentile_window,
+        _latency_hdr_window.get(), &ratio, 1, &number);
+    return number;
 }
 
 void LatencyRecorder::hide() {
@@ -288,7 +333,11 @@ LatencyRecorder& LatencyRecorder::operator<<(int64_t latency) {
     latency = latency / FLAGS_latency_scale_factor;
     _latency << latency;
     _max_latency << latency;
-    _latency_percentile << latency;
+    if (_latency_hdr) {
+        *_latency_hdr << latency;
+    } else {
+        _latency_percentile << latency;
+    }
     return *this;
 }
 
@@ -24,6 +24,7 @@
 #include "bvar/reducer.h"
 #include "bvar/passive_status.h"
 #include "bvar/detail/percentile.h"
+#include "bvar/detail/hdr_histogram.h"
 
 namespace bvar {
 namespace detail {
@@ -32,17 +33,20 @@ class Percentile;
 typedef Window<IntRecorder, SERIES_IN_SECOND> RecorderWindow;
 typedef Window<Maxer<int64_t>, SERIES_IN_SECOND> MaxWindow;
 typedef Window<Percentile, SERIES_IN_SECOND> PercentileWindow;
+typedef Window<HdrPercentile, SERIES_IN_SECOND> HdrPercentileWindow;
 
 // NOTE: Always use int64_t in the interfaces no matter what the impl. is.
 
 class CDF : public Variable {
 public:
-    explicit CDF(PercentileWindow* w);
+    // Plot from `hdr_w' if it's not NULL, from `w' otherwise.
+    explicit CDF(PercentileWindow* w, HdrPercentileWindow* hdr_w = NULL);
     ~CDF() override;
     void describe(std::ostream& os, bool quote_string) const override;
     int describe_series(std::ostream& os, const SeriesOptions& options) const override;
 private:
     PercentileWindow* _w; 
+    HdrPercentileWindow* _hdr_w;
 };
 
 // For mimic constructor inheritance.
@@ -65,6 +69,10 @@ protected:
     PassiveStatus<int64_t> _latency_p3;
     PassiveStatus<int64_t> _latency_999;  // 99.9%
     PassiveStatus<int64_t> _latency_9999; // 99.99%
+    // Replace _latency_percentile when -bvar_latency_use_hdr is true at
+    // construction, NULL otherwise.
+    std::unique_ptr<HdrPercentile> _latency_hdr;
+    std::unique_ptr<HdrPercentileWindow> _latency_hdr_window;
     CDF _latency_cdf;
     PassiveStatus<Vector<int64_t, 4> > _latency_percentiles;
 };
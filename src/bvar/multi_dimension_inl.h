@@ -38,7 +38,9 @@ static const std::string ALLOW_UNUSED METRIC_TYPE_GAUGE = "gauge";
 template <typename T, typename KeyType, bool Shared>
 MultiDimension<T, KeyType, Shared>::MultiDimension(const key_type& labels)
     : Base(labels)
-    , _max_stats_count(FLAGS_max_multi_dimension_stats_count) {
+    , _max_stats_count(FLAGS_max_multi_dimension_stats_count)
+    , _fast_slots(NULL)
+    , _fast_used_slots(0) {
     _metric_map.Modify(init_flatmap);
 }
 
@@ -61,6 +63,7 @@ template <typename T, typename KeyType, bool Shared>
 MultiDimension<T, KeyType, Shared>::~MultiDimension() {
     this->hide();
     delete_stats();
+    delete [] _fast_slots.load(butil::memory_order_relaxed);
 }
 
 template <typename T, typename KeyType, bool Shared>
@@ -93,6 +96,7 @@ void MultiDimension<T, KeyType, Shared>::delete_stats(const K& labels_value) {
             return bg.erase(labels_value, &tmp_metric);
         };
         _metric_map.Modify(erase_fn);
+        erase_fast_index(labels_value);
         if (tmp_metric) {
             delete_value(tmp_metric);
         }
@@ -116,6 +120,7 @@ void MultiDimension<T, KeyType, Shared>::delete_stats() {
     };
     int ret = _metric_map.Modify(clear_fn);
     CHECK_EQ(1, ret);
+    clear_fast_index();
     for (auto& kv : tmp_map) {
         delete_value(kv.second);
     }
@@ -211,6 +216,153 @@ MultiDimension<T, KeyType, Shared>::get_stats_impl(
     return cache_metric;
 }
 
+template <typename T, typename KeyType, bool Shared>
+template <typename K, bool S>
+typename std::enable_if<!S, typename MultiDimension<T, KeyType, Shared>::value_ptr_type>::type
+MultiDimension<T, KeyType, Shared>::get_stats_fast(const K& labels_value, uint64_t hash) {
+    value_ptr_type value = find_fast_index(labels_value, hash);
+    if (NULL != value) {
+        return value;
+    }
+    value = get_stats_impl(labels_value, READ_OR_INSERT);
+    if (NULL != value) {
+        // `hash' may be given by the user, recompute it.
+        insert_fast_index(labels_value, labels_hash(labels_value), value);
+    }
+    return value;
+}
+
+template <typename T, typename KeyType, bool Shared>
+template <typename K>
+typename MultiDimension<T, KeyType, Shared>::value_ptr_type
+MultiDimension<T, KeyType, Shared>::find_fast_index(
+    const K& labels_value, uint64_t hash) const {
+    const FastSlot* slots = _fast_slots.load(butil::memory_order_acquire);
+    if (NULL == slots) {
+        return NULL;
+    }
+    for (size_t i = 0; i < FAST_INDEX_CAPACITY; ++i) {
+        const FastSlot& slot = slots[(hash + i) & (FAST_INDEX_CAPACITY - 1)];
+        const uint64_t slot_hash = slot.hash.load(butil::memory_order_acquire);
+        if (slot_hash == 0) {
+            // Labels are never inserted beyond an empty slot.
+            return NULL;
+        }
+        if (slot_hash != hash) {
+            continue;
+        }
+        const FastEntry* entry = slot.entry.load(butil::memory_order_acquire);
+        if (NULL != entry && KeyEqualTo()(entry->key, labels_value)) {
+            return entry->value;
+        }
+    }
+    return NULL;
+}
+
+template <typename T, typename KeyType, bool Shared>
+template <typename K>
+void MultiDimension<T, KeyType, Shared>::insert_fast_index(
+    const K& labels_value, uint64_t hash, value_ptr_type value) {
+    BAIDU_SCOPED_LOCK(_fast_mutex);
+    FastSlot* slots = _fast_slots.load(butil::memory_order_relaxed);
+    if (NULL == slots) {
+        slots = new (std::nothrow) FastSlot[FAST_INDEX_CAPACITY];
+        if (NULL == slots) {
+            return;
+        }
+        for (size_t i = 0; i < FAST_INDEX_CAPACITY; ++i) {
+            slots[i].hash.store(0, butil::memory_order_relaxed);
+            slots[i].entry.store(NULL, butil::memory_order_relaxed);
+        }
+        _fast_slots.store(slots, butil::memory_order_release);
+    }
+    FastSlot* reusable = NULL;
+    size_t i = 0;
+    for (; i < FAST_INDEX_CAPACITY; ++i) {
+        FastSlot& slot = slots[(hash + i) & (FAST_INDEX_CAPACITY - 1)];
+        const uint64_t slot_hash = slot.hash.load(butil::memory_order_relaxed);
+        if (slot_hash == 0) {
+            break;
+        }
+        if (slot_hash != hash) {
+            continue;
+        }
+        FastEntry* entry = slot.entry.load(butil::memory_order_relaxed);
+        if (NULL == entry) {
+            if (NULL == reusable) {
+                reusable = &slot;
+            }
+        } else if (KeyEqualTo()(entry->key, labels_value)) {
+            // Inserted by another thread.
+            return;
+        }
+    }
+    if (NULL == reusable &&
+        (i == FAST_INDEX_CAPACITY || _fast_used_slots >= FAST_INDEX_CAPACITY / 2)) {
+        // Full, the stats are still accessible through `_metric_map'.
+        return;
+    }
+    FastEntry* entry = new (std::nothrow) FastEntry;
+    if (NULL == entry) {
+        return;
+    }
+    entry->key = key_type(labels_value.cbegin(), labels_value.cend());
+    entry->value = value;
+    if (NULL != reusable) {
+        reusable->entry.store(entry, butil::memory_order_release);
+        return;
+    }
+    FastSlot& slot = slots[(hash + i) & (FAST_INDEX_CAPACITY - 1)];
+    slot.entry.store(entry, butil::memory_order_relaxed);
+    slot.hash.store(hash, butil::memory_order_release);
+    ++_fast_used_slots;
+}
+
+template <typename T, typename KeyType, bool Shared>
+template <typename K>
+void MultiDimension<T, KeyType, Shared>::erase_fast_index(const K& labels_value) {
+    BAIDU_SCOPED_LOCK(_fast_mutex);
+    FastSlot* slots = _fast_slots.load(butil::memory_order_relaxed);
+    if (NULL == slots) {
+        return;
+    }
+    const uint64_t hash = labels_hash(labels_value);
+    for (size_t i = 0; i < FAST_INDEX_CAPACITY; ++i) {
+        FastSlot& slot = slots[(hash + i) & (FAST_INDEX_CAPACITY - 1)];
+        const uint64_t slot_hash = slot.hash.load(butil::memory_order_relaxed);
+        if (slot_hash == 0) {
+            return;
+        }
+        if (slot_hash != hash) {
+            continue;
+        }
+        FastEntry* entry = slot.entry.load(butil::memory_order_relaxed);
+        if (NULL != entry && KeyEqualTo()(entry->key, labels_value)) {
+            // Keep the hash so that probing of other labels is not broken.
+            slot.entry.store(NULL, butil::memory_order_release);
+            // Like the stats, the entry is deleted without waiting for
+            // readers, which is why delete_stats() is not thread safe in
+            // the non-shared mode.
+            delete entry;
+            return;
+        }
+    }
+}
+
+template <typename T, typename KeyType, bool Shared>
+void MultiDimension<T, KeyType, Shared>::clear_fast_index() {
+    BAIDU_SCOPED_LOCK(_fast_mutex);
+    FastSlot* slots = _fast_slots.load(butil::memory_order_relaxed);
+    if (NULL == slots) {
+        return;
+    }
+    for (size_t i = 0; i < FAST_INDEX_CAPACITY; ++i) {
+        delete slots[i].entry.exchange(NULL, butil::memory_order_relaxed);
+        slots[i].hash.store(0, butil::memory_order_release);
+    }
+    _fast_used_slots = 0;
+}
+
 template <typename T, typename KeyType, bool Shared>
 void MultiDimension<T, KeyType, Shared>::clear_stats() {
     delete_stats();
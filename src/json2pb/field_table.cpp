@@ -0,0 +1,143 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <unordered_map>
+#include <google/protobuf/descriptor.h>
+#include "butil/containers/doubly_buffered_data.h"
+#include "butil/logging.h"
+#include "butil/memory/singleton_on_pthread_once.h"
+#include "json2pb/encode_decode.h"
+#include "json2pb/protobuf_map.h"
+#include "json2pb/field_table.h"
+
+namespace json2pb {
+
+// Tables are never removed since types in the generated pool live as long
+// as the program.
+typedef std::unordered_map<const google::protobuf::Descriptor*,
+                           const FieldTable*> FieldTableMap;
+typedef butil::DoublyBufferedData<FieldTableMap> SharedFieldTables;
+
+static size_t AddFieldTable(FieldTableMap& m, const FieldTable* table) {
+    return m.insert(std::make_pair(table->descriptor(), table)).second;
+}
+
+FieldInfo::FieldInfo(const google::protobuf::FieldDescriptor* f)
+    : field(f)
+    , cpp_type(f->cpp_type())
+    , repeated(f->is_repeated())
+    , required(f->is_required())
+    , bytes(f->type() == google::protobuf::FieldDescriptor::TYPE_BYTES) {
+}
+
+FieldTable::FieldTable(const google::protobuf::Message& message)
+    : _descriptor(message.GetDescriptor())
+    , _has_map_field(false) {
+    const google::protobuf::Reflection* reflection = message.GetReflection();
+    std::vector<const google::protobuf::FieldDescriptor*> fields;
+    for (int i = 0; i < _descriptor->extension_range_count(); ++i) {
+        const google::protobuf::Descriptor::ExtensionRange*
+            ext_range = _descriptor->extension_range(i);
+#if GOOGLE_PROTOBUF_VERSION < 4025000
+        for (int tag_number = ext_range->start; tag_number < ext_range->end; ++tag_number)
+#else
+        for (int tag_number = ext_range->start_number(); tag_number < ext_range->end_number(); ++tag_number)
+#endif
+        {
+            const google::protobuf::FieldDescriptor* field =
+                reflection->FindKnownExtensionByNumber(tag_number);
+            if (field) {
+                fields.push_back(field);
+            }
+        }
+    }
+    for (int i = 0; i < _descriptor->field_count(); ++i) {
+        fields.push_back(_descriptor->field(i));
+    }
+
+    _fields.resize(fields.size());
+    CHECK_EQ(0, _index.init(fields.size() * 2 + 1, 70));
+    for (size_t i = 0; i < fields.size(); ++i) {
+        const google::protobuf::FieldDescriptor* field = fields[i];
+        FieldEntry& e = _fields[i];
+        static_cast<FieldInfo&>(e) = FieldInfo(field);
+        if (!decode_name(field->name(), e.json_name)) {
+            e.json_name = field->name();
+        }
+        e.map_key = NULL;
+        if (IsProtobufMap(field)) {
+            e.map_key = field->message_type()->field(KEY_INDEX);
+            e.map_value = FieldInfo(field->message_type()->field(VALUE_INDEX));
+            _has_map_field = _has_map_field || !field->is_extension();
+        }
+        if (e.required) {
+            _required_fields.push_back(field);
+        }
+        // Same as FindMember() of rapidjson, the first one wins.
+        if (_index.seek(e.json_name) == NULL) {
+            _index[e.json_name] = i;
+        }
+    }
+}
+
+const FieldTable* FieldTable::Get(const google::protobuf::Message& message,
+                                  std::unique_ptr<FieldTable>* holder) {
+    const google::protobuf::Descriptor* descriptor = message.GetDescriptor();
+    if (descriptor->file()->pool() !=
+        google::protobuf::DescriptorPool::generated_pool()) {
+        holder->reset(new FieldTable(message));
+        return holder->get();
+    }
+    SharedFieldTables* tables = butil::get_leaky_singleton<SharedFieldTables>();
+    {
+        SharedFieldTables::ScopedPtr ptr;
+        if (tables->Read(&ptr) != 0) {
+            holder->reset(new FieldTable(message));
+            return holder->get();
+        }
+        FieldTableMap::const_iterator it = ptr->find(descriptor);
+        if (it != ptr->end()) {
+            return it->second;
+        }
+    }
+    FieldTable* table = new FieldTable(message);
+    if (tables->Modify(AddFieldTable, table) == 0) {
+        // Added by another thread, use ours this time.
+        holder->reset(table);
+    }
+    return table;
+}
+
+const FieldTable* FieldTableCache::Get(const google::protobuf::Message& message) {
+    const google::protobuf::Descriptor* descriptor = message.GetDescriptor();
+    // Few types are involved in a conversion generally, scanning is faster
+    // than hashing.
+    for (size_t i = 0; i < _tables.size(); ++i) {
+        if (_tables[i]->descriptor() == descriptor) {
+            return _tables[i];
+        }
+    }
+    std::unique_ptr<FieldTable> holder;
+    const FieldTable* table = FieldTable::Get(message, &holder);
+    if (holder != NULL) {
+        _owned_tables.push_back(std::move(holder));
+    }
+    _tables.push_back(table);
+    return table;
+}
+
+} // namespace json2pb
@@ -0,0 +1,104 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_JSON2PB_FIELD_TABLE_H
+#define BRPC_JSON2PB_FIELD_TABLE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <google/protobuf/message.h>
+#include "butil/containers/flat_map.h"
+
+namespace json2pb {
+
+// Properties of a field copied from its descriptor so that conversions
+// dispatch without asking the descriptor again.
+struct FieldInfo {
+    FieldInfo() : field(NULL), cpp_type(), repeated(false),
+                  required(false), bytes(false) {}
+    explicit FieldInfo(const google::protobuf::FieldDescriptor* f);
+
+    const google::protobuf::FieldDescriptor* field;
+    google::protobuf::FieldDescriptor::CppType cpp_type;
+    bool repeated;
+    bool required;
+    bool bytes;
+};
+
+struct FieldEntry : public FieldInfo {
+    // Name of the field in json, namely the decoded name.
+    std::string json_name;
+    // Key and value of entries if the field is a map, NULL field otherwise.
+    const google::protobuf::FieldDescriptor* map_key;
+    FieldInfo map_value;
+};
+
+// Fields of a message type and lookup table by their names in json, which
+// are computed once instead of in each conversion.
+class FieldTable {
+public:
+    // Get the table of the type of `message'. Tables of types in the
+    // generated pool are built once and shared by all threads, tables of
+    // other types(which may be destroyed) are built into `holder'.
+    static const FieldTable* Get(const google::protobuf::Message& message,
+                                 std::unique_ptr<FieldTable>* holder);
+
+    const google::protobuf::Descriptor* descriptor() const { return _descriptor; }
+
+    // Known extensions followed by declared fields.
+    const std::vector<FieldEntry>& fields() const { return _fields; }
+
+    // True if any declared field is a map.
+    bool has_map_field() const { return _has_map_field; }
+
+    // Required fields in fields().
+    const std::vector<const google::protobuf::FieldDescriptor*>&
+    required_fields() const { return _required_fields; }
+
+    // Find the field whose name in json is `name', NULL if not found.
+    const FieldEntry* Find(const char* name, size_t length) const {
+        const size_t* index = butil::find_cstr(_index, name, length);
+        return index != NULL ? &_fields[*index] : NULL;
+    }
+
+private:
+    explicit FieldTable(const google::protobuf::Message& message);
+
+    const google::protobuf::Descriptor* _descriptor;
+    bool _has_map_field;
+    std::vector<FieldEntry> _fields;
+    std::vector<const google::protobuf::FieldDescriptor*> _required_fields;
+    butil::FlatMap<std::string, size_t> _index;
+};
+
+// Tables used in one conversion. A type is looked up in the shared tables
+// or built at most once no matter how many messages of it are converted.
+// Not thread-safe.
+class FieldTableCache {
+public:
+    const FieldTable* Get(const google::protobuf::Message& message);
+
+private:
+    std::vector<const FieldTable*> _tables;
+    // Tables of types not in the generated pool.
+    std::vector<std::unique_ptr<FieldTable> > _owned_tables;
+};
+
+} // namespace json2pb
+
+#endif // BRPC_JSON2PB_FIELD_TABLE_H
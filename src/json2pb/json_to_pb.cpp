@@ -23,6 +23,7 @@
 #include <time.h>
 #include <typeinfo>
 #include <limits> 
+#include <memory>
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
@@ -36,6 +37,8 @@
 #include "json2pb/protobuf_map.h"
 #include "json2pb/rapidjson.h"
 #include "json2pb/protobuf_type_resolver.h"
+#include "json2pb/field_table.h"
+#include "json2pb/structural_parser.h"
 #include "butil/base64.h"
 #include "butil/iobuf.h"
 
@@ -73,7 +76,8 @@ Json2PbOptions::Json2PbOptions()
     : base64_to_bytes(true)
 #endif
     , array_to_single_repeated(false)
-    , allow_remaining_bytes_after_parsing(false) {
+    , allow_remaining_bytes_after_parsing(false)
+    , parser(PARSE_BY_RAPIDJSON) {
 }
 
 enum MatchType { 
@@ -291,7 +295,8 @@ bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
                              google::protobuf::Message* message,
                              const Json2PbOptions& options,
                              std::string* err,
-                             int depth);
+                             int depth,
+                             FieldTableCache* tables);
 //Json value to protobuf convert rules for type:
 //Json value type                 Protobuf type                convert rules
 //int                             int uint int64 uint64        valid convert is available
@@ -316,42 +321,26 @@ bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
         })
 
 
-static bool JsonValueToProtoField(const BUTIL_RAPIDJSON_NAMESPACE::Value& value,
-                                  const google::protobuf::FieldDescriptor* field,
-                                  google::protobuf::Message* message,
-                                  const Json2PbOptions& options,
-                                  std::string* err,
-                                  int depth) {
-    if (value.IsNull()) {
-        if (field->is_required()) {
-            J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
-            return false;
-        }
-        return true;
-    }
-        
-    if (field->is_repeated()) {
-        if (!value.IsArray()) {
-            J2PERROR(err, "Invalid value for repeated field: %s",
-                     field->full_name().c_str());
-            return false;
-        }
-    } 
-
+// Convert `value' to `field' of `message', which is added to the field if
+// `repeated' is true.
+static bool JsonValueToProtoFieldValue(const BUTIL_RAPIDJSON_NAMESPACE::Value& value,
+                                       const google::protobuf::FieldDescriptor* field,
+                                       google::protobuf::Message* message,
+                                       bool repeated,
+                                       const Json2PbOptions& options,
+                                       std::string* err,
+                                       int depth,
+                                       FieldTableCache* tables) {
     const google::protobuf::Reflection* reflection = message->GetReflection();
     switch (field->cpp_type()) {
 #define CASE_FIELD_TYPE(cpptype, method, jsontype)                      \
         case google::protobuf::FieldDescriptor::CPPTYPE_##cpptype: {                      \
-            if (field->is_repeated()) {                                 \
-                const BUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();          \
-                for (BUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) { \
-                    const BUTIL_RAPIDJSON_NAMESPACE::Value & item = value[index];       \
-                    if (TYPE_MATCH == J2PCHECKTYPE(item, cpptype, jsontype)) { \
-                        reflection->Add##method(message, field, item.Get##jsontype()); \
-                    }                                                   \
+            if (TYPE_MATCH == J2PCHECKTYPE(value, cpptype, jsontype)) { \
+                if (repeated) {                                         \
+                    reflection->Add##method(message, field, value.Get##jsontype()); \
+                } else {                                                \
+                    reflection->Set##method(message, field, value.Get##jsontype()); \
                 }                                                       \
-            } else if (TYPE_MATCH == J2PCHECKTYPE(value, cpptype, jsontype)) { \
-                reflection->Set##method(message, field, value.Get##jsontype()); \
             }                                                           \
             break;                                                      \
         }                                                               \
@@ -362,91 +351,31 @@ static bool JsonValueToProtoField(const BUTIL_RAPIDJSON_NAMESPACE::Value& value,
 #undef CASE_FIELD_TYPE
 
     case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
-        if (field->is_repeated()) {
-            const BUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (BUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size;
-                 ++index) {
-                const BUTIL_RAPIDJSON_NAMESPACE::Value& item = value[index];
-                if (!convert_int64_type(item, true, message, field, reflection,
-                                        err)) {
-                    return false;
-                }
-            }
-        } else if (!convert_int64_type(value, false, message, field, reflection,
-                                       err)) {
+        if (!convert_int64_type(value, repeated, message, field, reflection, err)) {
             return false;
         }
         break;
 
     case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
-        if (field->is_repeated()) {
-            const BUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (BUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size;
-                 ++index) {
-                const BUTIL_RAPIDJSON_NAMESPACE::Value& item = value[index];
-                if (!convert_uint64_type(item, true, message, field, reflection,
-                                         err)) {
-                    return false;
-                }
-            }
-        } else if (!convert_uint64_type(value, false, message, field, reflection,
-                                       err)) {
+        if (!convert_uint64_type(value, repeated, message, field, reflection, err)) {
             return false;
         }
         break;
 
     case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
-        if (field->is_repeated()) {
-            const BUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (BUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                const BUTIL_RAPIDJSON_NAMESPACE::Value & item = value[index];
-                if (!convert_float_type(item, true, message, field,
-                                        reflection, err)) {
-                    return false;
-                }
-            }
-        } else if (!convert_float_type(value, false, message, field,
-                                       reflection, err)) {
+        if (!convert_float_type(value, repeated, message, field, reflection, err)) {
             return false;
         }
         break;
 
     case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE: 
-        if (field->is_repeated()) {
-            const BUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (BUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                const BUTIL_RAPIDJSON_NAMESPACE::Value & item = value[index];
-                if (!convert_double_type(item, true, message, field,
-                                         reflection, err)) {
-                    return false;
-                }
-            }
-        } else if (!convert_double_type(value, false, message, field,
-                                        reflection, err)) {
+        if (!convert_double_type(value, repeated, message, field, reflection, err)) {
             return false;
         }
         break;
         
     case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
-        if (field->is_repeated()) {
-            const BUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (BUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                const BUTIL_RAPIDJSON_NAMESPACE::Value & item = value[index];
-                if (TYPE_MATCH == J2PCHECKTYPE(item, string, String)) { 
-                    std::string str(item.GetString(), item.GetStringLength());
-                    if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES &&
-                        options.base64_to_bytes) {
-                        std::string str_decoded;
-                        if (!butil::Base64Decode(str, &str_decoded)) {
-                            J2PERROR_WITH_PB(message, err, "Fail to decode base64 string=%s", str.c_str());
-                            return false;
-                        }
-                        str = str_decoded;
-                    }
-                    reflection->AddString(message, field, str);
-                }  
-            }
-        } else if (TYPE_MATCH == J2PCHECKTYPE(value, string, String)) {
+        if (TYPE_MATCH == J2PCHECKTYPE(value, string, String)) {
             std::string str(value.GetString(), value.GetStringLength());
             if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES &&
                 options.base64_to_bytes) {
@@ -457,40 +386,32 @@ static bool JsonValueToProtoField(const BUTIL_RAPIDJSON_NAMESPACE::Value& value,
                 }
                 str = str_decoded;
             }
-            reflection->SetString(message, field, str);
+            if (repeated) {
+                reflection->AddString(message, field, str);
+            } else {
+                reflection->SetString(message, field, str);
+            }
         }
         break;
 
     case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
-        if (field->is_repeated()) {
-            const BUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (BUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                const BUTIL_RAPIDJSON_NAMESPACE::Value & item = value[index];
-                if (!convert_enum_type(item, true, message, field,
-                                       reflection, err)) {
-                    return false;
-                }
-            }
-        } else if (!convert_enum_type(value, false, message, field,
-                                      reflection, err)) {
+        if (!convert_enum_type(value, repeated, message, field, reflection, err)) {
             return false;
         }
         break;
         
     case google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
-        if (field->is_repeated()) {
-            const BUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (BUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                const BUTIL_RAPIDJSON_NAMESPACE::Value& item = value[index];
-                if (TYPE_MATCH == J2PCHECKTYPE(item, message, Object)) { 
-                    if (!JsonValueToProtoMessage(
-                            item, reflection->AddMessage(message, field), options, err, depth + 1)) {
-                        return false;
-                    }
-                } 
-            }
+        if (repeated) {
+            if (TYPE_MATCH == J2PCHECKTYPE(value, message, Object)) { 
+                if (!JsonValueToProtoMessage(
+                        value, reflection->AddMessage(message, field),
+                        options, err, depth + 1, tables)) {
+                    return false;
+                }
+            } 
         } else if (!JsonValueToProtoMessage(
-            value, reflection->MutableMessage(message, field), options, err, depth + 1)) {
+            value, reflection->MutableMessage(message, field),
+            options, err, depth + 1, tables)) {
             return false;
         }
         break;
@@ -498,32 +419,64 @@ static bool JsonValueToProtoField(const BUTIL_RAPIDJSON_NAMESPACE::Value& value,
     return true;
 }
 
+static bool JsonValueToProtoField(const BUTIL_RAPIDJSON_NAMESPACE::Value& value,
+                                  const google::protobuf::FieldDescriptor* field,
+                                  google::protobuf::Message* message,
+                                  const Json2PbOptions& options,
+                                  std::string* err,
+                                  int depth,
+                                  FieldTableCache* tables) {
+    if (value.IsNull()) {
+        if (field->is_required()) {
+            J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
+            return false;
+        }
+        return true;
+    }
+        
+    if (field->is_repeated()) {
+        if (!value.IsArray()) {
+            J2PERROR(err, "Invalid value for repeated field: %s",
+                     field->full_name().c_str());
+            return false;
+        }
+        const BUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
+        for (BUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
+            if (!JsonValueToProtoFieldValue(value[index], field, message, true,
+                                            options, err, depth, tables)) {
+                return false;
+            }
+        }
+        return true;
+    } 
+    return JsonValueToProtoFieldValue(value, field, message, false,
+                                      options, err, depth, tables);
+}
+
 bool JsonMapToProtoMap(const BUTIL_RAPIDJSON_NAMESPACE::Value& value,
-                       const google::protobuf::FieldDescriptor* map_desc,
+                       const FieldEntry& map_field,
                        google::protobuf::Message* message,
                        const Json2PbOptions& options,
                        std::string* err,
-                       int depth) {
+                       int depth,
+                       FieldTableCache* tables) {
     if (!value.IsObject()) {
         J2PERROR(err, "Non-object value for map field: %s",
-                 map_desc->full_name().c_str());
+                 map_field.field->full_name().c_str());
         return false;
     }
 
     const google::protobuf::Reflection* reflection = message->GetReflection();
-    const google::protobuf::FieldDescriptor* key_desc =
-            map_desc->message_type()->FindFieldByName(KEY_NAME);
-    const google::protobuf::FieldDescriptor* value_desc =
-            map_desc->message_type()->FindFieldByName(VALUE_NAME);
-
     for (BUTIL_RAPIDJSON_NAMESPACE::Value::ConstMemberIterator it =
                  value.MemberBegin(); it != value.MemberEnd(); ++it) {
-        google::protobuf::Message* entry = reflection->AddMessage(message, map_desc);
+        google::protobuf::Message* entry =
+            reflection->AddMessage(message, map_field.field);
         const google::protobuf::Reflection* entry_reflection = entry->GetReflection();
         entry_reflection->SetString(
-            entry, key_desc, std::string(it->name.GetString(),
-                                         it->name.GetStringLength()));
-        if (!JsonValueToProtoField(it->value, value_desc, entry, options, err, depth + 1)) {
+            entry, map_field.map_key, std::string(it->name.GetString(),
+                                                  it->name.GetStringLength()));
+        if (!JsonValueToProtoField(it->value, map_field.map_value.field, entry,
+                                   options, err, depth + 1, tables)) {
             return false;
         }
     }
@@ -534,65 +487,39 @@ bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
                              google::protobuf::Message* message,
                              const Json2PbOptions& options,
                              std::string* err,
-                             int depth) {
+                             int depth,
+                             FieldTableCache* tables) {
     if (depth > FLAGS_json2pb_max_recursion_depth) {
         J2PERROR_WITH_PB(message, err, "Exceeded maximum recursion depth");
         return false;
     }
-    const google::protobuf::Descriptor* descriptor = message->GetDescriptor();
     if (!json_value.IsObject() &&
         !(json_value.IsArray() && options.array_to_single_repeated && depth == 0)) {
         J2PERROR_WITH_PB(message, err, "The input is not a json object");
         return false;
     }
 
-    const google::protobuf::Reflection* reflection = message->GetReflection();
-    
-    std::vector<const google::protobuf::FieldDescriptor*> fields;
-    fields.reserve(64);
-    for (int i = 0; i < descriptor->extension_range_count(); ++i) {
-        const google::protobuf::Descriptor::ExtensionRange*
-            ext_range = descriptor->extension_range(i);
-#if GOOGLE_PROTOBUF_VERSION < 4025000
-        for (int tag_number = ext_range->start; tag_number < ext_range->end; ++tag_number)
-#else
-        for (int tag_number = ext_range->start_number(); tag_number < ext_range->end_number(); ++tag_number)
-#endif
-        {
-            const google::protobuf::FieldDescriptor* field =
-                reflection->FindKnownExtensionByNumber(tag_number);
-            if (field) {
-                fields.push_back(field);
-            }
-        }
-    }
-    for (int i = 0; i < descriptor->field_count(); ++i) {
-        fields.push_back(descriptor->field(i));
-    }
-
+    const std::vector<FieldEntry>& fields = tables->Get(*message)->fields();
     if (json_value.IsArray()) {
-        if (fields.size() == 1 && fields.front()->is_repeated()) {
-            return JsonValueToProtoField(json_value, fields.front(), message, options, err, depth);
+        if (fields.size() == 1 && fields.front().repeated) {
+            return JsonValueToProtoField(json_value, fields.front().field, message,
+                                         options, err, depth, tables);
         }
 
         J2PERROR_WITH_PB(message, err, "the input json can't be array here");
         return false;
     }
 
-    std::string field_name_str_temp; 
     const BUTIL_RAPIDJSON_NAMESPACE::Value* value_ptr = NULL;
     for (size_t i = 0; i < fields.size(); ++i) {
-        const google::protobuf::FieldDescriptor* field = fields[i];
-        
-        const std::string& orig_name = field->name();
-        bool res = decode_name(orig_name, field_name_str_temp); 
-        const std::string& field_name_str = (res ? field_name_str_temp : orig_name);
+        const FieldEntry& e = fields[i];
+        const google::protobuf::FieldDescriptor* field = e.field;
 
 #ifndef RAPIDJSON_VERSION_0_1
         BUTIL_RAPIDJSON_NAMESPACE::Value::ConstMemberIterator member =
-                json_value.FindMember(field_name_str.data());
+                json_value.FindMember(e.json_name.c_str());
         if (member == json_value.MemberEnd()) {
-            if (field->is_required()) {
+            if (e.required) {
                 J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
                 return false;
             }
@@ -601,9 +528,9 @@ bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
         value_ptr = &(member->value);
 #else 
         const BUTIL_RAPIDJSON_NAMESPACE::Value::Member* member =
-                json_value.FindMember(field_name_str.data());
+                json_value.FindMember(e.json_name.c_str());
         if (member == NULL) {
-            if (field->is_required()) {
+            if (e.required) {
                 J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
                 return false;
             }
@@ -612,13 +539,14 @@ bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
         value_ptr = &(member->value);
 #endif
 
-        if (IsProtobufMap(field) && value_ptr->IsObject()) {
+        if (e.map_value.field != NULL && value_ptr->IsObject()) {
             // Try to parse json like {"key":value, ...} into protobuf map
-            if (!JsonMapToProtoMap(*value_ptr, field, message, options, err, depth)) {
+            if (!JsonMapToProtoMap(*value_ptr, e, message, options, err, depth, tables)) {
                 return false;
             }
         } else {
-            if (!JsonValueToProtoField(*value_ptr, field, message, options, err, depth)) {
+            if (!JsonValueToProtoField(*value_ptr, field, message, options,
+                                       err, depth, tables)) {
                 return false;
             }
         }
@@ -626,11 +554,329 @@ bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
     return true;
 }
 
+// Convert json to protobuf along with parsing, namely without building the
+// DOM. Semantics are same as JsonValueToProtoMessage() except that fields
+// are filled in the order of the json and a key appearing more than once
+// is converted more than once.
+class JsonToProtoHandler {
+public:
+    JsonToProtoHandler(google::protobuf::Message* message,
+                       const Json2PbOptions& options,
+                       std::string* err)
+        : _root(message), _options(options), _err(err) {}
+
+    bool Null() { return OnValue(BUTIL_RAPIDJSON_NAMESPACE::Value()); }
+    bool Bool(bool b) { return OnValue(BUTIL_RAPIDJSON_NAMESPACE::Value(b)); }
+    bool AddInt(int i) { return OnValue(BUTIL_RAPIDJSON_NAMESPACE::Value(i)); }
+    bool AddUint(unsigned u) { return OnValue(BUTIL_RAPIDJSON_NAMESPACE::Value(u)); }
+    bool AddInt64(int64_t i) { return OnValue(BUTIL_RAPIDJSON_NAMESPACE::Value(i)); }
+    bool AddUint64(uint64_t u) { return OnValue(BUTIL_RAPIDJSON_NAMESPACE::Value(u)); }
+    bool Double(double d) { return OnValue(BUTIL_RAPIDJSON_NAMESPACE::Value(d)); }
+    bool String(const char* str, BUTIL_RAPIDJSON_NAMESPACE::SizeType length, bool) {
+        return OnValue(BUTIL_RAPIDJSON_NAMESPACE::Value(str, length));
+    }
+    bool StartObject() { return OnStart(BUTIL_RAPIDJSON_NAMESPACE::kObjectType); }
+    bool StartArray() { return OnStart(BUTIL_RAPIDJSON_NAMESPACE::kArrayType); }
+    bool Key(const char* str, BUTIL_RAPIDJSON_NAMESPACE::SizeType length, bool);
+    bool EndObject(BUTIL_RAPIDJSON_NAMESPACE::SizeType);
+    bool EndArray(BUTIL_RAPIDJSON_NAMESPACE::SizeType);
+
+private:
+    enum FrameType {
+        // Converting an object to a message.
+        FRAME_MESSAGE,
+        // Converting an array to a repeated field.
+        FRAME_ARRAY,
+        // Converting an object to a map field.
+        FRAME_MAP,
+        // Skipping a value of unknown field or mismatched type.
+        FRAME_SKIP,
+    };
+    struct Frame {
+        FrameType type;
+        int depth;
+        google::protobuf::Message* message;
+        // FRAME_MESSAGE: table of `message'.
+        const FieldTable* table;
+        // FRAME_MESSAGE: field of last key, NULL if the key is unknown.
+        // FRAME_MAP: the field.
+        const FieldEntry* entry;
+        // FRAME_ARRAY: the repeated field of `message'.
+        const google::protobuf::FieldDescriptor* field;
+        // FRAME_MAP: entry message of last key.
+        google::protobuf::Message* map_entry;
+        // The root message whose only repeated field is the input array.
+        bool array_holder;
+    };
+
+    bool PushMessage(google::protobuf::Message* message, int depth);
+    void Push(FrameType type, google::protobuf::Message* message, int depth);
+    bool OnValue(const BUTIL_RAPIDJSON_NAMESPACE::Value& value);
+    bool OnStart(BUTIL_RAPIDJSON_NAMESPACE::Type type);
+
+    google::protobuf::Message* _root;
+    const Json2PbOptions& _options;
+    std::string* _err;
+    std::vector<Frame> _stack;
+    FieldTableCache _tables;
+};
+
+bool JsonToProtoHandler::PushMessage(google::protobuf::Message* message,
+                                     int depth) {
+    if (depth > FLAGS_json2pb_max_recursion_depth) {
+        J2PERROR_WITH_PB(message, _err, "Exceeded maximum recursion depth");
+        return false;
+    }
+    const FieldTable* table = _tables.Get(*message);
+    Push(FRAME_MESSAGE, message, depth);
+    _stack.back().table = table;
+    return true;
+}
+
+void JsonToProtoHandler::Push(FrameType type, google::protobuf::Message* message,
+                              int depth) {
+    Frame f;
+    f.type = type;
+    f.depth = depth;
+    f.message = message;
+    f.table = NULL;
+    f.entry = NULL;
+    f.field = NULL;
+    f.map_entry = NULL;
+    f.array_holder = false;
+    _stack.push_back(f);
+}
+
+bool JsonToProtoHandler::OnValue(const BUTIL_RAPIDJSON_NAMESPACE::Value& value) {
+    if (_stack.empty()) {
+        J2PERROR_WITH_PB(_root, _err, "The input is not a json object");
+        return false;
+    }
+    const Frame& f = _stack.back();
+    switch (f.type) {
+    case FRAME_MESSAGE:
+        if (f.entry == NULL) {
+            return true;
+        }
+        return JsonValueToProtoField(value, f.entry->field, f.message,
+                                     _options, _err, f.depth, &_tables);
+    case FRAME_ARRAY:
+        return JsonValueToProtoFieldValue(value, f.field, f.message,
+                                          true, _options, _err, f.depth, &_tables);
+    case FRAME_MAP:
+        return JsonValueToProtoField(value, f.entry->map_value.field, f.map_entry,
+                                     _options, _err, f.depth, &_tables);
+    case FRAME_SKIP:
+        return true;
+    }
+    return true;
+}
+
+bool JsonToProtoHandler::OnStart(BUTIL_RAPIDJSON_NAMESPACE::Type type) {
+    const bool is_object = (type == BUTIL_RAPIDJSON_NAMESPACE::kObjectType);
+    if (_stack.empty()) {
+        if (!PushMessage(_root, 0)) {
+            return false;
+        }
+        if (is_object) {
+            return true;
+        }
+        Frame& root = _stack.back();
+        if (!_options.array_to_single_repeated) {
+            J2PERROR_WITH_PB(_root, _err, "The input is not a json object");
+            return false;
+        }
+        if (root.table->fields().size() != 1 ||
+            !root.table->fields()[0].repeated) {
+            J2PERROR_WITH_PB(_root, _err, "the input json can't be array here");
+            return false;
+        }
+        root.entry = &root.table->fields()[0];
+        root.array_holder = true;
+    }
+    // Copied since pushing may invalidate references to the stack.
+    const Frame f = _stack.back();
+    const google::protobuf::FieldDescriptor* field = NULL;
+    google::protobuf::Message* message = f.message;
+    int depth = f.depth;
+    bool repeated = false;
+    switch (f.type) {
+    case FRAME_MESSAGE:
+        if (f.entry == NULL) {
+            Push(FRAME_SKIP, NULL, depth);
+            return true;
+        }
+        field = f.entry->field;
+        if (is_object && f.entry->map_value.field != NULL) {
+            Push(FRAME_MAP, message, depth + 1);
+            _stack.back().entry = f.entry;
+            return true;
+        }
+        break;
+    case FRAME_ARRAY:
+        field = f.field;
+        repeated = true;
+        if (is_object &&
+            field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+            return PushMessage(
+                message->GetReflection()->AddMessage(message, field), depth + 1);
+        }
+        break;
+    case FRAME_MAP:
+        field = f.entry->map_value.field;
+        message = f.map_entry;
+        break;
+    case FRAME_SKIP:
+        Push(FRAME_SKIP, NULL, depth);
+        return true;
+    }
+    if (!repeated) {
+        if (!is_object && field->is_repeated()) {
+            Push(FRAME_ARRAY, message, depth);
+            _stack.back().field = field;
+            return true;
+        }
+        if (is_object && !field->is_repeated() &&
+            field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+            return PushMessage(
+                message->GetReflection()->MutableMessage(message, field), depth + 1);
+        }
+    }
+    // Mismatched type. Let the DOM version report the error, the value is
+    // skipped if the error is tolerable.
+    const BUTIL_RAPIDJSON_NAMESPACE::Value value(type);
+    const bool ok = repeated ?
+        JsonValueToProtoFieldValue(value, field, message, true,
+                                   _options, _err, depth, &_tables) :
+        JsonValueToProtoField(value, field, message, _options, _err, depth, &_tables);
+    if (!ok) {
+        return false;
+    }
+    Push(FRAME_SKIP, NULL, depth);
+    return true;
+}
+
+bool JsonToProtoHandler::Key(const char* str,
+                             BUTIL_RAPIDJSON_NAMESPACE::SizeType length, bool) {
+    Frame& f = _stack.back();
+    if (f.type == FRAME_MESSAGE) {
+        f.entry = f.table->Find(str, length);
+    } else if (f.type == FRAME_MAP) {
+        f.map_entry = f.message->GetReflection()->AddMessage(
+            f.message, f.entry->field);
+        f.map_entry->GetReflection()->SetString(
+            f.map_entry, f.entry->map_key, std::string(str, length));
+    }
+    return true;
+}
+
+bool JsonToProtoHandler::EndObject(BUTIL_RAPIDJSON_NAMESPACE::SizeType) {
+    const Frame& f = _stack.back();
+    if (f.type == FRAME_MESSAGE) {
+        const google::protobuf::Reflection* reflection = f.message->GetReflection();
+        const std::vector<const google::protobuf::FieldDescriptor*>& required =
+            f.table->required_fields();
+        for (size_t i = 0; i < required.size(); ++i) {
+            if (!reflection->HasField(*f.message, required[i])) {
+                J2PERROR(_err, "Missing required field: %s",
+                         required[i]->full_name().c_str());
+                return false;
+            }
+        }
+    }
+    _stack.pop_back();
+    return true;
+}
+
+bool JsonToProtoHandler::EndArray(BUTIL_RAPIDJSON_NAMESPACE::SizeType) {
+    _stack.pop_back();
+    if (!_stack.empty() && _stack.back().array_holder) {
+        _stack.pop_back();
+    }
+    return true;
+}
+
+static bool OnParseResult(const BUTIL_RAPIDJSON_NAMESPACE::ParseResult& res,
+                          google::protobuf::Message* message,
+                          const Json2PbOptions& options,
+                          std::string* error) {
+    if (res.IsError()) {
+        if (res.Code() == BUTIL_RAPIDJSON_NAMESPACE::kParseErrorTermination) {
+            // Stopped by the handler which has set the error.
+            return false;
+        }
+        if (options.allow_remaining_bytes_after_parsing) {
+            if (res.Code() == BUTIL_RAPIDJSON_NAMESPACE::kParseErrorDocumentEmpty) {
+                return false;
+            }
+        }
+        J2PERROR_WITH_PB(message, error, "Invalid json: %s", BUTIL_RAPIDJSON_NAMESPACE::GetParseError_En(res.Code()));
+        return false;
+    }
+    return true;
+}
+
+static bool StructuralIndexToProtoMessage(const char* json, size_t length,
+                                          google::protobuf::Message* message,
+                                          const Json2PbOptions& options,
+                                          std::string* error,
+                                          size_t* parsed_offset) {
+    if (error) {
+        error->clear();
+    }
+    JsonToProtoHandler handler(message, options, error);
+    StructuralParser parser(json, length);
+    const BUTIL_RAPIDJSON_NAMESPACE::ParseResult res =
+        parser.Parse(handler, options.allow_remaining_bytes_after_parsing);
+    if (options.allow_remaining_bytes_after_parsing && parsed_offset != nullptr) {
+        *parsed_offset = res.Offset();
+    }
+    return OnParseResult(res, message, options, error);
+}
+
+bool JsonToProtoMessage(const butil::IOBuf& json,
+                        google::protobuf::Message* message,
+                        const Json2PbOptions& options,
+                        std::string* error,
+                        size_t* parsed_offset) {
+    if (options.parser == PARSE_BY_STRUCTURAL_INDEX) {
+        if (json.backing_block_num() <= 1) {
+            const butil::StringPiece data = json.backing_block(0);
+            return StructuralIndexToProtoMessage(
+                data.data(), data.size(), message, options, error, parsed_offset);
+        }
+        const std::string data = json.to_string();
+        return StructuralIndexToProtoMessage(
+            data.data(), data.size(), message, options, error, parsed_offset);
+    }
+    if (error) {
+        error->clear();
+    }
+    butil::IOBufAsZeroCopyInputStream stream(json);
+    ZeroCopyStreamReader reader(&stream);
+    JsonToProtoHandler handler(message, options, error);
+    BUTIL_RAPIDJSON_NAMESPACE::Reader parser;
+    BUTIL_RAPIDJSON_NAMESPACE::ParseResult res;
+    if (options.allow_remaining_bytes_after_parsing) {
+        res = parser.Parse<RAPIDJSON_PARSE_FLAG_STOP_WHEN_DONE>(reader, handler);
+        if (parsed_offset != nullptr) {
+            *parsed_offset = res.Offset();
+        }
+    } else {
+        res = parser.Parse<RAPIDJSON_PARSE_FLAG_DEFAULT>(reader, handler);
+    }
+    return OnParseResult(res, message, options, error);
+}
+
 inline bool JsonToProtoMessageInline(const std::string& json_string, 
                         google::protobuf::Message* message,
                         const Json2PbOptions& options,
                         std::string* error,
                         size_t* parsed_offset) {
+    if (options.parser == PARSE_BY_STRUCTURAL_INDEX) {
+        return StructuralIndexToProtoMessage(json_string.data(), json_string.size(),
+                                             message, options, error, parsed_offset);
+    }
     if (error) {
         error->clear();
     }
@@ -654,7 +900,8 @@ inline bool JsonToProtoMessageInline(const std::string& json_string,
         J2PERROR_WITH_PB(message, error, "Invalid json: %s", BUTIL_RAPIDJSON_NAMESPACE::GetParseError_En(d.GetParseError()));
         return false;
     }
-    return JsonValueToProtoMessage(d, message, options, error, 0);
+    FieldTableCache tables;
+    return JsonValueToProtoMessage(d, message, options, error, 0, &tables);
 }
 
 bool JsonToProtoMessage(const std::string& json_string,
@@ -702,7 +949,8 @@ bool JsonToProtoMessage(ZeroCopyStreamReader* reader,
         J2PERROR_WITH_PB(message, error, "Invalid json: %s", BUTIL_RAPIDJSON_NAMESPACE::GetParseError_En(d.GetParseError()));
         return false;
     }
-    return JsonValueToProtoMessage(d, message, options, error, 0);
+    FieldTableCache tables;
+    return JsonValueToProtoMessage(d, message, options, error, 0, &tables);
 }
 
 bool JsonToProtoMessage(const std::string& json_string, 
@@ -25,8 +25,20 @@
 #include <google/protobuf/io/zero_copy_stream.h>    // ZeroCopyInputStream
 #include <google/protobuf/util/json_util.h>
 
+namespace butil {
+class IOBuf;
+}
+
 namespace json2pb {
 
+enum JsonParser {
+    // Parse with rapidjson.
+    PARSE_BY_RAPIDJSON = 0,
+    // Locate all structural characters of the json with SIMD instructions
+    // first, then walk them to fill the message. Faster on large inputs.
+    PARSE_BY_STRUCTURAL_INDEX = 1,
+};
+
 struct Json2PbOptions {
     Json2PbOptions();
 
@@ -42,6 +54,13 @@ struct Json2PbOptions {
     // Allow more bytes remaining in the input after parsing the first json
     // object. Useful when the input contains more than one json object.
     bool allow_remaining_bytes_after_parsing;
+
+    // The parser to use, only effective for overloads taking std::string
+    // or butil::IOBuf. With PARSE_BY_STRUCTURAL_INDEX, `message' is filled
+    // along with parsing like the butil::IOBuf overload(see below) and
+    // non-contiguous IOBuf is copied before parsing.
+    // Default: PARSE_BY_RAPIDJSON.
+    JsonParser parser;
 };
 
 // Convert `json' to protobuf `message' according to `options'.
@@ -76,6 +95,17 @@ bool JsonToProtoMessage(ZeroCopyStreamReader* json,
                         std::string* error = nullptr,
                         size_t* parsed_offset = nullptr);
 
+// Use IOBuf as input instead of std::string. Different from overloads above,
+// the json is converted along with parsing block by block rather than after
+// the whole document is built, thus `message' may be partially filled on
+// invalid json, fields are filled in the order they appear in `json' and
+// the first error met in `json' is reported.
+bool JsonToProtoMessage(const butil::IOBuf& json,
+                        google::protobuf::Message* message,
+                        const Json2PbOptions& options,
+                        std::string* error = nullptr,
+                        size_t* parsed_offset = nullptr);
+
 // Using default Json2PbOptions.
 bool JsonToProtoMessage(const std::string& json,
                         google::protobuf::Message* message,
@@ -30,6 +30,7 @@
 #include "json2pb/rapidjson.h"
 #include "json2pb/pb_to_json.h"
 #include "json2pb/protobuf_type_resolver.h"
+#include "json2pb/field_table.h"
 #include "butil/iobuf.h"
 #include "butil/base64.h"
 
@@ -111,11 +112,12 @@ public:
 private:
     template <typename Handler>
     bool _PbFieldToJson(const google::protobuf::Message& message,
-                        const google::protobuf::FieldDescriptor* field,
+                        const FieldInfo& info,
                         Handler& handler, int depth);
 
     std::string _error;
     Pb2JsonOptions _option;
+    FieldTableCache _tables;
 };
 
 template <typename Handler>
@@ -125,40 +127,14 @@ bool PbToJsonConverter::Convert(const google::protobuf::Message& message, Handle
         return false;
     }
     const google::protobuf::Reflection* reflection = message.GetReflection();
-    const google::protobuf::Descriptor* descriptor = message.GetDescriptor();
-
-    int ext_range_count = descriptor->extension_range_count();
-    int field_count = descriptor->field_count();
-    std::vector<const google::protobuf::FieldDescriptor*> fields;
-    fields.reserve(64);
-    for (int i = 0; i < ext_range_count; ++i) {
-        const google::protobuf::Descriptor::ExtensionRange*
-            ext_range = descriptor->extension_range(i);
-#if GOOGLE_PROTOBUF_VERSION < 4025000
-        for (int tag_number = ext_range->start; tag_number < ext_range->end; ++tag_number)
-#else
-        for (int tag_number = ext_range->start_number(); tag_number < ext_range->end_number(); ++tag_number)
-#endif
-        {
-            const google::protobuf::FieldDescriptor* field =
-                    reflection->FindKnownExtensionByNumber(tag_number);
-            if (field) {
-                fields.push_back(field);
-            }
-        }
-    }
-    std::vector<const google::protobuf::FieldDescriptor*> map_fields;
-    for (int i = 0; i < field_count; ++i) {
-        const google::protobuf::FieldDescriptor* field = descriptor->field(i);
-        if (_option.enable_protobuf_map && json2pb::IsProtobufMap(field)) {
-            map_fields.push_back(field);
-        } else {
-            fields.push_back(field);
-        }
-    }
+    const FieldTable* table = _tables.Get(message);
+    const std::vector<FieldEntry>& fields = table->fields();
+    // Map fields are written after others.
+    const bool has_map_field =
+        _option.enable_protobuf_map && table->has_map_field();
 
     if (depth == 0 && _option.single_repeated_to_array) {
-        if (map_fields.empty() && fields.size() == 1 && fields.front()->is_repeated()) {
+        if (!has_map_field && fields.size() == 1 && fields.front().repeated) {
             return _PbFieldToJson(message, fields.front(), handler, depth);
         }
     }
@@ -166,61 +142,57 @@ bool PbToJsonConverter::Convert(const google::protobuf::Message& message, Handle
     handler.StartObject();
 
     // Fill in non-map fields
-    std::string field_name_str;
     for (size_t i = 0; i < fields.size(); ++i) {
-        const google::protobuf::FieldDescriptor* field = fields[i];
-        if (!field->is_repeated() && !reflection->HasField(message, field)) {
+        const FieldEntry& e = fields[i];
+        if (has_map_field && e.map_value.field != NULL &&
+            !e.field->is_extension()) {
+            continue;
+        }
+        if (!e.repeated && !reflection->HasField(message, e.field)) {
             // Field that has not been set
-            if (field->is_required()) {
-                _error = "Missing required field: " + field->full_name();
+            if (e.required) {
+                _error = "Missing required field: " + e.field->full_name();
                 return false;
             }
             // Whether dumps default fields
             if (!_option.always_print_primitive_fields) {
                 continue;
             }
-        } else if (field->is_repeated()
-                   && reflection->FieldSize(message, field) == 0
+        } else if (e.repeated
+                   && reflection->FieldSize(message, e.field) == 0
                    && !_option.jsonify_empty_array) {
             // Repeated field that has no entry
             continue;
         }
 
-        const std::string& orig_name = field->name();
-        bool decoded = decode_name(orig_name, field_name_str); 
-        const std::string& name = decoded ? field_name_str : orig_name;
-        handler.Key(name.data(), name.size(), false);
-        if (!_PbFieldToJson(message, field, handler, depth)) {
+        handler.Key(e.json_name.data(), e.json_name.size(), false);
+        if (!_PbFieldToJson(message, e, handler, depth)) {
             return false;
         }
     }
 
     // Fill in map fields
-    for (size_t i = 0; i < map_fields.size(); ++i) {
-        const google::protobuf::FieldDescriptor* map_desc = map_fields[i];
-        const google::protobuf::FieldDescriptor* key_desc =
-                map_desc->message_type()->field(json2pb::KEY_INDEX);
-        const google::protobuf::FieldDescriptor* value_desc =
-                map_desc->message_type()->field(json2pb::VALUE_INDEX);
-
+    for (size_t i = 0; has_map_field && i < fields.size(); ++i) {
+        const FieldEntry& e = fields[i];
+        if (e.map_value.field == NULL || e.field->is_extension()) {
+            continue;
+        }
         // Write a json object corresponding to hold protobuf map
         // such as {"key": value, ...}
-        const std::string& orig_name = map_desc->name();
-        bool decoded = decode_name(orig_name, field_name_str);
-        const std::string& name = decoded ? field_name_str : orig_name;
-        handler.Key(name.data(), name.size(), false);
+        handler.Key(e.json_name.data(), e.json_name.size(), false);
         handler.StartObject();
         std::string entry_name;
-        for (int j = 0; j < reflection->FieldSize(message, map_desc); ++j) {
+        const int field_size = reflection->FieldSize(message, e.field);
+        for (int j = 0; j < field_size; ++j) {
             const google::protobuf::Message& entry =
-                    reflection->GetRepeatedMessage(message, map_desc, j);
+                    reflection->GetRepeatedMessage(message, e.field, j);
             const google::protobuf::Reflection* entry_reflection = entry.GetReflection();
-            entry_name = entry_reflection->GetStringReference(
-                entry, key_desc, &entry_name);
-            handler.Key(entry_name.data(), entry_name.size(), false);
+            const std::string& key = entry_reflection->GetStringReference(
+                entry, e.map_key, &entry_name);
+            handler.Key(key.data(), key.size(), false);
 
             // Fill in entries into this json object
-            if (!_PbFieldToJson(entry, value_desc, handler, depth)) {
+            if (!_PbFieldToJson(entry, e.map_value, handler, depth)) {
                 return false;
             }
         }
@@ -235,13 +207,14 @@ bool PbToJsonConverter::Convert(const google::protobuf::Message& message, Handle
 template <typename Handler>
 bool PbToJsonConverter::_PbFieldToJson(
     const google::protobuf::Message& message,
-    const google::protobuf::FieldDescriptor* field,
+    const FieldInfo& info,
     Handler& handler, int depth) {
     const google::protobuf::Reflection* reflection = message.GetReflection();
-    switch (field->cpp_type()) {
+    const google::protobuf::FieldDescriptor* field = info.field;
+    switch (info.cpp_type) {
 #define CASE_FIELD_TYPE(cpptype, method, valuetype, handle)             \
     case google::protobuf::FieldDescriptor::CPPTYPE_##cpptype: {                          \
-        if (field->is_repeated()) {                                     \
+        if (info.repeated) {                                            \
             int field_size = reflection->FieldSize(message, field);     \
             handler.StartArray();                                       \
             for (int index = 0; index < field_size; ++index) {          \
@@ -268,15 +241,15 @@ bool PbToJsonConverter::_PbFieldToJson(
 #undef CASE_FIELD_TYPE
 
     case google::protobuf::FieldDescriptor::CPPTYPE_STRING: {
-        std::string value;
-        if (field->is_repeated()) {
+        // Only used when the string is not stored as std::string.
+        std::string scratch;
+        if (info.repeated) {
             int field_size = reflection->FieldSize(message, field);
             handler.StartArray();
             for (int index = 0; index < field_size; ++index) {
-                value = reflection->GetRepeatedStringReference(
-                    message, field, index, &value);
-                if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES
-                    && _option.bytes_to_base64) {
+                const std::string& value = reflection->GetRepeatedStringReference(
+                    message, field, index, &scratch);
+                if (info.bytes && _option.bytes_to_base64) {
                     std::string value_decoded;
                     butil::Base64Encode(value, &value_decoded);
                     handler.String(value_decoded.data(), value_decoded.size(), false);
@@ -287,9 +260,9 @@ bool PbToJsonConverter::_PbFieldToJson(
             handler.EndArray(field_size);
             
         } else {
-            value = reflection->GetStringReference(message, field, &value);
-            if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES
-                && _option.bytes_to_base64) {
+            const std::string& value =
+                reflection->GetStringReference(message, field, &scratch);
+            if (info.bytes && _option.bytes_to_base64) {
                 std::string value_decoded;
                 butil::Base64Encode(value, &value_decoded);
                 handler.String(value_decoded.data(), value_decoded.size(), false);
@@ -301,7 +274,7 @@ bool PbToJsonConverter::_PbFieldToJson(
     }
 
     case google::protobuf::FieldDescriptor::CPPTYPE_ENUM: {
-        if (field->is_repeated()) {
+        if (info.repeated) {
             int field_size = reflection->FieldSize(message, field);
             handler.StartArray();
             if (_option.enum_option == OUTPUT_ENUM_BY_NAME) {
@@ -331,7 +304,7 @@ bool PbToJsonConverter::_PbFieldToJson(
     }
 
     case google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE: {
-        if (field->is_repeated()) {
+        if (info.repeated) {
             int field_size = reflection->FieldSize(message, field);
             handler.StartArray();
             for (int index = 0; index < field_size; ++index) {
@@ -353,6 +326,27 @@ bool PbToJsonConverter::_PbFieldToJson(
     return true;
 }
 
+// Output stream of rapidjson writing into IOBufAppender.
+class IOBufAppenderStream {
+public:
+    typedef char Ch;
+    explicit IOBufAppenderStream(butil::IOBufAppender* appender)
+        : _appender(appender) {}
+
+    void Put(char c) { _appender->push_back(c); }
+    void Puts(const char* str, size_t length) { _appender->append(str, length); }
+    void Flush() {}
+
+    char Peek() { return 0; }
+    char Take() { return 0; }
+    size_t Tell() { return 0; }
+    char* PutBegin() { return NULL; }
+    size_t PutEnd(char*) { return 0; }
+
+private:
+    butil::IOBufAppender* _appender;
+};
+
 template <typename OutputStream>
 bool ProtoMessageToJsonStream(const google::protobuf::Message& message,
                               const Pb2JsonOptions& options,
@@ -399,6 +393,19 @@ bool ProtoMessageToJson(const google::protobuf::Message& message,
     return json2pb::ProtoMessageToJsonStream(message, options, wrapper, error);
 }
 
+bool ProtoMessageToJson(const google::protobuf::Message& message,
+                        butil::IOBuf* json,
+                        const Pb2JsonOptions& options,
+                        std::string* error) {
+    butil::IOBufAppender appender;
+    IOBufAppenderStream os(&appender);
+    if (!json2pb::ProtoMessageToJsonStream(message, options, os, error)) {
+        return false;
+    }
+    json->append(butil::IOBuf::Movable(appender.buf()));
+    return true;
+}
+
 bool ProtoMessageToJson(const google::protobuf::Message& message,
                         google::protobuf::io::ZeroCopyOutputStream* stream,
                         std::string* error) {
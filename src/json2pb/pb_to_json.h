@@ -25,6 +25,10 @@
 #include <google/protobuf/io/zero_copy_stream.h> // ZeroCopyOutputStream
 #include <google/protobuf/util/json_util.h>
 
+namespace butil {
+class IOBuf;
+}
+
 namespace json2pb {
 
 enum EnumOption {
@@ -83,6 +87,12 @@ bool ProtoMessageToJson(const google::protobuf::Message& message,
                         google::protobuf::io::ZeroCopyOutputStream* json,
                         const Pb2JsonOptions& options,
                         std::string* error = NULL);
+// Append output to IOBuf, which is faster than wrapping the IOBuf with
+// IOBufAsZeroCopyOutputStream. Nothing is appended on failure.
+bool ProtoMessageToJson(const google::protobuf::Message& message,
+                        butil::IOBuf* json,
+                        const Pb2JsonOptions& options,
+                        std::string* error = NULL);
 
 // Using default Pb2JsonOptions.
 bool ProtoMessageToJson(const google::protobuf::Message& message,
@@ -0,0 +1,441 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <stdlib.h>
+#include <algorithm>
+#include "butil/third_party/rapidjson/reader.h"
+#include "json2pb/structural_parser.h"
+
+namespace json2pb {
+
+using namespace BUTIL_RAPIDJSON_NAMESPACE;
+
+// Bytes indexed in one batch, small enough to keep positions in cache.
+static const size_t BATCH_SIZE = 16384;
+
+struct BlockMasks {
+    uint64_t backslash;
+    uint64_t quote;
+    // {}[]:,
+    uint64_t op;
+    uint64_t space;
+};
+
+// Classify the 64 bytes starting at `p'.
+static inline void ClassifyBlock(const char* p, BlockMasks* m) {
+#ifdef __SSE2__
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i quote = _mm_set1_epi8('"');
+    // '[' and ']' are '{' and '}' with 0x20 cleared.
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i lbrace = _mm_set1_epi8('{');
+    const __m128i rbrace = _mm_set1_epi8('}');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    m->backslash = 0;
+    m->quote = 0;
+    m->op = 0;
+    m->space = 0;
+    for (int i = 0; i < 4; ++i) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(p + i * 16));
+        const __m128i v_lower = _mm_or_si128(v, lower);
+        const int shift = i * 16;
+        m->backslash |= (uint64_t)(uint32_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(v, backslash)) << shift;
+        m->quote |= (uint64_t)(uint32_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(v, quote)) << shift;
+        const __m128i op = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v_lower, lbrace),
+                         _mm_cmpeq_epi8(v_lower, rbrace)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+        m->op |= (uint64_t)(uint32_t)_mm_movemask_epi8(op) << shift;
+        const __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+        m->space |= (uint64_t)(uint32_t)_mm_movemask_epi8(ws) << shift;
+    }
+#else
+    m->backslash = 0;
+    m->quote = 0;
+    m->op = 0;
+    m->space = 0;
+    for (int i = 0; i < 64; ++i) {
+        const uint64_t bit = 1ULL << i;
+        switch (p[i]) {
+        case '\\':
+            m->backslash |= bit;
+            break;
+        case '"':
+            m->quote |= bit;
+            break;
+        case '{': case '}': case '[': case ']': case ':': case ',':
+            m->op |= bit;
+            break;
+        case ' ': case '\t': case '\n': case '\r':
+            m->space |= bit;
+            break;
+        }
+    }
+#endif
+}
+
+// Bit i of the result is the xor of bit 0..i of `x'.
+static inline uint64_t PrefixXor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+StructuralIndexer::StructuralIndexer(const char* json, size_t length)
+    : _json(json)
+    , _length(length)
+    , _indexed(0)
+    , _prev_escaped(0)
+    , _prev_in_string(0)
+    , _prev_scalar(0) {
+}
+
+void StructuralIndexer::IndexBlock(const char* block, size_t offset,
+                                   std::vector<size_t>* out) {
+    BlockMasks m;
+    ClassifyBlock(block, &m);
+
+    // Characters escaped by backslashes. A backslash escapes the next
+    // character iff it's preceded by an even number of backslashes, which
+    // is found by adding starts of backslash sequences to the sequences.
+    uint64_t escaped = 0;
+    if (m.backslash == 0) {
+        escaped = _prev_escaped;
+        _prev_escaped = 0;
+    } else {
+        const uint64_t even_bits = 0x5555555555555555ULL;
+        const uint64_t backslash = m.backslash & ~_prev_escaped;
+        const uint64_t follows_escape = (backslash << 1) | _prev_escaped;
+        const uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+        unsigned long long even_starts = 0;
+        _prev_escaped = __builtin_uaddll_overflow(
+            odd_starts, backslash, &even_starts);
+        const uint64_t invert_mask = (uint64_t)even_starts << 1;
+        escaped = (even_bits ^ invert_mask) & follows_escape;
+    }
+
+    const uint64_t quote = m.quote & ~escaped;
+    // Opening quotes and characters inside strings.
+    const uint64_t in_string = PrefixXor(quote) ^ _prev_in_string;
+    _prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+
+    // Only the first character of a literal or number is structural.
+    const uint64_t scalar = ~(m.op | m.space | quote);
+    const uint64_t follows_scalar = (scalar << 1) | _prev_scalar;
+    _prev_scalar = scalar >> 63;
+    const uint64_t scalar_start = scalar & ~follows_scalar;
+
+    uint64_t structurals = ((m.op | scalar_start) & ~in_string) | quote;
+    while (structurals) {
+        out->push_back(offset + __builtin_ctzll(structurals));
+        structurals &= structurals - 1;
+    }
+}
+
+bool StructuralIndexer::IndexNextBatch(std::vector<size_t>* out) {
+    const size_t batch_end = std::min(_indexed + BATCH_SIZE, _length);
+    for (; _indexed + 64 <= batch_end; _indexed += 64) {
+        IndexBlock(_json + _indexed, _indexed, out);
+    }
+    if (batch_end == _length && _indexed < _length) {
+        // Pad the last block with spaces which are never structural.
+        char block[64];
+        memset(block, ' ', sizeof(block));
+        memcpy(block, _json + _indexed, _length - _indexed);
+        IndexBlock(block, _indexed, out);
+        _indexed = _length;
+    }
+    return _indexed < _length;
+}
+
+StructuralParser::StructuralParser(const char* json, size_t length)
+    : _json(json)
+    , _length(length)
+    , _indexer(json, length)
+    , _next(0)
+    , _pending((size_t)-1)
+    , _indexer_done(false) {
+}
+
+// Returns the first backslash or control character in [p, end), or `end'.
+static inline const char* FindEscapeOrControl(const char* p, const char* end) {
+#ifdef __SSE2__
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i max_control = _mm_set1_epi8(0x1F);
+    for (; end - p >= 16; p += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)p);
+        const __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(v, max_control),
+                                               max_control);
+        const int mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, backslash), control));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; p != end; ++p) {
+        if (*p == '\\' || (unsigned char)*p < 0x20) {
+            break;
+        }
+    }
+    return p;
+}
+
+static inline bool ParseHex4(const char* p, const char* end, unsigned* code) {
+    if (end - p < 4) {
+        return false;
+    }
+    unsigned c = 0;
+    for (int i = 0; i < 4; ++i) {
+        const char h = p[i];
+        c <<= 4;
+        if (h >= '0' && h <= '9') {
+            c |= h - '0';
+        } else if (h >= 'A' && h <= 'F') {
+            c |= h - 'A' + 10;
+        } else if (h >= 'a' && h <= 'f') {
+            c |= h - 'a' + 10;
+        } else {
+            return false;
+        }
+    }
+    *code = c;
+    return true;
+}
+
+static inline void AppendUTF8(std::string* out, unsigned code) {
+    if (code <= 0x7F) {
+        out->push_back((char)code);
+    } else if (code <= 0x7FF) {
+        out->push_back((char)(0xC0 | (code >> 6)));
+        out->push_back((char)(0x80 | (code & 0x3F)));
+    } else if (code <= 0xFFFF) {
+        out->push_back((char)(0xE0 | (code >> 12)));
+        out->push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+        out->push_back((char)(0x80 | (code & 0x3F)));
+    } else {
+        out->push_back((char)(0xF0 | (code >> 18)));
+        out->push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+        out->push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+        out->push_back((char)(0x80 | (code & 0x3F)));
+    }
+}
+
+ParseErrorCode StructuralParser::ParseString(
+    size_t pos, const char** str, size_t* len, size_t* end, size_t* err_pos) {
+    // Nothing inside a string is indexed, the next one must be the closing
+    // quote.
+    size_t close = 0;
+    if (!NextToken(&close)) {
+        *err_pos = _length;
+        return kParseErrorStringMissQuotationMark;
+    }
+    *end = close + 1;
+    const char* begin = _json + pos + 1;
+    const char* const stop = _json + close;
+    const char* p = FindEscapeOrControl(begin, stop);
+    if (p == stop) {
+        *str = begin;
+        *len = stop - begin;
+        return kParseErrorNone;
+    }
+    _unescaped.assign(begin, p);
+    while (p != stop) {
+        if ((unsigned char)*p < 0x20) {
+            *err_pos = p - _json;
+            return kParseErrorStringEscapeInvalid;
+        }
+        // A backslash never escapes the closing quote, `p + 1' is valid.
+        ++p;
+        switch (*p) {
+        case '"':  _unescaped.push_back('"'); break;
+        case '\\': _unescaped.push_back('\\'); break;
+        case '/':  _unescaped.push_back('/'); break;
+        case 'b':  _unescaped.push_back('\b'); break;
+        case 'f':  _unescaped.push_back('\f'); break;
+        case 'n':  _unescaped.push_back('\n'); break;
+        case 'r':  _unescaped.push_back('\r'); break;
+        case 't':  _unescaped.push_back('\t'); break;
+        case 'u': {
+            unsigned code = 0;
+            if (!ParseHex4(p + 1, stop, &code)) {
+                *err_pos = p + 1 - _json;
+                return kParseErrorStringUnicodeEscapeInvalidHex;
+            }
+            p += 4;
+            if (code >= 0xD800 && code <= 0xDBFF) {
+                unsigned code2 = 0;
+                if (stop - p < 3 || p[1] != '\\' || p[2] != 'u' ||
+                    !ParseHex4(p + 3, stop, &code2) ||
+                    code2 < 0xDC00 || code2 > 0xDFFF) {
+                    *err_pos = p + 1 - _json;
+                    return kParseErrorStringUnicodeSurrogateInvalid;
+                }
+                p += 6;
+                code = (((code - 0xD800) << 10) | (code2 - 0xDC00)) + 0x10000;
+            }
+            AppendUTF8(&_unescaped, code);
+            break;
+        }
+        default:
+            *err_pos = p - _json;
+            return kParseErrorStringEscapeInvalid;
+        }
+        ++p;
+        const char* next = FindEscapeOrControl(p, stop);
+        _unescaped.append(p, next);
+        p = next;
+    }
+    *str = _unescaped.data();
+    *len = _unescaped.size();
+    return kParseErrorNone;
+}
+
+// Receives the double converted by rapidjson.
+struct DoubleHandler : public BaseReaderHandler<UTF8<>, DoubleHandler> {
+    DoubleHandler() : d(0) {}
+    bool Default() { return false; }
+    bool Double(double v) { d = v; return true; }
+    double d;
+};
+
+static inline bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+ParseErrorCode StructuralParser::ParseNumber(
+    size_t pos, Number* num, size_t* end, size_t* err_pos) {
+    const char* const begin = _json + pos;
+    const char* const stop = _json + _length;
+    const char* p = begin;
+    const bool minus = (*p == '-');
+    if (minus) {
+        ++p;
+    }
+    if (p == stop || !IsDigit(*p)) {
+        *err_pos = p - _json;
+        return kParseErrorValueInvalid;
+    }
+    uint64_t i = 0;
+    bool overflow = false;
+    if (*p == '0') {
+        ++p;
+    } else {
+        for (; p != stop && IsDigit(*p); ++p) {
+            const unsigned d = *p - '0';
+            // 2^64 - 1 = 18446744073709551615
+            if (i >= 1844674407370955161ULL &&
+                (i != 1844674407370955161ULL || d > 5)) {
+                overflow = true;
+            }
+            i = i * 10 + d;
+        }
+    }
+    bool is_double = overflow;
+    if (p != stop && *p == '.') {
+        ++p;
+        if (p == stop || !IsDigit(*p)) {
+            *err_pos = p - _json;
+            return kParseErrorNumberMissFraction;
+        }
+        while (p != stop && IsDigit(*p)) {
+            ++p;
+        }
+        is_double = true;
+    }
+    if (p != stop && (*p == 'e' || *p == 'E')) {
+        ++p;
+        if (p != stop && (*p == '+' || *p == '-')) {
+            ++p;
+        }
+        if (p == stop || !IsDigit(*p)) {
+            *err_pos = p - _json;
+            return kParseErrorNumberMissExponent;
+        }
+        while (p != stop && IsDigit(*p)) {
+            ++p;
+        }
+        is_double = true;
+    }
+    *end = p - _json;
+
+    if (!is_double) {
+        if (!minus) {
+            if (i <= 0xFFFFFFFFULL) {
+                num->type = Number::UINT;
+                num->u = (unsigned)i;
+            } else {
+                num->type = Number::UINT64;
+                num->u64 = i;
+            }
+            return kParseErrorNone;
+        }
+        // Same as rapidjson, the negative number is converted from the
+        // complement of its absolute value.
+        if (i <= 2147483648ULL) {
+            num->type = Number::INT;
+            num->i = static_cast<int32_t>(~(uint32_t)i + 1);
+            return kParseErrorNone;
+        }
+        if (i <= 9223372036854775808ULL) {
+            num->type = Number::INT64;
+            num->i64 = static_cast<int64_t>(~i + 1);
+            return kParseErrorNone;
+        }
+    }
+    // Convert with rapidjson as the SAX path does, strtod() depends on
+    // the locale and may not accept '.' as the decimal point.
+    const size_t n = p - begin;
+    char buf[64];
+    std::string long_buf;
+    const char* s = buf;
+    if (n < sizeof(buf)) {
+        memcpy(buf, begin, n);
+        buf[n] = '\0';
+    } else {
+        long_buf.assign(begin, n);
+        s = long_buf.c_str();
+    }
+    DoubleHandler handler;
+    StringStream stream(s);
+    Reader reader;
+    if (reader.Parse<kParseDefaultFlags>(stream, handler).IsError()) {
+        *err_pos = pos;
+        return kParseErrorNumberTooBig;
+    }
+    num->type = Number::DOUBLE;
+    num->d = handler.d;
+    return kParseErrorNone;
+}
+
+} // namespace json2pb
@@ -0,0 +1,341 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_JSON2PB_STRUCTURAL_PARSER_H
+#define BRPC_JSON2PB_STRUCTURAL_PARSER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "butil/third_party/rapidjson/error/error.h"
+#include "butil/third_party/rapidjson/rapidjson.h"
+
+namespace json2pb {
+
+// Stage 1 of StructuralParser: find positions of structural characters
+// (namely {}[]:, outside strings), quotes which are not escaped and first
+// characters of literals and numbers, 64 bytes at a time with SIMD
+// instructions when possible. Input is indexed batch by batch on demand, so
+// that parsing the first json in a long input does not index all of it.
+class StructuralIndexer {
+public:
+    StructuralIndexer(const char* json, size_t length);
+
+    // Index next batch of the input and append the positions to `out'.
+    // Returns false if the whole input has been indexed.
+    bool IndexNextBatch(std::vector<size_t>* out);
+
+private:
+    void IndexBlock(const char* block, size_t offset, std::vector<size_t>* out);
+
+    const char* _json;
+    size_t _length;
+    size_t _indexed;
+    // States carried from previous block.
+    uint64_t _prev_escaped;
+    uint64_t _prev_in_string;
+    uint64_t _prev_scalar;
+};
+
+// Parse json in a contiguous buffer and generate events to a rapidjson SAX
+// handler like BUTIL_RAPIDJSON_NAMESPACE::Reader does. Instead of checking
+// characters one by one, stage 2 walks the positions found by
+// StructuralIndexer and only looks into strings and numbers.
+// Values are reported as rapidjson does by default(kParseDefaultFlags),
+// doubles are converted with rapidjson's Reader as well so that both
+// paths give identical values regardless of the locale. Unlike rapidjson,
+// the input is not terminated by '\0'.
+class StructuralParser {
+public:
+    typedef BUTIL_RAPIDJSON_NAMESPACE::ParseResult ParseResult;
+    typedef BUTIL_RAPIDJSON_NAMESPACE::ParseErrorCode ParseErrorCode;
+
+    StructuralParser(const char* json, size_t length);
+
+    // Parse the input with `handler'. If `stop_when_done' is true, remaining
+    // bytes after the first json are ignored and Offset() of the result is
+    // set to the position right after the json on success.
+    template <typename Handler>
+    ParseResult Parse(Handler& handler, bool stop_when_done);
+
+private:
+    struct Number {
+        enum Type { INT, UINT, INT64, UINT64, DOUBLE };
+        Type type;
+        union {
+            int i;
+            unsigned u;
+            int64_t i64;
+            uint64_t u64;
+            double d;
+        };
+    };
+    struct Container {
+        bool is_object;
+        BUTIL_RAPIDJSON_NAMESPACE::SizeType count;
+    };
+
+    // Get position of next structural character, false on end of input.
+    bool NextToken(size_t* pos);
+    // Next token starts at `pos' which is not indexed by stage 1 since
+    // it follows a literal or number directly.
+    void PushBackToken(size_t pos) { _pending = pos; }
+
+    // Parse the string whose opening quote is at `pos'. `*end' is set to the
+    // position after the closing quote.
+    ParseErrorCode ParseString(size_t pos, const char** str, size_t* len,
+                               size_t* end, size_t* err_pos);
+    ParseErrorCode ParseNumber(size_t pos, Number* num, size_t* end,
+                               size_t* err_pos);
+    // Parse true, false, null or number starting at `pos'.
+    template <typename Handler>
+    ParseErrorCode ParseScalar(Handler& handler, size_t pos, size_t* end,
+                               size_t* err_pos);
+
+    const char* _json;
+    size_t _length;
+    StructuralIndexer _indexer;
+    std::vector<size_t> _positions;
+    size_t _next;
+    size_t _pending;
+    bool _indexer_done;
+    // Unescaped content of the last string with escapes.
+    std::string _unescaped;
+    std::vector<Container> _containers;
+};
+
+inline bool StructuralParser::NextToken(size_t* pos) {
+    if (_pending != (size_t)-1) {
+        *pos = _pending;
+        _pending = (size_t)-1;
+        return true;
+    }
+    while (_next == _positions.size()) {
+        if (_indexer_done) {
+            return false;
+        }
+        _positions.clear();
+        _next = 0;
+        _indexer_done = !_indexer.IndexNextBatch(&_positions);
+    }
+    *pos = _positions[_next++];
+    return true;
+}
+
+template <typename Handler>
+StructuralParser::ParseErrorCode StructuralParser::ParseScalar(
+    Handler& handler, size_t pos, size_t* end, size_t* err_pos) {
+    const char* p = _json + pos;
+    const size_t left = _length - pos;
+    bool ok = true;
+    switch (*p) {
+    case 't':
+        if (left < 4 || memcmp(p, "true", 4) != 0) {
+            *err_pos = pos;
+            return BUTIL_RAPIDJSON_NAMESPACE::kParseErrorValueInvalid;
+        }
+        *end = pos + 4;
+        ok = handler.Bool(true);
+        break;
+    case 'f':
+        if (left < 5 || memcmp(p, "false", 5) != 0) {
+            *err_pos = pos;
+            return BUTIL_RAPIDJSON_NAMESPACE::kParseErrorValueInvalid;
+        }
+        *end = pos + 5;
+        ok = handler.Bool(false);
+        break;
+    case 'n':
+        if (left < 4 || memcmp(p, "null", 4) != 0) {
+            *err_pos = pos;
+            return BUTIL_RAPIDJSON_NAMESPACE::kParseErrorValueInvalid;
+        }
+        *end = pos + 4;
+        ok = handler.Null();
+        break;
+    default: {
+        Number num;
+        const ParseErrorCode rc = ParseNumber(pos, &num, end, err_pos);
+        if (rc != BUTIL_RAPIDJSON_NAMESPACE::kParseErrorNone) {
+            return rc;
+        }
+        switch (num.type) {
+        case Number::INT:    ok = handler.AddInt(num.i); break;
+        case Number::UINT:   ok = handler.AddUint(num.u); break;
+        case Number::INT64:  ok = handler.AddInt64(num.i64); break;
+        case Number::UINT64: ok = handler.AddUint64(num.u64); break;
+        case Number::DOUBLE: ok = handler.Double(num.d); break;
+        }
+        break;
+    }
+    }
+    if (!ok) {
+        *err_pos = *end;
+        return BUTIL_RAPIDJSON_NAMESPACE::kParseErrorTermination;
+    }
+    return BUTIL_RAPIDJSON_NAMESPACE::kParseErrorNone;
+}
+
+template <typename Handler>
+StructuralParser::ParseResult StructuralParser::Parse(
+    Handler& handler, bool stop_when_done) {
+    using namespace BUTIL_RAPIDJSON_NAMESPACE;
+    size_t pos = 0;
+    // Position after the last value.
+    size_t end = 0;
+    size_t err_pos = 0;
+    ParseErrorCode rc = kParseErrorNone;
+    if (!NextToken(&pos)) {
+        return ParseResult(kParseErrorDocumentEmpty, _length);
+    }
+    while (true) {
+        // Parse the value at `pos'.
+        switch (_json[pos]) {
+        case '{':
+            if (!handler.StartObject()) {
+                return ParseResult(kParseErrorTermination, pos + 1);
+            }
+            if (!NextToken(&pos)) {
+                return ParseResult(kParseErrorObjectMissName, _length);
+            }
+            if (_json[pos] == '}') {
+                if (!handler.EndObject(0)) {
+                    return ParseResult(kParseErrorTermination, pos + 1);
+                }
+                end = pos + 1;
+                break;
+            }
+            _containers.push_back(Container{true, 0});
+            goto object_member;
+        case '[':
+            if (!handler.StartArray()) {
+                return ParseResult(kParseErrorTermination, pos + 1);
+            }
+            if (!NextToken(&pos)) {
+                return ParseResult(kParseErrorValueInvalid, _length);
+            }
+            if (_json[pos] == ']') {
+                if (!handler.EndArray(0)) {
+                    return ParseResult(kParseErrorTermination, pos + 1);
+                }
+                end = pos + 1;
+                break;
+            }
+            _containers.push_back(Container{false, 0});
+            continue;
+        case '"': {
+            const char* str = NULL;
+            size_t len = 0;
+            rc = ParseString(pos, &str, &len, &end, &err_pos);
+            if (rc != kParseErrorNone) {
+                return ParseResult(rc, err_pos);
+            }
+            if (!handler.String(str, (SizeType)len, true)) {
+                return ParseResult(kParseErrorTermination, end);
+            }
+            break;
+        }
+        case '}': case ']': case ':': case ',':
+            return ParseResult(kParseErrorValueInvalid, pos);
+        default:
+            rc = ParseScalar(handler, pos, &end, &err_pos);
+            if (rc != kParseErrorNone) {
+                return ParseResult(rc, err_pos);
+            }
+            if (end < _length && _json[end] != '"') {
+                // Things like `12a' or `truex' of which the tail is not
+                // indexed.
+                const char c = _json[end];
+                if (c != ' ' && c != '\t' && c != '\n' && c != '\r' &&
+                    c != '{' && c != '}' && c != '[' && c != ']' &&
+                    c != ':' && c != ',') {
+                    PushBackToken(end);
+                }
+            }
+            break;
+        }
+
+        // A value ends, close containers ending here.
+        while (true) {
+            if (_containers.empty()) {
+                if (stop_when_done) {
+                    return ParseResult(kParseErrorNone, end);
+                }
+                if (NextToken(&pos)) {
+                    return ParseResult(kParseErrorDocumentRootNotSingular, pos);
+                }
+                return ParseResult();
+            }
+            Container& c = _containers.back();
+            ++c.count;
+            if (!NextToken(&pos)) {
+                return ParseResult(c.is_object ? kParseErrorObjectMissCommaOrCurlyBracket
+                                   : kParseErrorArrayMissCommaOrSquareBracket,
+                                   _length);
+            }
+            if (_json[pos] == ',') {
+                if (!NextToken(&pos)) {
+                    return ParseResult(c.is_object ? kParseErrorObjectMissName
+                                       : kParseErrorValueInvalid, _length);
+                }
+                if (c.is_object) {
+                    goto object_member;
+                }
+                break;
+            }
+            if (c.is_object ? _json[pos] != '}' : _json[pos] != ']') {
+                return ParseResult(c.is_object ? kParseErrorObjectMissCommaOrCurlyBracket
+                                   : kParseErrorArrayMissCommaOrSquareBracket,
+                                   pos);
+            }
+            if (!(c.is_object ? handler.EndObject(c.count) : handler.EndArray(c.count))) {
+                return ParseResult(kParseErrorTermination, pos + 1);
+            }
+            end = pos + 1;
+            _containers.pop_back();
+        }
+        continue;
+
+object_member:
+        // `pos' is at the name of a member.
+        {
+            if (_json[pos] != '"') {
+                return ParseResult(kParseErrorObjectMissName, pos);
+            }
+            const char* str = NULL;
+            size_t len = 0;
+            rc = ParseString(pos, &str, &len, &end, &err_pos);
+            if (rc != kParseErrorNone) {
+                return ParseResult(rc, err_pos);
+            }
+            if (!handler.Key(str, (SizeType)len, true)) {
+                return ParseResult(kParseErrorTermination, end);
+            }
+            if (!NextToken(&pos) || _json[pos] != ':') {
+                return ParseResult(kParseErrorObjectMissColon, end);
+            }
+            if (!NextToken(&pos)) {
+                return ParseResult(kParseErrorValueInvalid, _length);
+            }
+        }
+    }
+}
+
+} // namespace json2pb
+
+#endif // BRPC_JSON2PB_STRUCTURAL_PARSER_H
@@ -0,0 +1,143 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/fast_rand.h"
+#include "brpc/compress.h"
+#include "brpc/controller.h"
+#include "brpc/global.h"
+#include "brpc/policy/adaptive_compression.h"
+#include "echo.pb.h"
+
+namespace brpc {
+namespace policy {
+DECLARE_bool(enable_adaptive_compression);
+DECLARE_int32(adaptive_compression_sample_interval);
+extern bool DeserializeRpcMessage(const butil::IOBuf& deserializer,
+                                  Controller& cntl, ContentType content_type,
+                                  CompressType compress_type,
+                                  ChecksumType checksum_type,
+                                  google::protobuf::Message* message);
+}
+}
+
+namespace {
+
+class AdaptiveCompressionTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        brpc::GlobalInitializeOrDie();
+        brpc::policy::FLAGS_adaptive_compression_sample_interval = 1;
+    }
+    void TearDown() override {
+        brpc::policy::FLAGS_adaptive_compression_sample_interval = 32;
+    }
+};
+
+// Compress `req' as baidu_std does and returns the chosen type.
+brpc::CompressType Send(const google::protobuf::MethodDescriptor* method,
+                        const google::protobuf::Message& req) {
+    brpc::policy::CompressionSample sample;
+    const brpc::CompressType type =
+        brpc::policy::ChooseCompressType(method, req.ByteSizeLong(), &sample);
+    butil::IOBuf buf;
+    EXPECT_TRUE(brpc::SerializeAsCompressedData(req, &buf, type));
+    brpc::policy::OnCompressed(sample, buf.size());
+    return type;
+}
+
+TEST_F(AdaptiveCompressionTest, choose_by_payload) {
+    const google::protobuf::ServiceDescriptor* service =
+        test::EchoService::descriptor();
+    const google::protobuf::MethodDescriptor* text_method =
+        service->FindMethodByName("Echo");
+    const google::protobuf::MethodDescriptor* media_method =
+        service->FindMethodByName("BytesEcho1");
+    ASSERT_TRUE(text_method && media_method);
+
+    test::EchoRequest text;
+    std::string* s = text.mutable_message();
+    while (s->size() < 32768) {
+        s->append("compressible text compressible text ");
+    }
+    test::BytesRequest media;
+    s = media.mutable_databytes();
+    s->resize(32768);
+    for (size_t i = 0; i < s->size(); i += 8) {
+        const uint64_t r = butil::fast_rand();
+        memcpy(&(*s)[i], &r, 8);
+    }
+
+    // Small messages are never compressed.
+    test::EchoRequest small;
+    small.set_message("hello");
+    ASSERT_EQ(brpc::COMPRESS_TYPE_NONE, Send(text_method, small));
+
+    for (int i = 0; i < 200; ++i) {
+        Send(text_method, text);
+        Send(media_method, media);
+    }
+    // Calls which are not sampled use the chosen types.
+    brpc::policy::FLAGS_adaptive_compression_sample_interval = 1000000;
+    ASSERT_NE(brpc::COMPRESS_TYPE_NONE, Send(text_method, text));
+    ASSERT_EQ(brpc::COMPRESS_TYPE_NONE, Send(media_method, media));
+    // Bands are independent.
+    text.mutable_message()->resize(70000, 'x');
+    ASSERT_EQ(brpc::COMPRESS_TYPE_NONE, Send(text_method, text));
+}
+
+TEST_F(AdaptiveCompressionTest, no_method) {
+    test::EchoRequest req;
+    req.mutable_message()->assign(4096, 'a');
+    brpc::policy::CompressionSample sample;
+    ASSERT_EQ(brpc::COMPRESS_TYPE_NONE,
+              brpc::policy::ChooseCompressType(NULL, req.ByteSizeLong(), &sample));
+    ASSERT_TRUE(sample.stats == NULL);
+}
+
+TEST_F(AdaptiveCompressionTest, measured_decompression) {
+    test::EchoRequest req;
+    std::string* s = req.mutable_message();
+    while (s->size() < 8192) {
+        s->append("compressible text compressible text ");
+    }
+    const brpc::CompressType types[] = {
+        brpc::COMPRESS_TYPE_SNAPPY, brpc::COMPRESS_TYPE_GZIP,
+        brpc::COMPRESS_TYPE_ZLIB
+    };
+    brpc::policy::FLAGS_enable_adaptive_compression = true;
+    // Measured and not measured decompressions parse the same message.
+    for (int interval = 1; interval <= 2; ++interval) {
+        brpc::policy::FLAGS_adaptive_compression_sample_interval = interval;
+        for (size_t i = 0; i < ARRAY_SIZE(types); ++i) {
+            butil::IOBuf buf;
+            ASSERT_TRUE(brpc::SerializeAsCompressedData(req, &buf, types[i]));
+            for (int j = 0; j < 2; ++j) {
+                brpc::Controller cntl;
+                test::EchoRequest parsed;
+                ASSERT_TRUE(brpc::policy::DeserializeRpcMessage(
+                    buf, cntl, brpc::CONTENT_TYPE_PB, types[i],
+                    brpc::CHECKSUM_TYPE_NONE, &parsed));
+                ASSERT_EQ(req.message(), parsed.message());
+            }
+        }
+    }
+    brpc::policy::FLAGS_enable_adaptive_compression = false;
+}
+
+} // namespace
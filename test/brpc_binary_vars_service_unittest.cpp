@@ -0,0 +1,131 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+
+#include "butil/iobuf.h"
+#include "bvar/bvar.h"
+#include "brpc/builtin/binary_vars_service.h"
+
+namespace {
+
+class BinaryVarsTest : public testing::Test {
+protected:
+    void SetUp() {}
+    void TearDown() {}
+};
+
+TEST_F(BinaryVarsTest, encode_and_decode) {
+    brpc::BinaryVarsEncoder encoder;
+    brpc::BinaryVarsDecoder decoder;
+    butil::IOBuf buf;
+
+    encoder.Begin(true, &buf, NULL);
+    encoder.dump("a_count", "100");
+    encoder.dump("a_negative", "-7");
+    encoder.dump("a_ratio", "0.25");
+    encoder.dump("a_string", "\"hello\"");
+    ASSERT_EQ(0, encoder.End());
+    ASSERT_EQ(0, decoder.Decode(buf));
+    ASSERT_EQ(1UL, decoder.seq());
+    std::map<std::string, std::string> expected = {
+        {"a_count", "100"}, {"a_negative", "-7"},
+        {"a_ratio", "0.25"}, {"a_string", "\"hello\""}};
+    ASSERT_EQ(expected, decoder.values());
+    const size_t full_size = buf.size();
+
+    // Only changed values are sent, names are not sent again.
+    buf.clear();
+    encoder.Begin(false, &buf, NULL);
+    encoder.dump("a_count", "103");
+    encoder.dump("a_negative", "-7");
+    encoder.dump("a_ratio", "0.25");
+    encoder.dump("a_string", "\"hello\"");
+    ASSERT_EQ(0, encoder.End());
+    ASSERT_LT(buf.size(), full_size / 3);
+    ASSERT_EQ(0, decoder.Decode(buf));
+    expected["a_count"] = "103";
+    ASSERT_EQ(expected, decoder.values());
+
+    // Hidden and new variables, type changes.
+    buf.clear();
+    encoder.Begin(false, &buf, NULL);
+    encoder.dump("a_count", "abc");
+    encoder.dump("a_negative", "9");
+    encoder.dump("b_new", "1.5");
+    ASSERT_EQ(0, encoder.End());
+    butil::IOBuf delta = buf;
+    ASSERT_EQ(0, decoder.Decode(buf));
+    expected = {{"a_count", "abc"}, {"a_negative", "9"}, {"b_new", "1.5"}};
+    ASSERT_EQ(expected, decoder.values());
+
+    // A delta can't be applied twice.
+    ASSERT_EQ(-1, decoder.Decode(delta));
+    ASSERT_EQ(expected, decoder.values());
+
+    // Start over.
+    buf.clear();
+    encoder.Begin(true, &buf, NULL);
+    encoder.dump("a_count", "1");
+    ASSERT_EQ(0, encoder.End());
+    brpc::BinaryVarsDecoder decoder2;
+    ASSERT_EQ(0, decoder2.Decode(buf));
+    ASSERT_EQ(0, decoder.Decode(buf));
+    expected = {{"a_count", "1"}};
+    ASSERT_EQ(expected, decoder.values());
+    ASSERT_EQ(expected, decoder2.values());
+
+    butil::IOBuf bad;
+    bad.append("BVB2");
+    ASSERT_EQ(-1, decoder.Decode(bad));
+}
+
+TEST_F(BinaryVarsTest, dump_exposed) {
+    bvar::Adder<int> adder("binary_vars_test_adder");
+    adder << 10;
+    brpc::BinaryVarsEncoder encoder;
+    brpc::BinaryVarsDecoder decoder;
+    for (int i = 1; i <= 3; ++i) {
+        butil::IOBuf buf;
+        encoder.Begin(i == 1, &buf, NULL);
+        ASSERT_LE(0, bvar::Variable::dump_exposed(&encoder, NULL));
+        ASSERT_EQ(0, encoder.End());
+        ASSERT_EQ(0, decoder.Decode(buf));
+        auto it = decoder.values().find("binary_vars_test_adder");
+        ASSERT_TRUE(it != decoder.values().end());
+        ASSERT_EQ(std::to_string(10 * i), it->second);
+        adder << 10;
+    }
+}
+
+TEST_F(BinaryVarsTest, large_snapshot_in_chunks) {
+    brpc::BinaryVarsEncoder encoder;
+    brpc::BinaryVarsDecoder decoder;
+    butil::IOBuf buf;
+    encoder.Begin(true, &buf, NULL);
+    for (int i = 0; i < 20000; ++i) {
+        encoder.dump("var_with_a_long_name_" + std::to_string(i),
+                     std::to_string(i));
+    }
+    ASSERT_EQ(0, encoder.End());
+    ASSERT_GT(buf.size(), brpc::BinaryVarsEncoder::CHUNK_SIZE);
+    ASSERT_EQ(0, decoder.Decode(buf));
+    ASSERT_EQ(20000UL, decoder.values().size());
+    ASSERT_EQ("12345", decoder.values().at("var_with_a_long_name_12345"));
+}
+
+} // namespace
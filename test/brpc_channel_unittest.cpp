@@ -2803,6 +2803,87 @@ TEST_F(ChannelTest, backup_request_policy) {
     }
 }
 
+TEST_F(ChannelTest, adaptive_backup_request_policy) {
+    brpc::AdaptiveBackupRequestPolicyOptions options;
+    options.update_interval_ms = 0;
+    brpc::AdaptiveBackupRequestPolicy policy(options);
+    brpc::Controller cntl;
+    // No backup request before enough samples.
+    ASSERT_EQ(-1, policy.GetBackupRequestMs(&cntl));
+    ASSERT_FALSE(policy.DoBackup(&cntl));
+
+    for (int i = 1; i <= 400; ++i) {
+        brpc::Controller c;
+        c._begin_time_us = 0;
+        // 10% of RPCs take 100ms.
+        c._end_time_us = (i % 10 == 0 ? 100000 : 10000);
+        policy.OnRPCEnd(&c);
+    }
+    // Budget is capped by max_backup_burst.
+    for (int i = 0; i < options.max_backup_burst; ++i) {
+        ASSERT_TRUE(policy.DoBackup(&cntl));
+    }
+    ASSERT_FALSE(policy.DoBackup(&cntl));
+    for (int i = 0; i < 20; ++i) {
+        brpc::Controller c;
+        c._begin_time_us = 0;
+        c._end_time_us = 1000;
+        policy.OnRPCEnd(&c);
+    }
+    ASSERT_TRUE(policy.DoBackup(&cntl));
+    ASSERT_FALSE(policy.DoBackup(&cntl));
+
+    // Wait for the percentile window to be sampled.
+    int32_t backup_ms = -1;
+    for (int i = 0; i < 30 && backup_ms < 0; ++i) {
+        bthread_usleep(100000);
+        backup_ms = policy.GetBackupRequestMs(&cntl);
+    }
+    ASSERT_EQ(100, backup_ms);
+}
+
+TEST_F(ChannelTest, max_concurrency) {
+    ASSERT_EQ(0, StartAccept(_ep));
+    brpc::ChannelOptions opt;
+    opt.max_retry = 3;
+    opt.max_concurrency = "no_such_limiter";
+    {
+        brpc::Channel channel;
+        ASSERT_EQ(-1, channel.Init(_ep, &opt));
+    }
+    opt.max_concurrency = "gradient";
+    {
+        brpc::Channel channel;
+        ASSERT_EQ(0, channel.Init(_ep, &opt));
+    }
+    opt.max_concurrency = 1;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init(_ep, &opt));
+
+    test::EchoRequest req;
+    req.set_message(__FUNCTION__);
+    req.set_sleep_us(50000); // 50ms
+    test::EchoResponse res1;
+    brpc::Controller cntl1;
+    test::EchoService::Stub(&channel).Echo(&cntl1, &req, &res1, brpc::DoNothing());
+
+    // Rejected without retrying.
+    test::EchoResponse res2;
+    brpc::Controller cntl2;
+    CallMethod(&channel, &cntl2, &req, &res2, false);
+    ASSERT_EQ(brpc::ELIMIT, cntl2.ErrorCode());
+    ASSERT_EQ(0, cntl2.retried_count());
+
+    brpc::Join(cntl1.call_id());
+    ASSERT_EQ(0, cntl1.ErrorCode()) << cntl1.ErrorText();
+
+    // Concurrency is released after the RPC ends.
+    brpc::Controller cntl3;
+    CallMethod(&channel, &cntl3, &req, &res2, false);
+    ASSERT_EQ(0, cntl3.ErrorCode()) << cntl3.ErrorText();
+    StopAndJoin();
+}
+
 TEST_F(ChannelTest, multiple_threads_single_channel) {
     srand(time(NULL));
     ASSERT_EQ(0, StartAccept(_ep));
@@ -23,6 +23,7 @@
 #include <gtest/gtest.h>
 #include <gflags/gflags.h>
 #include "butil/macros.h"
+#include "butil/time.h"
 #include "bthread/bthread.h"
 #include "brpc/circuit_breaker.h"
 #include "brpc/socket.h"
@@ -46,6 +47,7 @@ const int kErrorCost = 1000;
 const int kLatency = 1000;
 const int kThreadNum = 3;
 const int kHalfWindowSize = 0;
+const int kProbeIntervalMs = 100;
 } // namespace
 
 namespace brpc {
@@ -56,6 +58,7 @@ DECLARE_int32(circuit_breaker_long_window_error_percent);
 DECLARE_int32(circuit_breaker_min_isolation_duration_ms);
 DECLARE_int32(circuit_breaker_max_isolation_duration_ms);
 DECLARE_int32(circuit_breaker_half_open_window_size);
+DECLARE_int32(circuit_breaker_half_open_probe_interval_ms);
 } // namespace brpc
 
 int main(int argc, char* argv[]) {
@@ -66,6 +69,7 @@ int main(int argc, char* argv[]) {
     brpc::FLAGS_circuit_breaker_min_isolation_duration_ms = kMinIsolationDurationMs;
     brpc::FLAGS_circuit_breaker_max_isolation_duration_ms = kMaxIsolationDurationMs;
     brpc::FLAGS_circuit_breaker_half_open_window_size = kHalfWindowSize;
+    brpc::FLAGS_circuit_breaker_half_open_probe_interval_ms = kProbeIntervalMs;
     testing::InitGoogleTest(&argc, argv);
     GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
     return RUN_ALL_TESTS();
@@ -217,6 +221,95 @@ TEST_F(CircuitBreakerTest, should_isolate_with_half_open) {
     EXPECT_EQ(kLongWindowSize * 2 * kThreadNum, total_failed2);
 }
 
+TEST_F(CircuitBreakerTest, half_open_probing) {
+    brpc::CircuitBreaker cb;
+    uint64_t generation = 0;
+    ASSERT_TRUE(cb.AllowCall(&generation));
+    while (cb.OnCallEnd(kErrorCodeForFailed, kErrorCost, generation)) {}
+    ASSERT_FALSE(cb.AllowCall(&generation));
+
+    // Half-open after the isolation, only one probe passes through in an
+    // interval and closes the breaker when it succeeds.
+    usleep(cb.isolation_duration_ms() * 1000 + 1000);
+    uint64_t probe_generation = 0;
+    ASSERT_TRUE(cb.AllowCall(&probe_generation));
+    ASSERT_FALSE(cb.AllowCall(&generation));
+    ASSERT_TRUE(cb.OnCallEnd(kErrorCodeForSucc, kLatency, probe_generation));
+    ASSERT_TRUE(cb.AllowCall(&generation));
+    ASSERT_TRUE(cb.AllowCall(&generation));
+
+    // A failed probe breaks the breaker again.
+    while (cb.OnCallEnd(kErrorCodeForFailed, kErrorCost, generation)) {}
+    ASSERT_EQ(2, cb.isolated_times());
+    usleep(cb.isolation_duration_ms() * 1000 + 1000);
+    ASSERT_TRUE(cb.AllowCall(&probe_generation));
+    ASSERT_FALSE(cb.OnCallEnd(kErrorCodeForFailed, kErrorCost, probe_generation));
+    ASSERT_EQ(3, cb.isolated_times());
+    ASSERT_FALSE(cb.AllowCall(&generation));
+}
+
+TEST_F(CircuitBreakerTest, half_open_ignores_late_replies) {
+    brpc::CircuitBreaker cb;
+    uint64_t old_generation = 0;
+    ASSERT_TRUE(cb.AllowCall(&old_generation));
+    uint64_t generation = 0;
+    ASSERT_TRUE(cb.AllowCall(&generation));
+    while (cb.OnCallEnd(kErrorCodeForFailed, kErrorCost, generation)) {}
+    ASSERT_EQ(1, cb.isolated_times());
+
+    usleep(cb.isolation_duration_ms() * 1000 + 1000);
+    uint64_t probe_generation = 0;
+    ASSERT_TRUE(cb.AllowCall(&probe_generation));
+    ASSERT_NE(old_generation, probe_generation);
+    // Replies of calls issued before being broken neither break the
+    // half-open breaker again nor close it.
+    ASSERT_TRUE(cb.OnCallEnd(kErrorCodeForFailed, kErrorCost, old_generation));
+    ASSERT_EQ(1, cb.isolated_times());
+    ASSERT_TRUE(cb.OnCallEnd(kErrorCodeForSucc, kLatency, old_generation));
+    ASSERT_FALSE(cb.AllowCall(&generation));
+
+    ASSERT_TRUE(cb.OnCallEnd(kErrorCodeForSucc, kLatency, probe_generation));
+    ASSERT_TRUE(cb.AllowCall(&generation));
+    ASSERT_EQ(probe_generation, generation);
+}
+
+TEST_F(CircuitBreakerTest, half_open_transition_is_atomic) {
+    brpc::CircuitBreaker cb;
+    uint64_t generation = 0;
+    ASSERT_TRUE(cb.AllowCall(&generation));
+    while (cb.OnCallEnd(kErrorCodeForFailed, kErrorCost, generation)) {}
+    usleep(cb.isolation_duration_ms() * 1000 + 1000);
+
+    // Only one of the concurrent callers sends the first probe.
+    struct Caller {
+        static void* Run(void* arg) {
+            brpc::CircuitBreaker* cb = static_cast<brpc::CircuitBreaker*>(arg);
+            uint64_t generation = 0;
+            intptr_t nallowed = 0;
+            for (int i = 0; i < 1000; ++i) {
+                nallowed += cb->AllowCall(&generation);
+            }
+            return (void*)nallowed;
+        }
+    };
+    pthread_t threads[kThreadNum * 4];
+    const int64_t start_ms = butil::cpuwide_time_ms();
+    for (size_t i = 0; i < arraysize(threads); ++i) {
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, Caller::Run, &cb));
+    }
+    intptr_t nallowed = 0;
+    for (size_t i = 0; i < arraysize(threads); ++i) {
+        void* ret = NULL;
+        ASSERT_EQ(0, pthread_join(threads[i], &ret));
+        nallowed += (intptr_t)ret;
+    }
+    // More probes pass if the threads ran longer than the probe interval.
+    const int64_t elapsed_ms = butil::cpuwide_time_ms() - start_ms;
+    ASSERT_GE(nallowed, 1);
+    ASSERT_LE(nallowed, 1 + elapsed_ms / kProbeIntervalMs);
+    ASSERT_EQ(1, cb.isolated_times());
+}
+
 TEST_F(CircuitBreakerTest, isolation_duration_grow_and_reset) {
     std::vector<pthread_t> thread_list;
     std::vector<std::unique_ptr<FeedbackControl>> fc_list;
@@ -0,0 +1,78 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "brpc/policy/gradient_concurrency_limiter.h"
+#include "butil/time.h"
+#include <gtest/gtest.h>
+
+namespace brpc {
+namespace policy {
+DECLARE_int32(gradient_cl_sample_window_size_ms);
+DECLARE_int32(gradient_cl_min_sample_count);
+DECLARE_int32(gradient_cl_max_sample_count);
+}  // namespace policy
+}  // namespace brpc
+
+// Submit a sample window of `count' requests with `latency_us' while
+// `inflight' requests are running.
+static void SubmitWindow(brpc::policy::GradientConcurrencyLimiter* limiter,
+                         int inflight, int64_t latency_us, int64_t* now_us) {
+    limiter->OnRequested(inflight, NULL);
+    for (int i = 0; i < brpc::policy::FLAGS_gradient_cl_max_sample_count; ++i) {
+        ASSERT_EQ(i + 1 == brpc::policy::FLAGS_gradient_cl_max_sample_count,
+                  limiter->AddSample(0, latency_us, *now_us));
+        *now_us += 100;
+    }
+}
+
+TEST(GradientConcurrencyLimiterTest, AddSample) {
+    brpc::policy::FLAGS_gradient_cl_sample_window_size_ms = 10;
+    brpc::policy::FLAGS_gradient_cl_min_sample_count = 5;
+    brpc::policy::FLAGS_gradient_cl_max_sample_count = 10;
+
+    brpc::policy::GradientConcurrencyLimiter limiter;
+    int64_t now_us = butil::gettimeofday_us();
+    // Not enough samples at the end of the window.
+    limiter.AddSample(0, 50, now_us);
+    ASSERT_FALSE(limiter.AddSample(0, 50, now_us + 20000));
+    ASSERT_EQ(0, limiter._sw.succ_count);
+    // The next window starts from the discarded one.
+    now_us += 20000;
+
+    const int initial_max_concurrency = limiter.MaxConcurrency();
+    ASSERT_TRUE(limiter.OnRequested(initial_max_concurrency, NULL));
+    ASSERT_FALSE(limiter.OnRequested(initial_max_concurrency + 1, NULL));
+
+    // Few requests are running, the limit should not grow.
+    for (int i = 0; i < 10; ++i) {
+        SubmitWindow(&limiter, 1, 1000, &now_us);
+    }
+    ASSERT_EQ(initial_max_concurrency, limiter.MaxConcurrency());
+
+    // Latency is stable at full load, the limit grows.
+    for (int i = 0; i < 20; ++i) {
+        SubmitWindow(&limiter, limiter.MaxConcurrency(), 1000, &now_us);
+    }
+    const int grown_max_concurrency = limiter.MaxConcurrency();
+    ASSERT_GT(grown_max_concurrency, initial_max_concurrency);
+
+    // Latency grows a lot, the limit shrinks.
+    for (int i = 0; i < 10; ++i) {
+        SubmitWindow(&limiter, limiter.MaxConcurrency(), 10000, &now_us);
+    }
+    ASSERT_LT(limiter.MaxConcurrency(), grown_max_concurrency);
+}
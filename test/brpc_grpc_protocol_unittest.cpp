@@ -22,7 +22,10 @@
 #include "brpc/server.h"
 #include "brpc/channel.h"
 #include "brpc/grpc.h"
+#include "brpc/progressive_attachment.h"
+#include "bthread/countdown_event.h"
 #include "butil/time.h"
+#include "butil/string_printf.h"
 #include "grpc.pb.h"
 
 int main(int argc, char* argv[]) {
@@ -47,6 +50,91 @@ const std::string g_req = "wyt";
 const int64_t g_timeout_ms = 1000;
 const std::string g_protocol = "h2:grpc";
 
+const int g_stream_count = 3;
+
+// Collect messages of a streaming gRPC.
+class GrpcResponseCollector : public brpc::GrpcMessageReader {
+public:
+    GrpcResponseCollector() : _event(1) {}
+
+    butil::Status OnGrpcMessage(butil::IOBuf* message) override {
+        test::GrpcResponse res;
+        butil::IOBufAsZeroCopyInputStream wrapper(*message);
+        if (!res.ParseFromZeroCopyStream(&wrapper)) {
+            return butil::Status(EINVAL, "Fail to parse GrpcResponse");
+        }
+        BAIDU_SCOPED_LOCK(_mutex);
+        _messages.push_back(res.message());
+        return butil::Status::OK();
+    }
+
+    void OnEndOfStream(const butil::Status& status) override {
+        _status = status;
+        _event.signal();
+    }
+
+    size_t message_count() {
+        BAIDU_SCOPED_LOCK(_mutex);
+        return _messages.size();
+    }
+
+    void wait() { _event.wait(); }
+    const butil::Status& status() const { return _status; }
+    const std::vector<std::string>& messages() const { return _messages; }
+
+private:
+    butil::Mutex _mutex;
+    std::vector<std::string> _messages;
+    butil::Status _status;
+    bthread::CountdownEvent _event;
+};
+
+// Answer each message of the client stream with a response if `pa' is not
+// NULL, otherwise fill `res' with all messages at the end of the stream.
+class GrpcRequestHandler : public brpc::GrpcMessageReader {
+public:
+    GrpcRequestHandler(brpc::ProgressiveAttachment* pa,
+                       ::test::GrpcResponse* res,
+                       ::google::protobuf::Closure* done)
+        : _pa(pa), _res(res), _done(done) {}
+
+    butil::Status OnGrpcMessage(butil::IOBuf* message) override {
+        test::GrpcRequest req;
+        butil::IOBufAsZeroCopyInputStream wrapper(*message);
+        if (!req.ParseFromZeroCopyStream(&wrapper)) {
+            return butil::Status(EINVAL, "Fail to parse GrpcRequest");
+        }
+        if (_pa != NULL) {
+            test::GrpcResponse res;
+            res.set_message(g_prefix + req.message());
+            if (brpc::WriteGrpcMessage(_pa.get(), res) != 0) {
+                return butil::Status(errno, "Fail to write GrpcResponse");
+            }
+        } else {
+            _joined.append(req.message());
+        }
+        return butil::Status::OK();
+    }
+
+    void OnEndOfStream(const butil::Status& status) override {
+        EXPECT_TRUE(status.ok()) << status;
+        if (_res != NULL) {
+            _res->set_message(g_prefix + _joined);
+        }
+        _pa.reset();
+        if (_done != NULL) {
+            _done->Run();
+        }
+        delete this;
+    }
+
+private:
+    butil::intrusive_ptr<brpc::ProgressiveAttachment> _pa;
+    ::test::GrpcResponse* _res;
+    ::google::protobuf::Closure* _done;
+    std::string _joined;
+};
+
 class MyGrpcService : public ::test::GrpcService {
 public:
     void Method(::google::protobuf::RpcController* cntl_base,
@@ -86,6 +174,52 @@ public:
         res->set_message(g_prefix + req->message());
         return;
     }
+
+    void ServerStream(::google::protobuf::RpcController* cntl_base,
+                      const ::test::GrpcRequest* req,
+                      ::test::GrpcResponse*,
+                      ::google::protobuf::Closure* done) {
+        brpc::Controller* cntl =
+                static_cast<brpc::Controller*>(cntl_base);
+        brpc::ClosureGuard done_guard(done);
+        butil::intrusive_ptr<brpc::ProgressiveAttachment> pa =
+            cntl->CreateProgressiveAttachment();
+        ASSERT_TRUE(pa != NULL);
+        const std::string message = req->message();
+        // Send headers of the response, `req' is destroyed.
+        done_guard.reset(NULL);
+        for (int i = 0; i < g_stream_count; ++i) {
+            test::GrpcResponse res;
+            res.set_message(g_prefix + message + std::to_string(i));
+            ASSERT_EQ(0, brpc::WriteGrpcMessage(pa.get(), res));
+        }
+    }
+
+    void ClientStream(::google::protobuf::RpcController* cntl_base,
+                      const ::test::GrpcRequest*,
+                      ::test::GrpcResponse* res,
+                      ::google::protobuf::Closure* done) {
+        brpc::Controller* cntl =
+                static_cast<brpc::Controller*>(cntl_base);
+        cntl->request_will_be_read_progressively();
+        cntl->ReadProgressiveAttachmentBy(
+            new GrpcRequestHandler(NULL, res, done));
+    }
+
+    void BidiStream(::google::protobuf::RpcController* cntl_base,
+                    const ::test::GrpcRequest*,
+                    ::test::GrpcResponse*,
+                    ::google::protobuf::Closure* done) {
+        brpc::Controller* cntl =
+                static_cast<brpc::Controller*>(cntl_base);
+        brpc::ClosureGuard done_guard(done);
+        butil::intrusive_ptr<brpc::ProgressiveAttachment> pa =
+            cntl->CreateProgressiveAttachment();
+        ASSERT_TRUE(pa != NULL);
+        cntl->request_will_be_read_progressively();
+        cntl->ReadProgressiveAttachmentBy(
+            new GrpcRequestHandler(pa.get(), NULL, NULL));
+    }
 };
 
 class GrpcTest : public ::testing::Test {
@@ -242,6 +376,28 @@ TEST_F(GrpcTest, GrpcTimeOut) {
         EXPECT_FALSE(cntl.Failed());
     }
 
+    // the earlier one of x-bd-deadline and grpc-timeout wins
+    const int64_t deadline_timeouts_us[][2] = {
+        { 1000000, 2000000 }, { 5000000, 1000000 } };
+    for (size_t i = 0; i < arraysize(deadline_timeouts_us); ++i) {
+        test::GrpcRequest req;
+        test::GrpcResponse res;
+        brpc::Controller cntl;
+        req.set_message(g_req);
+        req.set_gzip(false);
+        req.set_return_error(false);
+        req.set_timeout_us(std::min(deadline_timeouts_us[i][0],
+                                    deadline_timeouts_us[i][1]));
+        cntl.set_timeout_ms(-1);
+        cntl.http_request().SetHeader("x-bd-deadline", butil::string_printf(
+            "%" PRId64, butil::gettimeofday_us() + deadline_timeouts_us[i][0]));
+        cntl.http_request().SetHeader("grpc-timeout", butil::string_printf(
+            "%" PRId64 "u", deadline_timeouts_us[i][1]));
+        test::GrpcService_Stub stub(&_channel);
+        stub.Method(&cntl, &req, &res, NULL);
+        EXPECT_FALSE(cntl.Failed());
+    }
+
     // test timeout by using timeout_ms in cntl
     {
         test::GrpcRequest req;
@@ -272,4 +428,122 @@ TEST_F(GrpcTest, GrpcTimeOut) {
     }
 }
 
+TEST_F(GrpcTest, server_streaming) {
+    test::GrpcRequest req;
+    test::GrpcResponse res;
+    brpc::Controller cntl;
+    req.set_message(g_req);
+    req.set_gzip(false);
+    req.set_return_error(false);
+    cntl.response_will_be_read_progressively();
+    test::GrpcService_Stub stub(&_channel);
+    stub.ServerStream(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+
+    GrpcResponseCollector collector;
+    cntl.ReadProgressiveAttachmentBy(&collector);
+    collector.wait();
+    ASSERT_TRUE(collector.status().ok()) << collector.status();
+    ASSERT_EQ((size_t)g_stream_count, collector.messages().size());
+    for (int i = 0; i < g_stream_count; ++i) {
+        EXPECT_EQ(g_prefix + g_req + std::to_string(i),
+                  collector.messages()[i]);
+    }
+}
+
+TEST_F(GrpcTest, client_streaming) {
+    test::GrpcRequest req;
+    test::GrpcResponse res;
+    brpc::Controller cntl;
+    butil::intrusive_ptr<brpc::ProgressiveAttachment> pa =
+        cntl.CreateRequestProgressiveAttachment();
+    ASSERT_TRUE(pa != NULL);
+    std::string joined;
+    for (int i = 0; i < g_stream_count; ++i) {
+        test::GrpcRequest msg;
+        msg.set_message(g_req + std::to_string(i));
+        msg.set_gzip(false);
+        msg.set_return_error(false);
+        ASSERT_EQ(0, brpc::WriteGrpcMessage(pa.get(), msg));
+        joined.append(msg.message());
+    }
+    // End the request stream.
+    pa.reset();
+    test::GrpcService_Stub stub(&_channel);
+    stub.ClientStream(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    EXPECT_EQ(g_prefix + joined, res.message());
+}
+
+TEST_F(GrpcTest, bidi_streaming) {
+    test::GrpcRequest req;
+    test::GrpcResponse res;
+    brpc::Controller cntl;
+    butil::intrusive_ptr<brpc::ProgressiveAttachment> pa =
+        cntl.CreateRequestProgressiveAttachment();
+    ASSERT_TRUE(pa != NULL);
+    cntl.response_will_be_read_progressively();
+    test::GrpcService_Stub stub(&_channel);
+    stub.BidiStream(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+
+    GrpcResponseCollector collector;
+    cntl.ReadProgressiveAttachmentBy(&collector);
+    for (int i = 0; i < g_stream_count; ++i) {
+        test::GrpcRequest msg;
+        msg.set_message(g_req + std::to_string(i));
+        msg.set_gzip(false);
+        msg.set_return_error(false);
+        ASSERT_EQ(0, brpc::WriteGrpcMessage(pa.get(), msg));
+        // The response of each message arrives before the stream ends.
+        for (int j = 0; j < 1000 && collector.message_count() <= (size_t)i; ++j) {
+            bthread_usleep(1000);
+        }
+        ASSERT_EQ((size_t)i + 1, collector.message_count());
+    }
+    pa.reset();
+    collector.wait();
+    ASSERT_TRUE(collector.status().ok()) << collector.status();
+    for (int i = 0; i < g_stream_count; ++i) {
+        EXPECT_EQ(g_prefix + g_req + std::to_string(i),
+                  collector.messages()[i]);
+    }
+}
+
+TEST_F(GrpcTest, grpc_message_reader) {
+    GrpcResponseCollector collector;
+    butil::IOBuf stream;
+    for (int i = 0; i < g_stream_count; ++i) {
+        test::GrpcResponse res;
+        res.set_message(g_prefix + std::to_string(i));
+        const std::string body = res.SerializeAsString();
+        const char header[5] = { 0, 0, 0, 0, (char)body.size() };
+        stream.append(header, sizeof(header));
+        stream.append(body);
+    }
+    // Messages are split at arbitrary positions.
+    const std::string data = stream.to_string();
+    for (size_t i = 0; i < data.size(); i += 3) {
+        ASSERT_TRUE(collector.OnReadOnePart(
+            data.data() + i, std::min((size_t)3, data.size() - i)).ok());
+    }
+    ASSERT_EQ((size_t)g_stream_count, collector.message_count());
+    // A partial message at the end breaks the stream.
+    ASSERT_TRUE(collector.OnReadOnePart(data.data(), 4).ok());
+    collector.OnEndOfMessage(butil::Status::OK());
+    collector.wait();
+    ASSERT_FALSE(collector.status().ok());
+}
+
+TEST_F(GrpcTest, grpc_message_reader_rejects_large_message) {
+    GrpcResponseCollector collector;
+    // The length is checked before the message is buffered.
+    const char header[5] = { 0, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF };
+    butil::Status st = collector.OnReadOnePart(header, sizeof(header));
+    ASSERT_EQ(brpc::ELIMIT, st.error_code()) << st;
+    ASSERT_EQ(brpc::GRPC_RESOURCEEXHAUSTED,
+              brpc::ErrorCodeToGrpcStatus(st.error_code()));
+    ASSERT_EQ(0u, collector.message_count());
+}
+
 } // namespace 
@@ -22,6 +22,7 @@
 #include <gtest/gtest.h>
 #include "brpc/details/hpack.h"
 #include "butil/logging.h"
+#include "butil/string_printf.h"
 
 class HPackTest : public testing::Test {
 };
@@ -548,3 +549,132 @@ TEST_F(HPackTest, responses_with_huffman) {
     }
     ASSERT_TRUE(buf.buf().empty());
 }
+
+TEST_F(HPackTest, huffman_if_shorter) {
+    brpc::HPacker p1;
+    ASSERT_EQ(0, p1.Init(4096));
+    brpc::HPacker p2;
+    ASSERT_EQ(0, p2.Init(4096));
+    brpc::HPackOptions options;
+    options.index_policy = brpc::HPACK_NOT_INDEX_HEADER;
+    options.huffman_if_shorter = true;
+    butil::IOBufAppender buf;
+    // Shorter with huffman encoding, same as C.4.1 of rfc7541
+    p1.Encode(&buf, ":authority", "www.example.com", options);
+    uint8_t expected[] = {
+        0x01, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90,
+        0xf4, 0xff,
+    };
+    butil::StringPiece sp((char*)expected, sizeof(expected));
+    ASSERT_TRUE(buf.buf().equals(sp)) << butil::ToPrintable(buf.buf());
+    brpc::HPacker::Header h;
+    ASSERT_EQ((ssize_t)sizeof(expected), p2.Decode(&buf.buf(), &h));
+    ASSERT_EQ(":authority", h.name);
+    ASSERT_EQ("www.example.com", h.value);
+
+    // Longer with huffman encoding.
+    const std::string binary("\x01\x02\xfe\xff{}", 6);
+    p1.Encode(&buf, "x-bin", binary, options);
+    // The name is still shorter with huffman encoding.
+    ASSERT_EQ(1u + 1 + 4 + 1 + binary.size(), buf.buf().size());
+    ASSERT_GT(p2.Decode(&buf.buf(), &h), 0);
+    ASSERT_EQ("x-bin", h.name);
+    ASSERT_EQ(binary, h.value);
+}
+
+TEST_F(HPackTest, index_repeated_header) {
+    brpc::HPacker p1;
+    ASSERT_EQ(0, p1.Init(4096));
+    brpc::HPacker p2;
+    ASSERT_EQ(0, p2.Init(4096));
+    brpc::HPackOptions options;
+    options.index_policy = brpc::HPACK_INDEX_REPEATED_HEADER;
+    butil::IOBufAppender buf;
+    brpc::HPacker::Header h;
+    // Seen once: not indexed.
+    p1.Encode(&buf, "user-agent", "brpc/1.0", options);
+    ASSERT_EQ(0x0f, *(const uint8_t*)buf.buf().fetch1()); // literal, name index=58
+    ASSERT_GT(p2.Decode(&buf.buf(), &h), 0);
+    ASSERT_EQ("user-agent", h.name);
+    ASSERT_EQ("brpc/1.0", h.value);
+    // Seen twice: indexed.
+    p1.Encode(&buf, "user-agent", "brpc/1.0", options);
+    ASSERT_EQ(0x40 | 58, *(const uint8_t*)buf.buf().fetch1());
+    ASSERT_GT(p2.Decode(&buf.buf(), &h), 0);
+    ASSERT_EQ("brpc/1.0", h.value);
+    // Replaced by the index afterwards.
+    for (int i = 0; i < 3; ++i) {
+        p1.Encode(&buf, "user-agent", "brpc/1.0", options);
+        ASSERT_EQ(1u, buf.buf().size());
+        ASSERT_EQ(0x80 | 62, *(const uint8_t*)buf.buf().fetch1());
+        ASSERT_EQ(1, p2.Decode(&buf.buf(), &h));
+        ASSERT_EQ("user-agent", h.name);
+        ASSERT_EQ("brpc/1.0", h.value);
+    }
+    // Varying values don't enter the table except the first one, which
+    // makes the name indexed.
+    for (int i = 0; i < 100; ++i) {
+        p1.Encode(&buf, "x-bd-trace-id", butil::string_printf("%d", i), options);
+        if (i == 0) {
+            ASSERT_EQ(0x40, *(const uint8_t*)buf.buf().fetch1());
+        } else {
+            // literal, name index=62
+            ASSERT_EQ(0x0f, *(const uint8_t*)buf.buf().fetch1());
+        }
+        ASSERT_GT(p2.Decode(&buf.buf(), &h), 0);
+        ASSERT_EQ(butil::string_printf("%d", i), h.value);
+    }
+    p1.Encode(&buf, "user-agent", "brpc/1.0", options);
+    ASSERT_EQ(1u, buf.buf().size());
+    ASSERT_EQ(1, p2.Decode(&buf.buf(), &h));
+    ASSERT_EQ("brpc/1.0", h.value);
+}
+
+TEST_F(HPackTest, huffman_decoding) {
+    brpc::HPacker p1;
+    ASSERT_EQ(0, p1.Init(4096));
+    brpc::HPacker p2;
+    ASSERT_EQ(0, p2.Init(4096));
+    brpc::HPackOptions options;
+    options.index_policy = brpc::HPACK_NEVER_INDEX_HEADER;
+    options.encode_name = true;
+    options.encode_value = true;
+    butil::IOBufAppender buf;
+    std::string value;
+    for (int i = 0; i < 256; ++i) {
+        value.push_back((char)i);
+    }
+    for (int i = 0; i < 300; ++i) {
+        const std::string v = value.substr(i % 256) + value.substr(0, i / 2);
+        p1.Encode(&buf, "x-value", v, options);
+        brpc::HPacker::Header h;
+        ASSERT_GT(p2.Decode(&buf.buf(), &h), 0);
+        ASSERT_EQ("x-value", h.name);
+        ASSERT_EQ(v, h.value);
+    }
+
+    // "a" is 00011 in huffman encoding, padded with EOS (all 1s).
+    const char good[] = { 0x00, 0x01, 'a', (char)0x81, 0x1f };
+    // Padded with 0s.
+    const char bad_padding[] = { 0x00, 0x01, 'a', (char)0x81, 0x18 };
+    // Padding longer than 7 bits.
+    const char long_padding[] = { 0x00, 0x01, 'a', (char)0x82, 0x1f, (char)0xff };
+    // EOS in the middle.
+    const char eos[] = { 0x00, 0x01, 'a', (char)0x84,
+                         (char)0xff, (char)0xff, (char)0xff, (char)0xff };
+    brpc::HPacker::Header h;
+    butil::IOBuf in;
+    in.append(good, sizeof(good));
+    ASSERT_EQ((ssize_t)sizeof(good), p2.Decode(&in, &h));
+    ASSERT_EQ("a", h.name);
+    ASSERT_EQ("a", h.value);
+    in.clear();
+    in.append(bad_padding, sizeof(bad_padding));
+    ASSERT_EQ(-1, p2.Decode(&in, &h));
+    in.clear();
+    in.append(long_padding, sizeof(long_padding));
+    ASSERT_EQ(-1, p2.Decode(&in, &h));
+    in.clear();
+    in.append(eos, sizeof(eos));
+    ASSERT_EQ(-1, p2.Decode(&in, &h));
+}
@@ -20,8 +20,10 @@
 #include <gtest/gtest.h>
 #include <google/protobuf/descriptor.h>
 
+#include "butil/string_printf.h"
 #include "brpc/server.h"
 #include "brpc/details/http_message.h"
+#include "brpc/details/fast_http_parser.h"
 #include "brpc/policy/http_rpc_protocol.h"
 #include "echo.pb.h"
 
@@ -29,6 +31,8 @@ namespace brpc {
 
 DECLARE_bool(allow_chunked_length);
 DECLARE_bool(allow_http_1_1_request_without_host);
+DECLARE_bool(http_parser_fast_path);
+DECLARE_int32(http_max_header_fields);
 
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
@@ -561,7 +565,7 @@ TEST(HttpMessageTest, http_header) {
     ASSERT_EQ(1, set_cookie_value3_count);
     header.RemoveHeader(brpc::HttpHeader::SET_COOKIE);
     ASSERT_FALSE(header.GetHeader(brpc::HttpHeader::SET_COOKIE));
-    ASSERT_EQ(header._first_set_cookie, nullptr);
+    ASSERT_TRUE(header.GetAllSetCookieHeader().empty());
 
     ASSERT_EQ(brpc::HTTP_METHOD_GET, header.method());
     header.set_method(brpc::HTTP_METHOD_POST);
@@ -581,6 +585,113 @@ TEST(HttpMessageTest, http_header) {
                  header.reason_phrase());
 }
 
+TEST(HttpMessageTest, http_header_id) {
+    for (int i = 0; i < brpc::HTTP_HEADER_UNKNOWN; ++i) {
+        const brpc::HttpHeaderId id = (brpc::HttpHeaderId)i;
+        std::string name = brpc::HttpHeaderName(id);
+        ASSERT_EQ(id, brpc::FindHttpHeaderId(name)) << name;
+        for (size_t j = 0; j < name.size(); ++j) {
+            name[j] = ::toupper(name[j]);
+        }
+        ASSERT_EQ(id, brpc::FindHttpHeaderId(name)) << name;
+        name.push_back('x');
+        ASSERT_EQ(brpc::HTTP_HEADER_UNKNOWN, brpc::FindHttpHeaderId(name));
+        name.resize(name.size() - 2);
+        ASSERT_EQ(brpc::HTTP_HEADER_UNKNOWN, brpc::FindHttpHeaderId(name));
+    }
+    ASSERT_EQ(NULL, brpc::HttpHeaderName(brpc::HTTP_HEADER_UNKNOWN));
+    ASSERT_EQ(brpc::HTTP_HEADER_UNKNOWN, brpc::FindHttpHeaderId(""));
+    ASSERT_EQ(brpc::HTTP_HEADER_UNKNOWN, brpc::FindHttpHeaderId("content-typf"));
+    ASSERT_EQ(brpc::HTTP_HEADER_UNKNOWN,
+              brpc::FindHttpHeaderId("a-really-long-header-name-not-known"));
+
+    brpc::HttpHeader header;
+    header.SetHeader("Foo", "1");
+    header.SetHeader("User-Agent", "ua");
+    header.AppendHeader("set-cookie", "a=1");
+    header.AppendHeader("accept-encoding", "gzip");
+    header.AppendHeader("Set-Cookie", "b=2");
+    header.AppendHeader("Accept-Encoding", "zstd");
+    header.SetHeader("bar", "2");
+    ASSERT_EQ(6u, header.HeaderCount());
+    const std::string* value = header.GetHeader(brpc::HTTP_HEADER_USER_AGENT);
+    ASSERT_TRUE(value && *value == "ua");
+    ASSERT_EQ(value, header.GetHeader("user-agent"));
+    value = header.GetHeader(brpc::HTTP_HEADER_ACCEPT_ENCODING);
+    ASSERT_TRUE(value && *value == "gzip,zstd");
+    value = header.GetHeader(brpc::HTTP_HEADER_SET_COOKIE);
+    ASSERT_TRUE(value && *value == "a=1");
+    ASSERT_FALSE(header.GetHeader(brpc::HTTP_HEADER_HOST));
+    ASSERT_FALSE(header.GetHeader(brpc::HTTP_HEADER_UNKNOWN));
+    // Iterated in the order of insertion.
+    const char* const expected[][2] = {
+        { "Foo", "1" }, { "User-Agent", "ua" }, { "set-cookie", "a=1" },
+        { "accept-encoding", "gzip,zstd" }, { "Set-Cookie", "b=2" },
+        { "bar", "2" } };
+    size_t i = 0;
+    for (brpc::HttpHeader::HeaderIterator it = header.HeaderBegin();
+         it != header.HeaderEnd(); ++it, ++i) {
+        ASSERT_EQ(expected[i][0], it->first);
+        ASSERT_EQ(expected[i][1], it->second);
+    }
+    // Indexes of remaining headers are updated after removals.
+    header.RemoveHeader("FOO");
+    header.RemoveHeader("Set-cookie");
+    ASSERT_EQ(3u, header.HeaderCount());
+    ASSERT_FALSE(header.GetHeader(brpc::HTTP_HEADER_SET_COOKIE));
+    value = header.GetHeader(brpc::HTTP_HEADER_ACCEPT_ENCODING);
+    ASSERT_TRUE(value && *value == "gzip,zstd");
+    value = header.GetHeader("BAR");
+    ASSERT_TRUE(value && *value == "2");
+
+    brpc::HttpHeader header2;
+    header2.Swap(header);
+    ASSERT_FALSE(header.GetHeader(brpc::HTTP_HEADER_USER_AGENT));
+    value = header2.GetHeader(brpc::HTTP_HEADER_USER_AGENT);
+    ASSERT_TRUE(value && *value == "ua");
+    header2.Clear();
+    ASSERT_EQ(0u, header2.HeaderCount());
+    ASSERT_FALSE(header2.GetHeader(brpc::HTTP_HEADER_USER_AGENT));
+}
+
+TEST(HttpMessageTest, many_unknown_headers) {
+    // Names that are not well-known are indexed when there're many headers.
+    brpc::HttpHeader header;
+    for (int i = 0; i < 100; ++i) {
+        header.AppendHeader(butil::string_printf("X-Foo-%d", i),
+                            butil::string_printf("%d", i));
+        header.AppendHeader("set-cookie", "a=1");
+    }
+    header.AppendHeader("x-foo-7", "again");
+    ASSERT_EQ(200u, header.HeaderCount());
+    for (int i = 0; i < 100; ++i) {
+        const std::string* value =
+            header.GetHeader(butil::string_printf("x-FOO-%d", i));
+        ASSERT_TRUE(value != NULL) << i;
+        ASSERT_EQ(i == 7 ? "7,again" : butil::string_printf("%d", i), *value);
+    }
+    ASSERT_FALSE(header.GetHeader("x-foo-100"));
+    ASSERT_EQ(100u, header.GetAllSetCookieHeader().size());
+
+    header.RemoveHeader("X-Foo-0");
+    header.RemoveHeader("set-cookie");
+    ASSERT_EQ(99u, header.HeaderCount());
+    ASSERT_FALSE(header.GetHeader("x-foo-0"));
+    for (int i = 1; i < 100; ++i) {
+        const std::string* value =
+            header.GetHeader(butil::string_printf("X-Foo-%d", i));
+        ASSERT_TRUE(value != NULL) << i;
+        ASSERT_EQ(i, atoi(value->c_str()));
+    }
+
+    brpc::HttpHeader header2(header);
+    header.Clear();
+    ASSERT_FALSE(header.GetHeader("x-foo-1"));
+    header.SetHeader("X-Foo-1", "new");
+    ASSERT_EQ("new", *header.GetHeader("x-foo-1"));
+    ASSERT_EQ("1", *header2.GetHeader("x-foo-1"));
+}
+
 TEST(HttpMessageTest, empty_url) {
     butil::EndPoint host;
     ASSERT_FALSE(ParseHttpServerAddress(&host, ""));
@@ -613,27 +724,27 @@ TEST(HttpMessageTest, serialize_http_request) {
     // user-set accept
     header.SetHeader("accePT"/*intended uppercase*/, "blahblah");
     MakeRawHttpRequest(&request, &header, ep, &content);
-    ASSERT_EQ("POST / HTTP/1.1\r\nContent-Length: 4\r\nFoo: Bar\r\naccePT: blahblah\r\nHost: MyHost: 4321\r\nUser-Agent: brpc/1.0 curl/7.0\r\n\r\ndata", request);
+    ASSERT_EQ("POST / HTTP/1.1\r\nContent-Length: 4\r\nFoo: Bar\r\nHost: MyHost: 4321\r\naccePT: blahblah\r\nUser-Agent: brpc/1.0 curl/7.0\r\n\r\ndata", request);
 
     // user-set UA
     header.SetHeader("user-AGENT", "myUA");
     MakeRawHttpRequest(&request, &header, ep, &content);
-    ASSERT_EQ("POST / HTTP/1.1\r\nContent-Length: 4\r\nFoo: Bar\r\naccePT: blahblah\r\nHost: MyHost: 4321\r\nuser-AGENT: myUA\r\n\r\ndata", request);
+    ASSERT_EQ("POST / HTTP/1.1\r\nContent-Length: 4\r\nFoo: Bar\r\nHost: MyHost: 4321\r\naccePT: blahblah\r\nuser-AGENT: myUA\r\n\r\ndata", request);
 
     // user-set Authorization
     header.SetHeader("authorization", "myAuthString");
     MakeRawHttpRequest(&request, &header, ep, &content);
-    ASSERT_EQ("POST / HTTP/1.1\r\nContent-Length: 4\r\nFoo: Bar\r\naccePT: blahblah\r\nHost: MyHost: 4321\r\nuser-AGENT: myUA\r\nauthorization: myAuthString\r\n\r\ndata", request);
+    ASSERT_EQ("POST / HTTP/1.1\r\nContent-Length: 4\r\nFoo: Bar\r\nHost: MyHost: 4321\r\naccePT: blahblah\r\nuser-AGENT: myUA\r\nauthorization: myAuthString\r\n\r\ndata", request);
 
     header.SetHeader("Transfer-Encoding", "chunked");
     MakeRawHttpRequest(&request, &header, ep, &content);
-    ASSERT_EQ("POST / HTTP/1.1\r\nFoo: Bar\r\naccePT: blahblah\r\nTransfer-Encoding: chunked\r\nHost: MyHost: 4321\r\nuser-AGENT: myUA\r\nauthorization: myAuthString\r\n\r\ndata", request);
+    ASSERT_EQ("POST / HTTP/1.1\r\nFoo: Bar\r\nHost: MyHost: 4321\r\naccePT: blahblah\r\nuser-AGENT: myUA\r\nauthorization: myAuthString\r\nTransfer-Encoding: chunked\r\n\r\ndata", request);
 
     // GET does not serialize content and user-set content-length is ignored.
     header.set_method(brpc::HTTP_METHOD_GET);
     header.SetHeader("Content-Length", "100");
     MakeRawHttpRequest(&request, &header, ep, &content);
-    ASSERT_EQ("GET / HTTP/1.1\r\nFoo: Bar\r\naccePT: blahblah\r\nHost: MyHost: 4321\r\nuser-AGENT: myUA\r\nauthorization: myAuthString\r\n\r\n", request);
+    ASSERT_EQ("GET / HTTP/1.1\r\nFoo: Bar\r\nHost: MyHost: 4321\r\naccePT: blahblah\r\nuser-AGENT: myUA\r\nauthorization: myAuthString\r\n\r\n", request);
 }
 
 TEST(HttpMessageTest, serialize_http_response) {
@@ -738,4 +849,144 @@ TEST(HttpMessageTest, http_1_1_request_without_host) {
     brpc::FLAGS_allow_http_1_1_request_without_host = true;
 }
 
+TEST(HttpMessageTest, fast_parse_http_headers) {
+    brpc::FastHttpHeaders h;
+    const std::string req =
+        "POST /EchoService/Echo?a=b HTTP/1.1\r\n"
+        "Host: 127.0.0.1:8010\r\n"
+        "Content-Type: application/json\r\n"
+        "X-Long-Header: 0123456789abcdef0123456789abcdef0123456789abcdef\r\n"
+        "X|Token~: \t v  \r\n"
+        "Connection: Keep-Alive\r\n"
+        "Content-Length: 13\r\n"
+        "\r\n"
+        "{\"message\":1}";
+    ASSERT_TRUE(brpc::FastParseHttpHeaders(req.data(), req.size(), &h));
+    ASSERT_TRUE(h.is_request);
+    ASSERT_EQ(brpc::HTTP_METHOD_POST, h.method);
+    ASSERT_EQ("/EchoService/Echo?a=b", h.url);
+    ASSERT_EQ(1, h.http_minor);
+    ASSERT_EQ(6u, h.nfield);
+    ASSERT_EQ("X|Token~", h.fields[3].name);
+    ASSERT_EQ("v  ", h.fields[3].value);
+    ASSERT_EQ(13u, h.content_length);
+    ASSERT_EQ((unsigned)(brpc::F_CONTENTLENGTH | brpc::F_CONNECTION_KEEP_ALIVE),
+              h.flags);
+    ASSERT_EQ(req.find("\r\n\r\n") + 3, h.size);
+    // Incomplete headers.
+    ASSERT_FALSE(brpc::FastParseHttpHeaders(req.data(), h.size, &h));
+
+    const std::string res = "HTTP/1.0 404 Not Found\r\nServer: brpc\r\n\r\n";
+    ASSERT_TRUE(brpc::FastParseHttpHeaders(res.data(), res.size(), &h));
+    ASSERT_FALSE(h.is_request);
+    ASSERT_EQ(404, h.status_code);
+    ASSERT_EQ(0, h.http_minor);
+    ASSERT_EQ(1u, h.nfield);
+    ASSERT_EQ(ULLONG_MAX, h.content_length);
+
+    // Left to http_parser.
+    const char* const unhandled[] = {
+        "GET http://host/ HTTP/1.1\r\n\r\n",
+        "CONNECT host:443 HTTP/1.1\r\n\r\n",
+        "GET /a#b HTTP/1.1\r\n\r\n",
+        "GET / HTTP/2.0\r\n\r\n",
+        "GET / HTTP/1.1\nHost: a\n\n",
+        "GET / HTTP/1.1\r\nA: b\r\n c\r\n\r\n",
+        "GET / HTTP/1.1\r\nA : b\r\n\r\n",
+        "GET / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+        "GET / HTTP/1.1\r\nUpgrade: h2c\r\n\r\n",
+        "GET / HTTP/1.1\r\nConnection: Upgrade\r\n\r\n",
+        "GET / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 1\r\n\r\n",
+        "GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(unhandled); ++i) {
+        ASSERT_FALSE(brpc::FastParseHttpHeaders(
+            unhandled[i], strlen(unhandled[i]), &h)) << unhandled[i];
+    }
+}
+
+struct ParsedHttpMessage {
+    ssize_t rc;
+    bool completed;
+    std::string headers;
+    std::string body;
+};
+
+static ParsedHttpMessage ParseWithHttpMessage(const std::string& data,
+                                              bool fast_path) {
+    brpc::FLAGS_http_parser_fast_path = fast_path;
+    brpc::HttpMessage msg;
+    butil::IOBuf buf;
+    buf.append(data);
+    ParsedHttpMessage r;
+    r.rc = msg.ParseFromIOBuf(buf);
+    r.completed = msg.Completed();
+    std::ostringstream os;
+    const brpc::HttpHeader& h = msg.header();
+    os << h.method() << ' ' << h.uri() << ' ' << h.status_code()
+       << ' ' << h.major_version() << '.' << h.minor_version()
+       << ' ' << msg.parser().flags << ' ' << msg.parser().content_length
+       << ' ' << brpc::http_should_keep_alive(&msg.parser());
+    std::map<std::string, std::string> sorted(h.HeaderBegin(), h.HeaderEnd());
+    for (auto& kv : sorted) {
+        os << '\n' << kv.first << ": " << kv.second;
+    }
+    r.headers = os.str();
+    r.body = msg.body().to_string();
+    brpc::FLAGS_http_parser_fast_path = true;
+    return r;
+}
+
+TEST(HttpMessageTest, fast_path_same_as_http_parser) {
+    const char* const messages[] = {
+        "GET /a/b?c=d&e HTTP/1.1\r\nHost: x.com:80\r\nAccept: */*\r\n\r\n",
+        "POST /s/m HTTP/1.1\r\nContent-Length: 5\r\nConnection: close\r\n\r\nhello",
+        "POST /s/m HTTP/1.0\r\ncontent-length: 10\r\n\r\nhello",
+        "PUT /x HTTP/1.1\r\nCookie: a=1\r\nCookie: b=2\r\nX: 1\r\nx: 2\r\n\r\n",
+        "DELETE /x HTTP/1.0\r\nConnection: keep-alive\r\nEmpty:\r\nA:b \r\n\r\n",
+        "HEAD /x HTTP/1.1\r\nHost: h\r\n\r\n",
+        "OPTIONS /x HTTP/1.1\r\n\r\n",
+        "PATCH /%E4%BD%A0 HTTP/1.1\r\nContent-Length: 0\r\n\r\n",
+        "GET /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n",
+        "GET /a HTTP/1.1\r\nA: b\r\n c\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: 3\r\nSet-Cookie: a=1\r\nSet-Cookie: b=2\r\n\r\nabc",
+        "HTTP/1.1 204\r\n\r\n",
+        "HTTP/1.0 500 Internal Server Error\r\nServer: x\r\n\r\nbody until eof",
+        "HTTP/1.1 200 OK\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\nabcd",
+        "GET /a HTTP/1.1\r\nBad{Name: 1\r\n\r\n",
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(messages); ++i) {
+        const std::string data = messages[i];
+        // Also try headers of all sizes.
+        for (size_t len = 1; len <= data.size(); ++len) {
+            const std::string part = data.substr(0, len);
+            ParsedHttpMessage slow = ParseWithHttpMessage(part, false);
+            ParsedHttpMessage fast = ParseWithHttpMessage(part, true);
+            ASSERT_EQ(slow.rc, fast.rc) << part;
+            if (slow.rc < 0) {
+                continue;
+            }
+            ASSERT_EQ(slow.completed, fast.completed) << part;
+            ASSERT_EQ(slow.headers, fast.headers) << part;
+            ASSERT_EQ(slow.body, fast.body) << part;
+        }
+    }
+}
+
+TEST(HttpMessageTest, too_many_header_fields) {
+    const int32_t saved_max = brpc::FLAGS_http_max_header_fields;
+    brpc::FLAGS_http_max_header_fields = 10;
+    std::string data = "GET /a HTTP/1.1\r\n";
+    for (int i = 0; i < 10; ++i) {
+        butil::string_appendf(&data, "X-%d: %d\r\n", i, i);
+    }
+    const std::string accepted = data + "\r\n";
+    const std::string rejected = data + "X-10: 10\r\n\r\n";
+    for (int fast = 0; fast < 2; ++fast) {
+        ASSERT_GT(ParseWithHttpMessage(accepted, fast).rc, 0);
+        ASSERT_LT(ParseWithHttpMessage(rejected, fast).rc, 0);
+    }
+    brpc::FLAGS_http_max_header_fields = saved_max;
+}
+
 } //namespace
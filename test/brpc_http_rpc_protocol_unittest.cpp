@@ -1411,6 +1411,67 @@ TEST_F(HttpTest, http2_settings) {
     ASSERT_TRUE(ctx->_remote_settings.stream_window_size == (1u << 29) - 1);
 }
 
+TEST_F(HttpTest, http2_bdp_probe) {
+    brpc::policy::H2Context* ctx = new brpc::policy::H2Context(_socket.get(), NULL);
+    CHECK_EQ(ctx->Init(), 0);
+    _socket->initialize_parsing_context(&ctx);
+    ctx->_conn_state = brpc::policy::H2_CONNECTION_READY;
+    const int64_t stream_window = ctx->_unack_local_settings.stream_window_size;
+    const int64_t conn_window = ctx->local_conn_window_size();
+    ASSERT_EQ((int64_t)ctx->_unack_local_settings.connection_window_size, conn_window);
+
+    for (int round = 0; round < 2; ++round) {
+        // DATA starts a probe.
+        ctx->ProbeBdp(1024);
+        butil::IOPortal ping_buf;
+        ASSERT_EQ((ssize_t)brpc::policy::FRAME_HEAD_SIZE + 8,
+                  ping_buf.append_from_file_descriptor(_pipe_fds[0], 1024));
+        brpc::policy::H2FrameHead frame_head;
+        butil::IOBufBytesIterator it(ping_buf);
+        ctx->ConsumeFrameHead(it, &frame_head);
+        ASSERT_EQ(brpc::policy::H2_FRAME_PING, frame_head.type);
+        ASSERT_EQ(0, frame_head.flags);
+
+        // The remote side is limited by the stream-level window in the first
+        // round and by the connection-level window in the second round.
+        const int64_t bdp = (round == 0 ? stream_window : conn_window);
+        ctx->ProbeBdp(bdp);
+        char ackbuf[brpc::policy::FRAME_HEAD_SIZE + 8];
+        ping_buf.copy_to(ackbuf, sizeof(ackbuf));
+        ackbuf[4] = 0x01 /* H2_FLAGS_ACK */;
+        butil::IOBuf buf;
+        buf.append(ackbuf, sizeof(ackbuf));
+        brpc::policy::ParseH2Message(&buf, _socket.get(), false, NULL);
+        ASSERT_EQ(bdp, ctx->_bdp);
+        ASSERT_EQ(bdp * 2, (int64_t)ctx->_unack_local_settings.stream_window_size);
+
+        butil::IOPortal update_buf;
+        update_buf.append_from_file_descriptor(_pipe_fds[0], 1024);
+        butil::IOBufBytesIterator it2(update_buf);
+        ctx->ConsumeFrameHead(it2, &frame_head);
+        ASSERT_EQ(brpc::policy::H2_FRAME_SETTINGS, frame_head.type);
+        ASSERT_EQ(0, frame_head.flags);
+        if (round == 0) {
+            ASSERT_EQ(brpc::policy::FRAME_HEAD_SIZE + frame_head.payload_size,
+                      update_buf.size());
+            ASSERT_EQ(conn_window, ctx->local_conn_window_size());
+        } else {
+            ASSERT_EQ(brpc::policy::FRAME_HEAD_SIZE * 2 + frame_head.payload_size + 4,
+                      update_buf.size());
+            ASSERT_EQ(conn_window * 2, ctx->local_conn_window_size());
+        }
+    }
+
+    // Enlarged stream-level window takes effect after being acknowledged.
+    char settings_ack[brpc::policy::FRAME_HEAD_SIZE];
+    brpc::policy::SerializeFrameHead(settings_ack, 0, brpc::policy::H2_FRAME_SETTINGS,
+                                     0x01 /* H2_FLAGS_ACK */, 0);
+    butil::IOBuf buf;
+    buf.append(settings_ack, sizeof(settings_ack));
+    brpc::policy::ParseH2Message(&buf, _socket.get(), false, NULL);
+    ASSERT_EQ(conn_window * 2, (int64_t)ctx->local_settings().stream_window_size);
+}
+
 TEST_F(HttpTest, http2_invalid_settings) {
     {
         brpc::Server server;
@@ -2135,8 +2196,28 @@ TEST_F(HttpTest, grpc_auth_failed_response) {
 
     // For HTTP/2, the response format should be different from HTTP/1.1
     // Let's check if it contains HTTP/2 frame data
-    std::string response_str = buf.to_string();
-    EXPECT_GT(response_str.length(), 0);
+    EXPECT_GT(buf.length(), 0u);
+    // Header blocks may be huffman-encoded, decode them before checking.
+    std::string response_str;
+    brpc::HPacker decoder;
+    ASSERT_EQ(0, decoder.Init(4096));
+    while (buf.length() >= 9 /*FRAME_HEAD_SIZE*/) {
+        uint8_t head[9];
+        buf.cutn(head, sizeof(head));
+        const uint32_t length = ((uint32_t)head[0] << 16) |
+            ((uint32_t)head[1] << 8) | head[2];
+        butil::IOBuf payload;
+        buf.cutn(&payload, length);
+        if (head[3] != brpc::policy::H2_FRAME_HEADERS) {
+            response_str.append(payload.to_string());
+            continue;
+        }
+        while (!payload.empty()) {
+            brpc::HPacker::Header h;
+            ASSERT_GT(decoder.Decode(&payload, &h), 0);
+            response_str.append(h.name).append(": ").append(h.value).append("\n");
+        }
+    }
 
     // HTTP/2 gRPC response should contain:
     // 1. grpc-status header (error code)
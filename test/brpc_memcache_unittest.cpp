@@ -18,8 +18,10 @@
 #include <iostream>
 #include "butil/time.h"
 #include "butil/logging.h"
+#include "butil/sys_byteorder.h"
 #include <brpc/memcache.h>
 #include <brpc/channel.h>
+#include <brpc/policy/memcache_binary_header.h>
 #include <gtest/gtest.h>
 
 namespace brpc {
@@ -222,4 +224,102 @@ TEST_F(MemcacheTest, version) {
     ASSERT_TRUE(response.PopVersion(&version)) << response.LastError();
     std::cout << "version=" << version << std::endl;
 }
+TEST_F(MemcacheTest, multi_get_codec) {
+    brpc::MemcacheRequest request;
+    std::vector<butil::StringPiece> keys;
+    keys.push_back("k1");
+    keys.push_back("key2");
+    ASSERT_TRUE(request.MultiGet(keys));
+    // Only the NOOP is replied for sure.
+    ASSERT_EQ(1, request.pipelined_count());
+    ASSERT_EQ(24u * 3 + 2 + 4, request.raw_buffer().size());
+    ASSERT_TRUE(request.Get("k1"));
+    ASSERT_EQ(2, request.pipelined_count());
+
+    // Headers in MemcacheResponse are already converted to host order.
+    brpc::MemcacheResponse response;
+    butil::IOBuf& buf = response.raw_buffer();
+    const char* key = "key2";
+    const char* value = "value2";
+    const uint32_t raw_flags = butil::HostToNet32(0xdeadbeef);
+    brpc::policy::MemcacheResponseHeader header = {
+        brpc::policy::MC_MAGIC_RESPONSE, brpc::policy::MC_BINARY_GETKQ,
+        4, 4, brpc::policy::MC_BINARY_RAW_BYTES, 0, 4 + 4 + 6, 0, 12345 };
+    buf.append(&header, sizeof(header));
+    buf.append(&raw_flags, sizeof(raw_flags));
+    buf.append(key);
+    buf.append(value);
+    header.command = brpc::policy::MC_BINARY_NOOP;
+    header.key_length = 0;
+    header.extras_length = 0;
+    header.total_body_length = 0;
+    header.cas_value = 0;
+    buf.append(&header, sizeof(header));
+    std::vector<brpc::MemcacheResponse::Hit> hits;
+    ASSERT_TRUE(response.PopMultiGet(&hits)) << response.LastError();
+    ASSERT_EQ(1u, hits.size());
+    ASSERT_EQ("key2", hits[0].key);
+    ASSERT_EQ("value2", hits[0].value.to_string());
+    ASSERT_EQ(0xdeadbeef, hits[0].flags);
+    ASSERT_EQ(12345u, hits[0].cas_value);
+    ASSERT_TRUE(buf.empty());
+    ASSERT_FALSE(response.PopMultiGet(&hits));
+}
+
+TEST_F(MemcacheTest, multi_get) {
+    if (g_mc_pid < 0) {
+        puts("Skipped due to absence of memcached");
+        return;
+    }
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_MEMCACHE;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("list://0.0.0.0:" MEMCACHED_PORT,
+                              "c_murmurhash", &options));
+    brpc::MemcacheRequest request;
+    brpc::MemcacheResponse response;
+    brpc::Controller cntl;
+    request.Set("mk1", "v1", 1, 10, 0);
+    request.Set("mk3", "v3", 3, 10, 0);
+    request.Delete("mk2");
+    cntl.set_request_code(0);
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_TRUE(response.PopSet(NULL)) << response.LastError();
+    ASSERT_TRUE(response.PopSet(NULL)) << response.LastError();
+    response.PopDelete();
+
+    // Quiet GETs pipelined with normal operations.
+    cntl.Reset();
+    request.Clear();
+    response.raw_buffer().clear();
+    std::vector<butil::StringPiece> keys;
+    keys.push_back("mk1");
+    keys.push_back("mk2");
+    keys.push_back("mk3");
+    request.Get("mk1");
+    request.MultiGet(keys);
+    request.Version();
+    cntl.set_request_code(0);
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    std::string value;
+    ASSERT_TRUE(response.PopGet(&value, NULL, NULL)) << response.LastError();
+    ASSERT_EQ("v1", value);
+    std::vector<brpc::MemcacheResponse::Hit> hits;
+    ASSERT_TRUE(response.PopMultiGet(&hits)) << response.LastError();
+    ASSERT_EQ(2u, hits.size());
+    ASSERT_EQ("mk1", hits[0].key);
+    ASSERT_EQ("v1", hits[0].value.to_string());
+    ASSERT_EQ(1u, hits[0].flags);
+    ASSERT_EQ("mk3", hits[1].key);
+    ASSERT_EQ("v3", hits[1].value.to_string());
+    std::string version;
+    ASSERT_TRUE(response.PopVersion(&version)) << response.LastError();
+
+    cntl.Reset();
+    hits.clear();
+    ASSERT_EQ(0, brpc::MemcacheMultiGet(&channel, &cntl, keys, &hits));
+    ASSERT_EQ(2u, hits.size());
+}
 } //namespace
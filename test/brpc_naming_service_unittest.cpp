@@ -35,10 +35,14 @@
 #include "brpc/policy/nacos_naming_service.h"
 #include "echo.pb.h"
 #include "brpc/server.h"
+#include "brpc/socket.h"
+#include "brpc/details/naming_service_thread.h"
+#include "brpc/details/shared_naming_service.h"
 
 
 namespace brpc {
 DECLARE_int32(health_check_interval);
+DECLARE_string(ns_shared_dir);
 
 namespace policy {
 
@@ -269,6 +273,149 @@ TEST(NamingServiceTest, remotefile) {
     for (size_t i = 0; i < expected_servers.size(); ++i) {
         ASSERT_EQ(expected_servers[i], servers[i]);
     }
+
+    // Unchanged list yields no changes.
+    std::vector<brpc::ServerNode> added;
+    std::vector<brpc::ServerNode> removed;
+    ASSERT_EQ(0, rfns.GetServerChanges(
+                  "http://0.0.0.0:8635/UserNamingService/ListNames",
+                  &added, &removed));
+    ASSERT_TRUE(added.empty());
+    ASSERT_TRUE(removed.empty());
+}
+
+class IncrementalNamingService : public brpc::NamingService {
+public:
+    int RunNamingService(const char*,
+                         brpc::NamingServiceActions* actions) override {
+        std::vector<brpc::ServerNode> servers;
+        servers.push_back(Node(8001));
+        servers.push_back(Node(8002));
+        actions->ResetServers(servers);
+        std::vector<brpc::ServerNode> added(1, Node(8003));
+        std::vector<brpc::ServerNode> removed(1, Node(8001));
+        actions->UpdateServers(added, removed, 1);
+        // Stale version is ignored.
+        added.assign(1, Node(8004));
+        actions->UpdateServers(added, std::vector<brpc::ServerNode>(), 1);
+        // Adding existing servers or removing absent ones changes nothing.
+        added.assign(1, Node(8002));
+        removed.assign(1, Node(8005));
+        actions->UpdateServers(added, removed, 2);
+        // A server removed and added again in the same batch is kept.
+        added.assign(1, Node(8002));
+        removed.assign(1, Node(8002));
+        actions->UpdateServers(added, removed, 3);
+        return 0;
+    }
+    bool RunNamingServiceReturnsQuickly() override { return true; }
+    brpc::NamingService* New() const override {
+        return new IncrementalNamingService;
+    }
+    void Destroy() override { delete this; }
+    void Describe(std::ostream& os, const brpc::DescribeOptions&) const override {
+        os << "incremental";
+    }
+
+    static brpc::ServerNode Node(int port) {
+        butil::EndPoint pt;
+        butil::str2endpoint("127.0.0.1", port, &pt);
+        return brpc::ServerNode(pt);
+    }
+};
+
+class RecordingWatcher : public brpc::NamingServiceWatcher {
+public:
+    void OnAddedServers(const std::vector<brpc::ServerId>& servers) override {
+        for (size_t i = 0; i < servers.size(); ++i) {
+            brpc::SocketUniquePtr ptr;
+            ASSERT_EQ(0, brpc::Socket::Address(servers[i].id, &ptr));
+            ports.insert(ptr->remote_side().port);
+        }
+    }
+    void OnRemovedServers(const std::vector<brpc::ServerId>&) override {}
+
+    std::set<int> ports;
+};
+
+TEST(NamingServiceTest, shared_between_processes) {
+    char dir[] = "/tmp/brpc_ns_shared_XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    const std::string saved_dir = brpc::FLAGS_ns_shared_dir;
+    brpc::FLAGS_ns_shared_dir = dir;
+    brpc::SharedNamingService* publisher = new brpc::SharedNamingService(
+        new brpc::policy::ListNamingService, "list://shared");
+    brpc::SharedNamingService* reader = new brpc::SharedNamingService(
+        new brpc::policy::ListNamingService, "list://shared");
+    ASSERT_EQ(0, publisher->OpenSharedFile());
+    ASSERT_EQ(0, reader->OpenSharedFile());
+    ASSERT_EQ(publisher->_path, reader->_path);
+    std::vector<brpc::ServerNode> servers;
+    // Nothing published yet.
+    ASSERT_FALSE(reader->ReadIfChanged(&servers));
+
+    ASSERT_TRUE(publisher->TryLockSharedFile());
+    ASSERT_FALSE(reader->TryLockSharedFile());
+    std::set<brpc::ServerNode> published;
+    published.insert(IncrementalNamingService::Node(8001));
+    published.insert(brpc::ServerNode(
+                         IncrementalNamingService::Node(8002).addr, "tag2"));
+    publisher->Publish(published);
+    ASSERT_TRUE(reader->ReadIfChanged(&servers));
+    ASSERT_EQ(published, std::set<brpc::ServerNode>(servers.begin(),
+                                                    servers.end()));
+    // Unchanged version is not read again.
+    ASSERT_FALSE(reader->ReadIfChanged(&servers));
+
+    published.erase(IncrementalNamingService::Node(8001));
+    publisher->Publish(published);
+    ASSERT_TRUE(reader->ReadIfChanged(&servers));
+    ASSERT_EQ(1UL, servers.size());
+    ASSERT_EQ("tag2", servers[0].tag);
+
+    // The publisher quits in the middle of writing. Readers keep their
+    // lists instead of waiting for it forever.
+    // The version follows 4-byte magic and capacity in the shared file.
+    butil::atomic<uint64_t>* version =
+        reinterpret_cast<butil::atomic<uint64_t>*>(
+            reinterpret_cast<char*>(publisher->_header) + 8);
+    version->fetch_add(1, butil::memory_order_release);
+    publisher->Destroy();
+    ASSERT_FALSE(reader->ReadIfChanged(&servers));
+
+    // The reader takes over and publishes with even versions again.
+    ASSERT_TRUE(reader->TryLockSharedFile());
+    published.insert(IncrementalNamingService::Node(8003));
+    reader->Publish(published);
+    version = reinterpret_cast<butil::atomic<uint64_t>*>(
+        reinterpret_cast<char*>(reader->_header) + 8);
+    ASSERT_EQ(0UL, version->load() & 1);
+    brpc::SharedNamingService* reader2 = new brpc::SharedNamingService(
+        new brpc::policy::ListNamingService, "list://shared");
+    ASSERT_EQ(0, reader2->OpenSharedFile());
+    ASSERT_TRUE(reader2->ReadIfChanged(&servers));
+    ASSERT_EQ(published, std::set<brpc::ServerNode>(servers.begin(),
+                                                    servers.end()));
+    reader2->Destroy();
+    unlink(reader->_path.c_str());
+    reader->Destroy();
+    rmdir(dir);
+    brpc::FLAGS_ns_shared_dir = saved_dir;
+}
+
+TEST(NamingServiceTest, incremental_update) {
+    static IncrementalNamingService ns;
+    brpc::NamingServiceExtension()->RegisterOrDie("incremental", &ns);
+    butil::intrusive_ptr<brpc::NamingServiceThread> nsthread;
+    ASSERT_EQ(0, brpc::GetNamingServiceThread(&nsthread, "incremental://x",
+                                              NULL));
+    RecordingWatcher watcher;
+    ASSERT_EQ(0, nsthread->AddWatcher(&watcher));
+    std::set<int> expected_ports;
+    expected_ports.insert(8002);
+    expected_ports.insert(8003);
+    ASSERT_EQ(expected_ports, watcher.ports);
+    ASSERT_EQ(0, nsthread->RemoveWatcher(&watcher));
 }
 
 class ConsulNamingServiceImpl : public test::UserNamingService {
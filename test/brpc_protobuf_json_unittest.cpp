@@ -16,12 +16,17 @@
 // under the License.
 
 #include <sys/time.h>
+#include <locale.h>
 #include <gtest/gtest.h>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <google/protobuf/descriptor.pb.h>
+#include <google/protobuf/dynamic_message.h>
 #include <google/protobuf/text_format.h>
+#include "butil/fast_rand.h"
 #include "butil/iobuf.h"
+#include "butil/macros.h"
 #include "butil/string_printf.h"
 #include "butil/strings/string_util.h"
 #include "butil/third_party/rapidjson/rapidjson.h"
@@ -31,6 +36,8 @@
 #include "json2pb/pb_to_json.h"
 #include "json2pb/json_to_pb.h"
 #include "json2pb/encode_decode.h"
+#include "json2pb/rapidjson.h"
+#include "json2pb/structural_parser.h"
 #include "json2pb/zero_copy_stream_reader.h"
 #include "message.pb.h"
 #include "addressbook1.pb.h"
@@ -752,6 +759,33 @@ TEST_F(ProtobufJsonTest, json_to_pb_complex_perf_case) {
     ProfilerStop();
     avg_time1 /= times;
     printf("avg time to convert json to pb is %fus\n", avg_time1);
+
+    gss::message::gss_us_res_t expected;
+    {
+        butil::IOBufAsZeroCopyInputStream stream(buf);
+        ASSERT_TRUE(json2pb::JsonToProtoMessage(&stream, &expected, options, &error));
+    }
+    const json2pb::JsonParser parsers[] = {
+        json2pb::PARSE_BY_RAPIDJSON, json2pb::PARSE_BY_STRUCTURAL_INDEX };
+    for (json2pb::JsonParser parser : parsers) {
+        options.parser = parser;
+        float avg_time2 = 0;
+        for (int i = 0; i < times; i++) {
+            gss::message::gss_us_res_t data;
+            timer.start();
+            res = json2pb::JsonToProtoMessage(buf, &data, options, &error);
+            timer.stop();
+            avg_time2 += timer.u_elapsed();
+            ASSERT_TRUE(res) << error;
+            if (i == 0) {
+                ASSERT_EQ(expected.SerializeAsString(), data.SerializeAsString());
+            }
+        }
+        avg_time2 /= times;
+        printf("avg time to convert json in IOBuf to pb with %s is %fus\n",
+               parser == json2pb::PARSE_BY_RAPIDJSON ? "rapidjson" : "structural index",
+               avg_time2);
+    }
 }
 
 TEST_F(ProtobufJsonTest, json_to_pb_to_string_complex_perf_case) {
@@ -986,6 +1020,47 @@ TEST_F(ProtobufJsonTest, pb_to_json_map_case) {
                             "\"year\":2007}]}") != std::string::npos);
 }
 
+TEST_F(ProtobufJsonTest, dynamic_message_case) {
+    // Types not in the generated pool don't share field tables, results
+    // should be same as generated types anyway.
+    google::protobuf::FileDescriptorProto file_proto;
+    AddressComplex::descriptor()->file()->CopyTo(&file_proto);
+    google::protobuf::DescriptorPool pool;
+    ASSERT_TRUE(pool.BuildFile(file_proto) != NULL);
+    const google::protobuf::Descriptor* descriptor =
+        pool.FindMessageTypeByName("AddressComplex");
+    ASSERT_TRUE(descriptor != NULL);
+    google::protobuf::DynamicMessageFactory factory(&pool);
+
+    const std::string json = "{\"addr\":\"baidu.com\","
+        "\"friends\":{\"John\":[{\"school\":\"SJTU\",\"year\":2007},"
+        "{\"school\":\"MIT\",\"year\":2011}],"
+        "\"Jack\":[{\"school\":\"PKU\",\"year\":2009}]}}";
+    std::string expected;
+    std::string error;
+    AddressComplex generated;
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(json, &generated, &error)) << error;
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(generated, &expected, &error)) << error;
+
+    for (int i = 0; i < 2; ++i) {
+        std::unique_ptr<google::protobuf::Message> dynamic(
+            factory.GetPrototype(descriptor)->New());
+        ASSERT_TRUE(json2pb::JsonToProtoMessage(json, dynamic.get(), &error)) << error;
+        ASSERT_EQ(generated.SerializeAsString(), dynamic->SerializeAsString());
+        std::string output;
+        ASSERT_TRUE(json2pb::ProtoMessageToJson(*dynamic, &output, &error)) << error;
+        ASSERT_EQ(expected, output);
+
+        dynamic->Clear();
+        butil::IOBuf buf;
+        buf.append(json);
+        ASSERT_TRUE(json2pb::JsonToProtoMessage(buf, dynamic.get(),
+                                                json2pb::Json2PbOptions(), &error))
+            << error;
+        ASSERT_EQ(generated.SerializeAsString(), dynamic->SerializeAsString());
+    }
+}
+
 TEST_F(ProtobufJsonTest, pb_to_json_encode_decode) {
     JsonContextBodyEncDec json_data;
     json_data.set_type(80000);
@@ -1663,6 +1738,369 @@ TEST_F(ProtobufJsonTest, zero_copy_stream_to_json_normal_case) {
     ASSERT_EQ(1, person.datafloat());
 }
 
+// Split `json' into blocks of at most `block_size' bytes so that the parser
+// has to cross block boundaries.
+static void SplitIntoIOBuf(const std::string& json, size_t block_size,
+                           butil::IOBuf* buf) {
+    buf->clear();
+    for (size_t i = 0; i < json.size(); i += block_size) {
+        const size_t n = std::min(block_size, json.size() - i);
+        char* data = (char*)malloc(n);
+        memcpy(data, json.data() + i, n);
+        buf->append_user_data(data, n, free);
+    }
+}
+
+template <typename T>
+static void ExpectSameAsString(const std::string& json,
+                               const json2pb::Json2PbOptions& options) {
+    T expected;
+    std::string expected_error;
+    const bool expected_ok = json2pb::JsonToProtoMessage(
+        json, &expected, options, &expected_error);
+    const size_t block_sizes[] = { 1, 3, 7, json.size() + 1 };
+    for (size_t block_size : block_sizes) {
+        butil::IOBuf buf;
+        SplitIntoIOBuf(json, block_size, &buf);
+        T actual;
+        std::string error;
+        ASSERT_EQ(expected_ok, json2pb::JsonToProtoMessage(
+                      buf, &actual, options, &error)) << json << " " << error;
+        ASSERT_EQ(expected_error, error) << json;
+        if (expected_ok) {
+            ASSERT_EQ(expected.SerializeAsString(), actual.SerializeAsString())
+                << json;
+        }
+
+        json2pb::Json2PbOptions structural_options = options;
+        structural_options.parser = json2pb::PARSE_BY_STRUCTURAL_INDEX;
+        T actual2;
+        ASSERT_EQ(expected_ok, json2pb::JsonToProtoMessage(
+                      buf, &actual2, structural_options, &error)) << json << " " << error;
+        ASSERT_EQ(expected_error, error) << json;
+        if (expected_ok) {
+            ASSERT_EQ(expected.SerializeAsString(), actual2.SerializeAsString())
+                << json;
+        }
+    }
+    T actual;
+    std::string error;
+    json2pb::Json2PbOptions structural_options = options;
+    structural_options.parser = json2pb::PARSE_BY_STRUCTURAL_INDEX;
+    ASSERT_EQ(expected_ok, json2pb::JsonToProtoMessage(
+                  json, &actual, structural_options, &error)) << json << " " << error;
+    ASSERT_EQ(expected_error, error) << json;
+}
+
+TEST_F(ProtobufJsonTest, iobuf_to_pb_case) {
+    json2pb::Json2PbOptions options;
+    const char* const bodies[] = {
+        "{\"content\":[{\"distance\":1,\"unknown_member\":2,\"ext\":"
+        "{\"age\":1666666666, \"databyte\":\"d2VsY29tZQ==\", \"enumtype\":1},"
+        "\"uid\":\"someone\"},{\"distance\":10,\"unknown_member\":20,"
+        "\"ext\":{\"age\":1666666660, \"databyte\":\"d2VsY29tZQ==\","
+        "\"enumtype\":2},\"uid\":\"someone0\"}], \"judge\":false,"
+        "\"spur\":2, \"data\":[1,2,3,4,5,6,7,8,9,10]}",
+        "{\"content\":[{\"uid\":\"someone\"}],\"judge\":false,\"spur\":1}",
+        "{\"judge\":\"false\"}",
+        "{\"unknown\":{\"a\":[1,{\"b\":[]}],\"c\":null},\"judge\":true,"
+        "\"spur\":1.5,\"more\":[[],{}]}",
+        "{\"content\":{\"distance\":1},\"judge\":true,\"spur\":1}",
+        "{\"judge\":true,\"data\":[1,\"2\",3]}",
+        "{\"judge\":true,\"data\":[1,null,3]}",
+        "{\"judge\":null}",
+        "{\"judge\":true,\"content\":null}",
+        "{\"judge\":true,\"content\":[{\"distance\":1,\"ext\":[]}],\"spur\":1}",
+        "{\"judge\":true,\"type\":[\"x\"],\"spur\":{}}",
+        "{\"judge\":true",
+        "{\"judge\":tru}",
+        "[{\"judge\":true}]",
+        "",
+        "  ",
+        "1",
+    };
+    for (const char* body : bodies) {
+        ExpectSameAsString<JsonContextBody>(body, options);
+    }
+
+    const std::string map_json =
+        "{\"addr\":\"baidu.com\","
+        "\"numbers\":{\"tel\":123456,\"cell\":654321},"
+        "\"contacts\":{\"email\":\"frank@baidu.com\","
+        "               \"office\":\"Shanghai\"},"
+        "\"friends\":{\"John\":[{\"school\":\"SJTU\",\"year\":2007}]}}";
+    ExpectSameAsString<AddressNoMap>(map_json, options);
+    ExpectSameAsString<AddressIntMap>(map_json, options);
+    ExpectSameAsString<AddressStringMap>(map_json, options);
+    ExpectSameAsString<AddressComplex>(map_json, options);
+    ExpectSameAsString<AddressIntMap>(
+        "{\"addr\":\"baidu.com\",\"numbers\":[{\"key\":\"tel\",\"value\":1}]}",
+        options);
+    ExpectSameAsString<AddressIntMap>(
+        "{\"addr\":\"baidu.com\",\"numbers\":{\"tel\":\"x\"}}", options);
+    ExpectSameAsString<AddressComplex>(
+        "{\"addr\":\"baidu.com\",\"friends\":{\"John\":{\"school\":\"SJTU\"}}}",
+        options);
+
+    std::string nested_json;
+    for (int i = 0; i < DEEP_RECURSION_TEST_DEPTH; ++i) {
+        nested_json += "{\"child\":";
+    }
+    nested_json += "{\"data\":\"leaf\"}";
+    for (int i = 0; i < DEEP_RECURSION_TEST_DEPTH; ++i) {
+        nested_json += "}";
+    }
+    butil::IOBuf buf;
+    SplitIntoIOBuf(nested_json, 16, &buf);
+    test::RecursiveMessage msg;
+    std::string error;
+    ASSERT_FALSE(json2pb::JsonToProtoMessage(buf, &msg, options, &error));
+    ASSERT_EQ("Exceeded maximum recursion depth [RecursiveMessage]", error);
+
+    json2pb::Json2PbOptions options2;
+    options2.array_to_single_repeated = true;
+    ExpectSameAsString<AddressBookEncDec>(
+        "[{\"name\":\"foo\",\"id\":1}]", options2);
+    ExpectSameAsString<AddressBookEncDec>("[]", options2);
+    ExpectSameAsString<AddressBookEncDec>("[1]", options2);
+    ExpectSameAsString<JsonContextBody>("[{\"judge\":true}]", options2);
+}
+
+TEST_F(ProtobufJsonTest, iobuf_to_pb_remaining_bytes) {
+    const json2pb::JsonParser parsers[] = {
+        json2pb::PARSE_BY_RAPIDJSON, json2pb::PARSE_BY_STRUCTURAL_INDEX };
+    for (json2pb::JsonParser parser : parsers) {
+        json2pb::Json2PbOptions options;
+        options.allow_remaining_bytes_after_parsing = true;
+        options.parser = parser;
+        const std::string json = "{\"name\":\"hello\",\"id\":9,\"datadouble\":1} "
+                                 "{\"name\":\"world\",\"id\":1,\"datadouble\":2}";
+        butil::IOBuf buf;
+        SplitIntoIOBuf(json, 5, &buf);
+        Person person;
+        std::string error;
+        size_t offset = 0;
+        ASSERT_TRUE(json2pb::JsonToProtoMessage(
+                        buf, &person, options, &error, &offset)) << error;
+        ASSERT_EQ("hello", person.name());
+        ASSERT_EQ(9, person.id());
+        ASSERT_EQ(json.find('}') + 1, offset);
+
+        buf.pop_front(offset);
+        person.Clear();
+        ASSERT_TRUE(json2pb::JsonToProtoMessage(
+                        buf, &person, options, &error, &offset)) << error;
+        ASSERT_EQ("world", person.name());
+
+        buf.clear();
+        buf.append("  ");
+        ASSERT_FALSE(json2pb::JsonToProtoMessage(
+                         buf, &person, options, &error, &offset));
+        ASSERT_TRUE(error.empty());
+    }
+}
+
+// Records events of a rapidjson SAX handler as a string.
+class JsonEventRecorder {
+public:
+    bool Null() { _events += "n,"; return true; }
+    bool Bool(bool b) { _events += b ? "t," : "f,"; return true; }
+    bool AddInt(int i) { return Add("i", std::to_string(i)); }
+    bool AddUint(unsigned u) { return Add("u", std::to_string(u)); }
+    bool AddInt64(int64_t i) { return Add("I", std::to_string(i)); }
+    bool AddUint64(uint64_t u) { return Add("U", std::to_string(u)); }
+    bool Double(double d) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.12g", d);
+        return Add("d", buf);
+    }
+    bool String(const char* str, BUTIL_RAPIDJSON_NAMESPACE::SizeType len, bool) {
+        return Add("s", std::string(str, len));
+    }
+    bool Key(const char* str, BUTIL_RAPIDJSON_NAMESPACE::SizeType len, bool) {
+        return Add("k", std::string(str, len));
+    }
+    bool StartObject() { _events += "{,"; return true; }
+    bool EndObject(BUTIL_RAPIDJSON_NAMESPACE::SizeType n) {
+        return Add("}", std::to_string(n));
+    }
+    bool StartArray() { _events += "[,"; return true; }
+    bool EndArray(BUTIL_RAPIDJSON_NAMESPACE::SizeType n) {
+        return Add("]", std::to_string(n));
+    }
+    const std::string& events() const { return _events; }
+
+private:
+    bool Add(const char* type, const std::string& value) {
+        _events += type;
+        _events += '(';
+        _events += value;
+        _events += "),";
+        return true;
+    }
+    std::string _events;
+};
+
+static std::string RandomJsonString() {
+    static const char* const pieces[] = {
+        "a", "hello world", "\\\"", "\\\\", "\\\\\\\\\\\"", "\\n\\t",
+        "\\u00e9", "\\ud83d\\ude00", "\\/", "{[:,]}", "\xe4\xbd\xa0",
+        "0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz",
+    };
+    std::string s = "\"";
+    const int n = butil::fast_rand_less_than(6);
+    for (int i = 0; i < n; ++i) {
+        s += pieces[butil::fast_rand_less_than(arraysize(pieces))];
+    }
+    s += '"';
+    return s;
+}
+
+static std::string RandomSpaces() {
+    static const char* const spaces[] = { "", "", " ", "\n", " \t\r\n  " };
+    return spaces[butil::fast_rand_less_than(arraysize(spaces))];
+}
+
+static void RandomJson(int depth, std::string* out) {
+    static const char* const scalars[] = {
+        "0", "-0", "12", "-7", "4294967295", "4294967296", "-2147483648",
+        "-2147483649", "9223372036854775807", "-9223372036854775808",
+        "-9223372036854775809", "18446744073709551615", "18446744073709551616",
+        "1.5", "-0.25e3", "2E-2", "1e10", "true", "false", "null",
+    };
+    const int type = depth > 4 ? 2 + butil::fast_rand_less_than(2)
+                               : butil::fast_rand_less_than(4);
+    *out += RandomSpaces();
+    if (type == 0) {
+        *out += '{';
+        const int n = butil::fast_rand_less_than(5);
+        for (int i = 0; i < n; ++i) {
+            if (i) {
+                *out += ',';
+            }
+            *out += RandomSpaces() + RandomJsonString() + RandomSpaces() + ':';
+            RandomJson(depth + 1, out);
+        }
+        *out += RandomSpaces() + '}';
+    } else if (type == 1) {
+        *out += '[';
+        const int n = butil::fast_rand_less_than(5);
+        for (int i = 0; i < n; ++i) {
+            if (i) {
+                *out += ',';
+            }
+            RandomJson(depth + 1, out);
+        }
+        *out += RandomSpaces() + ']';
+    } else if (type == 2) {
+        *out += RandomJsonString();
+    } else {
+        *out += scalars[butil::fast_rand_less_than(arraysize(scalars))];
+    }
+    *out += RandomSpaces();
+}
+
+static void ExpectSameEvents(const std::string& json) {
+    JsonEventRecorder expected;
+    BUTIL_RAPIDJSON_NAMESPACE::StringStream stream(json.c_str());
+    BUTIL_RAPIDJSON_NAMESPACE::Reader reader;
+    const BUTIL_RAPIDJSON_NAMESPACE::ParseResult expected_res =
+        reader.Parse<BUTIL_RAPIDJSON_NAMESPACE::kParseDefaultFlags>(stream, expected);
+    JsonEventRecorder actual;
+    json2pb::StructuralParser parser(json.data(), json.size());
+    const BUTIL_RAPIDJSON_NAMESPACE::ParseResult res = parser.Parse(actual, false);
+    ASSERT_EQ(expected_res.Code(), res.Code()) << json;
+    ASSERT_EQ(expected.events(), actual.events()) << json;
+}
+
+TEST_F(ProtobufJsonTest, structural_parser_case) {
+    const char* const jsons[] = {
+        "", " ", "{}", "[]", "1", "\"abc\"", "{\"a\":1}", "[1,2,3]",
+        "{\"a\":[1,{\"b\":null}],\"c\":\"\\u4f60\"}",
+        "{\"a\" 1}", "{\"a\":}", "{\"a\":1,}", "{1:2}", "{\"a\":1",
+        "[1,]", "[1 2]", "[", "]", "{", "}", "[1,2", "\"abc", "12a", "[12a]",
+        "truex", "[tru]", "nul", "-", "1.", "1e", "1e+", "01", "1 2", "{} {}",
+        "\"\\x\"", "\"\\u12\"", "\"\\ud800\"", "\"\\ud800\\u0041\"",
+        "\"a\tb\"", "1e400", "[\"a\"\"b\"]", "{\"a\":1\"b\":2}",
+    };
+    for (const char* json : jsons) {
+        ExpectSameEvents(json);
+    }
+    for (int i = 0; i < 2000; ++i) {
+        std::string json;
+        RandomJson(0, &json);
+        ExpectSameEvents(json);
+        // Break the json somewhere.
+        const size_t pos = butil::fast_rand_less_than(json.size() + 1);
+        std::string broken = json;
+        switch (butil::fast_rand_less_than(3)) {
+        case 0: broken.erase(pos, 1); break;
+        case 1: broken.insert(pos, 1, "{}[]:,\"\\ax1"[butil::fast_rand_less_than(11)]); break;
+        case 2: broken.resize(pos); break;
+        }
+        JsonEventRecorder expected;
+        BUTIL_RAPIDJSON_NAMESPACE::StringStream stream(broken.c_str());
+        BUTIL_RAPIDJSON_NAMESPACE::Reader reader;
+        const bool expected_ok = !reader.Parse<BUTIL_RAPIDJSON_NAMESPACE::kParseDefaultFlags>(
+            stream, expected).IsError();
+        JsonEventRecorder actual;
+        json2pb::StructuralParser parser(broken.data(), broken.size());
+        ASSERT_EQ(expected_ok, !parser.Parse(actual, false).IsError()) << broken;
+        if (expected_ok) {
+            ASSERT_EQ(expected.events(), actual.events()) << broken;
+        }
+    }
+}
+
+TEST_F(ProtobufJsonTest, structural_parser_ignores_locale) {
+    // Locales using ',' as the decimal point.
+    const char* const locales[] = { "de_DE.UTF-8", "fr_FR.UTF-8", "ru_RU.UTF-8" };
+    const char* old = setlocale(LC_NUMERIC, NULL);
+    const std::string saved = old ? old : "C";
+    const char* used = NULL;
+    for (const char* l : locales) {
+        if (setlocale(LC_NUMERIC, l) != NULL) {
+            used = l;
+            break;
+        }
+    }
+    ExpectSameEvents("[1.5,-0.25e3,2E-2,0.1,"
+                     "3.14159265358979323846264338327950288419716939937510582]");
+    setlocale(LC_NUMERIC, saved.c_str());
+    if (used == NULL) {
+        std::cout << "No locale with ',' as the decimal point" << std::endl;
+    }
+}
+
+TEST_F(ProtobufJsonTest, pb_to_iobuf_case) {
+    Person person;
+    person.set_name("hello");
+    person.set_id(9);
+    person.set_datadouble(2.2);
+    person.set_datafloat(1);
+    json2pb::Pb2JsonOptions options;
+    butil::IOBuf buf;
+    buf.append("prefix");
+    std::string error;
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(person, &buf, options, &error)) << error;
+    ASSERT_EQ("prefix{\"name\":\"hello\",\"id\":9,\"datadouble\":2.2,\"datafloat\":1.0}",
+              buf.to_string());
+
+    std::string expected;
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(person, &expected, options, &error));
+    buf.clear();
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(person, &buf, options, &error));
+    ASSERT_EQ(expected, buf.to_string());
+
+    // Nothing is appended if required fields are missing.
+    Person incomplete;
+    incomplete.set_name("hello");
+    buf.clear();
+    buf.append("prefix");
+    ASSERT_FALSE(json2pb::ProtoMessageToJson(incomplete, &buf, options, &error));
+    ASSERT_EQ("prefix", buf.to_string());
+}
+
 TEST_F(ProtobufJsonTest, extension_case) {
     std::string json = "{\"name\":\"hello\",\"id\":9,\"datadouble\":2.2,\"datafloat\":1.0,\"hobby\":\"coding\"}";
     Person person;
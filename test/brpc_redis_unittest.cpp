@@ -16,21 +16,27 @@
 // under the License.
 
 
+#include <locale.h>
 #include <iostream>
+#include <limits>
+#include <sstream>
 #include <unordered_map>
 #include <butil/time.h>
 #include <butil/logging.h>
+#include <bthread/countdown_event.h>
 #include <brpc/redis.h>
 #include <brpc/channel.h>
 #include <brpc/policy/redis_authenticator.h>
 #include <brpc/server.h>
 #include <brpc/redis_command.h>
+#include <brpc/redis_cluster_channel.h>
 #include <gtest/gtest.h>
 #include <gflags/gflags.h>
 
 namespace brpc {
 DECLARE_int32(idle_timeout_second);
 DECLARE_int32(redis_max_allocation_size);
+DECLARE_bool(redis_reference_bulk_strings);
 }
 
 int main(int argc, char* argv[]) {
@@ -830,6 +836,194 @@ TEST_F(RedisTest, redis_reply_codec) {
     }
 }
 
+TEST_F(RedisTest, resp3_reply_codec) {
+    butil::Arena arena;
+    // double, boolean, null and big number
+    {
+        butil::IOBuf buf;
+        buf.append(",3.25\r\n#t\r\n#f\r\n_\r\n(3492890328409238509324850943850943825024385\r\n");
+        brpc::RedisReply r(&arena);
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r.is_double());
+        ASSERT_EQ(3.25, r.double_value());
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r.is_boolean());
+        ASSERT_TRUE(r.boolean());
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r.is_boolean());
+        ASSERT_FALSE(r.boolean());
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r.is_nil());
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r.is_bignum());
+        ASSERT_STREQ("3492890328409238509324850943850943825024385", r.c_str());
+        ASSERT_TRUE(buf.empty());
+
+        butil::IOBufAppender appender;
+        r.SetDouble(-1.5);
+        ASSERT_TRUE(r.SerializeTo(&appender));
+        r.SetBoolean(true);
+        ASSERT_TRUE(r.SerializeTo(&appender));
+        appender.move_to(buf);
+        ASSERT_EQ(",-1.5\r\n#t\r\n", buf.to_string());
+    }
+    // bulk error and verbatim string
+    {
+        butil::IOBuf buf;
+        buf.append("!21\r\nSYNTAX invalid syntax\r\n=15\r\ntxt:Some string\r\n");
+        brpc::RedisReply r(&arena);
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r.is_error());
+        ASSERT_STREQ("SYNTAX invalid syntax", r.error_message());
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r.is_string());
+        ASSERT_STREQ("Some string", r.c_str());
+    }
+    // map, set and push
+    {
+        butil::IOBuf buf;
+        buf.append("%2\r\n+first\r\n:1\r\n+second\r\n~2\r\n:2\r\n:3\r\n"
+                   ">2\r\n+message\r\n$5\r\nhello\r\n");
+        brpc::RedisReply r(&arena);
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r.is_map());
+        ASSERT_EQ(4ul, r.size());
+        ASSERT_STREQ("first", r[0].c_str());
+        ASSERT_EQ(1, r[1].integer());
+        ASSERT_STREQ("second", r[2].c_str());
+        ASSERT_TRUE(r[3].is_set());
+        ASSERT_EQ(2ul, r[3].size());
+        ASSERT_EQ(3, r[3][1].integer());
+        std::ostringstream os;
+        os << r;
+        ASSERT_EQ("{first: (integer) 1, second: [(integer) 2, (integer) 3]}", os.str());
+
+        butil::IOBufAppender appender;
+        ASSERT_TRUE(r.SerializeTo(&appender));
+        butil::IOBuf out;
+        appender.move_to(out);
+        ASSERT_EQ("%2\r\n+first\r\n:1\r\n+second\r\n~2\r\n:2\r\n:3\r\n", out.to_string());
+
+        brpc::RedisReply r2(&arena);
+        ASSERT_EQ(brpc::PARSE_OK, r2.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r2.is_push());
+        ASSERT_STREQ("hello", r2[1].c_str());
+    }
+    // map is parsed incrementally.
+    {
+        const std::string data = "%2\r\n$3\r\nfoo\r\n:1\r\n$3\r\nbar\r\n:2\r\n";
+        butil::IOBuf buf;
+        brpc::RedisReply r(&arena);
+        for (size_t i = 0; i < data.size() - 1; ++i) {
+            buf.push_back(data[i]);
+            ASSERT_EQ(brpc::PARSE_ERROR_NOT_ENOUGH_DATA, r.ConsumePartialIOBuf(buf));
+        }
+        buf.push_back(data.back());
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r.is_map());
+        ASSERT_STREQ("bar", r[2].c_str());
+        ASSERT_EQ(2, r[3].integer());
+    }
+    // attributes are not supported.
+    {
+        butil::IOBuf buf;
+        buf.append("|1\r\n+key-popularity\r\n%1\r\n$1\r\na\r\n,0.19\r\n");
+        brpc::RedisReply r(&arena);
+        ASSERT_EQ(brpc::PARSE_ERROR_ABSOLUTELY_WRONG, r.ConsumePartialIOBuf(buf));
+    }
+}
+
+TEST_F(RedisTest, resp3_double_ignores_locale) {
+    // Locales using ',' as the decimal point.
+    const char* const locales[] = { "de_DE.UTF-8", "fr_FR.UTF-8", "ru_RU.UTF-8" };
+    const char* old = setlocale(LC_NUMERIC, NULL);
+    const std::string saved = old ? old : "C";
+    const char* used = NULL;
+    for (const char* l : locales) {
+        if (setlocale(LC_NUMERIC, l) != NULL) {
+            used = l;
+            break;
+        }
+    }
+    butil::Arena arena;
+    butil::IOBuf buf;
+    buf.append(",3.14\r\n,-2.5e-3\r\n,inf\r\n,-inf\r\n");
+    brpc::RedisReply r(&arena);
+    ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+    ASSERT_EQ(3.14, r.double_value());
+    ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+    ASSERT_EQ(-2.5e-3, r.double_value());
+    ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+    ASSERT_EQ(std::numeric_limits<double>::infinity(), r.double_value());
+    ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+    ASSERT_EQ(-std::numeric_limits<double>::infinity(), r.double_value());
+
+    butil::IOBufAppender appender;
+    r.SetDouble(0.1);
+    ASSERT_TRUE(r.SerializeTo(&appender));
+    r.SetDouble(-1.25e-20);
+    ASSERT_TRUE(r.SerializeTo(&appender));
+    r.SetDouble(-std::numeric_limits<double>::infinity());
+    ASSERT_TRUE(r.SerializeTo(&appender));
+    appender.move_to(buf);
+    setlocale(LC_NUMERIC, saved.c_str());
+    ASSERT_EQ(",0.1\r\n,-1.25e-20\r\n,-inf\r\n", buf.to_string());
+    if (used == NULL) {
+        std::cout << "No locale with ',' as the decimal point" << std::endl;
+    }
+}
+
+TEST_F(RedisTest, referenced_bulk_string) {
+    const std::string value(100, 'v');
+    butil::IOBuf buf;
+    buf.append("*2\r\n$100\r\n" + value + "\r\n$5\r\nshort\r\n");
+    butil::IOBuf pinned;
+    butil::Arena arena;
+    brpc::RedisReply r(&arena);
+    ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf, &pinned));
+    ASSERT_TRUE(buf.empty());
+    // The long string is referenced instead of being copied.
+    ASSERT_EQ(value.size(), pinned.size());
+    ASSERT_EQ(pinned.backing_block(0).data(), r[0].data().data());
+    ASSERT_EQ(value, r[0].data().as_string());
+    ASSERT_STREQ("short", r[1].c_str());
+
+    // CopyFromDifferentArena does not reference `pinned'.
+    butil::Arena arena2;
+    brpc::RedisReply r2(&arena2);
+    r2.CopyFromDifferentArena(r);
+    ASSERT_NE(r[0].data().data(), r2[0].data().data());
+    ASSERT_EQ(value, r2[0].c_str());
+
+    // c_str() does not modify the reply.
+    ASSERT_STREQ("", r[0].c_str());
+    ASSERT_EQ(pinned.backing_block(0).data(), r[0].data().data());
+
+    // Long errors are copied for error_message().
+    const std::string error(100, 'e');
+    buf.append("!100\r\n" + error + "\r\n");
+    ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf, &pinned));
+    ASSERT_EQ(error, r.error_message());
+
+    // Strings of RedisResponse are copied by default.
+    buf.append("$100\r\n" + value + "\r\n");
+    brpc::RedisResponse resp;
+    ASSERT_EQ(brpc::PARSE_OK, resp.ConsumePartialIOBuf(buf, 1));
+    ASSERT_EQ(value, resp.reply(0).c_str());
+
+    // and pinned by itself if they're referenced.
+    brpc::FLAGS_redis_reference_bulk_strings = true;
+    buf.append("$100\r\n" + value + "\r\n");
+    resp.Clear();
+    ASSERT_EQ(brpc::PARSE_OK, resp.ConsumePartialIOBuf(buf, 1));
+    brpc::FLAGS_redis_reference_bulk_strings = false;
+    brpc::RedisResponse resp2;
+    resp2.Swap(&resp);
+    resp.Clear();
+    ASSERT_EQ(value, resp2.reply(0).data().as_string());
+    ASSERT_STREQ("", resp2.reply(0).c_str());
+}
+
 butil::Mutex s_mutex;
 std::unordered_map<std::string, std::string> m;
 std::unordered_map<std::string, int64_t> int_map;
@@ -1352,6 +1546,111 @@ TEST_F(RedisTest, server_handle_pipeline) {
     ASSERT_STREQ(response.reply(7).c_str(), "world");
 }
 
+// Runs leading GET/SET of a read together under one lock, and also handles
+// them one by one when they follow other commands.
+class BatchKVHandler : public brpc::RedisBatchCommandHandler
+                     , public brpc::RedisCommandHandler {
+public:
+    BatchKVHandler() : _nbatch(0), _nbatched_command(0) {}
+
+    int Run(brpc::RedisConnContext* ctx,
+            const std::vector<butil::StringPiece>* commands,
+            int ncommand,
+            butil::IOBufAppender* output) override {
+        BAIDU_SCOPED_LOCK(_mutex);
+        int i = 0;
+        for (; i < ncommand; ++i) {
+            if (commands[i][0] != "get" && commands[i][0] != "set") {
+                break;
+            }
+            brpc::RedisReply reply(&ctx->arena);
+            DoKV(commands[i], &reply);
+            reply.SerializeTo(output);
+        }
+        ++_nbatch;
+        _nbatched_command += i;
+        return i;
+    }
+
+    brpc::RedisCommandHandlerResult Run(const std::vector<butil::StringPiece>& args,
+                                        brpc::RedisReply* output,
+                                        bool) override {
+        BAIDU_SCOPED_LOCK(_mutex);
+        DoKV(args, output);
+        return brpc::REDIS_CMD_HANDLED;
+    }
+
+    void DoKV(const std::vector<butil::StringPiece>& args, brpc::RedisReply* output) {
+        if (args[0] == "set") {
+            _kv[args[1].as_string()] = args[2].as_string();
+            output->SetStatus("OK");
+            return;
+        }
+        auto it = _kv.find(args[1].as_string());
+        if (it != _kv.end()) {
+            output->SetString(it->second);
+        } else {
+            output->SetNullString();
+        }
+    }
+
+    butil::Mutex _mutex;
+    std::unordered_map<std::string, std::string> _kv;
+    int _nbatch;
+    int _nbatched_command;
+};
+
+class PingCommandHandler : public brpc::RedisCommandHandler {
+public:
+    brpc::RedisCommandHandlerResult Run(const std::vector<butil::StringPiece>&,
+                                        brpc::RedisReply* output,
+                                        bool) override {
+        output->SetStatus("PONG");
+        return brpc::REDIS_CMD_HANDLED;
+    }
+};
+
+TEST_F(RedisTest, server_batch_command_handler) {
+    brpc::Server server;
+    brpc::ServerOptions server_options;
+    brpc::RedisService* rs = new brpc::RedisService;
+    BatchKVHandler* kv = new BatchKVHandler;
+    rs->SetBatchCommandHandler(kv);
+    rs->AddCommandHandler("get", kv);
+    rs->AddCommandHandler("set", kv);
+    rs->AddCommandHandler("ping", new PingCommandHandler);
+    server_options.redis_service = rs;
+    brpc::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_REDIS;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+
+    brpc::RedisRequest request;
+    brpc::RedisResponse response;
+    brpc::Controller cntl;
+    ASSERT_TRUE(request.AddCommand("set k1 v1"));
+    ASSERT_TRUE(request.AddCommand("set k2 v2"));
+    ASSERT_TRUE(request.AddCommand("get k1"));
+    ASSERT_TRUE(request.AddCommand("ping"));
+    ASSERT_TRUE(request.AddCommand("get k2"));
+    ASSERT_TRUE(request.AddCommand("get k3"));
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(6, response.reply_size());
+    ASSERT_STREQ("OK", response.reply(0).c_str());
+    ASSERT_STREQ("OK", response.reply(1).c_str());
+    ASSERT_STREQ("v1", response.reply(2).c_str());
+    ASSERT_STREQ("PONG", response.reply(3).c_str());
+    ASSERT_STREQ("v2", response.reply(4).c_str());
+    ASSERT_TRUE(response.reply(5).is_nil());
+    // Commands of a request are written and usually read at once.
+    ASSERT_EQ(1, kv->_nbatch);
+    ASSERT_EQ(3, kv->_nbatched_command);
+}
+
 TEST_F(RedisTest, memory_allocation_limits) {
     int32_t original_limit = brpc::FLAGS_redis_max_allocation_size;
     brpc::FLAGS_redis_max_allocation_size = 1024;
@@ -1476,4 +1775,340 @@ TEST_F(RedisTest, memory_allocation_limits) {
     brpc::FLAGS_redis_max_allocation_size = original_limit;
 }
 
+TEST_F(RedisTest, cluster_slot) {
+    ASSERT_EQ(12182, brpc::RedisClusterSlot("foo"));
+    ASSERT_EQ(5061, brpc::RedisClusterSlot("bar"));
+    ASSERT_EQ(866, brpc::RedisClusterSlot("hello"));
+    // Hash tags.
+    ASSERT_EQ(brpc::RedisClusterSlot("foo"), brpc::RedisClusterSlot("{foo}.bar"));
+    ASSERT_EQ(brpc::RedisClusterSlot("foo"), brpc::RedisClusterSlot("x{foo}{bar}"));
+    ASSERT_EQ(brpc::RedisClusterSlot("{}foo"), brpc::RedisClusterSlot("{}foo"));
+    ASSERT_NE(brpc::RedisClusterSlot("foo"), brpc::RedisClusterSlot("{}foo"));
+}
+
+// Nodes of a fake redis cluster sharing slots and data.
+struct FakeRedisCluster {
+    butil::Mutex mutex;
+    std::vector<int> ports;
+    std::vector<int> owners;  // node index owning the slot
+    // Keys of `migrating_slot' not in its owner are in `importing_node'.
+    int migrating_slot;
+    int importing_node;
+    std::vector<std::map<std::string, std::string> > data;
+    std::vector<int> ncommand;  // number of commands run by each node
+    int64_t delay_us;  // delay of running commands
+
+    FakeRedisCluster()
+        : owners(brpc::REDIS_CLUSTER_SLOTS, 0)
+        , migrating_slot(-1)
+        , importing_node(-1)
+        , delay_us(0) {}
+};
+
+class AskingSession : public brpc::Destroyable {
+public:
+    void Destroy() override { delete this; }
+};
+
+class ClusterNodeHandler : public brpc::RedisCommandHandler {
+public:
+    ClusterNodeHandler(FakeRedisCluster* cluster, int index)
+        : _cluster(cluster), _index(index) {}
+
+    brpc::RedisCommandHandlerResult Run(brpc::RedisConnContext* ctx,
+                                        const std::vector<butil::StringPiece>& args,
+                                        brpc::RedisReply* output,
+                                        bool /*flush_batched*/) override {
+        int64_t delay_us = 0;
+        {
+            BAIDU_SCOPED_LOCK(_cluster->mutex);
+            delay_us = _cluster->delay_us;
+        }
+        if (delay_us > 0) {
+            bthread_usleep(delay_us);
+        }
+        BAIDU_SCOPED_LOCK(_cluster->mutex);
+        const bool asking = (ctx->session != NULL);
+        ctx->reset_session(NULL);
+        if (args[0] == "asking") {
+            ctx->reset_session(new AskingSession);
+            output->SetStatus("OK");
+            return brpc::REDIS_CMD_HANDLED;
+        }
+        if (args[0] == "cluster") {
+            // Each slot is a range for simplicity.
+            std::vector<std::pair<int, int> > ranges;
+            for (int i = 0; i < brpc::REDIS_CLUSTER_SLOTS; ++i) {
+                if (i == 0 || _cluster->owners[i] != _cluster->owners[i - 1]) {
+                    ranges.push_back(std::make_pair(i, i));
+                } else {
+                    ranges.back().second = i;
+                }
+            }
+            output->SetArray(ranges.size());
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                brpc::RedisReply& r = (*output)[i];
+                r.SetArray(3);
+                r[0].SetInteger(ranges[i].first);
+                r[1].SetInteger(ranges[i].second);
+                r[2].SetArray(2);
+                r[2][0].SetString("127.0.0.1");
+                r[2][1].SetInteger(_cluster->ports[_cluster->owners[ranges[i].first]]);
+            }
+            return brpc::REDIS_CMD_HANDLED;
+        }
+        ++_cluster->ncommand[_index];
+        const bool multi_key = (args[0] == "mget" || args[0] == "mset" || args[0] == "del");
+        const size_t step = (args[0] == "mset" ? 2 : 1);
+        const int slot = brpc::RedisClusterSlot(args[1]);
+        for (size_t i = 1; multi_key && i < args.size(); i += step) {
+            if (brpc::RedisClusterSlot(args[i]) != slot) {
+                output->SetError("CROSSSLOT Keys in request don't hash to the same slot");
+                return brpc::REDIS_CMD_HANDLED;
+            }
+        }
+        std::map<std::string, std::string>& kv = _cluster->data[_index];
+        const int owner = _cluster->owners[slot];
+        if (owner != _index) {
+            if (!(asking && slot == _cluster->migrating_slot &&
+                  _index == _cluster->importing_node)) {
+                output->FormatError("MOVED %d 127.0.0.1:%d", slot, _cluster->ports[owner]);
+                return brpc::REDIS_CMD_HANDLED;
+            }
+        } else if (slot == _cluster->migrating_slot && args[0] == "get" &&
+                   kv.find(args[1].as_string()) == kv.end()) {
+            output->FormatError("ASK %d 127.0.0.1:%d", slot,
+                                _cluster->ports[_cluster->importing_node]);
+            return brpc::REDIS_CMD_HANDLED;
+        }
+        if (args[0] == "get") {
+            auto it = kv.find(args[1].as_string());
+            if (it != kv.end()) {
+                output->SetString(it->second);
+            } else {
+                output->SetNullString();
+            }
+        } else if (args[0] == "set") {
+            kv[args[1].as_string()] = args[2].as_string();
+            output->SetStatus("OK");
+        } else if (args[0] == "mget") {
+            output->SetArray(args.size() - 1);
+            for (size_t i = 1; i < args.size(); ++i) {
+                auto it = kv.find(args[i].as_string());
+                if (it != kv.end()) {
+                    (*output)[i - 1].SetString(it->second);
+                } else {
+                    (*output)[i - 1].SetNullString();
+                }
+            }
+        } else if (args[0] == "mset") {
+            for (size_t i = 1; i + 1 < args.size(); i += 2) {
+                kv[args[i].as_string()] = args[i + 1].as_string();
+            }
+            output->SetStatus("OK");
+        } else if (args[0] == "del") {
+            int64_t n = 0;
+            for (size_t i = 1; i < args.size(); ++i) {
+                n += kv.erase(args[i].as_string());
+            }
+            output->SetInteger(n);
+        }
+        return brpc::REDIS_CMD_HANDLED;
+    }
+
+private:
+    FakeRedisCluster* _cluster;
+    int _index;
+};
+
+TEST_F(RedisTest, cluster_channel) {
+    const int NNODE = 3;
+    FakeRedisCluster cluster;
+    cluster.data.resize(NNODE);
+    cluster.ncommand.resize(NNODE);
+    brpc::Server servers[NNODE];
+    for (int i = 0; i < NNODE; ++i) {
+        brpc::RedisService* rs = new brpc::RedisService;
+        ClusterNodeHandler* h = new ClusterNodeHandler(&cluster, i);
+        const char* const commands[] = {
+            "asking", "cluster", "get", "set", "mget", "mset", "del" };
+        for (size_t j = 0; j < arraysize(commands); ++j) {
+            ASSERT_TRUE(rs->AddCommandHandler(commands[j], h));
+        }
+        brpc::ServerOptions server_options;
+        server_options.redis_service = rs;
+        ASSERT_EQ(0, servers[i].Start("127.0.0.1", brpc::PortRange(8081, 8900),
+                                      &server_options));
+        cluster.ports.push_back(servers[i].listen_address().port);
+    }
+    for (int i = 0; i < brpc::REDIS_CLUSTER_SLOTS; ++i) {
+        cluster.owners[i] = i * NNODE / brpc::REDIS_CLUSTER_SLOTS;
+    }
+
+    brpc::RedisClusterChannel channel;
+    const std::string seed = butil::string_printf("127.0.0.1:%d", cluster.ports[1]);
+    ASSERT_EQ(0, channel.Init(seed.c_str(), NULL));
+
+    // Keys spread over all nodes.
+    const int NKEY = 30;
+    {
+        brpc::RedisRequest request;
+        for (int i = 0; i < NKEY; ++i) {
+            ASSERT_TRUE(request.AddCommand("set key%d value%d", i, i));
+        }
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(NKEY, response.reply_size());
+        for (int i = 0; i < NKEY; ++i) {
+            ASSERT_STREQ("OK", response.reply(i).c_str());
+        }
+        for (int i = 0; i < NNODE; ++i) {
+            ASSERT_LT(0, cluster.ncommand[i]);
+        }
+    }
+    // MGET is split by slots and merged in order of keys.
+    {
+        std::vector<std::string> keys;
+        keys.push_back("mget");
+        for (int i = NKEY; i >= 0; --i) {
+            keys.push_back(butil::string_printf("key%d", i));
+        }
+        std::vector<butil::StringPiece> components(keys.begin(), keys.end());
+        brpc::RedisRequest request;
+        ASSERT_TRUE(request.AddCommandByComponents(&components[0], components.size()));
+        ASSERT_TRUE(request.AddCommand("get key3"));
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(2, response.reply_size());
+        const brpc::RedisReply& r = response.reply(0);
+        ASSERT_TRUE(r.is_array());
+        ASSERT_EQ((size_t)NKEY + 1, r.size());
+        ASSERT_TRUE(r[0].is_nil());
+        for (int i = 1; i <= NKEY; ++i) {
+            ASSERT_EQ(butil::string_printf("value%d", NKEY - i), r[i].data());
+        }
+        ASSERT_STREQ("value3", response.reply(1).c_str());
+    }
+    // Slot of key1 is moved to another node.
+    const int slot = brpc::RedisClusterSlot("key1");
+    {
+        BAIDU_SCOPED_LOCK(cluster.mutex);
+        const int from = cluster.owners[slot];
+        const int to = (from + 1) % NNODE;
+        cluster.owners[slot] = to;
+        cluster.data[to]["key1"] = cluster.data[from]["key1"];
+        cluster.data[from].erase("key1");
+    }
+    {
+        brpc::RedisRequest request;
+        ASSERT_TRUE(request.AddCommand("get key1"));
+        ASSERT_TRUE(request.AddCommand("del key1 key2 nokey"));
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(2, response.reply_size());
+        ASSERT_STREQ("value1", response.reply(0).c_str());
+        ASSERT_EQ(2, response.reply(1).integer());
+    }
+    // The slot is being migrated to another node, keys which have been
+    // migrated are accessed by ASK.
+    {
+        BAIDU_SCOPED_LOCK(cluster.mutex);
+        const int from = cluster.owners[slot];
+        cluster.migrating_slot = slot;
+        cluster.importing_node = (from + 1) % NNODE;
+        cluster.data[from].erase("key1");
+        cluster.data[cluster.importing_node]["key1"] = "migrated";
+    }
+    {
+        brpc::RedisRequest request;
+        ASSERT_TRUE(request.AddCommand("get key1"));
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_STREQ("migrated", response.reply(0).c_str());
+    }
+    // Asynchronous call.
+    {
+        brpc::RedisRequest request;
+        ASSERT_TRUE(request.AddCommand("mset k1 v1 k2 v2 k3 v3"));
+        ASSERT_TRUE(request.AddCommand("mget k1 k2 k3"));
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        bthread::CountdownEvent event;
+        channel.CallMethod(NULL, &cntl, &request, &response,
+                           brpc::NewCallback(&event, &bthread::CountdownEvent::signal, 1, false));
+        ASSERT_EQ(0, event.wait());
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_STREQ("OK", response.reply(0).c_str());
+        ASSERT_EQ(3ul, response.reply(1).size());
+        ASSERT_STREQ("v3", response.reply(1)[2].c_str());
+    }
+    // Commands which may have been run by a node failing to respond are
+    // not resent.
+    {
+        BAIDU_SCOPED_LOCK(cluster.mutex);
+        cluster.delay_us = 300000;
+    }
+    {
+        const int node = cluster.owners[brpc::RedisClusterSlot("key5")];
+        const int ncommand = cluster.ncommand[node];
+        brpc::RedisRequest request;
+        ASSERT_TRUE(request.AddCommand("set key5 timedout"));
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        cntl.set_timeout_ms(100);
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_TRUE(response.reply(0).is_error());
+        ASSERT_TRUE(strstr(response.reply(0).error_message(),
+                           "fail to access redis node") != NULL);
+        bthread_usleep(500000);
+        BAIDU_SCOPED_LOCK(cluster.mutex);
+        ASSERT_EQ(ncommand + 1, cluster.ncommand[node]);
+        cluster.delay_us = 0;
+    }
+    // Slots of a stopped node fail over to another node, read-only commands
+    // to the stopped node are resent after slots are refreshed.
+    {
+        int failed = 0;
+        int to = 0;
+        {
+            BAIDU_SCOPED_LOCK(cluster.mutex);
+            failed = cluster.owners[brpc::RedisClusterSlot("key5")];
+            to = (failed + 1) % NNODE;
+        }
+        servers[failed].Stop(0);
+        servers[failed].Join();
+        {
+            BAIDU_SCOPED_LOCK(cluster.mutex);
+            for (int i = 0; i < brpc::REDIS_CLUSTER_SLOTS; ++i) {
+                if (cluster.owners[i] == failed) {
+                    cluster.owners[i] = to;
+                }
+            }
+            cluster.data[to].insert(cluster.data[failed].begin(),
+                                    cluster.data[failed].end());
+        }
+        brpc::RedisRequest request;
+        ASSERT_TRUE(request.AddCommand("get key5"));
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        cntl.set_timeout_ms(2000);
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_STREQ("timedout", response.reply(0).c_str());
+    }
+    for (int i = 0; i < NNODE; ++i) {
+        servers[i].Stop(0);
+        servers[i].Join();
+    }
+}
+
 } //namespace
@@ -67,9 +67,13 @@ int main(int argc, char* argv[]) {
 namespace brpc {
 DECLARE_bool(enable_threads_service);
 DECLARE_bool(enable_dir_service);
+DECLARE_int32(admission_queue_interval_ms);
+DECLARE_int32(admission_queue_target_ms);
 
 namespace policy {
 DECLARE_bool(use_http_error_code);
+DECLARE_bool(baidu_std_protocol_deliver_timeout_ms);
+DECLARE_bool(baidu_std_protocol_deliver_deadline);
 
 extern bool SerializeRpcMessage(const google::protobuf::Message& serializer,
                                 Controller& cntl, ContentType content_type,
@@ -1662,6 +1666,226 @@ TEST_F(ServerTest, max_concurrency) {
     ASSERT_FALSE(cntl4.Failed()) << cntl4.ErrorText();
 }
 
+TEST_F(ServerTest, admission_queue) {
+    const int saved_interval_ms = brpc::FLAGS_admission_queue_interval_ms;
+    brpc::FLAGS_admission_queue_interval_ms = 1000;
+    const int port = 9200;
+    brpc::Server server1;
+    EchoServiceImpl service1;
+    ASSERT_EQ(0, server1.AddService(&service1, brpc::SERVER_DOESNT_OWN_SERVICE));
+    server1.MaxConcurrencyOf("test.EchoService.Echo") = 1;
+    brpc::ServerOptions options;
+    options.enable_admission_queue = true;
+    ASSERT_EQ(0, server1.Start(port, &options));
+
+    brpc::Channel channel;
+    brpc::ChannelOptions chan_options;
+    chan_options.timeout_ms = 2000;
+    ASSERT_EQ(0, channel.Init("0.0.0.0", port, &chan_options));
+    test::EchoService_Stub stub(&channel);
+    test::EchoRequest req;
+    req.set_message(EXP_REQUEST);
+    req.set_sleep_us(100000);
+
+    brpc::Controller cntl1;
+    test::EchoResponse res1;
+    stub.Echo(&cntl1, &req, &res1, brpc::DoNothing());
+    bthread_usleep(20000);
+
+    // Queued instead of being rejected, the one with higher priority is
+    // admitted first though it arrived later.
+    req.set_sleep_us(50000);
+    brpc::Controller cntl_low;
+    test::EchoResponse res_low;
+    const int64_t low_start_us = butil::cpuwide_time_us();
+    stub.Echo(&cntl_low, &req, &res_low, brpc::DoNothing());
+    bthread_usleep(10000);
+    brpc::Controller cntl_high;
+    cntl_high.set_request_priority(10);
+    test::EchoResponse res_high;
+    const int64_t high_start_us = butil::cpuwide_time_us();
+    stub.Echo(&cntl_high, &req, &res_high, brpc::DoNothing());
+
+    brpc::Join(cntl1.call_id());
+    brpc::Join(cntl_low.call_id());
+    brpc::Join(cntl_high.call_id());
+    ASSERT_FALSE(cntl1.Failed()) << cntl1.ErrorText();
+    ASSERT_FALSE(cntl_low.Failed()) << cntl_low.ErrorText();
+    ASSERT_FALSE(cntl_high.Failed()) << cntl_high.ErrorText();
+    ASSERT_LT(high_start_us + cntl_high.latency_us(),
+              low_start_us + cntl_low.latency_us());
+
+    // A request which can't finish before its deadline is dropped without
+    // being processed.
+    brpc::policy::FLAGS_baidu_std_protocol_deliver_timeout_ms = true;
+    req.set_sleep_us(300000);
+    brpc::Controller cntl2;
+    test::EchoResponse res2;
+    stub.Echo(&cntl2, &req, &res2, brpc::DoNothing());
+    bthread_usleep(20000);
+    const int64_t count = service1.count.load();
+    brpc::Controller cntl3;
+    cntl3.set_timeout_ms(100);
+    req.clear_sleep_us();
+    test::EchoResponse res3;
+    stub.Echo(&cntl3, &req, &res3, NULL);
+    ASSERT_TRUE(cntl3.Failed());
+    brpc::Join(cntl2.call_id());
+    ASSERT_FALSE(cntl2.Failed()) << cntl2.ErrorText();
+    bthread_usleep(50000);
+    ASSERT_EQ(count, service1.count.load());
+
+    brpc::policy::FLAGS_baidu_std_protocol_deliver_timeout_ms = false;
+    brpc::FLAGS_admission_queue_interval_ms = saved_interval_ms;
+    server1.Stop(0);
+    server1.Join();
+}
+
+TEST_F(ServerTest, admission_queue_not_bypassed) {
+    const int saved_interval_ms = brpc::FLAGS_admission_queue_interval_ms;
+    const int saved_target_ms = brpc::FLAGS_admission_queue_target_ms;
+    // Queued requests should not be dropped by the standing queue.
+    brpc::FLAGS_admission_queue_interval_ms = 1000;
+    brpc::FLAGS_admission_queue_target_ms = 1000;
+    const int port = 9200;
+    brpc::Server server1;
+    EchoServiceImpl service1;
+    ASSERT_EQ(0, server1.AddService(&service1, brpc::SERVER_DOESNT_OWN_SERVICE));
+    server1.MaxConcurrencyOf("test.EchoService.Echo") = 1;
+    brpc::ServerOptions options;
+    options.enable_admission_queue = true;
+    ASSERT_EQ(0, server1.Start(port, &options));
+
+    brpc::Channel channel;
+    brpc::ChannelOptions chan_options;
+    chan_options.timeout_ms = 2000;
+    ASSERT_EQ(0, channel.Init("0.0.0.0", port, &chan_options));
+    test::EchoService_Stub stub(&channel);
+    test::EchoRequest req;
+    req.set_message(EXP_REQUEST);
+    req.set_sleep_us(200000);
+
+    brpc::Controller cntl1;
+    test::EchoResponse res1;
+    const int64_t start1_us = butil::cpuwide_time_us();
+    stub.Echo(&cntl1, &req, &res1, brpc::DoNothing());
+    bthread_usleep(20000);
+
+    req.set_sleep_us(30000);
+    brpc::Controller cntl_queued;
+    test::EchoResponse res_queued;
+    const int64_t queued_start_us = butil::cpuwide_time_us();
+    stub.Echo(&cntl_queued, &req, &res_queued, brpc::DoNothing());
+    bthread_usleep(20000);
+
+    // Slots become available while a request is queued. New requests with
+    // the same priority keep arriving, but none of them is admitted before
+    // the queued one.
+    server1.MaxConcurrencyOf("test.EchoService.Echo") = 2;
+    const int N = 5;
+    brpc::Controller cntls[N];
+    test::EchoResponse responses[N];
+    int64_t start_us[N];
+    for (int i = 0; i < N; ++i) {
+        start_us[i] = butil::cpuwide_time_us();
+        stub.Echo(&cntls[i], &req, &responses[i], brpc::DoNothing());
+        bthread_usleep(5000);
+    }
+
+    brpc::Join(cntl1.call_id());
+    brpc::Join(cntl_queued.call_id());
+    ASSERT_FALSE(cntl1.Failed()) << cntl1.ErrorText();
+    ASSERT_FALSE(cntl_queued.Failed()) << cntl_queued.ErrorText();
+    const int64_t queued_end_us = queued_start_us + cntl_queued.latency_us();
+    for (int i = 0; i < N; ++i) {
+        brpc::Join(cntls[i].call_id());
+        ASSERT_FALSE(cntls[i].Failed()) << cntls[i].ErrorText();
+        ASSERT_LT(queued_end_us, start_us[i] + cntls[i].latency_us()) << i;
+    }
+    // The queued request took the available slot instead of waiting for
+    // the first request to finish.
+    ASSERT_LT(queued_end_us, start1_us + cntl1.latency_us());
+
+    brpc::FLAGS_admission_queue_target_ms = saved_target_ms;
+    brpc::FLAGS_admission_queue_interval_ms = saved_interval_ms;
+    server1.Stop(0);
+    server1.Join();
+}
+
+class ChainedEchoService : public test::EchoService {
+public:
+    explicit ChainedEchoService(brpc::Channel* downstream)
+        : _downstream(downstream), remaining_deadline_us(-1)
+        , child_error_code(0), child_latency_us(0) {}
+
+    void Echo(google::protobuf::RpcController* cntl_base,
+              const test::EchoRequest* request,
+              test::EchoResponse* response,
+              google::protobuf::Closure* done) override {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = (brpc::Controller*)cntl_base;
+        remaining_deadline_us = cntl->remaining_deadline();
+        brpc::Controller child_cntl;
+        test::EchoService_Stub stub(_downstream);
+        stub.Echo(&child_cntl, request, response, NULL);
+        child_latency_us = child_cntl.latency_us();
+        child_error_code = child_cntl.ErrorCode();
+    }
+
+private:
+    brpc::Channel* _downstream;
+
+public:
+    butil::atomic<int64_t> remaining_deadline_us;
+    butil::atomic<int> child_error_code;
+    butil::atomic<int64_t> child_latency_us;
+};
+
+TEST_F(ServerTest, inherit_deadline) {
+    brpc::policy::FLAGS_baidu_std_protocol_deliver_deadline = true;
+    const int port = 9200;
+    brpc::Server server1;
+    EchoServiceImpl service1;
+    ASSERT_EQ(0, server1.AddService(&service1, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server1.Start(port, NULL));
+    brpc::Channel downstream;
+    brpc::ChannelOptions chan_options;
+    chan_options.timeout_ms = 2000;
+    ASSERT_EQ(0, downstream.Init("0.0.0.0", port, &chan_options));
+
+    brpc::Server server2;
+    ChainedEchoService service2(&downstream);
+    ASSERT_EQ(0, server2.AddService(&service2, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server2.Start(port + 1, NULL));
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("0.0.0.0", port + 1, NULL));
+
+    test::EchoService_Stub stub(&channel);
+    test::EchoRequest req;
+    req.set_message(EXP_REQUEST);
+    req.set_sleep_us(1000000);
+    test::EchoResponse res;
+    brpc::Controller cntl;
+    cntl.set_timeout_ms(200);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_TRUE(cntl.Failed());
+    for (int i = 0; i < 100 && service2.child_error_code == 0; ++i) {
+        bthread_usleep(10000);
+    }
+    // The downstream call is bounded by the deadline of the upstream one
+    // rather than its own timeout.
+    ASSERT_EQ(brpc::ERPCTIMEDOUT, service2.child_error_code);
+    ASSERT_LT(service2.child_latency_us, 500000);
+    ASSERT_GT(service2.remaining_deadline_us, 0);
+    ASSERT_LE(service2.remaining_deadline_us, 200000);
+
+    brpc::policy::FLAGS_baidu_std_protocol_deliver_deadline = false;
+    server2.Stop(0);
+    server2.Join();
+    server1.Stop(0);
+    server1.Join();
+}
+
 TEST_F(ServerTest, user_fields) {
     const int port = 9200;
     brpc::Server server;
@@ -25,9 +25,12 @@
 #include "butil/macros.h"
 #include "butil/iobuf.h"
 #include "butil/time.h"
+#include "butil/string_printf.h"
 #include "snappy_message.pb.h"
 #include "brpc/policy/snappy_compress.h"
 #include "brpc/policy/gzip_compress.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/policy/zstd_compress.h"
 
 typedef bool (*Compress)(const google::protobuf::Message&, butil::IOBuf*);
 typedef bool (*Decompress)(const butil::IOBuf&, google::protobuf::Message*);
@@ -253,3 +256,76 @@ TEST_F(test_compress_method, mass_snappy_iobuf) {
     ASSERT_TRUE(strcmp(check_str.c_str(), text) == 0);
     delete [] text;
 }
+
+// Compressed data of multiple blocks must be decoded no matter how the
+// blocks are split.
+static void CheckIOBufRoundTrip(bool (*compress)(const butil::IOBuf&, butil::IOBuf*),
+                                bool (*decompress)(const butil::IOBuf&, butil::IOBuf*)) {
+    butil::IOBuf buf;
+    for (int i = 0; i < 100000; ++i) {
+        buf.append(butil::string_printf("%d,", i % 977));
+    }
+    butil::IOBuf compressed;
+    ASSERT_TRUE(compress(buf, &compressed));
+    ASSERT_LT(compressed.size(), buf.size());
+    butil::IOBuf split;
+    std::string compressed_str = compressed.to_string();
+    for (size_t i = 0; i < compressed_str.size(); i += 1000) {
+        const size_t n = std::min((size_t)1000, compressed_str.size() - i);
+        void* block = malloc(n);
+        memcpy(block, compressed_str.data() + i, n);
+        split.append_user_data(block, n, free);
+    }
+    ASSERT_GT(split.backing_block_num(), 1UL);
+    butil::IOBuf check_buf;
+    ASSERT_TRUE(decompress(split, &check_buf));
+    ASSERT_TRUE(buf.equals(check_buf.to_string()));
+
+    // Truncated data is rejected.
+    butil::IOBuf truncated;
+    compressed.cutn(&truncated, compressed.size() / 2);
+    check_buf.clear();
+    ASSERT_FALSE(decompress(truncated, &check_buf));
+    // Contexts reused by the thread are not affected by the failure.
+    check_buf.clear();
+    ASSERT_TRUE(decompress(split, &check_buf));
+    ASSERT_TRUE(buf.equals(check_buf.to_string()));
+}
+
+TEST_F(test_compress_method, zstd_iobuf) {
+#ifdef BRPC_WITH_ZSTD
+    CheckIOBufRoundTrip(brpc::policy::ZstdCompress, brpc::policy::ZstdDecompress);
+    snappy_message::SnappyMessageProto old_msg;
+    old_msg.set_text("Hello World!");
+    old_msg.add_numbers(2);
+    butil::IOBuf buf;
+    ASSERT_TRUE(brpc::policy::ZstdCompress(old_msg, &buf));
+    snappy_message::SnappyMessageProto new_msg;
+    ASSERT_TRUE(brpc::policy::ZstdDecompress(buf, &new_msg));
+    ASSERT_EQ("Hello World!", new_msg.text());
+    ASSERT_EQ(1, new_msg.numbers_size());
+#else
+    butil::IOBuf buf, output_buf;
+    buf.append("this is a test");
+    ASSERT_FALSE(brpc::policy::ZstdCompress(buf, &output_buf));
+#endif
+}
+
+TEST_F(test_compress_method, lz4_iobuf) {
+#ifdef BRPC_WITH_LZ4
+    CheckIOBufRoundTrip(brpc::policy::Lz4Compress, brpc::policy::Lz4Decompress);
+    snappy_message::SnappyMessageProto old_msg;
+    old_msg.set_text("Hello World!");
+    old_msg.add_numbers(2);
+    butil::IOBuf buf;
+    ASSERT_TRUE(brpc::policy::Lz4Compress(old_msg, &buf));
+    snappy_message::SnappyMessageProto new_msg;
+    ASSERT_TRUE(brpc::policy::Lz4Decompress(buf, &new_msg));
+    ASSERT_EQ("Hello World!", new_msg.text());
+    ASSERT_EQ(1, new_msg.numbers_size());
+#else
+    butil::IOBuf buf, output_buf;
+    buf.append("this is a test");
+    ASSERT_FALSE(brpc::policy::Lz4Compress(buf, &output_buf));
+#endif
+}
@@ -0,0 +1,220 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <stdlib.h>
+#include <algorithm>
+#include <gtest/gtest.h>
+
+#ifdef ENABLE_THRIFT_FRAMED_PROTOCOL
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include "butil/iobuf.h"
+#include "brpc/details/thrift_utils.h"
+
+namespace {
+
+using apache::thrift::protocol::TMessageType;
+using brpc::policy::IOBufTransport;
+
+class ThriftProtocolTest : public testing::Test {
+};
+
+// Append `data' into `buf' as user blocks of `block_size' bytes at most.
+void AppendInBlocks(butil::IOBuf* buf, const std::string& data, size_t block_size) {
+    for (size_t i = 0; i < data.size(); i += block_size) {
+        const size_t n = std::min(block_size, data.size() - i);
+        char* p = (char*)malloc(n);
+        memcpy(p, data.data() + i, n);
+        ASSERT_EQ(0, buf->append_user_data(p, n, free));
+    }
+}
+
+std::string WriteMessageBegin(brpc::ThriftProtocolType protocol_type,
+                              const std::string& method_name,
+                              TMessageType mtype, uint32_t seq_id) {
+    std::string buf(brpc::policy::ThriftMessageBeginMaxSize(method_name), '\0');
+    const size_t n = brpc::policy::WriteThriftMessageBegin(
+        &buf[0], protocol_type, method_name, mtype, seq_id);
+    buf.resize(n);
+    return buf;
+}
+
+TEST_F(ThriftProtocolTest, message_begin_wire_format) {
+    const char binary[] = "\x80\x01\x00\x01\x00\x00\x00\x04ping\x00\x00\x00\x07";
+    ASSERT_EQ(std::string(binary, sizeof(binary) - 1),
+              WriteMessageBegin(brpc::THRIFT_BINARY_PROTOCOL, "ping",
+                                apache::thrift::protocol::T_CALL, 7));
+    // Protocol id, version 1 with type T_REPLY, varint seq_id and length.
+    const char compact[] = "\x82\x41\xac\x02\x04ping";
+    ASSERT_EQ(std::string(compact, sizeof(compact) - 1),
+              WriteMessageBegin(brpc::THRIFT_COMPACT_PROTOCOL, "ping",
+                                apache::thrift::protocol::T_REPLY, 300));
+}
+
+TEST_F(ThriftProtocolTest, message_begin_round_trip) {
+    const brpc::ThriftProtocolType protocols[] = {
+        brpc::THRIFT_BINARY_PROTOCOL, brpc::THRIFT_COMPACT_PROTOCOL };
+    const TMessageType mtypes[] = {
+        apache::thrift::protocol::T_CALL, apache::thrift::protocol::T_REPLY,
+        apache::thrift::protocol::T_EXCEPTION, apache::thrift::protocol::T_ONEWAY };
+    const uint32_t seq_ids[] = { 0, 1, 127, 128, 0x7fffffff, 0xffffffff };
+    const std::string method_names[] = { "", "Echo", std::string(256, 'm') };
+    for (brpc::ThriftProtocolType protocol_type : protocols) {
+        for (TMessageType mtype : mtypes) {
+            for (uint32_t seq_id : seq_ids) {
+                for (const std::string& method_name : method_names) {
+                    const std::string header =
+                        WriteMessageBegin(protocol_type, method_name, mtype, seq_id);
+                    ASSERT_LE(header.size(),
+                              brpc::policy::ThriftMessageBeginMaxSize(method_name));
+                    // The header may be split into blocks in any way.
+                    for (size_t block_size = 1; block_size <= 8; block_size *= 2) {
+                        butil::IOBuf body;
+                        AppendInBlocks(&body, header + "fields", block_size);
+                        std::string method_name2;
+                        TMessageType mtype2 = apache::thrift::protocol::T_CALL;
+                        uint32_t seq_id2 = 0;
+                        brpc::ThriftProtocolType protocol_type2 = brpc::THRIFT_BINARY_PROTOCOL;
+                        const butil::Status st = brpc::policy::ReadThriftMessageBegin(
+                            &body, &method_name2, &mtype2, &seq_id2, &protocol_type2);
+                        ASSERT_TRUE(st.ok()) << st;
+                        ASSERT_EQ(protocol_type, protocol_type2);
+                        ASSERT_EQ(method_name, method_name2);
+                        ASSERT_EQ(mtype, mtype2);
+                        ASSERT_EQ(seq_id, seq_id2);
+                        ASSERT_EQ("fields", body.to_string());
+                    }
+                }
+            }
+        }
+    }
+    // Too long method name.
+    butil::IOBuf body;
+    body.append(WriteMessageBegin(brpc::THRIFT_COMPACT_PROTOCOL, std::string(257, 'm'),
+                                  apache::thrift::protocol::T_CALL, 1));
+    std::string method_name;
+    TMessageType mtype;
+    uint32_t seq_id;
+    brpc::ThriftProtocolType protocol_type;
+    ASSERT_FALSE(brpc::policy::ReadThriftMessageBegin(
+                     &body, &method_name, &mtype, &seq_id, &protocol_type).ok());
+}
+
+TEST_F(ThriftProtocolTest, iobuf_transport_borrow_and_consume) {
+    butil::IOBuf buf;
+    AppendInBlocks(&buf, "0123456789", 4);
+    IOBufTransport trans(&buf);
+    // Borrow the whole first block.
+    uint32_t len = 4;
+    const uint8_t* p = trans.borrow(NULL, &len);
+    ASSERT_TRUE(p != NULL);
+    ASSERT_EQ(4u, len);
+    ASSERT_EQ(0, memcmp(p, "0123", 4));
+    len = 2;
+    p = trans.borrow(NULL, &len);
+    ASSERT_TRUE(p != NULL);
+    ASSERT_EQ(4u, len);
+    trans.consume(3);
+    // Data across blocks can't be borrowed.
+    len = 2;
+    ASSERT_TRUE(trans.borrow(NULL, &len) == NULL);
+    uint8_t tmp[8];
+    ASSERT_EQ(4u, trans.read(tmp, 4));
+    ASSERT_EQ(0, memcmp(tmp, "3456", 4));
+    len = 1;
+    p = trans.borrow(NULL, &len);
+    ASSERT_TRUE(p != NULL);
+    ASSERT_EQ(1u, len);
+    ASSERT_EQ('7', *p);
+    trans.consume(1);
+    ASSERT_EQ(2u, trans.read(tmp, sizeof(tmp)));
+    ASSERT_EQ(0, memcmp(tmp, "89", 2));
+    len = 1;
+    ASSERT_TRUE(trans.borrow(NULL, &len) == NULL);
+    ASSERT_EQ(0u, trans.read(tmp, sizeof(tmp)));
+
+    // Write-only.
+    IOBufTransport wtrans;
+    len = 1;
+    ASSERT_TRUE(wtrans.borrow(NULL, &len) == NULL);
+    wtrans.write((const uint8_t*)"hello ", 6);
+    wtrans.write((const uint8_t*)"world", 5);
+    butil::IOBuf out;
+    wtrans.move_to(&out);
+    ASSERT_EQ("hello world", out.to_string());
+}
+
+template <typename Protocol>
+void CheckProtocolRoundTrip(brpc::ThriftProtocolType protocol_type) {
+    const std::string long_str(1000, 'x');
+    auto wtrans = THRIFT_STDCXX::make_shared<IOBufTransport>();
+    Protocol oprot(wtrans);
+    oprot.writeMessageBegin("Echo", apache::thrift::protocol::T_CALL, 12345);
+    oprot.writeString("short");
+    oprot.writeString(long_str);
+    oprot.writeI32(-42);
+    oprot.writeI64(1LL << 40);
+    oprot.writeMessageEnd();
+    butil::IOBuf out;
+    wtrans->move_to(&out);
+    // The fast header writer is same as thrift.
+    const std::string header = WriteMessageBegin(
+        protocol_type, "Echo", apache::thrift::protocol::T_CALL, 12345);
+    ASSERT_EQ(header, out.to_string().substr(0, header.size()));
+
+    // Strings inside one block are borrowed, others are read across blocks.
+    for (size_t block_size : { (size_t)7, (size_t)4096 }) {
+        butil::IOBuf in;
+        AppendInBlocks(&in, out.to_string(), block_size);
+        auto rtrans = THRIFT_STDCXX::make_shared<IOBufTransport>(&in);
+        Protocol iprot(rtrans);
+        std::string method_name;
+        TMessageType mtype;
+        int32_t seq_id = 0;
+        iprot.readMessageBegin(method_name, mtype, seq_id);
+        ASSERT_EQ("Echo", method_name);
+        ASSERT_EQ(apache::thrift::protocol::T_CALL, mtype);
+        ASSERT_EQ(12345, seq_id);
+        std::string s;
+        iprot.readString(s);
+        ASSERT_EQ("short", s);
+        iprot.readString(s);
+        ASSERT_EQ(long_str, s);
+        int32_t i32 = 0;
+        iprot.readI32(i32);
+        ASSERT_EQ(-42, i32);
+        int64_t i64 = 0;
+        iprot.readI64(i64);
+        ASSERT_EQ(1LL << 40, i64);
+        iprot.readMessageEnd();
+        ASSERT_TRUE(in.empty());
+    }
+}
+
+TEST_F(ThriftProtocolTest, binary_protocol_round_trip) {
+    CheckProtocolRoundTrip<apache::thrift::protocol::TBinaryProtocolT<IOBufTransport> >(
+        brpc::THRIFT_BINARY_PROTOCOL);
+}
+
+TEST_F(ThriftProtocolTest, compact_protocol_round_trip) {
+    CheckProtocolRoundTrip<apache::thrift::protocol::TCompactProtocolT<IOBufTransport> >(
+        brpc::THRIFT_COMPACT_PROTOCOL);
+}
+
+} // namespace
+
+#endif // ENABLE_THRIFT_FRAMED_PROTOCOL
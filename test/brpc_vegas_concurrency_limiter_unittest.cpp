@@ -0,0 +1,77 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "brpc/policy/vegas_concurrency_limiter.h"
+#include "butil/time.h"
+#include <gtest/gtest.h>
+
+namespace brpc {
+namespace policy {
+DECLARE_int32(vegas_cl_sample_window_size_ms);
+DECLARE_int32(vegas_cl_min_sample_count);
+DECLARE_int32(vegas_cl_max_sample_count);
+}  // namespace policy
+}  // namespace brpc
+
+// Submit a sample window of requests with `latency_us' or `error_code'
+// while `inflight' requests are running.
+static void SubmitWindow(brpc::policy::VegasConcurrencyLimiter* limiter,
+                         int inflight, int64_t latency_us, int64_t* now_us,
+                         int error_code = 0) {
+    limiter->OnRequested(inflight, NULL);
+    for (int i = 0; i < brpc::policy::FLAGS_vegas_cl_max_sample_count; ++i) {
+        ASSERT_EQ(i + 1 == brpc::policy::FLAGS_vegas_cl_max_sample_count,
+                  limiter->AddSample(error_code, latency_us, *now_us));
+        *now_us += 100;
+    }
+}
+
+TEST(VegasConcurrencyLimiterTest, AddSample) {
+    brpc::policy::FLAGS_vegas_cl_sample_window_size_ms = 10;
+    brpc::policy::FLAGS_vegas_cl_min_sample_count = 5;
+    brpc::policy::FLAGS_vegas_cl_max_sample_count = 10;
+
+    brpc::policy::VegasConcurrencyLimiter limiter;
+    int64_t now_us = butil::gettimeofday_us();
+    const int initial_max_concurrency = limiter.MaxConcurrency();
+    ASSERT_TRUE(limiter.OnRequested(initial_max_concurrency, NULL));
+    ASSERT_FALSE(limiter.OnRequested(initial_max_concurrency + 1, NULL));
+
+    // The first window measures the min latency.
+    SubmitWindow(&limiter, initial_max_concurrency, 1000, &now_us);
+    ASSERT_EQ(1000, limiter._min_latency_us);
+    ASSERT_EQ(initial_max_concurrency, limiter.MaxConcurrency());
+
+    // Few requests are running, the limit should not grow.
+    SubmitWindow(&limiter, 1, 1000, &now_us);
+    ASSERT_EQ(initial_max_concurrency, limiter.MaxConcurrency());
+
+    // No request is queued, the limit grows.
+    SubmitWindow(&limiter, limiter.MaxConcurrency(), 1000, &now_us);
+    const int grown_max_concurrency = limiter.MaxConcurrency();
+    ASSERT_GT(grown_max_concurrency, initial_max_concurrency);
+
+    // Most requests are queued, the limit shrinks.
+    SubmitWindow(&limiter, limiter.MaxConcurrency(), 10000, &now_us);
+    ASSERT_LT(limiter.MaxConcurrency(), grown_max_concurrency);
+    ASSERT_EQ(1000, limiter._min_latency_us);
+
+    // Timed out requests shrink the limit.
+    const int max_concurrency = limiter.MaxConcurrency();
+    SubmitWindow(&limiter, 1, 0, &now_us, brpc::ERPCTIMEDOUT);
+    ASSERT_LT(limiter.MaxConcurrency(), max_concurrency);
+}
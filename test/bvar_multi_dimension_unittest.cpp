@@ -663,3 +663,51 @@ TEST_F(MultiDimensionTest, shared) {
     ASSERT_EQ(0, pthread_join(delete_thread, NULL));
 }
 
+
+TEST_F(MultiDimensionTest, fast_index) {
+    bvar::MultiDimension<bvar::Adder<int>, std::vector<std::string>> my_madder(
+        "my_fast_adder", {"idc", "method", "status"});
+    std::vector<std::string> labels_value1{"bj", "get", "200"};
+    std::vector<std::string> labels_value2{"bj", "200", "get"};
+    const uint64_t hash1 = my_madder.labels_hash(labels_value1);
+    ASSERT_NE(0UL, hash1);
+    ASSERT_NE(hash1, my_madder.labels_hash(labels_value2));
+    ASSERT_EQ(hash1, my_madder.labels_hash(
+        std::array<butil::StringPiece, 3>{"bj", "get", "200"}));
+
+    bvar::Adder<int>* adder1 = my_madder.get_stats(labels_value1, hash1);
+    ASSERT_NE(nullptr, adder1);
+    ASSERT_EQ(adder1, my_madder.find_fast_index(labels_value1, hash1));
+    ASSERT_EQ(adder1, my_madder.get_stats(labels_value1));
+    bvar::Adder<int>* adder2 = my_madder.get_stats(labels_value2);
+    ASSERT_NE(nullptr, adder2);
+    ASSERT_NE(adder1, adder2);
+    ASSERT_EQ((size_t)2, my_madder.count_stats());
+
+    // A wrong hash does not return wrong stats.
+    ASSERT_EQ(adder2, my_madder.get_stats(labels_value2, hash1));
+    ASSERT_EQ(nullptr, my_madder.find_fast_index(labels_value2, hash1));
+
+    my_madder.delete_stats(labels_value1);
+    ASSERT_EQ(nullptr, my_madder.find_fast_index(labels_value1, hash1));
+    ASSERT_EQ(adder2, my_madder.get_stats(labels_value2));
+    adder1 = my_madder.get_stats(labels_value1, hash1);
+    ASSERT_NE(nullptr, adder1);
+    ASSERT_EQ(adder1, my_madder.find_fast_index(labels_value1, hash1));
+    ASSERT_EQ((size_t)2, my_madder.count_stats());
+
+    my_madder.clear_stats();
+    ASSERT_EQ(nullptr, my_madder.find_fast_index(labels_value1, hash1));
+    ASSERT_EQ((size_t)0, my_madder.count_stats());
+
+    // Stats beyond the capacity of the index are still accessible.
+    const size_t n = decltype(my_madder)::FAST_INDEX_CAPACITY;
+    for (size_t i = 0; i < n; ++i) {
+        std::vector<std::string> labels_value{"bj", "get", std::to_string(i)};
+        bvar::Adder<int>* adder = my_madder.get_stats(labels_value);
+        ASSERT_NE(nullptr, adder);
+        ASSERT_EQ(adder, my_madder.get_stats(labels_value));
+    }
+    ASSERT_EQ(n, my_madder.count_stats());
+    ASSERT_EQ(n / 2, my_madder._fast_used_slots);
+}
@@ -18,6 +18,7 @@
 // Date: 2015/09/15 15:42:55
 
 #include "bvar/detail/percentile.h"
+#include "bvar/detail/hdr_histogram.h"
 #include "butil/logging.h"
 #include <gtest/gtest.h>
 #include <fstream>
@@ -188,3 +189,52 @@ TEST_F(PercentileTest, combine_of) {
     }
 }
 #endif // !WITH_BABYLON_COUNTER
+
+TEST_F(PercentileTest, hdr_bucket) {
+    uint32_t last_index = 0;
+    for (uint64_t v = 0; v <= std::numeric_limits<uint32_t>::max();
+         v = v * 17 / 16 + 1) {
+        const size_t index = bvar::detail::hdr_bucket_index(v);
+        ASSERT_LT(index, bvar::detail::NUM_HDR_BUCKETS);
+        ASSERT_GE(index, last_index);
+        last_index = index;
+        const uint32_t repr = bvar::detail::hdr_bucket_value(index);
+        ASSERT_EQ(index, bvar::detail::hdr_bucket_index(repr)) << "v=" << v;
+        // Relative error is bounded.
+        ASSERT_LE(std::abs((double)repr - (double)v), v / 64.0) << "v=" << v;
+    }
+    ASSERT_EQ(bvar::detail::NUM_HDR_BUCKETS - 1,
+              bvar::detail::hdr_bucket_index(
+                  std::numeric_limits<uint32_t>::max()));
+}
+
+TEST_F(PercentileTest, hdr_add_and_merge) {
+    bvar::detail::HdrPercentile p;
+    bvar::detail::GlobalHdrHistogram merged;
+    for (int j = 0; j < 10; ++j) {
+        for (int i = 0; i < 100000; ++i) {
+            p << (i + 1);
+        }
+        bvar::detail::GlobalHdrHistogram h = p.reset();
+        ASSERT_EQ(100000u, h.added_count());
+        for (uint32_t k = 1; k <= 1000u; ++k) {
+            const double expected = k * 100;
+            const uint32_t value = h.get_number(k / 1000.0);
+            ASSERT_LE(std::abs(value - expected), expected / 64.0 + 1)
+                << "k=" << k;
+        }
+        merged.merge(h);
+    }
+    // Merging is exact: the merged histogram of 10 same intervals gives
+    // the same percentiles.
+    ASSERT_EQ(1000000u, merged.added_count());
+    bvar::detail::GlobalHdrHistogram h;
+    for (int i = 0; i < 100000; ++i) {
+        p << (i + 1);
+    }
+    h = p.reset();
+    for (uint32_t k = 1; k <= 1000u; ++k) {
+        ASSERT_EQ(h.get_number(k / 1000.0), merged.get_number(k / 1000.0));
+    }
+    ASSERT_EQ(0u, p.reset().added_count());
+}
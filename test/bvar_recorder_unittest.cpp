@@ -28,6 +28,10 @@
 #include "bvar/latency_recorder.h"
 #include <gtest/gtest.h>
 
+namespace bvar {
+DECLARE_bool(bvar_latency_use_hdr);
+}
+
 namespace {
 #if !WITH_BABYLON_COUNTER
 TEST(RecorderTest, test_complement) {
@@ -214,6 +218,26 @@ TEST(RecorderTest, perf) {
               << " threads";
 }
 
+TEST(RecorderTest, latency_recorder_hdr) {
+    const bool saved_use_hdr = bvar::FLAGS_bvar_latency_use_hdr;
+    bvar::FLAGS_bvar_latency_use_hdr = true;
+    bvar::LatencyRecorder lr(2);
+    bvar::FLAGS_bvar_latency_use_hdr = saved_use_hdr;
+    ASSERT_TRUE(lr._latency_hdr != NULL);
+    for (int i = 1; i <= 10000; ++i) {
+        lr << i;
+    }
+    usleep(1100000); // wait sampler to sample
+    ASSERT_EQ(10000, lr.count());
+    const bvar::Vector<int64_t, 4> percentiles = lr.latency_percentiles();
+    const double expected[] = { 8000, 9000, 9900, 9990 };
+    for (size_t i = 0; i < arraysize(expected); ++i) {
+        ASSERT_LE(std::abs(percentiles[i] - expected[i]), expected[i] / 64)
+            << "i=" << i;
+    }
+    ASSERT_LE(std::abs(lr.latency_percentile(0.5) - 5000), 5000 / 64);
+}
+
 TEST(RecorderTest, latency_recorder_qps_accuracy) {
     bvar::LatencyRecorder lr1(2); // set windows size to 2s
     bvar::LatencyRecorder lr2(2);